@@ -18,17 +18,45 @@
 #ifndef DCPLUSPLUS_DCPP_BLOOM_FILTER_H
 #define DCPLUSPLUS_DCPP_BLOOM_FILTER_H
 
+#include <algorithm>
+#include <bitset>
+
 #include "typedefs.h"
 
 namespace dcpp {
 
-template<size_t N>
+/**
+ * Bloom filter over the N-grams of strings.
+ *
+ * The table is split in cache-line sized blocks; each N-gram sets K bits within a single block
+ * so that adding or matching an N-gram costs one cache miss. N-gram hashes are rolled along the
+ * string rather than being recomputed for every window.
+ */
+template<size_t N, size_t K = 4>
 class BloomFilter {
 public:
-	BloomFilter(size_t tableSize) { table.resize(tableSize); }
+	/** Bits to allocate per added N-gram when sizing the table with getTableSize. */
+	static const size_t BITS_PER_GRAM = 8;
+
+	/** @param tableSize Size of the table in bits, rounded up to a whole number of blocks. */
+	BloomFilter(size_t tableSize) { resize(tableSize); }
 	~BloomFilter() { }
 
-	void add(const string& s) { xadd(s, N); }
+	/** Suitable table size for the given number of N-grams to be added, as counted by getGrams.
+	Names repeat many of their N-grams, so this errs on the large side. */
+	static size_t getTableSize(size_t grams) {
+		return std::min(std::max(grams * BITS_PER_GRAM, MIN_SIZE), MAX_SIZE);
+	}
+
+	/** @return The number of N-grams add sets bits for. */
+	static size_t getGrams(const string& s) {
+		return s.length() < N ? 0 : s.length() - N + 1;
+	}
+
+	void add(const string& s) {
+		roll(s, [this](uint64_t h) { set(h); return true; });
+	}
+
 	bool match(const StringList& s) const {
 		for(auto& i: s) {
 			if(!match(i))
@@ -36,54 +64,115 @@ public:
 		}
 		return true;
 	}
+
 	bool match(const string& s) const {
-		if(s.length() >= N) {
-			string::size_type l = s.length() - N;
-			for(string::size_type i = 0; i <= l; ++i) {
-				if(!table[getPos(s, i, N)]) {
-					return false;
-				}
-			}
-		}
-		return true;
+		return roll(s, [this](uint64_t h) { return test(h); });
 	}
+
 	void clear() {
-		size_t s = table.size();
-		table.clear();
-		table.resize(s);
+		std::fill(table.begin(), table.end(), Block());
 	}
-#ifdef TESTER
-	void print_table_status() {
-		int tot = 0;
-		for (unsigned int i = 0; i < table.size(); ++i) if (table[i] == true) ++tot;
-
-		std::cout << "table status: " << tot << " of " << table.size()
-			<< " filled, for an occupancy percentage of " << (100.*tot)/table.size()
-			<< "%" << std::endl;
+
+	/** Resize the table (in bits) and clear it. */
+	void resize(size_t tableSize) {
+		table.assign(std::max((tableSize + BLOCK_BITS - 1) / BLOCK_BITS, static_cast<size_t>(1)), Block());
 	}
-#endif
+
+	/** @return The size of the table, in bits. */
+	size_t size() const { return table.size() * BLOCK_BITS; }
+
+	/** @return The proportion of bits set; matches degrade towards always succeeding as it nears 1. */
+	double getFillRatio() const {
+		size_t n = 0;
+		for(auto& b: table) {
+			for(auto w: b.words) {
+				n += std::bitset<64>(w).count();
+			}
+		}
+		return static_cast<double>(n) / static_cast<double>(size());
+	}
+
 private:
-	void xadd(const string& s, size_t n) {
-		if(s.length() >= n) {
-			string::size_type l = s.length() - n;
-			for(string::size_type i = 0; i <= l; ++i) {
-				table[getPos(s, i, n)] = true;
+	enum { BLOCK_BITS = 512, WORDS = BLOCK_BITS / 64 };
+
+	static constexpr size_t MIN_SIZE = 1 << 20;
+	static constexpr size_t MAX_SIZE = static_cast<size_t>(1) << 30;
+
+	// base of the rolling polynomial hash; any odd number with well-spread bits will do.
+	static constexpr uint64_t BASE = 0x100000001b3ULL;
+
+	struct alignas(64) Block {
+		Block() : words() { }
+		uint64_t words[WORDS];
+	};
+
+	/** Call f with the hash of each N-gram of s until it returns false. */
+	template<typename F>
+	static bool roll(const string& s, F f) {
+		if(s.length() < N) {
+			return true;
+		}
+
+		uint64_t pow = 1; // BASE^(N-1), used to remove the leading byte from the window
+		for(size_t i = 1; i < N; ++i) {
+			pow *= BASE;
+		}
+
+		auto p = reinterpret_cast<const uint8_t*>(s.data());
+		uint64_t h = 0;
+		for(size_t i = 0; i < N; ++i) {
+			h = h * BASE + p[i];
+		}
+		if(!f(h)) {
+			return false;
+		}
+
+		for(size_t i = N, l = s.length(); i < l; ++i) {
+			h = (h - p[i - N] * pow) * BASE + p[i];
+			if(!f(h)) {
+				return false;
 			}
 		}
+		return true;
 	}
 
-	/* This is roughly how boost::hash does it */
-	size_t getPos(const string& s, size_t i, size_t l) const {
-		size_t h = 0;
-		const char* c = s.data() + i;
-		const char* end = s.data() + i + l;
-		for(; c < end; ++c) {
-			h ^= *c + 0x9e3779b9 + (h<<6) + (h>>2);
+	/** Finalizer from splitmix64; spreads the rolling hash over all 64 bits. */
+	static uint64_t mix(uint64_t x) {
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+
+	/** The high 28 bits pick the block, the low 36 bits the K positions within it. */
+	size_t getBlock(uint64_t x) const {
+		return static_cast<size_t>(((x >> 36) * static_cast<uint64_t>(table.size())) >> 28);
+	}
+
+	void set(uint64_t h) {
+		auto x = mix(h);
+		auto& b = table[getBlock(x)];
+		for(size_t i = 0; i < K; ++i) {
+			auto bit = (x >> (i * 9)) & (BLOCK_BITS - 1);
+			b.words[bit / 64] |= static_cast<uint64_t>(1) << (bit % 64);
 		}
-		return (h % table.size());
 	}
 
-	vector<bool> table;
+	bool test(uint64_t h) const {
+		auto x = mix(h);
+		auto& b = table[getBlock(x)];
+		for(size_t i = 0; i < K; ++i) {
+			auto bit = (x >> (i * 9)) & (BLOCK_BITS - 1);
+			if(!(b.words[bit / 64] & (static_cast<uint64_t>(1) << (bit % 64)))) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static_assert(K * 9 <= 36, "the low 36 bits of the hash are split in 9-bit positions");
+	static_assert(MAX_SIZE / BLOCK_BITS <= (1 << 28), "the high 28 bits of the hash pick the block");
+
+	vector<Block> table;
 };
 
 } // namespace dcpp
@@ -29,6 +29,7 @@
 #include "PluginEntity.h"
 #include "Speaker.h"
 #include "TimerManager.h"
+#include "TokenBucket.h"
 
 #include <boost/core/noncopyable.hpp>
 #include <atomic>
@@ -149,6 +150,9 @@ protected:
 
 	BufferedSocket *sock;
 
+	/** TTH searches from this hub that will be answered; only used from the hub's socket thread. */
+	TokenBucket tthSearchBudget;
+
 	/** Update hub counts. Thread-safe. */
 	void updateCounts(bool aRemove);
 	void updateActivity() { lastActivity = GET_TICK(); }
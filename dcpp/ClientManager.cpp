@@ -497,45 +497,122 @@ void ClientManager::on(NmdcSearch, Client* aClient, const string& aSeeker, int a
 		return;
 	}
 
-	auto l = ShareManager::getInstance()->search(aString, aSearchType, aSize, aFileType, isPassive ? 5 : 10);
+	if(aFileType == SearchManager::TYPE_TTH && aString.compare(0, 4, "TTH:") == 0) {
+		// a plain lookup, answered right away within the hub's budget.
+		if(!aClient->tthSearchBudget.take(GET_TICK())) {
+			return;
+		}
+
+		TTHValue root(aString.substr(4));
+		auto r = ShareManager::getInstance()->findTTH(root);
+		if(r) {
+			string ip, port;
+			if(!isPassive) {
+				resolveSeeker(aSeeker, ip, port);
+			}
+			SearchResultList l(1, new SearchResult(SearchResult::TYPE_FILE, r->size, r->file, root));
+			sendResults(*aClient, aSeeker, isPassive, ip, port, l);
+		}
+		return;
+	}
+
+	// answered from a search thread; the hub may be gone by then, and is found again by its address.
+	auto hubUrl = aClient->getHubUrl();
+	ShareManager::getInstance()->searchAsync(aString, aSearchType, aSize, aFileType, isPassive ? 5 : 10,
+		[this, hubUrl, aSeeker, isPassive](const SearchResultList& l)
+	{
 //		dcdebug("Found %d items (%s)\n", l.size(), aString.c_str());
-	if(!l.empty()) {
-		if(isPassive) {
-			string name = aSeeker.substr(4);
-			// Good, we have a passive seeker, those are easier...
-			string str;
-			for(const auto& sr: l) {
-				str += sr->toSR(*aClient);
-				str[str.length()-1] = 5;
-				str += Text::fromUtf8(name, aClient->getEncoding());
-				str += '|';
+		if(l.empty()) {
+			return;
+		}
+
+		string ip, port;
+		if(!isPassive) {
+			resolveSeeker(aSeeker, ip, port);
+		}
+
+		StringList data;
+		{
+			Lock l2(cs);
+			auto c = find_if(clients.begin(), clients.end(), [&hubUrl](Client* c) { return c->isConnected() && c->getHubUrl() == hubUrl; });
+			if(c == clients.end()) {
+				return;
 			}
 
-			if(!str.empty())
-				aClient->send(str);
+			data = formatResults(**c, aSeeker, isPassive, ip, l);
+			if(isPassive) {
+				// only queued on the hub's socket; the lock keeps the hub around meanwhile.
+				for(auto& i: data) {
+					(*c)->send(i);
+				}
+				return;
+			}
+		}
 
-		} else {
-			string ip, port;
+		for(auto& i: data) {
+			sendUDP(ip, port, i);
+		}
+	});
+}
 
-			auto ipPortPair = NmdcHub::parseIpPort(aSeeker);
+void ClientManager::resolveSeeker(const string& aSeeker, string& ip, string& port) {
+	auto ipPortPair = NmdcHub::parseIpPort(aSeeker);
 
-			port = ipPortPair.second;
-			ip = Socket::resolve(ipPortPair.first, AF_INET);
+	port = ipPortPair.second;
+	ip = Socket::resolve(ipPortPair.first, AF_INET);
 
-			if(static_cast<NmdcHub*>(aClient)->isProtectedIP(ip))
-				return;
+	if(port.empty())
+		port = "412";
+}
 
-			if(port.empty())
-				port = "412";
+StringList ClientManager::formatResults(Client& aClient, const string& aSeeker, bool isPassive, const string& ip,
+	const SearchResultList& l)
+{
+	StringList ret;
+	if(isPassive) {
+		string name = aSeeker.substr(4);
+		// Good, we have a passive seeker, those are easier...
+		string str;
+		for(const auto& sr: l) {
+			str += sr->toSR(aClient);
+			str[str.length()-1] = 5;
+			str += Text::fromUtf8(name, aClient.getEncoding());
+			str += '|';
+		}
 
-			for(const auto& sr: l) {
-				sendUDP(ip, port, sr->toSR(*aClient));
-			}
+		if(!str.empty())
+			ret.push_back(move(str));
+
+	} else {
+		if(static_cast<NmdcHub&>(aClient).isProtectedIP(ip))
+			return ret;
+
+		for(const auto& sr: l) {
+			ret.push_back(sr->toSR(aClient));
 		}
 	}
+	return ret;
 }
 
-void ClientManager::on(AdcSearch, Client*, const AdcCommand& cmd, const OnlineUser& from) noexcept {
+void ClientManager::sendResults(Client& aClient, const string& aSeeker, bool isPassive, const string& ip, const string& port,
+	const SearchResultList& l)
+{
+	for(auto& i: formatResults(aClient, aSeeker, isPassive, ip, l)) {
+		if(isPassive) {
+			aClient.send(i);
+		} else {
+			sendUDP(ip, port, i);
+		}
+	}
+}
+
+void ClientManager::on(AdcSearch, Client* c, const AdcCommand& cmd, const OnlineUser& from) noexcept {
+	// TTH searches are answered right away, within the hub's budget.
+	string tth;
+	if(cmd.getParam("TR", 0, tth) && !c->tthSearchBudget.take(GET_TICK())) {
+		return;
+	}
+
 	SearchManager::getInstance()->respond(cmd, from);
 }
 
@@ -185,6 +185,16 @@ private:
 
 	void sendUDP(const string& ip, const string& port, const string& data, const string& aKey = Util::emptyString);
 
+	/** Resolve the address of an active NMDC seeker. */
+	static void resolveSeeker(const string& aSeeker, string& ip, string& port);
+	/** The reply to an NMDC search: one command for the hub when the seeker is passive, one
+	datagram per result otherwise; none for protected addresses. */
+	static StringList formatResults(Client& aClient, const string& aSeeker, bool isPassive, const string& ip,
+		const SearchResultList& l);
+	/** Reply to an NMDC search; ip and port are those of active seekers. */
+	void sendResults(Client& aClient, const string& aSeeker, bool isPassive, const string& ip, const string& port,
+		const SearchResultList& l);
+
 	string getUsersFile() const { return Util::getPath(Util::PATH_USER_LOCAL) + "Users.xml"; }
 
 	// ClientListener
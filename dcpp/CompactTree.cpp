@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stdinc.h"
+#include "CompactTree.h"
+
+#include "debug.h"
+
+namespace dcpp {
+
+uint32_t CompactTree::beginDirectory(const string& name) {
+	auto id = static_cast<uint32_t>(dirs.size());
+	auto files = static_cast<uint32_t>(this->files.size());
+	dirs.push_back(Dir { addName(name), open.empty() ? static_cast<uint32_t>(NONE) : open.back(), files, files, id + 1 });
+	open.push_back(id);
+	return id;
+}
+
+void CompactTree::addFile(const string& name, int64_t size, const TTHValue& tth) {
+	dcassert(!open.empty());
+	auto& dir = dirs[open.back()];
+	dcassert(dir.fileEnd == files.size()); // files must come before sub-directories
+	files.push_back(File { size, tth, addName(name), open.back() });
+	dir.fileEnd = static_cast<uint32_t>(files.size());
+}
+
+void CompactTree::endDirectory() {
+	dcassert(!open.empty());
+	dirs[open.back()].dirEnd = static_cast<uint32_t>(dirs.size());
+	open.pop_back();
+}
+
+void CompactTree::finish() {
+	dcassert(open.empty());
+	decltype(nameOffsets)().swap(nameOffsets);
+	dirs.shrink_to_fit();
+	files.shrink_to_fit();
+	names.shrink_to_fit();
+}
+
+size_t CompactTree::getMemoryUsage() const {
+	return sizeof(*this) + dirs.capacity() * sizeof(Dir) + files.capacity() * sizeof(File) + names.capacity();
+}
+
+uint32_t CompactTree::addName(const string& name) {
+	auto i = nameOffsets.find(name);
+	if(i != nameOffsets.end()) {
+		return i->second;
+	}
+
+	auto offset = static_cast<uint32_t>(names.size());
+	names.insert(names.end(), name.begin(), name.end());
+	names.push_back('\0');
+	nameOffsets.emplace(name, offset);
+	return offset;
+}
+
+} // namespace dcpp
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_COMPACT_TREE_H
+#define DCPLUSPLUS_DCPP_COMPACT_TREE_H
+
+#include <unordered_map>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "typedefs.h"
+#include "MerkleTree.h"
+
+namespace dcpp {
+
+using std::unordered_map;
+
+/**
+ * Read-only, flattened form of a directory tree: directories and files are stored in two
+ * contiguous arrays and names in a single buffer, instead of one allocation per node.
+ *
+ * Directories are laid out in pre-order, so the sub-directories of a directory are the ids
+ * following it up to its dirEnd; its children are found by skipping from one child's dirEnd to the
+ * next. The files of each directory are a contiguous range of file ids.
+ */
+class CompactTree : boost::noncopyable {
+public:
+	enum { NONE = 0xFFFFFFFF };
+
+	struct Dir {
+		uint32_t name; /// offset of the name in the name buffer
+		uint32_t parent; /// id of the parent directory; NONE for roots
+		uint32_t fileBegin; /// first file id of this directory
+		uint32_t fileEnd; /// one past the last file id of this directory (not of its sub-directories)
+		uint32_t dirEnd; /// one past the last id of this directory's sub-directories
+	};
+
+	struct File {
+		int64_t size;
+		TTHValue tth;
+		uint32_t name; /// offset of the name in the name buffer
+		uint32_t dir; /// id of the directory that holds this file
+	};
+
+	CompactTree() { }
+
+	/** Add a directory under the one currently open (or a root when none is); its files must be
+	added before its sub-directories, and endDirectory called once they all have been. */
+	uint32_t beginDirectory(const string& name);
+	void addFile(const string& name, int64_t size, const TTHValue& tth);
+	void endDirectory();
+	/** Release the memory only needed while building. */
+	void finish();
+
+	const vector<Dir>& getDirs() const { return dirs; }
+	const vector<File>& getFiles() const { return files; }
+	const char* getName(uint32_t offset) const { return &names[offset]; }
+
+	/** Roots and children are enumerated with these: for(auto i = first; i < end; i = next(i)). */
+	uint32_t firstChild(uint32_t dir) const { return dir + 1; }
+	uint32_t next(uint32_t dir) const { return dirs[dir].dirEnd; }
+
+	/** @return Bytes allocated for the tree. */
+	size_t getMemoryUsage() const;
+
+private:
+	uint32_t addName(const string& name);
+
+	vector<Dir> dirs;
+	vector<File> files;
+	/** NUL-terminated names; each distinct name is stored once. */
+	vector<char> names;
+
+	// building state
+	vector<uint32_t> open;
+	unordered_map<string, uint32_t> nameOffsets;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_COMPACT_TREE_H)
@@ -20,6 +20,7 @@
 
 #include <boost/thread/lock_guard.hpp>
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 namespace dcpp {
 
@@ -29,6 +30,12 @@ typedef boost::detail::spinlock	FastCriticalSection;
 typedef boost::unique_lock<boost::recursive_mutex> Lock;
 typedef boost::lock_guard<boost::detail::spinlock> FastLock;
 
+/* Many readers or one writer; not recursive, so don't take a SharedLock while already holding
+one on the same section. */
+typedef boost::shared_mutex SharedCriticalSection;
+typedef boost::shared_lock<boost::shared_mutex> SharedLock;
+typedef boost::unique_lock<boost::shared_mutex> WriteLock;
+
 } // namespace dcpp
 
 #endif // DCPLUSPLUS_DCPP_CRITICAL_SECTION_H
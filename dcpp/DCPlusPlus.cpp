@@ -124,7 +124,7 @@ void load(function<void (const string&)> stepF, function<void (float)> progressF
 	HashManager::getInstance()->startup(progressF);
 
 	announce(_("Shared Files"));
-	ShareManager::getInstance()->refresh(true, false, true, progressF);
+	ShareManager::getInstance()->startup(progressF);
 
 	announce(_("Download Queue"));
 	QueueManager::getInstance()->loadQueue(progressF);
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stdinc.h"
+#include "DirectoryMonitor.h"
+
+#include "format.h"
+#include "LogManager.h"
+#include "Text.h"
+#include "TimerManager.h"
+#include "Util.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace dcpp {
+
+#ifdef __linux__
+
+namespace {
+
+/** How long a directory has to be left alone before its changes are reported, in ms. */
+const uint64_t SETTLE_TIME = 2000;
+
+}
+
+DirectoryMonitor::DirectoryMonitor() : fd(-1), stop(false), errors(false) {
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(fd == -1) {
+		dcdebug("DirectoryMonitor: inotify_init1 failed: %s\n", Util::translateError(errno).c_str());
+		return;
+	}
+
+	try {
+		start();
+	} catch(const ThreadException& e) {
+		dcdebug("DirectoryMonitor: %s\n", e.getError().c_str());
+		::close(fd);
+		fd = -1;
+	}
+}
+
+DirectoryMonitor::~DirectoryMonitor() {
+	shutdown();
+}
+
+void DirectoryMonitor::shutdown() noexcept {
+	if(fd != -1) {
+		stop = true;
+		join();
+		::close(fd);
+		fd = -1;
+	}
+}
+
+void DirectoryMonitor::watch(const string& realPath) noexcept {
+	if(fd == -1) {
+		return;
+	}
+
+	auto wd = inotify_add_watch(fd, Text::fromUtf8(realPath).c_str(),
+		IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR);
+	if(wd == -1) {
+		// usually ENOSPC, when the share has more directories than fs.inotify.max_user_watches.
+		if(!errors.exchange(true)) {
+			LogManager::getInstance()->message(str(F_("Unable to watch %1% for changes (%2%); shared directories will be refreshed periodically")
+				% Util::addBrackets(realPath) % Util::translateError(errno)), LogMessage::TYPE_WARNING, LogMessage::LOG_SHARE);
+		}
+		return;
+	}
+
+	Lock l(cs);
+	watches[wd] = realPath;
+}
+
+void DirectoryMonitor::unwatch(const string& realPath) noexcept {
+	Lock l(cs);
+	for(auto i = watches.begin(); i != watches.end();) {
+		if(i->second.compare(0, realPath.size(), realPath) == 0) {
+			inotify_rm_watch(fd, i->first);
+			i = watches.erase(i);
+		} else {
+			++i;
+		}
+	}
+}
+
+int DirectoryMonitor::run() {
+	setThreadPriority(Thread::LOW);
+
+	// directory -> time of its last event
+	unordered_map<string, uint64_t> changed;
+
+	alignas(inotify_event) char buf[64 * 1024];
+
+	while(!stop) {
+		pollfd p = { fd, POLLIN, 0 };
+		if(::poll(&p, 1, 500) > 0) {
+			ssize_t n;
+			while((n = ::read(fd, buf, sizeof(buf))) > 0) {
+				auto tick = GET_TICK();
+				for(char* ptr = buf; ptr < buf + n;) {
+					auto ev = reinterpret_cast<const inotify_event*>(ptr);
+					ptr += sizeof(inotify_event) + ev->len;
+
+					if(ev->mask & IN_Q_OVERFLOW) {
+						errors = true;
+						changed.clear();
+						fire(DirectoryMonitorListener::Overflow());
+						continue;
+					}
+
+					Lock l(cs);
+					auto w = watches.find(ev->wd);
+					if(w == watches.end()) {
+						continue;
+					}
+
+					if(ev->mask & IN_IGNORED) {
+						// the directory is gone; its parent reports the removal.
+						watches.erase(w);
+						continue;
+					}
+
+					changed[w->second] = tick;
+				}
+			}
+		}
+
+		StringList settled;
+		auto tick = GET_TICK();
+		for(auto i = changed.begin(); i != changed.end();) {
+			if(i->second + SETTLE_TIME <= tick) {
+				settled.push_back(i->first);
+				i = changed.erase(i);
+			} else {
+				++i;
+			}
+		}
+
+		if(!settled.empty()) {
+			fire(DirectoryMonitorListener::Changed(), settled);
+		}
+	}
+
+	return 0;
+}
+
+#else // !__linux__
+
+DirectoryMonitor::DirectoryMonitor() : fd(-1), stop(false), errors(false) { }
+DirectoryMonitor::~DirectoryMonitor() { }
+void DirectoryMonitor::shutdown() noexcept { }
+void DirectoryMonitor::watch(const string&) noexcept { }
+void DirectoryMonitor::unwatch(const string&) noexcept { }
+int DirectoryMonitor::run() { return 0; }
+
+#endif // !__linux__
+
+} // namespace dcpp
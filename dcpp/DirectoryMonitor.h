@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_DIRECTORY_MONITOR_H
+#define DCPLUSPLUS_DCPP_DIRECTORY_MONITOR_H
+
+#include <atomic>
+#include <unordered_map>
+
+#include "CriticalSection.h"
+#include "DirectoryMonitorListener.h"
+#include "Speaker.h"
+#include "Thread.h"
+
+namespace dcpp {
+
+using std::unordered_map;
+
+/** Watches directories for changes, one directory at a time (not recursively); only implemented
+with inotify on Linux, elsewhere nothing is ever watched.
+Events are collected per directory and reported once the directory has been quiet for a couple of
+seconds, so that a copy or an extraction turns into a single Changed event. */
+class DirectoryMonitor : public Speaker<DirectoryMonitorListener>, private Thread
+{
+public:
+	DirectoryMonitor();
+	virtual ~DirectoryMonitor();
+
+	/** Start watching a directory; watching the same directory again is harmless.
+	@param realPath Path of the directory, with a trailing separator. */
+	void watch(const string& realPath) noexcept;
+	/** Stop watching the given directory and everything under it. */
+	void unwatch(const string& realPath) noexcept;
+
+	/** @return Whether every directory asked for is being watched and no event has been lost since
+	the last call to clearErrors. */
+	bool isReliable() const noexcept { return fd != -1 && !errors; }
+	void clearErrors() noexcept { errors = false; }
+
+	void shutdown() noexcept;
+
+private:
+	virtual int run();
+
+	int fd;
+	std::atomic<bool> stop;
+	std::atomic<bool> errors;
+
+	mutable CriticalSection cs;
+	/** Watch descriptor -> path of the watched directory. */
+	unordered_map<int, string> watches;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_DIRECTORY_MONITOR_H)
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_DIRECTORY_MONITOR_LISTENER_H
+#define DCPLUSPLUS_DCPP_DIRECTORY_MONITOR_LISTENER_H
+
+#include "forward.h"
+#include "typedefs.h"
+
+namespace dcpp {
+
+class DirectoryMonitorListener {
+public:
+	virtual ~DirectoryMonitorListener() { }
+	template<int I>	struct X { enum { TYPE = I }; };
+
+	typedef X<0> Changed;
+	typedef X<1> Overflow;
+
+	/** Entries were added, removed, renamed or written to in the given directories. */
+	virtual void on(Changed, const StringList& /* realPaths */) noexcept { }
+	/** Events were lost; the watched trees have to be scanned again. */
+	virtual void on(Overflow) noexcept { }
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_DIRECTORY_MONITOR_LISTENER_H)
@@ -56,6 +56,11 @@ uint32_t File::getLastModified() noexcept {
 	return convertTime(&f);
 }
 
+void File::dropCache(int64_t /*pos*/, int64_t /*len*/) noexcept {
+	// no way to drop part of a file from the cache; FILE_FLAG_SEQUENTIAL_SCAN already has the
+	// cache manager recycle the pages of files read through quickly.
+}
+
 uint32_t File::convertTime(FILETIME* f) {
 	SYSTEMTIME s = { 1970, 1, 0, 1, 0, 0, 0, 0 };
 	FILETIME f2 = {0};
@@ -170,6 +175,14 @@ int64_t File::getSize(const string& aFileName) noexcept {
 	return i != FileFindIter() ? i->getSize() : -1;
 }
 
+string File::getDeviceId(const string& path) noexcept {
+	TCHAR buf[MAX_PATH];
+	if(!::GetVolumePathName(Text::toT(path).c_str(), buf, MAX_PATH))
+		return Util::emptyString;
+
+	return Text::toLower(Text::fromT(buf));
+}
+
 void File::ensureDirectory(const string& aFile) noexcept {
 	// Skip the first dir...
 	tstring file;
@@ -229,6 +242,12 @@ uint32_t File::getLastModified() noexcept {
 	return (uint32_t)s.st_mtime;
 }
 
+void File::dropCache(int64_t pos, int64_t len) noexcept {
+#ifdef POSIX_FADV_DONTNEED
+	::posix_fadvise(h, pos, len, POSIX_FADV_DONTNEED);
+#endif
+}
+
 bool File::isOpen() noexcept {
 	return h != -1;
 }
@@ -380,6 +399,14 @@ int64_t File::getSize(const string& aFileName) noexcept {
 	return s.st_size;
 }
 
+string File::getDeviceId(const string& path) noexcept {
+	struct stat s;
+	if(stat(Text::fromUtf8(path).c_str(), &s) == -1)
+		return Util::emptyString;
+
+	return Util::toString(static_cast<long long>(s.st_dev));
+}
+
 void File::ensureDirectory(const string& aFile) noexcept {
 	string file = Text::fromUtf8(aFile);
 	string::size_type start = 0;
@@ -90,12 +90,18 @@ public:
 	virtual size_t flush();
 
 	uint32_t getLastModified() noexcept;
+	/** Tell the OS that the given range won't be read again soon, so its cached pages can go
+	before those of files that are in use. */
+	void dropCache(int64_t pos, int64_t len) noexcept;
 
 	static void copyFile(const string& src, const string& target);
 	static void renameFile(const string& source, const string& target);
 	static void deleteFile(const string& aFileName) noexcept;
 
 	static int64_t getSize(const string& aFileName) noexcept;
+	/** Identifier of the volume the given path lives on; paths on the same physical device share
+	it. Empty when it can't be determined. */
+	static string getDeviceId(const string& path) noexcept;
 
 	static void ensureDirectory(const string& aFile) noexcept;
 	static bool isAbsolute(const string& path) noexcept;
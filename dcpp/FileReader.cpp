@@ -25,10 +25,25 @@
 #include "Text.h"
 #include "Util.h"
 
+#ifndef _WIN32
+#include <aio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+#endif
+#endif
+
 namespace dcpp {
 
 using std::make_pair;
 using std::swap;
+using std::unique_ptr;
 
 namespace {
 static const size_t READ_FAILED = static_cast<size_t>(-1);
@@ -63,6 +78,11 @@ size_t FileReader::readCached(const string& file, const DataCallback& callback)
 	bool go = true;
 	while(f.read(buf, n) > 0 && go) {
 		go = callback(buf, n);
+		if(direct) {
+			// we'd have bypassed the cache if we could; at least don't let this file push out
+			// the ones that are being used.
+			f.dropCache(total, n);
+		}
 		total += n;
 		n = buffer.size();
 	}
@@ -192,8 +212,312 @@ size_t FileReader::readDirect(const string& file, const DataCallback& callback)
 
 #else
 
+namespace {
+
+/** O_DIRECT wants buffers, offsets and lengths aligned to the logical block size of the device,
+which this covers on the devices in use today. */
+const size_t DIRECT_ALIGNMENT = 4096;
+/** Number of blocks being read at the same time */
+const size_t DIRECT_READS = 4;
+
+struct Handle : boost::noncopyable {
+	Handle(int h) : h(h) { }
+	~Handle() { if(h != -1) ::close(h); }
+
+	operator int() { return h; }
+
+	int h;
+};
+
+/** Reads handed to the kernel; each slot is a buffer with at most one read in flight. The reads
+still in flight are waited for on destruction, so the buffers can't be released under them. */
+class AsyncReads : boost::noncopyable {
+public:
+	virtual ~AsyncReads() { }
+
+	/** @return 0, or an errno value */
+	virtual int submit(size_t slot, void* buf, size_t len, int64_t pos) = 0;
+	/** Wait for the read of the slot to finish. @return the number of bytes read, or -errno */
+	virtual ssize_t wait(size_t slot) = 0;
+};
+
+#ifdef HAVE_IO_URING
+
+/** io_uring through the raw system calls: a ring with one entry per slot. */
+class UringReads : public AsyncReads {
+public:
+	UringReads(int h, size_t slots) : h(h), ring(-1), sq(MAP_FAILED), sqSize(0), cq(MAP_FAILED), cqSize(0),
+		sqes(MAP_FAILED), sqesSize(0), iovecs(slots), results(slots), pending(slots, false)
+	{
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		ring.h = static_cast<int>(::syscall(__NR_io_uring_setup, static_cast<unsigned>(slots), &p));
+		if(ring == -1) {
+			return;
+		}
+
+		sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+		bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+#else
+		bool single = false;
+#endif
+		if(single) {
+			sqSize = cqSize = std::max(sqSize, cqSize);
+		}
+
+		sq = ::mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+		if(sq == MAP_FAILED) {
+			return;
+		}
+		if(single) {
+			cq = sq;
+		} else {
+			cq = ::mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+			if(cq == MAP_FAILED) {
+				return;
+			}
+		}
+		sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+		sqes = ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+		if(sqes == MAP_FAILED) {
+			return;
+		}
+
+		auto sqp = static_cast<uint8_t*>(sq);
+		sqTail = reinterpret_cast<unsigned*>(sqp + p.sq_off.tail);
+		sqMask = reinterpret_cast<unsigned*>(sqp + p.sq_off.ring_mask);
+		sqArray = reinterpret_cast<unsigned*>(sqp + p.sq_off.array);
+
+		auto cqp = static_cast<uint8_t*>(cq);
+		cqHead = reinterpret_cast<unsigned*>(cqp + p.cq_off.head);
+		cqTail = reinterpret_cast<unsigned*>(cqp + p.cq_off.tail);
+		cqMask = reinterpret_cast<unsigned*>(cqp + p.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(cqp + p.cq_off.cqes);
+	}
+
+	~UringReads() {
+		for(size_t i = 0; i < pending.size(); ++i) {
+			wait(i);
+		}
+
+		if(sqes != MAP_FAILED)
+			::munmap(sqes, sqesSize);
+		if(cq != MAP_FAILED && cq != sq)
+			::munmap(cq, cqSize);
+		if(sq != MAP_FAILED)
+			::munmap(sq, sqSize);
+	}
+
+	/** Whether the kernel has io_uring, and lets us use it */
+	bool isReady() const { return sqes != MAP_FAILED; }
+
+	int submit(size_t slot, void* buf, size_t len, int64_t pos) {
+		iovecs[slot].iov_base = buf;
+		iovecs[slot].iov_len = len;
+
+		// we are the only producer, so the tail is ours to read without synchronization.
+		auto tail = *sqTail;
+		auto index = tail & *sqMask;
+		auto& sqe = static_cast<io_uring_sqe*>(sqes)[index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_READV;
+		sqe.fd = h;
+		sqe.addr = reinterpret_cast<uint64_t>(&iovecs[slot]);
+		sqe.len = 1;
+		sqe.off = pos;
+		sqe.user_data = slot;
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+		while(::syscall(__NR_io_uring_enter, static_cast<int>(ring), 1, 0, 0, nullptr, 0) == -1) {
+			if(errno != EINTR && errno != EAGAIN) {
+				// the entry stays queued; it would go with the next submission, so rewind it.
+				__atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+				return errno;
+			}
+		}
+
+		pending[slot] = true;
+		return 0;
+	}
+
+	ssize_t wait(size_t slot) {
+		while(pending[slot]) {
+			auto head = *cqHead;
+			if(head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+				if(::syscall(__NR_io_uring_enter, static_cast<int>(ring), 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) == -1 && errno != EINTR) {
+					return -errno;
+				}
+				continue;
+			}
+
+			auto& cqe = cqes[head & *cqMask];
+			results[cqe.user_data] = cqe.res;
+			pending[cqe.user_data] = false;
+			__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+		}
+
+		return results[slot];
+	}
+
+private:
+	int h;
+	Handle ring;
+
+	void* sq;
+	size_t sqSize;
+	void* cq;
+	size_t cqSize;
+	void* sqes;
+	size_t sqesSize;
+
+	unsigned* sqTail;
+	unsigned* sqMask;
+	unsigned* sqArray;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned* cqMask;
+	io_uring_cqe* cqes;
+
+	vector<iovec> iovecs;
+	vector<ssize_t> results;
+	vector<bool> pending;
+};
+
+#endif // HAVE_IO_URING
+
+/** POSIX AIO, for kernels without io_uring (or where it is disabled, as in many containers). */
+class AioReads : public AsyncReads {
+public:
+	AioReads(int h, size_t slots) : h(h), cbs(slots), pending(slots, false) { }
+
+	~AioReads() {
+		for(size_t i = 0; i < pending.size(); ++i) {
+			if(pending[i]) {
+				::aio_cancel(h, &cbs[i]);
+				wait(i);
+			}
+		}
+	}
+
+	int submit(size_t slot, void* buf, size_t len, int64_t pos) {
+		auto& cb = cbs[slot];
+		memset(&cb, 0, sizeof(cb));
+		cb.aio_fildes = h;
+		cb.aio_buf = buf;
+		cb.aio_nbytes = len;
+		cb.aio_offset = pos;
+		if(::aio_read(&cb) == -1) {
+			return errno;
+		}
+
+		pending[slot] = true;
+		return 0;
+	}
+
+	ssize_t wait(size_t slot) {
+		if(!pending[slot]) {
+			return 0;
+		}
+
+		auto& cb = cbs[slot];
+		const aiocb* list[] = { &cb };
+		int err;
+		while((err = ::aio_error(&cb)) == EINPROGRESS) {
+			::aio_suspend(list, 1, nullptr);
+		}
+
+		pending[slot] = false;
+		auto ret = ::aio_return(&cb);
+		return err == 0 ? ret : -err;
+	}
+
+private:
+	int h;
+	vector<aiocb> cbs;
+	vector<bool> pending;
+};
+
+} // unnamed namespace
+
 size_t FileReader::readDirect(const string& file, const DataCallback& callback) {
+#ifdef O_DIRECT
+	Handle h(::open(Text::fromUtf8(file).c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC));
+
+	if(h == -1) {
+		dcdebug("Failed to open unbuffered file: %s\n", Util::translateError(errno).c_str());
+		return READ_FAILED;
+	}
+
+	auto bufSize = getBlockSize(DIRECT_ALIGNMENT);
+	buffer.resize(bufSize * DIRECT_READS + DIRECT_ALIGNMENT);
+
+	auto buf = static_cast<uint8_t*>(align(&buffer[0], DIRECT_ALIGNMENT));
+
+	unique_ptr<AsyncReads> reads;
+#ifdef HAVE_IO_URING
+	{
+		unique_ptr<UringReads> uring(new UringReads(h, DIRECT_READS));
+		if(uring->isReady()) {
+			reads = move(uring);
+		}
+	}
+#endif
+	if(!reads) {
+		reads.reset(new AioReads(h, DIRECT_READS));
+	}
+
+	// Slot i reads block i, i + DIRECT_READS and so on; they are used in file order.
+	int64_t pos = 0;
+	for(size_t i = 0; i < DIRECT_READS; ++i, pos += bufSize) {
+		auto err = reads->submit(i, buf + i * bufSize, bufSize, pos);
+		if(err != 0) {
+			dcdebug("Failed to start direct read: %s\n", Util::translateError(err).c_str());
+			return READ_FAILED;
+		}
+	}
+
+	size_t total = 0;
+	for(size_t slot = 0; ; slot = (slot + 1) % DIRECT_READS) {
+		auto n = reads->wait(slot);
+		if(n < 0) {
+			if(total == 0) {
+				// some file systems (tmpfs...) refuse unbuffered reads only once they are issued.
+				dcdebug("First direct read failed: %s\n", Util::translateError(-n).c_str());
+				return READ_FAILED;
+			}
+			throw FileException(Util::translateError(-n));
+		}
+
+		auto data = buf + slot * bufSize;
+		total += n;
+
+		if(static_cast<size_t>(n) < bufSize) {
+			// end of file
+			if(n > 0) {
+				callback(data, n);
+			}
+			break;
+		}
+
+		if(!callback(data, n)) {
+			break;
+		}
+
+		// the buffer is free again; queue the block after the ones in flight in it.
+		auto err = reads->submit(slot, data, bufSize, pos);
+		if(err != 0) {
+			throw FileException(Util::translateError(err));
+		}
+		pos += bufSize;
+	}
+
+	return total;
+#else
 	return READ_FAILED;
+#endif
 }
 
 #endif
@@ -42,16 +42,16 @@ uint64_t HashBloom::get_m(size_t n, size_t k) {
 
 void HashBloom::add(const TTHValue& tth) {
 	for(size_t i = 0; i < k; ++i) {
-		bloom[pos(tth, i)] = true;
+		set(pos(tth, i));
 	}
 }
 
 bool HashBloom::match(const TTHValue& tth) const {
-	if(bloom.empty()) {
+	if(bits == 0) {
 		return false;
 	}
 	for(size_t i = 0; i < k; ++i) {
-		if(!bloom[pos(tth, i)]) {
+		if(!test(pos(tth, i))) {
 			return false;
 		}
 	}
@@ -59,11 +59,18 @@ bool HashBloom::match(const TTHValue& tth) const {
 }
 
 void HashBloom::push_back(bool v) {
-	bloom.push_back(v);
+	if(bits % 64 == 0) {
+		bloom.push_back(0);
+	}
+	if(v) {
+		set(bits);
+	}
+	++bits;
 }
 
 void HashBloom::reset(size_t k_, size_t m, size_t h_) {
-	bloom.resize(m);
+	bloom.assign((m + 63) / 64, 0);
+	bits = m;
 	k = k_;
 	h = h_;
 }
@@ -73,25 +80,25 @@ size_t HashBloom::pos(const TTHValue& tth, size_t n) const {
 		return 0;
 	}
 
-	uint64_t x = 0;
-
+	// the TTH is read as a little-endian number; take bits [n * h, (n + 1) * h) of it, a byte at a time.
 	size_t start = n * h;
-	for(size_t i = 0; i < h; ++i) {
-		size_t bit = start + i;
-		size_t byte = bit / 8;
-		size_t pos = bit % 8;
+	size_t shift = start % 8;
+	const uint8_t* p = tth.data + start / 8;
 
-		if(tth.data[byte] & (1 << pos)) {
-			x |= (1LL << i);
-		}
+	uint64_t x = p[0] >> shift;
+	for(size_t i = 1, got = 8 - shift; got < h; ++i, got += 8) {
+		x |= static_cast<uint64_t>(p[i]) << got;
+	}
+	if(h < 64) {
+		x &= (1ULL << h) - 1;
 	}
-	return x % bloom.size();
+	return x % bits;
 }
 
 void HashBloom::copy_to(ByteVector& v) const {
-	v.resize(bloom.size() / 8);
-	for(size_t i = 0; i < bloom.size(); ++i) {
-		v[i/8] |= bloom[i] << (i % 8);
+	v.resize(bits / 8);
+	for(size_t i = 0; i < v.size(); ++i) {
+		v[i] = static_cast<uint8_t>(bloom[i / 8] >> (i % 8 * 8));
 	}
 }
 
@@ -33,7 +33,7 @@ namespace dcpp {
  */
 class HashBloom {
 public:
-	HashBloom() : k(0), h(0) { }
+	HashBloom() : bits(0), k(0), h(0) { }
 
 	/** Return a suitable value for k based on n */
 	static size_t get_k(size_t n, size_t h);
@@ -46,11 +46,20 @@ public:
 	void push_back(bool v);
 
 	void copy_to(ByteVector& v) const;
+
+	size_t get_k() const { return k; }
+	size_t get_m() const { return bits; }
+	size_t get_h() const { return h; }
 private:
 
 	size_t pos(const TTHValue& tth, size_t n) const;
 
-	std::vector<bool> bloom;
+	bool test(size_t bit) const { return (bloom[bit / 64] >> (bit % 64)) & 1; }
+	void set(size_t bit) { bloom[bit / 64] |= 1ULL << (bit % 64); }
+
+	/** Bit i is bit i % 64 of word i / 64, which makes copy_to a plain little-endian copy. */
+	std::vector<uint64_t> bloom;
+	size_t bits;
 	size_t k;
 	size_t h;
 };
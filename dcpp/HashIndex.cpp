@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stdinc.h"
+#include "HashIndex.h"
+
+#include "File.h"
+
+namespace dcpp {
+
+static_assert(sizeof(HashIndex::TreeRecord) == 48, "tree records must be packed");
+static_assert(sizeof(HashIndex::FileRecord) == 48, "file records must be packed");
+
+const uint32_t HashIndex::NOT_FOUND;
+
+HashIndex::HashIndex(const string& aFileName) : f(aFileName, MappedFile::RANDOM) {
+	if(f.getSize() < sizeof(Header))
+		throw HashException(_("Invalid hash index file"));
+
+	const auto& h = header();
+	if(h.magic != MAGIC || h.version != VERSION)
+		throw HashException(_("Invalid hash index file"));
+
+	if(h.treeSlots <= h.treeCount || (h.treeSlots & (h.treeSlots - 1)) != 0 ||
+		h.fileSlots <= h.fileCount || (h.fileSlots & (h.fileSlots - 1)) != 0)
+	{
+		throw HashException(_("Invalid hash index file"));
+	}
+
+	uint64_t expected = sizeof(Header) +
+		static_cast<uint64_t>(h.treeCount) * sizeof(TreeRecord) +
+		static_cast<uint64_t>(h.fileCount) * sizeof(FileRecord) +
+		(static_cast<uint64_t>(h.treeSlots) + h.fileSlots) * sizeof(uint32_t) +
+		h.stringsSize;
+	if(expected != f.getSize())
+		throw HashException(_("Invalid hash index file"));
+
+	// check everything lookups rely on once, so that they don't have to; probes stop at an empty
+	// slot, so there must be one.
+	bool empty = false;
+	for(uint32_t i = 0; i < h.treeSlots; ++i) {
+		if(treeSlots()[i] > h.treeCount)
+			throw HashException(_("Invalid hash index file"));
+		empty |= treeSlots()[i] == 0;
+	}
+	if(!empty)
+		throw HashException(_("Invalid hash index file"));
+
+	empty = false;
+	for(uint32_t i = 0; i < h.fileSlots; ++i) {
+		if(fileSlots()[i] > h.fileCount)
+			throw HashException(_("Invalid hash index file"));
+		empty |= fileSlots()[i] == 0;
+	}
+	if(!empty)
+		throw HashException(_("Invalid hash index file"));
+	for(uint32_t i = 0; i < h.fileCount; ++i) {
+		const auto& fr = files()[i];
+		if(static_cast<uint64_t>(fr.dir) + fr.dirLength > h.stringsSize ||
+			static_cast<uint64_t>(fr.name) + fr.nameLength > h.stringsSize)
+		{
+			throw HashException(_("Invalid hash index file"));
+		}
+	}
+}
+
+const HashIndex::TreeRecord* HashIndex::findTree(const TTHValue& root) const {
+	const auto& h = header();
+	auto mask = h.treeSlots - 1;
+	for(auto i = hashRoot(root.data) & mask; treeSlots()[i] != 0; i = (i + 1) & mask) {
+		const auto& tr = trees()[treeSlots()[i] - 1];
+		if(memcmp(tr.root, root.data, TTHValue::BYTES) == 0)
+			return &tr;
+	}
+	return nullptr;
+}
+
+uint32_t HashIndex::findFile(const string& dir, const string& name) const {
+	const auto& h = header();
+	auto mask = h.fileSlots - 1;
+	for(auto i = hashPath(dir, name) & mask; fileSlots()[i] != 0; i = (i + 1) & mask) {
+		auto n = fileSlots()[i] - 1;
+		const auto& fr = files()[n];
+		if(fr.nameLength == name.size() && fr.dirLength == dir.size() &&
+			memcmp(strings() + fr.name, name.data(), name.size()) == 0 &&
+			memcmp(strings() + fr.dir, dir.data(), dir.size()) == 0)
+		{
+			return n;
+		}
+	}
+	return NOT_FOUND;
+}
+
+uint32_t HashIndex::hashRoot(const uint8_t* root) {
+	// the root is a tiger hash already, any part of it will do
+	uint32_t x;
+	memcpy(&x, root, sizeof(x));
+	return x;
+}
+
+uint32_t HashIndex::hashPath(const string& dir, const string& name) {
+	// FNV-1a
+	uint32_t x = 2166136261u;
+	for(auto c: dir) { x = (x ^ static_cast<uint8_t>(c)) * 16777619u; }
+	for(auto c: name) { x = (x ^ static_cast<uint8_t>(c)) * 16777619u; }
+	return x;
+}
+
+uint32_t HashIndex::getSlotCount(uint32_t n) {
+	uint32_t slots = 16;
+	while(slots < n * 2ull)
+		slots <<= 1;
+	return slots;
+}
+
+void HashIndex::Writer::addTree(const TTHValue& root, int64_t size, int64_t index, int64_t blockSize) {
+	TreeRecord tr = { };
+	memcpy(tr.root, root.data, TTHValue::BYTES);
+	tr.size = size;
+	tr.index = index;
+	tr.blockSize = blockSize;
+	treeRecords.push_back(tr);
+}
+
+void HashIndex::Writer::addFile(const string& dir, const string& name, const TTHValue& root, uint32_t timeStamp) {
+	FileRecord fr = { };
+	memcpy(fr.root, root.data, TTHValue::BYTES);
+
+	auto i = dirs.find(dir);
+	if(i == dirs.end()) {
+		i = dirs.emplace(dir, addString(dir)).first;
+	}
+	fr.dir = i->second;
+	fr.dirLength = dir.size();
+	fr.name = addString(name);
+	fr.nameLength = name.size();
+	fr.timeStamp = timeStamp;
+	fileRecords.push_back(fr);
+}
+
+uint32_t HashIndex::Writer::addString(const string& s) {
+	if(stringTable.size() + s.size() > UINT32_MAX)
+		throw HashException(_("The hash index is too large"));
+
+	auto pos = static_cast<uint32_t>(stringTable.size());
+	stringTable += s;
+	return pos;
+}
+
+void HashIndex::Writer::write(const string& aFileName) const {
+	Header h = { MAGIC, VERSION };
+	h.treeCount = treeRecords.size();
+	h.treeSlots = getSlotCount(h.treeCount);
+	h.fileCount = fileRecords.size();
+	h.fileSlots = getSlotCount(h.fileCount);
+	h.stringsSize = stringTable.size();
+
+	vector<uint32_t> slots(h.treeSlots + h.fileSlots);
+
+	auto tslots = &slots[0];
+	for(uint32_t n = 0; n < h.treeCount; ++n) {
+		auto i = hashRoot(treeRecords[n].root) & (h.treeSlots - 1);
+		while(tslots[i] != 0)
+			i = (i + 1) & (h.treeSlots - 1);
+		tslots[i] = n + 1;
+	}
+
+	auto fslots = &slots[h.treeSlots];
+	for(uint32_t n = 0; n < h.fileCount; ++n) {
+		const auto& fr = fileRecords[n];
+		auto i = hashPath(stringTable.substr(fr.dir, fr.dirLength), stringTable.substr(fr.name, fr.nameLength)) & (h.fileSlots - 1);
+		while(fslots[i] != 0)
+			i = (i + 1) & (h.fileSlots - 1);
+		fslots[i] = n + 1;
+	}
+
+	// the old file may still be mapped; unlinking it leaves that mapping alone, truncating it wouldn't
+	File::deleteFile(aFileName);
+
+	File out(aFileName, File::WRITE, File::CREATE | File::TRUNCATE);
+	out.write(&h, sizeof(h));
+	if(!treeRecords.empty())
+		out.write(&treeRecords[0], treeRecords.size() * sizeof(TreeRecord));
+	if(!fileRecords.empty())
+		out.write(&fileRecords[0], fileRecords.size() * sizeof(FileRecord));
+	out.write(&slots[0], slots.size() * sizeof(uint32_t));
+	if(!stringTable.empty())
+		out.write(stringTable.data(), stringTable.size());
+	out.flush();
+	out.close();
+}
+
+} // namespace dcpp
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_HASH_INDEX_H
+#define DCPLUSPLUS_DCPP_HASH_INDEX_H
+
+#include <unordered_map>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "Exception.h"
+#include "forward.h"
+#include "HashValue.h"
+#include "MappedFile.h"
+#include "TigerHash.h"
+
+namespace dcpp {
+
+using std::unordered_map;
+
+STANDARD_EXCEPTION(HashException);
+
+/**
+ * Read-only view of the binary hash index, queried in place where the file is mapped. The file is
+ * a header followed by fixed-size tree and file records, one hash table for each (open addressing,
+ * keyed on the tree root and on the file path), then the string table holding the directory (once
+ * per directory) and name of each file. Everything is in host byte order; the index is a cache
+ * that never leaves the machine. Throws HashException when the file is corrupt and FileException
+ * when it can't be opened.
+ */
+class HashIndex : boost::noncopyable {
+public:
+	struct TreeRecord {
+		uint8_t root[TTHValue::BYTES];
+		int64_t size;
+		int64_t index;
+		int64_t blockSize;
+	};
+
+	struct FileRecord {
+		uint8_t root[TTHValue::BYTES];
+		uint32_t dir;
+		uint32_t dirLength;
+		uint32_t name;
+		uint32_t nameLength;
+		uint32_t timeStamp;
+		uint32_t reserved;
+	};
+
+	static const uint32_t NOT_FOUND = static_cast<uint32_t>(-1);
+
+	explicit HashIndex(const string& aFileName);
+
+	uint32_t getTreeCount() const { return header().treeCount; }
+	uint32_t getFileCount() const { return header().fileCount; }
+
+	const TreeRecord& getTree(uint32_t i) const { return trees()[i]; }
+	const FileRecord& getFile(uint32_t i) const { return files()[i]; }
+	string getDir(const FileRecord& f) const { return string(strings() + f.dir, f.dirLength); }
+	string getName(const FileRecord& f) const { return string(strings() + f.name, f.nameLength); }
+
+	/** @return the tree record of the root, or nullptr */
+	const TreeRecord* findTree(const TTHValue& root) const;
+	/** @return the number of the record of the file, or NOT_FOUND */
+	uint32_t findFile(const string& dir, const string& name) const;
+
+	/** Collects the records of a new index and writes it out. */
+	class Writer {
+	public:
+		void addTree(const TTHValue& root, int64_t size, int64_t index, int64_t blockSize);
+		void addFile(const string& dir, const string& name, const TTHValue& root, uint32_t timeStamp);
+
+		/** @throw FileException, HashException */
+		void write(const string& aFileName) const;
+
+	private:
+		vector<TreeRecord> treeRecords;
+		vector<FileRecord> fileRecords;
+		string stringTable;
+		unordered_map<string, uint32_t> dirs;
+
+		uint32_t addString(const string& s);
+	};
+
+private:
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t treeCount;
+		uint32_t treeSlots;
+		uint32_t fileCount;
+		uint32_t fileSlots;
+		uint64_t stringsSize;
+	};
+
+	static const uint32_t MAGIC = 0x48434444; // "DDCH" in little endian
+	static const uint32_t VERSION = 1;
+
+	static uint32_t hashRoot(const uint8_t* root);
+	static uint32_t hashPath(const string& dir, const string& name);
+	/** Size of a hash table for n records: a power of two, at most half full. */
+	static uint32_t getSlotCount(uint32_t n);
+
+	MappedFile f;
+
+	const Header& header() const { return *reinterpret_cast<const Header*>(f.getData()); }
+	const TreeRecord* trees() const { return reinterpret_cast<const TreeRecord*>(f.getData() + sizeof(Header)); }
+	const FileRecord* files() const { return reinterpret_cast<const FileRecord*>(trees() + header().treeCount); }
+	/** Record number + 1, 0 for an empty slot */
+	const uint32_t* treeSlots() const { return reinterpret_cast<const uint32_t*>(files() + header().fileCount); }
+	const uint32_t* fileSlots() const { return treeSlots() + header().treeSlots; }
+	const char* strings() const { return reinterpret_cast<const char*>(fileSlots() + header().fileSlots); }
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_HASH_INDEX_H)
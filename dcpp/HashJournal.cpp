@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stdinc.h"
+#include "HashJournal.h"
+
+#include "ZUtils.h"
+
+namespace dcpp {
+
+namespace {
+
+/* Every record is [uint32 length][uint32 CRC-32][length bytes: uint8 type, fields], in host byte
+order like the index itself. */
+const size_t HEADER_SIZE = 2 * sizeof(uint32_t);
+
+template<typename T> void put(string& s, const T& x) {
+	s.append(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+template<typename T> T get(const char*& p) {
+	T x;
+	memcpy(&x, p, sizeof(x));
+	p += sizeof(x);
+	return x;
+}
+
+}
+
+HashJournal::HashJournal(const string& aFileName) :
+	f(aFileName, File::READ | File::WRITE, File::OPEN | File::CREATE),
+	pending(0),
+	size(0),
+	appended(0)
+{
+	size = f.getSize();
+	f.setEndPos(0);
+}
+
+size_t HashJournal::replay(TreeF treeF, FileF fileF, DropF dropF) {
+	auto data = f.read();
+
+	size_t pos = 0, n = 0;
+	while(data.size() - pos >= HEADER_SIZE) {
+		const char* p = data.data() + pos;
+		auto len = get<uint32_t>(p);
+		auto crc = get<uint32_t>(p);
+		if(len == 0 || len > data.size() - pos - HEADER_SIZE)
+			break;
+
+		CRC32Filter check;
+		check(p, len);
+		if(check.getValue() != crc)
+			break;
+
+		auto end = p + len;
+		auto type = get<uint8_t>(p);
+		if(type == RECORD_TREE && len == 1 + TTHValue::BYTES + 3 * sizeof(int64_t)) {
+			TTHValue root(reinterpret_cast<const uint8_t*>(p));
+			p += TTHValue::BYTES;
+			auto treeSize = get<int64_t>(p);
+			auto index = get<int64_t>(p);
+			auto blockSize = get<int64_t>(p);
+			treeF(root, treeSize, index, blockSize);
+		} else if(type == RECORD_FILE && len > 1 + TTHValue::BYTES + sizeof(uint32_t)) {
+			TTHValue root(reinterpret_cast<const uint8_t*>(p));
+			p += TTHValue::BYTES;
+			auto timeStamp = get<uint32_t>(p);
+			fileF(string(p, end), root, timeStamp);
+		} else if(type == RECORD_DROP && len == 1 + TTHValue::BYTES) {
+			dropF(TTHValue(reinterpret_cast<const uint8_t*>(p)));
+		} else {
+			break;
+		}
+
+		pos += HEADER_SIZE + len;
+		++n;
+	}
+
+	if(pos != data.size()) {
+		// a crash cut the last batch short; append after the records that made it
+		f.setPos(pos);
+		f.setEOF();
+		f.flush();
+	}
+
+	size = pos;
+	f.setEndPos(0);
+	return n;
+}
+
+void HashJournal::addTree(const TTHValue& root, int64_t treeSize, int64_t index, int64_t blockSize) {
+	string record;
+	put(record, static_cast<uint8_t>(RECORD_TREE));
+	record.append(reinterpret_cast<const char*>(root.data), TTHValue::BYTES);
+	put(record, treeSize);
+	put(record, index);
+	put(record, blockSize);
+	append(record);
+}
+
+void HashJournal::addFile(const string& fileName, const TTHValue& root, uint32_t timeStamp) {
+	string record;
+	put(record, static_cast<uint8_t>(RECORD_FILE));
+	record.append(reinterpret_cast<const char*>(root.data), TTHValue::BYTES);
+	put(record, timeStamp);
+	record += fileName;
+	append(record);
+}
+
+void HashJournal::dropTree(const TTHValue& root) {
+	string record;
+	put(record, static_cast<uint8_t>(RECORD_DROP));
+	record.append(reinterpret_cast<const char*>(root.data), TTHValue::BYTES);
+	append(record);
+}
+
+void HashJournal::append(const string& record) {
+	CRC32Filter crc;
+	crc(record.data(), record.size());
+
+	put(buf, static_cast<uint32_t>(record.size()));
+	put(buf, crc.getValue());
+	buf += record;
+	++pending;
+	appended += HEADER_SIZE + record.size();
+}
+
+void HashJournal::sync() {
+	if(buf.empty())
+		return;
+
+	write(appended);
+	flush();
+}
+
+void HashJournal::write(uint64_t mark) {
+	// what came before buf is written already, or was cleared.
+	auto start = appended - buf.size();
+	if(mark <= start)
+		return;
+
+	auto n = static_cast<size_t>(mark - start);
+	f.write(buf.data(), n);
+
+	for(size_t pos = 0; pos < n; --pending) {
+		const char* p = buf.data() + pos;
+		pos += HEADER_SIZE + get<uint32_t>(p);
+	}
+
+	size += n;
+	buf.erase(0, n);
+}
+
+void HashJournal::flush() {
+	f.flush();
+}
+
+void HashJournal::clear() {
+	buf.clear();
+	pending = 0;
+
+	f.setPos(0);
+	f.setEOF();
+	size = 0;
+}
+
+} // namespace dcpp
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_HASH_JOURNAL_H
+#define DCPLUSPLUS_DCPP_HASH_JOURNAL_H
+
+#include <functional>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "File.h"
+#include "forward.h"
+#include "HashValue.h"
+#include "TigerHash.h"
+
+namespace dcpp {
+
+using std::function;
+
+/**
+ * Write-ahead log of the changes made to the hash store since its index was last saved. Records
+ * are buffered and reach the disk in batches, each one framed by its length and a CRC-32 so that
+ * a record torn by a crash ends the replay instead of corrupting it. Throws FileException.
+ */
+class HashJournal : boost::noncopyable {
+public:
+	typedef function<void (const TTHValue& root, int64_t size, int64_t index, int64_t blockSize)> TreeF;
+	typedef function<void (const string& fileName, const TTHValue& root, uint32_t timeStamp)> FileF;
+	typedef function<void (const TTHValue& root)> DropF;
+
+	explicit HashJournal(const string& aFileName);
+
+	/** Read back the records on disk, then drop whatever follows the last complete one.
+	@return the number of records read */
+	size_t replay(TreeF treeF, FileF fileF, DropF dropF);
+
+	void addTree(const TTHValue& root, int64_t size, int64_t index, int64_t blockSize);
+	void addFile(const string& fileName, const TTHValue& root, uint32_t timeStamp);
+	void dropTree(const TTHValue& root);
+
+	/** Write the buffered records and wait until they are on disk. */
+	void sync();
+
+	/** Position after the last record added, to be passed to write. */
+	uint64_t getMark() const { return appended; }
+	/** Write the buffered records that were added before the mark, without waiting for them to
+	reach the disk. */
+	void write(uint64_t mark);
+	/** Wait until the records written are on disk. Unlike the other calls, this may run while
+	records are being added or written. */
+	void flush();
+	/** Forget every record, once the index holds them all; flush makes that durable. */
+	void clear();
+
+	size_t getPending() const { return pending; }
+	/** Size of the journal, buffered records included. */
+	int64_t getSize() const { return size + buf.size(); }
+
+private:
+	enum { RECORD_TREE = 1, RECORD_FILE = 2, RECORD_DROP = 3 };
+
+	File f;
+	/** Records not written yet */
+	string buf;
+	size_t pending;
+	/** Bytes already written */
+	int64_t size;
+	/** Bytes ever added to buf */
+	uint64_t appended;
+
+	void append(const string& record);
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_HASH_JOURNAL_H)
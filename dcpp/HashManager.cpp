@@ -18,6 +18,8 @@
 #include "stdinc.h"
 #include "HashManager.h"
 
+#include <thread>
+
 #include <boost/scoped_array.hpp>
 
 #include "File.h"
@@ -30,6 +32,7 @@
 
 namespace dcpp {
 
+using std::multimap;
 using std::swap;
 
 using boost::none;
@@ -41,14 +44,37 @@ using boost::none;
 #define HASH_FILE_VERSION_STRING "3"
 static const uint32_t HASH_FILE_VERSION = 3;
 const int64_t HashManager::MIN_BLOCK_SIZE = 64 * 1024;
+const int64_t HashManager::PARALLEL_HASH_SIZE = 64 * 1024 * 1024;
+
+/** The journal is folded into the index when it reaches this size, or gets this old. */
+static const int64_t JOURNAL_MAX_SIZE = 4 * 1024 * 1024;
+static const uint64_t JOURNAL_MAX_AGE = 30 * 60 * 1000;
+
+/** A compaction starts once this much of the data file, and at least this proportion of it, is
+wasted. */
+static const int64_t COMPACT_MIN_WASTE = 16 * 1024 * 1024;
+static const double COMPACT_MIN_RATIO = 0.25;
+/** Tree data moved per step, between which the lock is released */
+static const int64_t COMPACT_STEP_SIZE = 1024 * 1024;
+/** Time between steps of a compaction, and between checks for fragmentation otherwise */
+static const uint32_t COMPACT_STEP_DELAY = 100;
+static const uint32_t COMPACT_CHECK_DELAY = 5 * 60 * 1000;
+
+/** Directories whose device the hasher remembers; forgotten all at once when there are more. */
+static const size_t DEVICE_CACHE_SIZE = 1024;
 
 optional<TTHValue> HashManager::getTTH(const string& aFileName, int64_t aSize, uint32_t aTimeStamp) noexcept {
-	Lock l(cs);
-	auto tth = store.getTTH(aFileName, aSize, aTimeStamp);
-	if(!tth) {
-		hasher.hashFile(aFileName, aSize);
+	{
+		Lock l(cs);
+		auto tth = store.getTTH(aFileName, aSize, aTimeStamp);
+		if(tth) {
+			return tth;
+		}
 	}
-	return tth;
+
+	// queued out of the lock, as finding the device of the file may touch the disk.
+	hasher.hashFile(aFileName, aSize);
+	return none;
 }
 
 bool HashManager::getTree(const TTHValue& root, TigerTree& tt) {
@@ -61,6 +87,48 @@ int64_t HashManager::getBlockSize(const TTHValue& root) {
 	return store.getBlockSize(root);
 }
 
+void HashManager::sync() noexcept {
+	// once this returns, what was in the journal before is on disk, even if another sync wrote it.
+	Lock sl(syncCs);
+
+	uint64_t mark;
+	{
+		Lock l(cs);
+		mark = store.getSyncMark();
+	}
+	if(!mark)
+		return;
+
+	// the trees the journal records point at go to disk first.
+	HashStore::flushDataFile();
+	{
+		Lock l(cs);
+		store.writeJournal(mark);
+	}
+	store.flushJournal();
+}
+
+void HashManager::checkpoint() noexcept {
+	HashIndex::Writer w;
+	vector<bool> used;
+	{
+		Lock l(cs);
+		if(!store.startCheckpoint(GET_TICK(), w, used))
+			return;
+	}
+
+	auto written = HashStore::writeIndex(w);
+
+	{
+		Lock l(cs);
+		store.endCheckpoint(written, move(used));
+	}
+
+	// the journal was emptied, then given the changes made while the index was written.
+	store.flushJournal();
+	sync();
+}
+
 void HashManager::hashDone(const string& aFileName, uint32_t aTimeStamp, const TigerTree& tth, int64_t speed, int64_t size) {
 	try {
 		Lock l(cs);
@@ -85,27 +153,71 @@ void HashManager::hashDone(const string& aFileName, uint32_t aTimeStamp, const T
 
 void HashManager::HashStore::addFile(const string& aFileName, uint32_t aTimeStamp, const TigerTree& tth, bool aUsed) {
 	addTree(tth);
+	setFile(aFileName, tth.getRoot(), aTimeStamp, aUsed);
+
+	// the timer syncs the journal.
+	if(journal) {
+		journal->addFile(aFileName, tth.getRoot(), aTimeStamp);
+	}
 
+	if(saving) {
+		auto root = tth.getRoot();
+		redo.push_back([=] {
+			setFile(aFileName, root, aTimeStamp, aUsed);
+			if(journal) {
+				journal->addFile(aFileName, root, aTimeStamp);
+			}
+		});
+	}
+}
+
+void HashManager::HashStore::setFile(const string& aFileName, const TTHValue& root, uint32_t aTimeStamp, bool aUsed) {
 	auto fname = Util::getFileName(aFileName), fpath = Util::getFilePath(aFileName);
 
 	auto& fileList = fileIndex[fpath];
 
 	auto j = find(fileList.begin(), fileList.end(), fname);
 	if (j != fileList.end()) {
+		if(j->getRoot() != root)
+			superseded.insert(j->getRoot());
 		fileList.erase(j);
 	}
 
-	fileList.emplace_back(fname, tth.getRoot(), aTimeStamp, aUsed);
+	fileList.emplace_back(fname, root, aTimeStamp, aUsed);
+
+	auto n = findBaseFile(fpath, fname);
+	if(n != HashIndex::NOT_FOUND) {
+		TTHValue oldRoot(base->getFile(n).root);
+		if(oldRoot != root)
+			superseded.insert(oldRoot);
+		baseRemoved[n] = true;
+	}
+
 	dirty = true;
 }
 
 void HashManager::HashStore::addTree(const TigerTree& tt) noexcept {
-	if (treeIndex.find(tt.getRoot()) == treeIndex.end()) {
+	if (!findTree(tt.getRoot())) {
 		try {
 			File f(getDataFile(), File::READ | File::WRITE, File::OPEN);
 			int64_t index = saveTree(f, tt);
-			treeIndex.emplace(tt.getRoot(), TreeInfo(tt.getFileSize(), index, tt.getBlockSize()));
+			TreeInfo ti(tt.getFileSize(), index, tt.getBlockSize());
+			auto root = tt.getRoot();
+			treeIndex.emplace(root, ti);
 			dirty = true;
+
+			if(journal) {
+				journal->addTree(root, ti.getSize(), ti.getIndex(), ti.getBlockSize());
+			}
+
+			if(saving) {
+				redo.push_back([=] {
+					treeIndex.emplace(root, ti);
+					if(journal) {
+						journal->addTree(root, ti.getSize(), ti.getIndex(), ti.getBlockSize());
+					}
+				});
+			}
 		} catch (const FileException& e) {
 			LogManager::getInstance()->message(str(F_("Error saving hash data: %1%") % e.getError()), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
 		}
@@ -157,47 +269,117 @@ bool HashManager::HashStore::loadTree(File& f, const TreeInfo& ti, const TTHValu
 }
 
 bool HashManager::HashStore::getTree(const TTHValue& root, TigerTree& tt) {
-	auto i = treeIndex.find(root);
-	if (i == treeIndex.end())
+	auto ti = findTree(root);
+	if (!ti)
 		return false;
 	try {
 		File f(getDataFile(), File::READ, File::OPEN);
-		return loadTree(f, i->second, root, tt);
+		return loadTree(f, *ti, root, tt);
 	} catch (const Exception&) {
 		return false;
 	}
 }
 
 int64_t HashManager::HashStore::getBlockSize(const TTHValue& root) const {
+	auto ti = findTree(root);
+	return ti ? ti->getBlockSize() : 0;
+}
+
+optional<HashManager::HashStore::TreeInfo> HashManager::HashStore::findTree(const TTHValue& root) const {
 	auto i = treeIndex.find(root);
-	return i == treeIndex.end() ? 0 : i->second.getBlockSize();
+	if(i != treeIndex.end())
+		return i->second;
+
+	if(base) {
+		auto tr = base->findTree(root);
+		if(tr && !baseTreeRemoved[tr - &base->getTree(0)])
+			return TreeInfo(tr->size, tr->index, tr->blockSize);
+	}
+	return none;
+}
+
+void HashManager::HashStore::dropTree(const TTHValue& root) {
+	treeIndex.erase(root);
+
+	if(base) {
+		auto tr = base->findTree(root);
+		if(tr)
+			baseTreeRemoved[tr - &base->getTree(0)] = true;
+	}
+
+	dirty = true;
+}
+
+uint32_t HashManager::HashStore::findBaseFile(const string& fpath, const string& fname) const {
+	if(!base)
+		return HashIndex::NOT_FOUND;
+
+	auto n = base->findFile(fpath, fname);
+	return n == HashIndex::NOT_FOUND || baseRemoved[n] ? HashIndex::NOT_FOUND : n;
 }
 
 optional<TTHValue> HashManager::HashStore::getTTH(const string& aFileName, int64_t aSize, uint32_t aTimeStamp) noexcept {
 	auto fname = Util::getFileName(aFileName), fpath = Util::getFilePath(aFileName);
 
+	// the index being written doesn't know of the change; look the file up again once it's in place.
+	auto redoLookup = [&] {
+		if(saving) {
+			redo.push_back([this, aFileName, aSize, aTimeStamp] { getTTH(aFileName, aSize, aTimeStamp); });
+		}
+	};
+
 	auto i = fileIndex.find(fpath);
 	if (i != fileIndex.end()) {
 		auto j = find(i->second.begin(), i->second.end(), fname);
 		if (j != i->second.end()) {
 			FileInfo& fi = *j;
 			const auto& root = fi.getRoot();
-			auto ti = treeIndex.find(root);
-			if(ti != treeIndex.end() && ti->second.getSize() == aSize && fi.getTimeStamp() == aTimeStamp) {
-				fi.setUsed(true);
+			auto ti = findTree(root);
+			if(ti && ti->getSize() == aSize && fi.getTimeStamp() == aTimeStamp) {
+				if(!fi.getUsed()) {
+					fi.setUsed(true);
+					redoLookup();
+				}
 				return root;
 			}
 
 			// the file size or the timestamp has changed
+			superseded.insert(root);
 			i->second.erase(j);
 			dirty = true;
+			redoLookup();
+			return none;
 		}
 	}
+
+	auto n = findBaseFile(fpath, fname);
+	if(n != HashIndex::NOT_FOUND) {
+		const auto& fr = base->getFile(n);
+		TTHValue root(fr.root);
+		auto ti = findTree(root);
+		if(ti && ti->getSize() == aSize && fr.timeStamp == aTimeStamp) {
+			if(!baseUsed[n]) {
+				baseUsed[n] = true;
+				redoLookup();
+			}
+			return root;
+		}
+
+		redoLookup();
+		superseded.insert(root);
+		baseRemoved[n] = true;
+		dirty = true;
+	}
 	return none;
 }
 
 void HashManager::HashStore::rebuild() {
 	try {
+		// the rebuild drops and moves trees itself
+		moves.clear();
+		superseded.clear();
+		unmapIndex();
+
 		decltype(fileIndex) newFileIndex;
 		decltype(treeIndex) newTreeIndex;
 
@@ -260,62 +442,479 @@ void HashManager::HashStore::rebuild() {
 
 void HashManager::HashStore::save() {
 	if (dirty) {
-		try {
-			File ff(getIndexFile() + ".tmp", File::WRITE, File::CREATE | File::TRUNCATE);
-			BufferedOutputStream<false> f(&ff);
-
-			string tmp;
-			string b32tmp;
-
-			f.write(SimpleXML::utf8Header);
-			f.write(LIT("<HashStore Version=\"" HASH_FILE_VERSION_STRING "\">\r\n"));
-
-			f.write(LIT("\t<Trees>\r\n"));
-
-			for (auto& i: treeIndex) {
-				const TreeInfo& ti = i.second;
-				f.write(LIT("\t\t<Hash Type=\"TTH\" Index=\""));
-				f.write(Util::toString(ti.getIndex()));
-				f.write(LIT("\" BlockSize=\""));
-				f.write(Util::toString(ti.getBlockSize()));
-				f.write(LIT("\" Size=\""));
-				f.write(Util::toString(ti.getSize()));
-				f.write(LIT("\" Root=\""));
-				b32tmp.clear();
-				f.write(i.first.toBase32(b32tmp));
-				f.write(LIT("\"/>\r\n"));
+		HashIndex::Writer w;
+		vector<bool> used;
+		prepareIndex(w, used);
+		if(writeIndex(w) && commitIndex(move(used))) {
+			flushJournal();
+		}
+	}
+}
+
+void HashManager::HashStore::prepareIndex(HashIndex::Writer& w, vector<bool>& used) const {
+	forEachTree([&w](const TTHValue& root, const TreeInfo& ti) {
+		w.addTree(root, ti.getSize(), ti.getIndex(), ti.getBlockSize());
+	});
+	forEachFile([&w, &used](const string& dir, const string& name, const TTHValue& root, uint32_t timeStamp, bool aUsed) {
+		w.addFile(dir, name, root, timeStamp);
+		used.push_back(aUsed);
+	});
+}
+
+bool HashManager::HashStore::writeIndex(const HashIndex::Writer& w) noexcept {
+	try {
+		// the index will point at trees the journal may not have synced yet
+		flushDataFile();
+		w.write(getIndexFile() + ".tmp");
+		return true;
+	} catch (const Exception& e) {
+		LogManager::getInstance()->message(str(F_("Error saving hash data: %1%") % e.getError()), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
+		return false;
+	}
+}
+
+bool HashManager::HashStore::commitIndex(vector<bool>&& used) noexcept {
+	try {
+		auto tmpName = getIndexFile() + ".tmp";
+		mapIndex(tmpName, move(used));
+		dirty = false;
+		lastSave = GET_TICK();
+
+		// the new index stays mapped while it's renamed, which MappedFile allows
+		File::deleteFile(getIndexFile());
+		File::renameFile(tmpName, getIndexFile());
+
+		if(journal) {
+			journal->clear();
+		}
+		return true;
+	} catch (const Exception& e) {
+		LogManager::getInstance()->message(str(F_("Error saving hash data: %1%") % e.getError()), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
+		return false;
+	}
+}
+
+uint64_t HashManager::HashStore::getSyncMark() const {
+	if(!journal || journal->getPending() == 0)
+		return 0;
+	return journal->getMark();
+}
+
+void HashManager::HashStore::writeJournal(uint64_t mark) noexcept {
+	if(!journal)
+		return;
+
+	try {
+		journal->write(mark);
+	} catch (const FileException& e) {
+		LogManager::getInstance()->message(str(F_("Error saving hash data: %1%") % e.getError()), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
+	}
+}
+
+void HashManager::HashStore::flushJournal() noexcept {
+	// only load sets the journal up, before anything can be written to it.
+	if(!journal)
+		return;
+
+	try {
+		journal->flush();
+	} catch (const FileException& e) {
+		LogManager::getInstance()->message(str(F_("Error saving hash data: %1%") % e.getError()), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
+	}
+}
+
+bool HashManager::HashStore::startCheckpoint(uint64_t aTick, HashIndex::Writer& w, vector<bool>& used) {
+	if(!dirty || (journal && journal->getSize() < JOURNAL_MAX_SIZE && aTick < lastSave + JOURNAL_MAX_AGE))
+		return false;
+
+	prepareIndex(w, used);
+	saving = true;
+	return true;
+}
+
+void HashManager::HashStore::endCheckpoint(bool written, vector<bool>&& used) noexcept {
+	saving = false;
+
+	if(written && commitIndex(move(used))) {
+		// what changed while the index was written goes on top of it, and into the journal again
+		for(auto& f: redo) {
+			f();
+		}
+		if(!redo.empty()) {
+			dirty = true;
+		}
+	}
+	redo.clear();
+}
+
+int64_t HashManager::HashStore::getTreeBytes(const TreeInfo& ti) {
+	return ti.getIndex() == SMALL_TREE ? 0 : TigerTree::calcBlocks(ti.getSize(), ti.getBlockSize()) * TTHValue::BYTES;
+}
+
+int64_t HashManager::HashStore::getDataEnd(File& f) {
+	f.setPos(0);
+	int64_t pos = 0;
+	size_t n = sizeof(pos);
+	if (f.read(&pos, n) != sizeof(pos))
+		throw HashException(_("Unable to read hash data file"));
+	return pos;
+}
+
+int64_t HashManager::HashStore::dropSuperseded() {
+	if(superseded.empty())
+		return 0;
+
+	if(base) {
+		for(uint32_t i = 0, n = base->getFileCount(); i < n; ++i) {
+			if(!baseRemoved[i]) {
+				superseded.erase(TTHValue(base->getFile(i).root));
 			}
+		}
+	}
+	for(auto& i: fileIndex) {
+		for(auto& fi: i.second) {
+			superseded.erase(fi.getRoot());
+		}
+	}
 
-			f.write(LIT("\t</Trees>\r\n\t<Files>\r\n"));
-
-			for (auto& i: fileIndex) {
-				const string& dir = i.first;
-				for (auto& fi: i.second) {
-					f.write(LIT("\t\t<File Name=\""));
-					f.write(SimpleXML::escape(dir + fi.getFileName(), tmp, true));
-					f.write(LIT("\" TimeStamp=\""));
-					f.write(Util::toString(fi.getTimeStamp()));
-					f.write(LIT("\" Root=\""));
-					b32tmp.clear();
-					f.write(fi.getRoot().toBase32(b32tmp));
-					f.write(LIT("\"/>\r\n"));
-				}
+	int64_t ret = 0;
+	for(auto& root: superseded) {
+		auto ti = findTree(root);
+		if(ti)
+			ret += getTreeBytes(*ti);
+		dropTree(root);
+		if(journal) {
+			journal->dropTree(root);
+		}
+	}
+	superseded.clear();
+	return ret;
+}
+
+bool HashManager::HashStore::planCompaction() {
+	// moved trees must reach the index through the journal before their old place can be reused
+	if(!journal)
+		return false;
+
+	File f(getDataFile(), File::READ, File::OPEN);
+	auto end = getDataEnd(f);
+	auto size = end - static_cast<int64_t>(sizeof(end));
+	auto enough = [size](int64_t waste) { return waste >= COMPACT_MIN_WASTE && waste >= COMPACT_MIN_RATIO * size; };
+
+	// count first; most of the time there is nothing to compact, which needs neither the files
+	// walked for superseded trees still in use, nor the trees listed
+	int64_t live = 0;
+	forEachTree([&live](const TTHValue&, const TreeInfo& ti) {
+		live += getTreeBytes(ti);
+	});
+
+	int64_t unused = 0;
+	for(auto& root: superseded) {
+		auto ti = findTree(root);
+		if(ti)
+			unused += getTreeBytes(*ti);
+	}
+
+	if(!enough(size - live + unused))
+		return false;
+
+	live -= dropSuperseded();
+	auto waste = size - live;
+	if(!enough(waste))
+		return false;
+
+	struct Tree {
+		TTHValue root;
+		int64_t index;
+		int64_t len;
+	};
+	vector<Tree> trees;
+	forEachTree([&trees](const TTHValue& root, const TreeInfo& ti) {
+		auto len = getTreeBytes(ti);
+		if(len > 0) {
+			trees.push_back(Tree { root, ti.getIndex(), len });
+		}
+	});
+
+	sort(trees.begin(), trees.end(), [](const Tree& a, const Tree& b) { return a.index < b.index; });
+
+	// the holes between trees, by size
+	multimap<int64_t, int64_t> holes;
+	int64_t pos = sizeof(pos);
+	for(auto& t: trees) {
+		if(t.index > pos)
+			holes.emplace(t.index - pos, pos);
+		pos = max(pos, t.index + t.len);
+	}
+
+	// fill the tightest hole that fits each tree, starting with the last tree, as long as that
+	// brings the tree closer to the start
+	int64_t newEnd = sizeof(newEnd);
+	for(auto i = trees.rbegin(); i != trees.rend(); ++i) {
+		auto h = holes.lower_bound(i->len);
+		if(h == holes.end() || h->second > i->index) {
+			newEnd = max(newEnd, i->index + i->len);
+			continue;
+		}
+
+		auto to = h->second, rest = h->first - i->len;
+		holes.erase(h);
+		if(rest > 0)
+			holes.emplace(rest, to + i->len);
+
+		moves.push_back(Move { i->root, i->index, to });
+		newEnd = max(newEnd, to + i->len);
+	}
+
+	if(moves.empty())
+		return false;
+
+	compactEnd = end;
+	compactNewEnd = newEnd;
+
+	LogManager::getInstance()->message(str(F_("Compacting hash data: %1% wasted, moving %2% trees") %
+		Util::formatBytes(waste) % moves.size()), LogMessage::TYPE_GENERAL, LogMessage::LOG_SHARE);
+	return true;
+}
+
+bool HashManager::HashStore::compactStep() noexcept {
+	try {
+		/* each step is synced before the next one, which is when the space it freed gets reused:
+		the plan drops trees, the copies are written in later steps, and the old copies go in the
+		last one. */
+		if(moves.empty()) {
+			if(!compactEnd)
+				return planCompaction();
+
+			File f(getDataFile(), File::READ | File::WRITE, File::OPEN);
+			finishCompaction(f);
+			compactEnd = 0;
+			return false;
+		}
+
+		File f(getDataFile(), File::READ | File::WRITE, File::OPEN);
+
+		vector<pair<TTHValue, TreeInfo>> moved;
+		int64_t bytes = 0;
+		while(!moves.empty() && bytes < COMPACT_STEP_SIZE) {
+			auto m = moves.front();
+			moves.pop_front();
+
+			// skip trees dropped or moved since the plan was made
+			auto ti = findTree(m.root);
+			if(!ti || ti->getIndex() != m.from)
+				continue;
+
+			TigerTree tt;
+			if(!loadTree(f, *ti, m.root, tt)) {
+				// damaged; leave it where it is
+				compactNewEnd = max(compactNewEnd, m.from + getTreeBytes(*ti));
+				continue;
 			}
-			f.write(LIT("\t</Files>\r\n</HashStore>"));
-			f.flush();
-			ff.close();
-			File::deleteFile( getIndexFile());
-			File::renameFile(getIndexFile() + ".tmp", getIndexFile());
 
-			dirty = false;
-		} catch (const FileException& e) {
-			LogManager::getInstance()->message(str(F_("Error saving hash data: %1%") % e.getError()), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
+			f.setPos(m.to);
+			f.write(tt.getLeaves()[0].data, tt.getLeaves().size() * TTHValue::BYTES);
+
+			ti->setIndex(m.to);
+			moved.emplace_back(m.root, *ti);
+			bytes += getTreeBytes(*ti);
+		}
+
+		if(!moved.empty()) {
+			// the sync flushes the copies before writing the journal that points the index at them;
+			// until then the old copies are left alone
+			for(auto& i: moved) {
+				treeIndex[i.first] = i.second;
+				journal->addTree(i.first, i.second.getSize(), i.second.getIndex(), i.second.getBlockSize());
+			}
+			dirty = true;
+		}
+		return true;
+	} catch (const Exception& e) {
+		moves.clear();
+		compactEnd = 0;
+		LogManager::getInstance()->message(str(F_("Hash data compaction failed: %1%") % e.getError()), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
+		return false;
+	}
+}
+
+void HashManager::HashStore::finishCompaction(File& f) {
+	// trees added meanwhile went after the old end. The new end reaches the disk with the next
+	// sync, before the journal can point at any tree written past it.
+	if(getDataEnd(f) != compactEnd)
+		return;
+
+	f.setPos(0);
+	f.write(&compactNewEnd, sizeof(compactNewEnd));
+	f.setSize(compactNewEnd);
+
+	LogManager::getInstance()->message(str(F_("Hash data compacted: %1% freed") %
+		Util::formatBytes(compactEnd - compactNewEnd)), LogMessage::TYPE_GENERAL, LogMessage::LOG_SHARE);
+}
+
+HashManager::StoreStats HashManager::HashStore::getStats() const {
+	StoreStats ret = { };
+	forEachTree([&ret](const TTHValue&, const TreeInfo& ti) {
+		++ret.trees;
+		ret.liveSize += getTreeBytes(ti);
+	});
+
+	// superseded trees no file uses anymore are as good as dropped
+	auto unused = superseded;
+	forEachFile([&ret, &unused](const string&, const string&, const TTHValue& root, uint32_t, bool) {
+		++ret.files;
+		if(!unused.empty())
+			unused.erase(root);
+	});
+	for(auto& root: unused) {
+		auto ti = findTree(root);
+		if(ti) {
+			--ret.trees;
+			ret.liveSize -= getTreeBytes(*ti);
+		}
+	}
+
+	try {
+		File f(getDataFile(), File::READ, File::OPEN);
+		ret.dataSize = getDataEnd(f) - sizeof(int64_t);
+	} catch (const Exception&) {
+		// no data file
+	}
+
+	if(ret.dataSize > 0) {
+		ret.fragmentation = max(0., 1. - static_cast<double>(ret.liveSize) / static_cast<double>(ret.dataSize));
+	}
+	ret.compacting = compactEnd != 0;
+	return ret;
+}
+
+void HashManager::HashStore::mapIndex(const string& aFileName, vector<bool>&& used) {
+	unique_ptr<HashIndex> index(new HashIndex(aFileName));
+
+	base = move(index);
+	baseRemoved.assign(base->getFileCount(), false);
+	baseTreeRemoved.assign(base->getTreeCount(), false);
+	baseUsed = move(used);
+	baseUsed.resize(base->getFileCount());
+
+	fileIndex.clear();
+	treeIndex.clear();
+}
+
+void HashManager::HashStore::unmapIndex() {
+	if(!base)
+		return;
+
+	for(uint32_t i = 0, n = base->getTreeCount(); i < n; ++i) {
+		if(baseTreeRemoved[i])
+			continue;
+		const auto& tr = base->getTree(i);
+		treeIndex.emplace(TTHValue(tr.root), TreeInfo(tr.size, tr.index, tr.blockSize));
+	}
+
+	for(uint32_t i = 0, n = base->getFileCount(); i < n; ++i) {
+		if(baseRemoved[i])
+			continue;
+		const auto& fr = base->getFile(i);
+		fileIndex[base->getDir(fr)].emplace_back(base->getName(fr), TTHValue(fr.root), fr.timeStamp, baseUsed[i]);
+	}
+
+	base.reset();
+	baseRemoved.clear();
+	baseUsed.clear();
+	baseTreeRemoved.clear();
+}
+
+template<typename F> void HashManager::HashStore::forEachTree(F f) const {
+	if(base) {
+		for(uint32_t i = 0, n = base->getTreeCount(); i < n; ++i) {
+			if(baseTreeRemoved[i])
+				continue;
+			// trees moved by a compaction since the save have their new place in treeIndex
+			TTHValue root(base->getTree(i).root);
+			if(!treeIndex.empty() && treeIndex.find(root) != treeIndex.end())
+				continue;
+			const auto& tr = base->getTree(i);
+			f(root, TreeInfo(tr.size, tr.index, tr.blockSize));
+		}
+	}
+
+	for(auto& i: treeIndex) {
+		f(i.first, i.second);
+	}
+}
+
+template<typename F> void HashManager::HashStore::forEachFile(F f) const {
+	if(base) {
+		for(uint32_t i = 0, n = base->getFileCount(); i < n; ++i) {
+			if(baseRemoved[i])
+				continue;
+			const auto& fr = base->getFile(i);
+			f(base->getDir(fr), base->getName(fr), TTHValue(fr.root), fr.timeStamp, baseUsed[i]);
+		}
+	}
+
+	for(auto& i: fileIndex) {
+		for(auto& fi: i.second) {
+			f(i.first, fi.getFileName(), fi.getRoot(), fi.getTimeStamp(), fi.getUsed());
 		}
 	}
 }
 
-string HashManager::HashStore::getIndexFile() { return Util::getPath(Util::PATH_USER_CONFIG) + "HashIndex.xml"; }
+void HashManager::HashStore::exportXml(const string& aFileName) const {
+	File ff(aFileName, File::WRITE, File::CREATE | File::TRUNCATE);
+	BufferedOutputStream<false> f(&ff);
+
+	string tmp;
+	string b32tmp;
+
+	f.write(SimpleXML::utf8Header);
+	f.write(LIT("<HashStore Version=\"" HASH_FILE_VERSION_STRING "\">\r\n"));
+
+	f.write(LIT("\t<Trees>\r\n"));
+
+	forEachTree([&](const TTHValue& root, const TreeInfo& ti) {
+		f.write(LIT("\t\t<Hash Type=\"TTH\" Index=\""));
+		f.write(Util::toString(ti.getIndex()));
+		f.write(LIT("\" BlockSize=\""));
+		f.write(Util::toString(ti.getBlockSize()));
+		f.write(LIT("\" Size=\""));
+		f.write(Util::toString(ti.getSize()));
+		f.write(LIT("\" Root=\""));
+		b32tmp.clear();
+		f.write(root.toBase32(b32tmp));
+		f.write(LIT("\"/>\r\n"));
+	});
+
+	f.write(LIT("\t</Trees>\r\n\t<Files>\r\n"));
+
+	forEachFile([&](const string& dir, const string& name, const TTHValue& root, uint32_t timeStamp, bool) {
+		f.write(LIT("\t\t<File Name=\""));
+		f.write(SimpleXML::escape(dir + name, tmp, true));
+		f.write(LIT("\" TimeStamp=\""));
+		f.write(Util::toString(timeStamp));
+		f.write(LIT("\" Root=\""));
+		b32tmp.clear();
+		f.write(root.toBase32(b32tmp));
+		f.write(LIT("\"/>\r\n"));
+	});
+
+	f.write(LIT("\t</Files>\r\n</HashStore>"));
+	f.flush();
+}
+
+string HashManager::HashStore::getIndexFile() { return Util::getPath(Util::PATH_USER_CONFIG) + "HashIndex.bin"; }
+string HashManager::HashStore::getXmlIndexFile() { return Util::getPath(Util::PATH_USER_CONFIG) + "HashIndex.xml"; }
 string HashManager::HashStore::getDataFile() { return Util::getPath(Util::PATH_USER_CONFIG) + "HashData.dat"; }
+string HashManager::HashStore::getJournalFile() { return Util::getPath(Util::PATH_USER_CONFIG) + "HashIndex.journal"; }
+
+void HashManager::HashStore::flushDataFile() noexcept {
+	try {
+		File(getDataFile(), File::READ | File::WRITE, File::OPEN).flush();
+	} catch (const FileException&) {
+		// saveTree reports the data file being unusable
+	}
+}
 
 class HashLoader: public SimpleXMLReader::CallBack {
 public:
@@ -349,15 +948,82 @@ private:
 };
 
 void HashManager::HashStore::load(function<void (float)> progressF) {
-	try {
-		Util::migrate(getIndexFile());
+	Util::migrate(getIndexFile());
+	Util::migrate(getJournalFile());
 
-		File f(getIndexFile(), File::READ, File::OPEN);
-		CountedInputStream<false> countedStream(&f);
-		HashLoader l(*this, countedStream, f.getSize(), progressF);
-		SimpleXMLReader(&l).parse(countedStream);
-	} catch (const Exception&) {
-		// ...
+	// a save cut short between removing the old index and renaming the new one, written in full,
+	// over it.
+	auto tmpName = getIndexFile() + ".tmp";
+	if(File::getSize(getIndexFile()) == -1 && File::getSize(tmpName) != -1) {
+		try {
+			File::renameFile(tmpName, getIndexFile());
+		} catch (const FileException&) {
+			// ...
+		}
+	}
+
+	bool mapped = false;
+	if(File::getSize(getIndexFile()) != -1) {
+		try {
+			mapIndex(getIndexFile(), vector<bool>());
+			mapped = true;
+		} catch (const Exception& e) {
+			LogManager::getInstance()->message(str(F_("Error loading hash data: %1%") % e.getError()), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
+		}
+	}
+
+	if(!mapped) {
+		// one-time conversion of the XML index of older versions
+		try {
+			Util::migrate(getXmlIndexFile());
+
+			File f(getXmlIndexFile(), File::READ, File::OPEN);
+			CountedInputStream<false> countedStream(&f);
+			HashLoader l(*this, countedStream, f.getSize(), progressF);
+			SimpleXMLReader(&l).parse(countedStream);
+		} catch (const Exception&) {
+			// ...
+		}
+
+		if(!fileIndex.empty() || !treeIndex.empty()) {
+			dirty = true;
+			save();
+
+			if(!dirty) {
+				// converted; never again, even should the binary index be lost.
+				try {
+					File::renameFile(getXmlIndexFile(), getXmlIndexFile() + ".bak");
+				} catch (const FileException&) {
+					// ...
+				}
+			}
+		}
+	}
+
+	lastSave = GET_TICK();
+
+	// redo what was hashed after the index was last saved
+	try {
+		journal.reset(new HashJournal(getJournalFile()));
+		auto n = journal->replay(
+			[this](const TTHValue& root, int64_t size, int64_t index, int64_t blockSize) {
+				// also where a compaction moved a tree
+				treeIndex[root] = TreeInfo(size, index, blockSize);
+			},
+			[this](const string& fileName, const TTHValue& root, uint32_t timeStamp) {
+				setFile(fileName, root, timeStamp, false);
+			},
+			[this](const TTHValue& root) {
+				dropTree(root);
+			});
+
+		if(n > 0) {
+			dirty = true;
+			LogManager::getInstance()->message(str(F_("Recovered %1% hash database updates from the journal") % n), LogMessage::TYPE_GENERAL, LogMessage::LOG_SHARE);
+		}
+	} catch (const FileException& e) {
+		journal.reset();
+		LogManager::getInstance()->message(str(F_("Error loading hash data: %1%") % e.getError()), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
 	}
 }
 
@@ -482,7 +1148,11 @@ void HashLoader::startTag(const string& name, StringPairList& attribs, bool simp
 }
 
 HashManager::HashStore::HashStore() :
-	dirty(false) {
+	dirty(false),
+	saving(false),
+	lastSave(0),
+	compactEnd(0),
+	compactNewEnd(0) {
 
 	Util::migrate(getDataFile());
 
@@ -520,172 +1190,329 @@ void HashManager::HashStore::createDataFile(const string& name) {
 }
 
 void HashManager::Hasher::hashFile(const string& fileName, int64_t size) noexcept {
+	// files come a directory at a time; look the device up once for each.
+	auto dir = Util::getFilePath(fileName);
+	optional<string> deviceId;
+	{
+		Lock l(cs);
+		auto i = deviceIds.find(dir);
+		if(i != deviceIds.end()) {
+			deviceId = i->second;
+		}
+	}
+
+	if(!deviceId) {
+		deviceId = File::getDeviceId(dir);
+
+		Lock l(cs);
+		if(deviceIds.size() >= DEVICE_CACHE_SIZE) {
+			deviceIds.clear();
+		}
+		deviceIds.emplace(dir, *deviceId);
+	}
+
 	Lock l(cs);
-	if(w.insert(make_pair(fileName, size)).second) {
-		if(paused > 0)
-			paused++;
-		else
-			s.signal();
+	auto& device = devices[*deviceId];
+	if(!device) {
+		device.reset(new Device);
+		if(started && !stop)
+			startWorkers(*device);
+	}
+	if(device->w.insert(make_pair(fileName, size)).second) {
+		device->s.signal();
+	}
+}
+
+void HashManager::Hasher::startWorkers(Device& device) {
+	auto count = static_cast<size_t>(max(SETTING(HASH_THREADS_PER_DEVICE), 1));
+	for(size_t i = 0; i < count; ++i) {
+		device.workers.push_back(unique_ptr<Worker>(new Worker(*this, device)));
+		try {
+			device.workers.back()->start();
+		} catch(const ThreadException&) {
+			// make do with the threads we have, if any.
+			device.workers.pop_back();
+			break;
+		}
 	}
 }
 
 bool HashManager::Hasher::pause() noexcept {
 	Lock l(cs);
-	return paused++;
+	auto wasPaused = paused;
+	paused = true;
+	return wasPaused;
 }
 
 void HashManager::Hasher::resume() noexcept {
 	Lock l(cs);
-	while(--paused > 0)
-		s.signal();
+	paused = false;
+	for(; waiting > 0; --waiting)
+		resumed.signal();
 }
 
 bool HashManager::Hasher::isPaused() const noexcept {
 	Lock l(cs);
-	return paused > 0;
+	return paused;
 }
 
 void HashManager::Hasher::stopHashing(const string& baseDir) {
 	Lock l(cs);
-	for(auto i = w.begin(); i != w.end();) {
-		if(strncmp(baseDir.c_str(), i->first.c_str(), baseDir.size()) == 0) {
-			w.erase(i++);
-		} else {
-			++i;
+	for(auto& device: devices) {
+		auto& w = device.second->w;
+		for(auto i = w.begin(); i != w.end();) {
+			if(strncmp(baseDir.c_str(), i->first.c_str(), baseDir.size()) == 0) {
+				w.erase(i++);
+			} else {
+				++i;
+			}
 		}
 	}
 }
 
 void HashManager::Hasher::getStats(string& curFile, uint64_t& bytesLeft, size_t& filesLeft) const {
 	Lock l(cs);
-	curFile = currentFile;
-	filesLeft = w.size();
-	if (running)
-		filesLeft++;
+	curFile.clear();
+	filesLeft = 0;
 	bytesLeft = 0;
-	for (auto& i: w) {
-		bytesLeft += i.second;
+	for(auto& i: devices) {
+		auto& device = *i.second;
+		filesLeft += device.w.size();
+		for(auto& j: device.w) {
+			bytesLeft += j.second;
+		}
+		for(auto& worker: device.workers) {
+			if(worker->running) {
+				filesLeft++;
+				bytesLeft += worker->currentSize;
+				if(curFile.empty())
+					curFile = worker->currentFile;
+			}
+		}
+	}
+}
+
+void HashManager::Hasher::setPriority(Thread::Priority p) noexcept {
+	Lock l(cs);
+	priority = p;
+	for(auto& device: devices) {
+		for(auto& worker: device.second->workers) {
+			worker->setThreadPriority(p);
+		}
+	}
+	if(pool) {
+		pool->setPriority(p);
 	}
-	bytesLeft += currentSize;
 }
 
-void HashManager::Hasher::instantPause() {
-	bool wait = false;
+void HashManager::Hasher::startup() {
 	{
 		Lock l(cs);
-		if(paused > 0) {
-			paused++;
-			wait = true;
+		auto threads = std::thread::hardware_concurrency();
+		if(threads > 1) {
+			pool.reset(new ParallelTigerTree::Pool(threads, priority));
+		}
+
+		started = true;
+		for(auto& device: devices) {
+			startWorkers(*device.second);
+		}
+	}
+	start();
+}
+
+void HashManager::Hasher::shutdown() {
+	Lock l(cs);
+	stop = true;
+	for(; waiting > 0; --waiting)
+		resumed.signal();
+	for(auto& device: devices) {
+		for(size_t i = 0, n = device.second->workers.size(); i < n; ++i)
+			device.second->s.signal();
+	}
+	s.signal();
+}
+
+void HashManager::Hasher::joinAll() {
+	join();
+
+	// devices are never removed, so the workers outlive the lock.
+	vector<Worker*> workers;
+	{
+		Lock l(cs);
+		for(auto& device: devices) {
+			for(auto& worker: device.second->workers) {
+				workers.push_back(worker.get());
+			}
+		}
+	}
+	for(auto worker: workers) {
+		worker->join();
+	}
+
+	Lock l(cs);
+	pool.reset();
+}
+
+void HashManager::Hasher::waitWhilePaused() {
+	for(;;) {
+		{
+			Lock l(cs);
+			if(!paused || stop)
+				return;
+			++waiting;
 		}
+		resumed.wait();
 	}
-	if(wait)
-		s.wait();
 }
 
 int HashManager::Hasher::run() {
 	setThreadPriority(Thread::IDLE);
 
-	string fname;
-
+	bool compacting = false;
 	for(;;) {
-		s.wait();
+		if(!s.wait(compacting ? COMPACT_STEP_DELAY : COMPACT_CHECK_DELAY)) {
+			if(!stop && !isPaused()) {
+				compacting = HashManager::getInstance()->compactStep();
+			}
+			continue;
+		}
 		if(stop)
 			break;
 		if(rebuild) {
 			HashManager::getInstance()->doRebuild();
 			rebuild = false;
 			LogManager::getInstance()->message(_("Hash database rebuilt"), LogMessage::TYPE_GENERAL, LogMessage::LOG_SHARE);
-			continue;
 		}
-		{
-			Lock l(cs);
-			if(!w.empty()) {
-				currentFile = fname = w.begin()->first;
-				currentSize = w.begin()->second;
-				w.erase(w.begin());
-			} else {
-				fname.clear();
-			}
+		if(checkpoint) {
+			checkpoint = false;
+			HashManager::getInstance()->checkpoint();
 		}
-		running = true;
+	}
+	return 0;
+}
 
-		if(!fname.empty()) {
-			try {
-				auto start = GET_TICK();
+int HashManager::Hasher::Worker::run() {
+	{
+		Lock l(hasher.cs);
+		setThreadPriority(hasher.priority);
+	}
 
-				File f(fname, File::READ, File::OPEN);
-				auto size = f.getSize();
-				auto timestamp = f.getLastModified();
+	string fname;
 
-				auto sizeLeft = size;
-				auto bs = max(TigerTree::calcBlockSize(size, 10), MIN_BLOCK_SIZE);
+	for(;;) {
+		device.s.wait();
+		hasher.waitWhilePaused();
+		if(hasher.stop)
+			break;
+		{
+			Lock l(hasher.cs);
+			if(device.w.empty()) {
+				// emptied by stopHashing
+				continue;
+			}
+			if(hasher.paused) {
+				// paused since waitWhilePaused; the file may not be shared yet, leave it for later.
+				device.s.signal();
+				continue;
+			}
+			currentFile = fname = device.w.begin()->first;
+			currentSize = device.w.begin()->second;
+			device.w.erase(device.w.begin());
+			running = true;
+			++hasher.busy;
+		}
 
-				TigerTree tt(bs);
+		hash(fname);
 
-				CRC32Filter crc32;
-				SFVReader sfv(fname);
-				CRC32Filter* xcrc32 = 0;
-				if(sfv.hasCRC())
-					xcrc32 = &crc32;
+		{
+			Lock l(hasher.cs);
+			currentFile.clear();
+			currentSize = 0;
+			running = false;
+			--hasher.busy;
+		}
+	}
+	return 0;
+}
+
+void HashManager::Hasher::Worker::hash(const string& fname) {
+	try {
+		auto start = GET_TICK();
 
-				auto lastRead = GET_TICK();
+		File f(fname, File::READ, File::OPEN);
+		auto size = f.getSize();
+		auto timestamp = f.getLastModified();
 
-				FileReader fr(true);
+		auto sizeLeft = size;
+		auto bs = max(TigerTree::calcBlockSize(size, 10), MIN_BLOCK_SIZE);
 
-				fr.read(fname, [&](const void* buf, size_t n) -> bool {
-					if(SETTING(MAX_HASH_SPEED)> 0) {
-						uint64_t now = GET_TICK();
-						uint64_t minTime = n * 1000LL / (SETTING(MAX_HASH_SPEED) * 1024LL * 1024LL);
-						if(lastRead + minTime> now) {
-							Thread::sleep(minTime - (now - lastRead));
-						}
-						lastRead = lastRead + minTime;
-					} else {
-						lastRead = GET_TICK();
-					}
+		TigerTree tt(bs);
+		// big files are worth spreading over the cores; the tree comes out the same.
+		ParallelTigerTree ptt(tt, size >= PARALLEL_HASH_SIZE ? hasher.pool.get() : nullptr);
 
-					tt.update(buf, n);
-					if(xcrc32)
-						(*xcrc32)(buf, n);
+		CRC32Filter crc32;
+		SFVReader sfv(fname);
+		CRC32Filter* xcrc32 = 0;
+		if(sfv.hasCRC())
+			xcrc32 = &crc32;
 
-					{
-						Lock l(cs);
-						currentSize = max(static_cast<uint64_t>(currentSize - n), static_cast<uint64_t>(0));
-					}
-					sizeLeft -= n;
+		auto lastRead = GET_TICK();
 
-					instantPause();
-					return !stop;
-				});
+		FileReader fr(true);
 
-				f.close();
-				tt.finalize();
-				uint64_t end = GET_TICK();
-				int64_t speed = 0;
-				if(end > start) {
-					speed = size * 1000 / (end - start);
+		fr.read(fname, [&](const void* buf, size_t n) -> bool {
+			if(SETTING(MAX_HASH_SPEED)> 0) {
+				uint64_t now = GET_TICK();
+				// the limit applies to all workers together; split it among the busy ones.
+				uint64_t busy;
+				{
+					Lock l(hasher.cs);
+					busy = max(hasher.busy, static_cast<size_t>(1));
 				}
-
-				if(xcrc32 && xcrc32->getValue() != sfv.getCRC()) {
-					LogManager::getInstance()->message(str(F_("%1% not shared; calculated CRC32 does not match the one found in SFV file.") % Util::addBrackets(fname)),
-																LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
-				} else if(sizeLeft != 0) {
-					LogManager::getInstance()->message(str(F_("%1% not shared; hashing did not complete.") % Util::addBrackets(fname)), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
-				} else {
-					HashManager::getInstance()->hashDone(fname, timestamp, tt, speed, size);
+				uint64_t minTime = n * 1000LL * busy / (SETTING(MAX_HASH_SPEED) * 1024LL * 1024LL);
+				if(lastRead + minTime> now) {
+					Thread::sleep(minTime - (now - lastRead));
 				}
-			} catch(const FileException& e) {
-				LogManager::getInstance()->message(str(F_("Error hashing %1%: %2%") % Util::addBrackets(fname) % e.getError()), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
+				lastRead = lastRead + minTime;
+			} else {
+				lastRead = GET_TICK();
+			}
+
+			ptt.update(buf, n);
+			if(xcrc32)
+				(*xcrc32)(buf, n);
+
+			{
+				Lock l(hasher.cs);
+				currentSize = max(static_cast<uint64_t>(currentSize - n), static_cast<uint64_t>(0));
 			}
+			sizeLeft -= n;
+
+			hasher.waitWhilePaused();
+			return !hasher.stop;
+		});
+
+		f.close();
+		ptt.flush();
+		tt.finalize();
+		uint64_t end = GET_TICK();
+		int64_t speed = 0;
+		if(end > start) {
+			speed = size * 1000 / (end - start);
 		}
-		{
-			Lock l(cs);
-			currentFile.clear();
-			currentSize = 0;
+
+		if(xcrc32 && xcrc32->getValue() != sfv.getCRC()) {
+			LogManager::getInstance()->message(str(F_("%1% not shared; calculated CRC32 does not match the one found in SFV file.") % Util::addBrackets(fname)),
+														LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
+		} else if(sizeLeft != 0) {
+			LogManager::getInstance()->message(str(F_("%1% not shared; hashing did not complete.") % Util::addBrackets(fname)), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
+		} else {
+			HashManager::getInstance()->hashDone(fname, timestamp, tt, speed, size);
 		}
-		running = false;
+	} catch(const FileException& e) {
+		LogManager::getInstance()->message(str(F_("Error hashing %1%: %2%") % Util::addBrackets(fname) % e.getError()), LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
 	}
-	return 0;
 }
 
 HashManager::HashPauser::HashPauser() {
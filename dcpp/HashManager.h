@@ -18,8 +18,10 @@
 #ifndef DCPLUSPLUS_DCPP_HASH_MANAGER_H
 #define DCPLUSPLUS_DCPP_HASH_MANAGER_H
 
+#include <deque>
 #include <functional>
 #include <map>
+#include <memory>
 
 #include <boost/optional.hpp>
 
@@ -31,16 +33,19 @@
 #include "TimerManager.h"
 #include "HashManagerListener.h"
 #include "GetSet.h"
+#include "HashIndex.h"
+#include "HashJournal.h"
+#include "ParallelTigerTree.h"
 
 namespace dcpp {
 
+using std::deque;
 using std::function;
 using std::map;
+using std::unique_ptr;
 
 using boost::optional;
 
-STANDARD_EXCEPTION(HashException);
-
 class HashLoader;
 
 class HashManager : public Singleton<HashManager>, public Speaker<HashManagerListener>,
@@ -50,20 +55,22 @@ public:
 
 	/** We don't keep leaves for blocks smaller than this... */
 	static const int64_t MIN_BLOCK_SIZE;
+	/** Files from this size on are hashed by several threads */
+	static const int64_t PARALLEL_HASH_SIZE;
 
 	HashManager() {
 		TimerManager::getInstance()->addListener(this);
 	}
 	virtual ~HashManager() {
 		TimerManager::getInstance()->removeListener(this);
-		hasher.join();
+		hasher.joinAll();
 	}
 
 	/** Get the TTH root associated with the filename if its tree is current. */
 	optional<TTHValue> getTTH(const string& aFileName, int64_t aSize, uint32_t aTimeStamp) noexcept;
 
 	void stopHashing(const string& baseDir) { hasher.stopHashing(baseDir); }
-	void setPriority(Thread::Priority p) { hasher.setThreadPriority(p); }
+	void setPriority(Thread::Priority p) { hasher.setPriority(p); }
 
 	bool getTree(const TTHValue& root, TigerTree& tt);
 
@@ -72,20 +79,34 @@ public:
 
 	void addTree(const TigerTree& tree) { Lock l(cs); store.addTree(tree); }
 
+	/** Write the hash index in the XML format of older versions. @throw FileException */
+	void exportIndex(const string& aFileName) { Lock l(cs); store.exportXml(aFileName); }
+
 	void getStats(string& curFile, uint64_t& bytesLeft, size_t& filesLeft) const {
 		hasher.getStats(curFile, bytesLeft, filesLeft);
 	}
 
+	struct StoreStats {
+		size_t trees;
+		size_t files;
+		int64_t dataSize; /// bytes of HashData.dat up to its next write position
+		int64_t liveSize; /// bytes taken by the trees of the index
+		double fragmentation; /// proportion of dataSize that holds no live tree
+		bool compacting;
+	};
+	/** Count the contents of the hash store; walks the whole index. */
+	StoreStats getStoreStats() const { Lock l(cs); return store.getStats(); }
+
 	/**
 	 * Rebuild hash data file
 	 */
 	void rebuild() { hasher.scheduleRebuild(); }
 
-	void startup(function<void (float)> progressF) { hasher.start(); store.load(progressF); }
+	void startup(function<void (float)> progressF) { hasher.startup(); Lock l(cs); store.load(progressF); }
 
 	void shutdown() {
 		hasher.shutdown();
-		hasher.join();
+		hasher.joinAll();
 		Lock l(cs);
 		store.save();
 	}
@@ -104,9 +125,14 @@ public:
 	bool isHashingPaused() const noexcept;
 
 private:
+	/** Hashes queued files with one pool of workers per device (as told by File::getDeviceId), so
+	that disks are read in parallel while each disk only serves HASH_THREADS_PER_DEVICE files at
+	once. The Hasher thread itself only takes care of database rebuilds, of saving the index when
+	the journal has grown, and of compacting the hash data file a little at a time while it's
+	idle. */
 	class Hasher : public Thread {
 	public:
-		Hasher() : stop(false), running(false), paused(0), rebuild(false), currentSize(0) { }
+		Hasher() : stop(false), paused(false), rebuild(false), checkpoint(false), started(false), waiting(0), busy(0), priority(Thread::IDLE) { }
 
 		void hashFile(const string& fileName, int64_t size) noexcept;
 
@@ -117,26 +143,69 @@ private:
 
 		void stopHashing(const string& baseDir);
 		virtual int run();
-		bool fastHash(const string& fname, uint8_t* buf, TigerTree& tth, int64_t size, CRC32Filter* xcrc32);
 		void getStats(string& curFile, uint64_t& bytesLeft, size_t& filesLeft) const;
-		void shutdown() { stop = true; if(paused) s.signal(); s.signal(); }
-		void scheduleRebuild() { rebuild = true; if(paused) s.signal(); s.signal(); }
+		void setPriority(Thread::Priority p) noexcept;
+		void startup();
+		void shutdown();
+		void joinAll();
+		void scheduleRebuild() { rebuild = true; s.signal(); }
+		void scheduleCheckpoint() { checkpoint = true; s.signal(); }
 
 	private:
-		// Case-sensitive (faster), it is rather unlikely that case changes, and if it does it's harmless.
-		// map because it's sorted (to avoid random hash order that would create quite strange shares while hashing)
-		map<string, int64_t> w;
+		struct Device;
+
+		class Worker : public Thread {
+		public:
+			Worker(Hasher& hasher, Device& device) : running(false), currentSize(0), hasher(hasher), device(device) { }
+			virtual int run();
+
+			// protected by Hasher::cs
+			bool running;
+			string currentFile;
+			int64_t currentSize;
+
+		private:
+			void hash(const string& fname);
+
+			Hasher& hasher;
+			Device& device;
+		};
+
+		struct Device {
+			// Case-sensitive (faster), it is rather unlikely that case changes, and if it does it's harmless.
+			// map because it's sorted (to avoid random hash order that would create quite strange shares while hashing)
+			map<string, int64_t> w;
+			/** Signaled once per queued file and once per worker on shutdown. */
+			Semaphore s;
+			vector<unique_ptr<Worker>> workers;
+		};
+
+		void startWorkers(Device& device);
+		/** Block the calling worker while hashing is paused. */
+		void waitWhilePaused();
+
+		/** Device id -> pending files and the workers hashing them. */
+		map<string, unique_ptr<Device>> devices;
+		/** Directory -> id of its device, for hashFile. */
+		unordered_map<string, string> deviceIds;
 		mutable CriticalSection cs;
+		/** Wakes the Hasher thread for rebuilds and shutdown. */
 		Semaphore s;
+		/** Wakes workers waiting in waitWhilePaused. */
+		Semaphore resumed;
 
 		bool stop;
-		bool running;
-		unsigned paused;
+		bool paused;
 		bool rebuild;
-		string currentFile;
-		int64_t currentSize;
-
-		void instantPause();
+		bool checkpoint;
+		bool started;
+		unsigned waiting;
+		/** Workers currently hashing a file. */
+		size_t busy;
+		Thread::Priority priority;
+		/** Threads hashing the chunks of big files, shared by all workers; one per core. Set up
+		before the workers start. */
+		unique_ptr<ParallelTigerTree::Pool> pool;
 	};
 
 	friend class Hasher;
@@ -147,7 +216,26 @@ private:
 		void addFile(const string& aFileName, uint32_t aTimeStamp, const TigerTree& tth, bool aUsed);
 
 		void load(function<void (float)> progressF);
+		/** Write the whole index, which empties the journal. */
 		void save();
+		/** Sync in steps, the waits for the disk left out of the lock: take the mark with the lock
+		held, flushDataFile without it, writeJournal with it, then flushJournal without it.
+		@return the mark to pass to writeJournal; 0 if there is nothing to sync */
+		uint64_t getSyncMark() const;
+		/** Write the journal records added before the mark; the data file must have been flushed
+		since the mark was taken, as they point into it. */
+		void writeJournal(uint64_t mark) noexcept;
+		void flushJournal() noexcept;
+		static void flushDataFile() noexcept;
+
+		/** Save in steps, so that the index is written without the lock: once the journal has
+		grown large or old enough, startCheckpoint fills w with the lock held, writeIndex writes it
+		without the lock, and endCheckpoint puts it in place with the lock, along with the changes
+		made meanwhile. The journal is then to be flushed.
+		@return whether to go on with the other steps */
+		bool startCheckpoint(uint64_t aTick, HashIndex::Writer& w, vector<bool>& used);
+		static bool writeIndex(const HashIndex::Writer& w) noexcept;
+		void endCheckpoint(bool written, vector<bool>&& used) noexcept;
 
 		void rebuild();
 
@@ -157,6 +245,15 @@ private:
 		bool getTree(const TTHValue& root, TigerTree& tth);
 		int64_t getBlockSize(const TTHValue& root) const;
 		bool isDirty() { return dirty; }
+
+		/** @throw FileException */
+		void exportXml(const string& aFileName) const;
+
+		/** Move a few trees from the end of the data file into the holes left by dropped trees,
+		starting a new compaction when the file has become fragmented enough.
+		@return whether the compaction goes on */
+		bool compactStep() noexcept;
+		StoreStats getStats() const;
 	private:
 		/** Root -> tree mapping info, we assume there's only one tree for each root (a collision would mean we've broken tiger...) */
 		struct TreeInfo {
@@ -184,18 +281,78 @@ private:
 
 		friend class HashLoader;
 
+		/** The index as of the last save, queried where it is mapped. fileIndex and treeIndex only
+		hold what changed since; files that were replaced or have gone stale are marked in
+		baseRemoved. */
+		unique_ptr<HashIndex> base;
+		vector<bool> baseRemoved;
+		vector<bool> baseUsed;
+		vector<bool> baseTreeRemoved;
+
 		unordered_map<string, vector<FileInfo>> fileIndex;
 		unordered_map<TTHValue, TreeInfo> treeIndex;
 
 		bool dirty;
 
+		/** Set between startCheckpoint and endCheckpoint; changes made meanwhile are kept in redo to
+		be made again once the index being written replaces the maps. */
+		bool saving;
+		vector<function<void ()>> redo;
+
+		/** Changes since the index was saved; null if it can't be written, the index is then saved
+		every minute as it used to be. */
+		unique_ptr<HashJournal> journal;
+		uint64_t lastSave;
+
+		/** Roots that files stopped pointing to; their trees are dropped when a compaction starts,
+		unless another file still uses them. */
+		unordered_set<TTHValue> superseded;
+
+		/** Copy of a tree to make by the running compaction */
+		struct Move {
+			TTHValue root;
+			int64_t from;
+			int64_t to;
+		};
+		deque<Move> moves;
+		/** End of the data when the compaction started, 0 when none is running; the file is only
+		shortened if nothing was added since. */
+		int64_t compactEnd;
+		int64_t compactNewEnd;
+
+		void prepareIndex(HashIndex::Writer& w, vector<bool>& used) const;
+		/** Map the index written by writeIndex in place of the current one, and empty the journal. */
+		bool commitIndex(vector<bool>&& used) noexcept;
+
+		bool planCompaction();
+		void finishCompaction(File& dataFile);
+		/** @return the bytes of the trees dropped */
+		int64_t dropSuperseded();
+		void dropTree(const TTHValue& root);
+		static int64_t getTreeBytes(const TreeInfo& ti);
+		static int64_t getDataEnd(File& dataFile);
+
+		void setFile(const string& aFileName, const TTHValue& root, uint32_t aTimeStamp, bool aUsed);
+		optional<TreeInfo> findTree(const TTHValue& root) const;
+		uint32_t findBaseFile(const string& fpath, const string& fname) const;
+		/** Move the contents of the mapped index into the maps, to edit them wholesale. */
+		void unmapIndex();
+		/** Map the saved index and forget what the maps held. */
+		void mapIndex(const string& aFileName, vector<bool>&& used);
+		/** Call f(dir, name, root, timeStamp, used) for each file of the store. */
+		template<typename F> void forEachFile(F f) const;
+		/** Call f(root, treeInfo) for each tree of the store. */
+		template<typename F> void forEachTree(F f) const;
+
 		void createDataFile(const string& name);
 
 		bool loadTree(File& dataFile, const TreeInfo& ti, const TTHValue& root, TigerTree& tt);
 		int64_t saveTree(File& dataFile, const TigerTree& tt);
 
 		static string getIndexFile();
+		static string getXmlIndexFile();
 		static string getDataFile();
+		static string getJournalFile();
 	};
 
 	friend class HashLoader;
@@ -204,6 +361,8 @@ private:
 	HashStore store;
 
 	mutable CriticalSection cs;
+	/** Held by sync throughout, without cs while waiting for the disk. */
+	CriticalSection syncCs;
 
 	/** Single node tree where node = root, no storage in HashData.dat */
 	static const int64_t SMALL_TREE = -1;
@@ -215,9 +374,28 @@ private:
 		store.rebuild();
 	}
 
+	bool compactStep() {
+		bool ret;
+		{
+			Lock l(cs);
+			ret = store.compactStep();
+		}
+		sync();
+		return ret;
+	}
+
+	/** Sync the hash store without holding cs while waiting for the disk. */
+	void sync() noexcept;
+	/** Save the index once the journal has grown large or old enough, without holding cs while
+	writing it. Run by the Hasher thread, so that it never overlaps a rebuild or a compaction. */
+	void checkpoint() noexcept;
+
+	virtual void on(TimerManagerListener::Second, uint64_t) noexcept {
+		sync();
+	}
+
 	virtual void on(TimerManagerListener::Minute, uint64_t) noexcept {
-		Lock l(cs);
-		store.save();
+		hasher.scheduleCheckpoint();
 	}
 };
 
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_LATENCY_HISTOGRAM_H
+#define DCPLUSPLUS_DCPP_LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace dcpp {
+
+/** Distribution of durations in power-of-2 buckets of microseconds; thread-safe and lock-free.
+Percentiles are only as precise as the buckets: within a factor of 2. */
+class LatencyHistogram {
+public:
+	/** Bucket i counts durations in [2^i, 2^(i+1)) microseconds; bucket 0 also counts those below
+	1 microsecond, and the last one everything above. */
+	enum { BUCKETS = 32 };
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct Summary {
+		uint64_t count;
+		uint64_t p50; /// microseconds; upper bound of the bucket holding the median
+		uint64_t p99;
+		uint64_t buckets[BUCKETS];
+	};
+
+	LatencyHistogram() {
+		for(auto& b: buckets) {
+			b = 0;
+		}
+	}
+
+	void add(uint64_t micros) {
+		size_t i = 0;
+		for(; i < BUCKETS - 1 && micros >= (uint64_t(2) << i); ++i)
+			;	// Empty
+		++buckets[i];
+	}
+
+	/** Add the time elapsed since the given point. */
+	void add(Clock::time_point start) {
+		add(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+	}
+
+	Summary getSummary() const {
+		Summary ret = { 0, 0, 0, { } };
+		for(size_t i = 0; i < BUCKETS; ++i) {
+			ret.buckets[i] = buckets[i];
+			ret.count += ret.buckets[i];
+		}
+		ret.p50 = getPercentile(ret, 50);
+		ret.p99 = getPercentile(ret, 99);
+		return ret;
+	}
+
+	static uint64_t getUpperBound(size_t bucket) { return uint64_t(2) << bucket; }
+
+private:
+	static uint64_t getPercentile(const Summary& s, uint64_t percent) {
+		if(s.count == 0) {
+			return 0;
+		}
+		// the rank of the sample, rounded up.
+		auto rank = (s.count * percent + 99) / 100;
+		uint64_t seen = 0;
+		for(size_t i = 0; i < BUCKETS; ++i) {
+			seen += s.buckets[i];
+			if(seen >= rank) {
+				return getUpperBound(i);
+			}
+		}
+		return getUpperBound(BUCKETS - 1);
+	}
+
+	std::atomic<uint64_t> buckets[BUCKETS];
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_LATENCY_HISTOGRAM_H)
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stdinc.h"
+#include "MappedFile.h"
+
+#include "Streams.h"
+#include "Text.h"
+#include "Util.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace dcpp {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const string& aFileName, Access access) : data(nullptr), size(0), h(INVALID_HANDLE_VALUE), mapping(nullptr) {
+	h = ::CreateFile(Text::toT(aFileName).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+		access == RANDOM ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(h == INVALID_HANDLE_VALUE) {
+		throw FileException(Util::translateError(GetLastError()));
+	}
+
+	LARGE_INTEGER x;
+	if(!::GetFileSizeEx(h, &x)) {
+		auto err = GetLastError();
+		close();
+		throw FileException(Util::translateError(err));
+	}
+
+	size = static_cast<size_t>(x.QuadPart);
+	if(size == 0) {
+		// empty files can't be mapped
+		return;
+	}
+
+	mapping = ::CreateFileMapping(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(mapping) {
+		data = reinterpret_cast<const uint8_t*>(::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	}
+
+	if(!data) {
+		auto err = GetLastError();
+		close();
+		throw FileException(Util::translateError(err));
+	}
+}
+
+void MappedFile::close() noexcept {
+	if(data) {
+		::UnmapViewOfFile(data);
+		data = nullptr;
+	}
+	if(mapping) {
+		::CloseHandle(mapping);
+		mapping = nullptr;
+	}
+	if(h != INVALID_HANDLE_VALUE) {
+		::CloseHandle(h);
+		h = INVALID_HANDLE_VALUE;
+	}
+	size = 0;
+}
+
+#else // !_WIN32
+
+MappedFile::MappedFile(const string& aFileName, Access access) : data(nullptr), size(0), h(-1) {
+	h = ::open(Text::fromUtf8(aFileName).c_str(), O_RDONLY);
+	if(h == -1) {
+		throw FileException(Util::translateError(errno));
+	}
+
+	struct stat s;
+	if(::fstat(h, &s) == -1) {
+		auto err = errno;
+		close();
+		throw FileException(Util::translateError(err));
+	}
+
+	size = static_cast<size_t>(s.st_size);
+	if(size == 0) {
+		// empty files can't be mapped
+		return;
+	}
+
+	auto p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, h, 0);
+	if(p == MAP_FAILED) {
+		auto err = errno;
+		close();
+		throw FileException(Util::translateError(err));
+	}
+
+	data = reinterpret_cast<const uint8_t*>(p);
+	::madvise(p, size, access == RANDOM ? MADV_RANDOM : MADV_SEQUENTIAL);
+}
+
+void MappedFile::close() noexcept {
+	if(data) {
+		::munmap(const_cast<uint8_t*>(data), size);
+		data = nullptr;
+	}
+	if(h != -1) {
+		::close(h);
+		h = -1;
+	}
+	size = 0;
+}
+
+#endif // !_WIN32
+
+} // namespace dcpp
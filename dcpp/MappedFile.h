@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_MAPPED_FILE_H
+#define DCPLUSPLUS_DCPP_MAPPED_FILE_H
+
+#include <boost/core/noncopyable.hpp>
+
+#include "typedefs.h"
+
+#ifdef _WIN32
+#include "w.h"
+#endif
+
+namespace dcpp {
+
+/** Read-only view of a whole file mapped into memory. Throws FileException when the file can't
+be opened or mapped. */
+class MappedFile : boost::noncopyable {
+public:
+	/** How the mapping is read, for the read-ahead of the system. */
+	enum Access {
+		SEQUENTIAL, /// through once, from start to end
+		RANDOM /// here and there, as lookups go
+	};
+
+	MappedFile(const string& aFileName, Access access);
+	~MappedFile() { close(); }
+
+	const uint8_t* getData() const { return data; }
+	size_t getSize() const { return size; }
+
+private:
+	void close() noexcept;
+
+	const uint8_t* data;
+	size_t size;
+
+#ifdef _WIN32
+	HANDLE h;
+	HANDLE mapping;
+#else
+	int h;
+#endif
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_MAPPED_FILE_H)
@@ -97,26 +97,42 @@ public:
 	 */
 	void update(const void* data, size_t len) {
 		uint8_t* buf = (uint8_t*)data;
-		uint8_t zero = 0;
 		size_t i = 0;
 
 		// Skip empty data sets if we already added at least one of them...
 		if(len == 0 && !(leaves.empty() && blocks.empty()))
 			return;
 
-		do {
-			size_t n = min(baseBlockSize, len-i);
+		// Whole blocks are independent, so hash a batch of them at once
+		uint8_t hashes[LEAF_BATCH * BYTES];
+		while(len - i >= baseBlockSize) {
+			size_t n = min((len - i) / baseBlockSize, LEAF_BATCH);
+			Hasher::hashMany(0, buf + i, baseBlockSize, n, hashes);
+			for(size_t j = 0; j < n; ++j)
+				addBlock(MerkleValue(hashes + j * BYTES), baseBlockSize);
+			i += n * baseBlockSize;
+		}
+
+		// ...and the last, partial one (or the empty one of a 0-length file) on its own
+		if(i < len || len == 0) {
+			uint8_t zero = 0;
 			Hasher h;
 			h.update(&zero, 1);
-			h.update(buf + i, n);
-			if((int64_t)baseBlockSize < blockSize) {
-				blocks.push_back(make_pair(MerkleValue(h.finalize()), baseBlockSize));
-				reduceBlocks();
-			} else {
-				leaves.emplace_back(h.finalize());
-			}
-			i += n;
-		} while(i < len);
+			h.update(buf + i, len - i);
+			addBlock(MerkleValue(h.finalize()), baseBlockSize);
+		}
+		fileSize += len;
+	}
+
+	/**
+	 * Add the root of a subtree hashed separately (see ParallelTigerTree), as if its data had
+	 * been passed to update.
+	 * @param len Length of the data under it; a power of two multiple of baseBlockSize, at most
+	 *            the block size, and the data added so far must be a multiple of it.
+	 */
+	void addSubtree(const MerkleValue& hash, int64_t len) {
+		dcassert(len <= blockSize && fileSize % len == 0);
+		addBlock(hash, len);
 		fileSize += len;
 	}
 
@@ -171,6 +187,9 @@ private:
 	typedef pair<MerkleValue, int64_t> MerkleBlock;
 	typedef vector<MerkleBlock> MBList;
 
+	/** How many base blocks update gives the hasher at a time */
+	static const size_t LEAF_BATCH = 64;
+
 	MBList blocks;
 
 	MerkleList leaves;
@@ -203,6 +222,15 @@ private:
 		return MerkleValue(h.finalize());
 	}
 
+	void addBlock(const MerkleValue& hash, int64_t len) {
+		if(len < blockSize) {
+			blocks.push_back(make_pair(hash, len));
+			reduceBlocks();
+		} else {
+			leaves.push_back(hash);
+		}
+	}
+
 	void reduceBlocks() {
 		while(blocks.size() > 1) {
 			MerkleBlock& a = blocks[blocks.size()-2];
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stdinc.h"
+#include "MultiStringSearch.h"
+
+#include <deque>
+
+namespace dcpp {
+
+using std::deque;
+
+MultiStringSearch::MultiStringSearch(const StringList& aPatterns) {
+	for(auto& i: aPatterns) {
+		patterns.push_back(Text::toLower(i));
+	}
+	build();
+}
+
+MultiStringSearch::MultiStringSearch(const StringSearch::List& aPatterns) {
+	for(auto& i: aPatterns) {
+		patterns.push_back(i.getPattern());
+	}
+	build();
+}
+
+bool MultiStringSearch::matchAnyLower(const string& aLower) const noexcept {
+	if(output[0]) {
+		return true;
+	}
+
+	uint32_t state = 0;
+	for(auto c: aLower) {
+		state = delta[state * classCount + classes[static_cast<uint8_t>(c)]];
+		if(output[state]) {
+			return true;
+		}
+	}
+
+	for(auto& i: overflow) {
+		if(i.matchLower(aLower)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void MultiStringSearch::build() {
+	auto n = std::min(patterns.size(), static_cast<size_t>(MAX_PATTERNS));
+	all = n == 64 ? ~Mask(0) : (Mask(1) << n) - 1;
+
+	for(auto i = patterns.begin() + n; i != patterns.end(); ++i) {
+		overflow.emplace_back(*i);
+	}
+
+	// only the bytes used by the patterns need their own column.
+	memset(classes, 0, sizeof(classes));
+	classCount = 1;
+	for(size_t i = 0; i < n; ++i) {
+		for(auto c: patterns[i]) {
+			auto& cls = classes[static_cast<uint8_t>(c)];
+			if(!cls) {
+				cls = classCount++;
+			}
+		}
+	}
+
+	// build the trie; 0 is the root, and also marks missing edges since no edge leads back to it.
+	delta.assign(classCount, 0);
+	output.assign(1, 0);
+	for(size_t i = 0; i < n; ++i) {
+		uint32_t state = 0;
+		for(auto c: patterns[i]) {
+			auto& next = delta[state * classCount + classes[static_cast<uint8_t>(c)]];
+			if(!next) {
+				next = output.size();
+				output.push_back(0);
+				delta.resize(delta.size() + classCount, 0);
+			}
+			// delta may have been reallocated.
+			state = delta[state * classCount + classes[static_cast<uint8_t>(c)]];
+		}
+		output[state] |= Mask(1) << i;
+	}
+
+	// turn the trie into a full automaton, breadth-first so that the suffix link of a state is
+	// complete before the state itself is.
+	vector<uint32_t> fail(output.size(), 0);
+	deque<uint32_t> queue;
+	for(size_t c = 0; c < classCount; ++c) {
+		if(delta[c]) {
+			queue.push_back(delta[c]);
+		}
+	}
+
+	while(!queue.empty()) {
+		auto state = queue.front();
+		queue.pop_front();
+		output[state] |= output[fail[state]];
+
+		for(size_t c = 0; c < classCount; ++c) {
+			auto& next = delta[state * classCount + c];
+			auto fallback = delta[fail[state] * classCount + c];
+			if(next) {
+				fail[next] = fallback;
+				queue.push_back(next);
+			} else {
+				next = fallback;
+			}
+		}
+	}
+}
+
+} // namespace dcpp
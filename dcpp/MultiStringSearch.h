@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_MULTI_STRING_SEARCH_H
+#define DCPLUSPLUS_DCPP_MULTI_STRING_SEARCH_H
+
+#include "StringSearch.h"
+
+namespace dcpp {
+
+/**
+ * Matches several patterns against a string in a single pass (Aho-Corasick, with the automaton
+ * expanded to a full transition table over the bytes that occur in the patterns). Like
+ * StringSearch, the match is case-insensitive and made against the text folded with Text::toLower.
+ *
+ * match / matchLower check that the text contains every pattern, the way a StringSearch::List is
+ * used; find reports which of the patterns it contains.
+ */
+class MultiStringSearch {
+public:
+	/** Bit i is set when pattern i is found. */
+	typedef uint64_t Mask;
+
+	/** Patterns past this many are checked one by one and never reported by find. */
+	enum { MAX_PATTERNS = 64 };
+
+	MultiStringSearch() : MultiStringSearch(StringList()) { }
+	explicit MultiStringSearch(const StringList& aPatterns);
+	explicit MultiStringSearch(const StringSearch::List& aPatterns);
+
+	const StringList& getPatterns() const { return patterns; }
+	size_t size() const { return patterns.size(); }
+	bool empty() const { return patterns.empty(); }
+
+	/** @return The bits of all the patterns find can report. */
+	Mask getAll() const { return all; }
+
+	/** Match a text against all the patterns. */
+	bool match(const string& aText) const noexcept {
+		string lower;
+		Text::toLower(aText, lower);
+		return matchLower(lower);
+	}
+
+	/** Match a text already folded with Text::toLower against all the patterns. */
+	bool matchLower(const string& aLower) const noexcept {
+		if(find(aLower, all) != all) {
+			return false;
+		}
+		for(auto& i: overflow) {
+			if(!i.matchLower(aLower)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/** Whether a text already folded with Text::toLower contains any of the patterns. */
+	bool matchAnyLower(const string& aLower) const noexcept;
+
+	/** Look for the patterns in a text already folded with Text::toLower.
+	@param wanted Stop scanning once all of these have been found.
+	@return The bits of the patterns found; may include ones found before stopping that weren't
+	wanted. */
+	Mask find(const string& aLower, Mask wanted) const noexcept {
+		auto found = output[0];
+		if((found & wanted) == wanted) {
+			return found;
+		}
+
+		uint32_t state = 0;
+		for(auto c: aLower) {
+			state = delta[state * classCount + classes[static_cast<uint8_t>(c)]];
+			if(output[state]) {
+				found |= output[state];
+				if((found & wanted) == wanted) {
+					break;
+				}
+			}
+		}
+		return found;
+	}
+
+private:
+	void build();
+
+	StringList patterns;
+	StringSearch::List overflow;
+	Mask all;
+
+	/** Byte -> column of the transition table; bytes that appear in no pattern share column 0. */
+	uint16_t classes[256];
+	size_t classCount;
+	/** state * classCount + class -> next state. */
+	vector<uint32_t> delta;
+	/** state -> patterns that end there, including through its suffix links. */
+	vector<Mask> output;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_MULTI_STRING_SEARCH_H)
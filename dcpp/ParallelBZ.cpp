@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stdinc.h"
+#include "ParallelBZ.h"
+
+#include <bzlib.h>
+
+#include "format.h"
+#include "Thread.h"
+
+namespace dcpp {
+
+namespace {
+
+/* Blocks of level 9 hold 899981 bytes once run-length encoded; that first encoding turns runs of
+4 identical bytes into 5 bytes, so chunks must leave room for it. */
+const size_t chunkSize = 700 * 1000;
+
+const uint64_t blockMagic = 0x314159265359ULL;
+const uint64_t endMagic = 0x177245385090ULL;
+
+/** Read n bits (most significant first) starting at bit pos. */
+uint64_t getBits(const uint8_t* p, size_t pos, int n) {
+	uint64_t ret = 0;
+	for(; n > 0; --n, ++pos) {
+		ret = (ret << 1) | ((p[pos / 8] >> (7 - pos % 8)) & 1);
+	}
+	return ret;
+}
+
+} // unnamed namespace
+
+class ParallelBZOutputStream::Worker : public Thread {
+public:
+	Worker(ParallelBZOutputStream& s) : s(s) { }
+
+private:
+	int run() {
+		setThreadPriority(Thread::LOW);
+		for(;;) {
+			s.work.wait();
+
+			Chunk* chunk;
+			{
+				Lock l(s.cs);
+				chunk = s.queue.front();
+				s.queue.pop_front();
+			}
+
+			if(!chunk) {
+				return 0;
+			}
+
+			compress(*chunk);
+			chunk->done.signal();
+		}
+	}
+
+	ParallelBZOutputStream& s;
+};
+
+ParallelBZOutputStream::ParallelBZOutputStream(OutputStream* aStream, size_t threads) :
+	f(aStream), buf("BZh9"), bits(0), bitCount(0), crc(0), flushed(false)
+{
+	for(size_t i = 0; i < threads; ++i) {
+		workers.push_back(unique_ptr<Worker>(new Worker(*this)));
+		try {
+			workers.back()->start();
+		} catch(const ThreadException&) {
+			// make do with the threads we have, if any.
+			workers.pop_back();
+			break;
+		}
+	}
+}
+
+ParallelBZOutputStream::~ParallelBZOutputStream() {
+	{
+		Lock l(cs);
+		queue.insert(queue.end(), workers.size(), nullptr);
+	}
+	for(size_t i = 0; i < workers.size(); ++i) {
+		work.signal();
+	}
+	for(auto& i: workers) {
+		i->join();
+	}
+}
+
+size_t ParallelBZOutputStream::write(const void* wbuf, size_t len) {
+	if(flushed)
+		throw Exception("No filtered writes after flush");
+
+	auto p = reinterpret_cast<const char*>(wbuf);
+	size_t written = 0;
+	while(len > 0) {
+		if(!current) {
+			current.reset(new Chunk);
+			current->in.reserve(chunkSize);
+		}
+
+		auto n = std::min(len, chunkSize - current->in.size());
+		current->in.append(p, n);
+		p += n;
+		len -= n;
+
+		if(current->in.size() == chunkSize) {
+			// keep a bounded number of chunks in memory.
+			while(chunks.size() >= std::max(workers.size() * 2, static_cast<size_t>(1))) {
+				written += collect();
+			}
+			submit();
+		}
+	}
+	return written;
+}
+
+size_t ParallelBZOutputStream::flush() {
+	if(flushed)
+		return 0;
+
+	flushed = true;
+
+	if(current) {
+		submit();
+	}
+
+	size_t written = 0;
+	while(!chunks.empty()) {
+		written += collect();
+	}
+
+	putBits(static_cast<uint32_t>(endMagic >> 24), 24);
+	putBits(static_cast<uint32_t>(endMagic & 0xFFFFFF), 24);
+	putBits(crc, 32);
+	if(bitCount > 0) {
+		putBits(0, 8 - bitCount);
+	}
+
+	return written + writeOut() + f->flush();
+}
+
+void ParallelBZOutputStream::compress(Chunk& chunk) noexcept {
+	// bzip2 output can be a little larger than its input.
+	chunk.out.resize(chunk.in.size() + chunk.in.size() / 100 + 600);
+	auto outLen = static_cast<unsigned int>(chunk.out.size());
+	if(::BZ2_bzBuffToBuffCompress(&chunk.out[0], &outLen, &chunk.in[0], static_cast<unsigned int>(chunk.in.size()), 9, 0, 30) != BZ_OK) {
+		chunk.failed = true;
+		return;
+	}
+	chunk.out.resize(outLen);
+	string().swap(chunk.in);
+}
+
+void ParallelBZOutputStream::submit() {
+	auto chunk = current.get();
+	chunks.push_back(move(current));
+
+	if(workers.empty()) {
+		compress(*chunk);
+		chunk->done.signal();
+		return;
+	}
+
+	{
+		Lock l(cs);
+		queue.push_back(chunk);
+	}
+	work.signal();
+}
+
+size_t ParallelBZOutputStream::collect() {
+	auto chunk = move(chunks.front());
+	chunks.pop_front();
+
+	chunk->done.wait();
+	if(chunk->failed) {
+		throw Exception(_("Error during compression"));
+	}
+
+	appendBlock(chunk->out);
+
+	return buf.size() >= 64 * 1024 ? writeOut() : 0;
+}
+
+void ParallelBZOutputStream::appendBlock(const string& stream) {
+	auto p = reinterpret_cast<const uint8_t*>(stream.data());
+	auto total = stream.size() * 8;
+
+	// header (32 bits), block magic (48) and CRC (32), end magic (48), stream CRC (32).
+	if(total < 192 || getBits(p, 32, 48) != blockMagic) {
+		throw Exception(_("Error during compression"));
+	}
+
+	// the stream ends with the end magic and CRC, then up to 7 bits of padding.
+	size_t end = 0;
+	for(size_t pad = 0; pad < 8; ++pad) {
+		if(getBits(p, total - pad - 80, 48) == endMagic) {
+			end = total - pad - 80;
+			break;
+		}
+	}
+	if(!end) {
+		throw Exception(_("Error during compression"));
+	}
+
+	auto blockCrc = static_cast<uint32_t>(getBits(p, 80, 32));
+	crc = ((crc << 1) | (crc >> 31)) ^ blockCrc;
+
+	// the block starts on a byte boundary, right after the header.
+	size_t i = 4;
+	for(; i < end / 8; ++i) {
+		putBits(p[i], 8);
+	}
+	if(end % 8) {
+		putBits(p[i] >> (8 - end % 8), end % 8);
+	}
+}
+
+void ParallelBZOutputStream::putBits(uint32_t value, int n) {
+	bits = (bits << n) | (value & ((1ULL << n) - 1));
+	bitCount += n;
+	while(bitCount >= 8) {
+		bitCount -= 8;
+		buf += static_cast<char>(bits >> bitCount);
+	}
+}
+
+size_t ParallelBZOutputStream::writeOut() {
+	auto written = f->write(buf.data(), buf.size());
+	buf.clear();
+	return written;
+}
+
+} // namespace dcpp
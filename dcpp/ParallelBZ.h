@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_PARALLEL_BZ_H
+#define DCPLUSPLUS_DCPP_PARALLEL_BZ_H
+
+#include <deque>
+#include <memory>
+
+#include "CriticalSection.h"
+#include "SemaphoreDCpp.h"
+#include "Streams.h"
+
+namespace dcpp {
+
+using std::deque;
+using std::unique_ptr;
+
+/**
+ * bzip2 compression spread over several threads. The input is cut into chunks small enough to
+ * fit in a single bzip2 block, which are compressed independently; their blocks are then joined,
+ * in order, into one regular bzip2 stream (not a concatenation of streams, which some
+ * decompressors stop reading after the first of).
+ */
+class ParallelBZOutputStream : public OutputStream {
+public:
+	using OutputStream::write;
+
+	/** @param threads Number of compressing threads; 0 to compress on the calling thread. */
+	ParallelBZOutputStream(OutputStream* aStream, size_t threads);
+	virtual ~ParallelBZOutputStream();
+
+	size_t write(const void* buf, size_t len);
+	size_t flush();
+
+private:
+	struct Chunk {
+		Chunk() : failed(false) { }
+
+		string in;
+		string out; /// a whole bzip2 stream holding a single block
+		bool failed;
+		Semaphore done;
+	};
+
+	class Worker;
+
+	static void compress(Chunk& chunk) noexcept;
+
+	void submit();
+	/** Wait for the oldest chunk to be compressed and append its block to the output. */
+	size_t collect();
+	void appendBlock(const string& stream);
+	void putBits(uint32_t value, int n);
+	size_t writeOut();
+
+	OutputStream* f;
+
+	vector<unique_ptr<Worker>> workers;
+	/** Chunks waiting for a worker; nullptr stops a worker. Protected by cs. */
+	deque<Chunk*> queue;
+	CriticalSection cs;
+	Semaphore work;
+
+	unique_ptr<Chunk> current;
+	/** Submitted chunks, in stream order. */
+	deque<unique_ptr<Chunk>> chunks;
+
+	string buf;
+	uint64_t bits;
+	int bitCount;
+	uint32_t crc;
+	bool flushed;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_PARALLEL_BZ_H)
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stdinc.h"
+#include "ParallelTigerTree.h"
+
+#include "Thread.h"
+
+namespace dcpp {
+
+namespace {
+
+/* Large enough for the hand-over to be cheap next to hashing the chunk, small enough to keep the
+threads busy up to the end of the file. */
+const int64_t maxChunkSize = 1024 * 1024;
+
+} // unnamed namespace
+
+class ParallelTigerTree::Pool::Worker : public Thread {
+public:
+	Worker(Pool& pool, Thread::Priority priority) : pool(pool), priority(priority) { }
+
+private:
+	int run() {
+		setThreadPriority(priority);
+
+		for(;;) {
+			pool.work.wait();
+
+			Chunk* chunk;
+			{
+				Lock l(pool.cs);
+				chunk = pool.queue.front();
+				pool.queue.pop_front();
+			}
+			if(!chunk) {
+				return 0;
+			}
+
+			hash(*chunk);
+			chunk->done.signal();
+		}
+	}
+
+	Pool& pool;
+	Thread::Priority priority;
+};
+
+ParallelTigerTree::Pool::Pool(size_t threads, Thread::Priority priority) {
+	for(size_t i = 0; i < threads; ++i) {
+		workers.push_back(unique_ptr<Worker>(new Worker(*this, priority)));
+		try {
+			workers.back()->start();
+		} catch(const ThreadException&) {
+			// make do with the threads we have, if any.
+			workers.pop_back();
+			break;
+		}
+	}
+}
+
+ParallelTigerTree::Pool::~Pool() {
+	{
+		Lock l(cs);
+		queue.insert(queue.end(), workers.size(), nullptr);
+	}
+	for(size_t i = 0; i < workers.size(); ++i) {
+		work.signal();
+	}
+	for(auto& i: workers) {
+		i->join();
+	}
+}
+
+void ParallelTigerTree::Pool::setPriority(Thread::Priority p) {
+	for(auto& i: workers) {
+		i->setThreadPriority(p);
+	}
+}
+
+void ParallelTigerTree::Pool::push(Chunk* chunk) {
+	{
+		Lock l(cs);
+		queue.push_back(chunk);
+	}
+	work.signal();
+}
+
+ParallelTigerTree::ParallelTigerTree(TigerTree& aTree, Pool* aPool) :
+	tree(aTree), pool(aPool), chunkSize(static_cast<size_t>(std::min(tree.getBlockSize(), maxChunkSize)))
+{
+	// chunks must line up with the tree.
+	if(pool && (pool->getThreads() == 0 || tree.getFileSize() % chunkSize != 0))
+		pool = nullptr;
+
+	// on our own, only gather what the tree needs: whole base blocks.
+	if(!pool)
+		chunkSize = TigerTree::BASE_BLOCK_SIZE;
+}
+
+ParallelTigerTree::~ParallelTigerTree() {
+	// the workers may still be hashing chunks of ours.
+	for(auto& i: chunks) {
+		i->done.wait();
+	}
+}
+
+void ParallelTigerTree::update(const void* data, size_t len) {
+	auto p = reinterpret_cast<const uint8_t*>(data);
+	while(len > 0) {
+		if(!current) {
+			current.reset(new Chunk);
+			current->in.reserve(chunkSize);
+		}
+
+		if(!pool && current->in.empty() && len >= chunkSize) {
+			// nothing to hand out; whole blocks can go straight to the tree.
+			auto n = len - len % chunkSize;
+			tree.update(p, n);
+			p += n;
+			len -= n;
+			continue;
+		}
+
+		auto n = std::min(len, chunkSize - current->in.size());
+		current->in.insert(current->in.end(), p, p + n);
+		p += n;
+		len -= n;
+
+		if(current->in.size() == chunkSize) {
+			if(!pool) {
+				tree.update(current->in.data(), chunkSize);
+				current->in.clear();
+				continue;
+			}
+
+			// keep a bounded number of chunks in memory.
+			while(chunks.size() >= pool->getThreads() * 2) {
+				collect();
+			}
+			submit();
+		}
+	}
+}
+
+void ParallelTigerTree::flush() {
+	while(!chunks.empty()) {
+		collect();
+	}
+
+	// the end of the file, shorter than a chunk.
+	if(current && !current->in.empty()) {
+		tree.update(current->in.data(), current->in.size());
+		current.reset();
+	}
+}
+
+void ParallelTigerTree::hash(Chunk& chunk) noexcept {
+	TigerTree subtree(chunk.in.size());
+	subtree.update(chunk.in.data(), chunk.in.size());
+	chunk.root = TigerTree::MerkleValue(subtree.finalize());
+	ByteVector().swap(chunk.in);
+}
+
+void ParallelTigerTree::submit() {
+	auto chunk = current.get();
+	chunks.push_back(move(current));
+	pool->push(chunk);
+}
+
+void ParallelTigerTree::collect() {
+	auto chunk = move(chunks.front());
+	chunks.pop_front();
+	chunk->done.wait();
+
+	tree.addSubtree(chunk->root, chunkSize);
+}
+
+} // namespace dcpp
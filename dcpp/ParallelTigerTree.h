@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_PARALLEL_TIGER_TREE_H
+#define DCPLUSPLUS_DCPP_PARALLEL_TIGER_TREE_H
+
+#include <deque>
+#include <memory>
+
+#include "CriticalSection.h"
+#include "MerkleTree.h"
+#include "SemaphoreDCpp.h"
+#include "Thread.h"
+
+namespace dcpp {
+
+using std::deque;
+using std::unique_ptr;
+
+/**
+ * Tiger tree of a single file computed by several threads. The data is cut into chunks aligned
+ * to the tree (a power of two times the base block size, no larger than the tree's block size)
+ * whose subtree roots are computed independently; they are then added to the tree in order,
+ * where they are combined like the leaves of a serial update, so the tree comes out the same.
+ */
+class ParallelTigerTree {
+	struct Chunk;
+
+public:
+	/** Hashing threads shared by all the trees being computed at once, so that hashing several
+	files together doesn't start more threads than there are cores. */
+	class Pool {
+	public:
+		explicit Pool(size_t threads, Thread::Priority priority);
+		~Pool();
+
+		void setPriority(Thread::Priority p);
+		size_t getThreads() const { return workers.size(); }
+
+	private:
+		friend class ParallelTigerTree;
+		class Worker;
+
+		void push(Chunk* chunk);
+
+		vector<unique_ptr<Worker>> workers;
+		/** Chunks waiting for a worker; nullptr stops a worker. Protected by cs. */
+		deque<Chunk*> queue;
+		CriticalSection cs;
+		Semaphore work;
+	};
+
+	/** @param pool Threads to hash with; null to hash on the calling thread. */
+	ParallelTigerTree(TigerTree& aTree, Pool* pool);
+	~ParallelTigerTree();
+
+	/** Like TigerTree::update, but len doesn't have to be a multiple of the base block size. */
+	void update(const void* data, size_t len);
+	/** Add everything passed to update to the tree; call before finalizing it. */
+	void flush();
+
+private:
+	struct Chunk {
+		ByteVector in;
+		TigerTree::MerkleValue root;
+		Semaphore done;
+	};
+
+	static void hash(Chunk& chunk) noexcept;
+
+	void submit();
+	/** Wait for the oldest chunk to be hashed and add its root to the tree. */
+	void collect();
+
+	TigerTree& tree;
+	Pool* pool;
+	size_t chunkSize;
+
+	unique_ptr<Chunk> current;
+	/** Submitted chunks, in file order. */
+	deque<unique_ptr<Chunk>> chunks;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_PARALLEL_TIGER_TREE_H)
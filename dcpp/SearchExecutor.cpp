@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stdinc.h"
+#include "SearchExecutor.h"
+
+#include "Thread.h"
+
+namespace dcpp {
+
+using std::make_shared;
+
+namespace {
+
+/** Searches waiting beyond this many are dropped; a hub flooding searches would otherwise have
+them pile up faster than they can be answered. */
+const size_t maxQueued = 256;
+
+} // unnamed namespace
+
+class SearchExecutor::Worker : public Thread {
+public:
+	Worker(SearchExecutor& s) : s(s) { }
+
+private:
+	int run() {
+		for(;;) {
+			s.work.wait();
+
+			Task task;
+			{
+				Lock l(s.cs);
+				task = move(s.queue.front());
+				s.queue.pop_front();
+			}
+
+			if(!task) {
+				return 0;
+			}
+
+			task();
+		}
+	}
+
+	SearchExecutor& s;
+};
+
+bool SearchExecutor::Batch::help() {
+	bool last = false;
+	for(size_t i; (i = next++) < count;) {
+		tasks[i]();
+		if(++done == count) {
+			last = true;
+		}
+	}
+	return last;
+}
+
+SearchExecutor::SearchExecutor(size_t threads) {
+	for(size_t i = 0; i < threads; ++i) {
+		workers.push_back(unique_ptr<Worker>(new Worker(*this)));
+		try {
+			workers.back()->start();
+		} catch(const ThreadException&) {
+			// make do with the threads we have, if any.
+			workers.pop_back();
+			break;
+		}
+	}
+}
+
+SearchExecutor::~SearchExecutor() {
+	{
+		// searches that haven't started are dropped.
+		Lock l(cs);
+		queue.clear();
+		queue.resize(workers.size());
+	}
+	for(size_t i = 0; i < workers.size(); ++i) {
+		work.signal();
+	}
+	for(auto& i: workers) {
+		i->join();
+	}
+}
+
+bool SearchExecutor::submit(Task&& task) {
+	if(workers.empty()) {
+		task();
+		return true;
+	}
+
+	{
+		Lock l(cs);
+		if(queue.size() >= maxQueued) {
+			return false;
+		}
+		queue.push_back(move(task));
+	}
+	work.signal();
+	return true;
+}
+
+void SearchExecutor::run(vector<Task>& tasks) {
+	if(tasks.empty()) {
+		return;
+	}
+
+	auto batch = make_shared<Batch>(tasks);
+
+	auto helpers = std::min(workers.size(), tasks.size() - 1);
+	if(helpers > 0) {
+		{
+			Lock l(cs);
+			for(size_t i = 0; i < helpers; ++i) {
+				queue.push_back([batch] {
+					if(batch->help()) {
+						batch->finished.signal();
+					}
+				});
+			}
+		}
+		for(size_t i = 0; i < helpers; ++i) {
+			work.signal();
+		}
+	}
+
+	if(!batch->help()) {
+		// some parts are still running on workers.
+		batch->finished.wait();
+	}
+}
+
+} // namespace dcpp
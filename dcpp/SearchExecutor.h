@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_SEARCH_EXECUTOR_H
+#define DCPLUSPLUS_DCPP_SEARCH_EXECUTOR_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include "CriticalSection.h"
+#include "SemaphoreDCpp.h"
+#include "typedefs.h"
+
+namespace dcpp {
+
+using std::deque;
+using std::function;
+using std::unique_ptr;
+
+/**
+ * A small pool of threads that share searches run off the threads that receive them (hub
+ * sockets, the UDP listener), so that an expensive query doesn't hold up the rest of the hub's
+ * traffic. A search may itself be split into parts run in parallel on the same pool.
+ */
+class SearchExecutor {
+public:
+	typedef function<void ()> Task;
+
+	/** @param threads Number of worker threads; 0 to run everything on the calling thread. */
+	explicit SearchExecutor(size_t threads);
+	~SearchExecutor();
+
+	/** Queue a task to be run on a worker thread.
+	@return false if too many tasks are already waiting; the task is then dropped. */
+	bool submit(Task&& task);
+
+	/** Run all the tasks, spread over the workers and the calling thread, and return once they are
+	done. Tasks that haven't started can be skipped by having them check a shared flag. May be
+	called from a task; the calling thread runs whatever parts no worker has picked up, so this
+	never waits on a busy pool. */
+	void run(vector<Task>& tasks);
+
+	size_t getThreads() const { return workers.size(); }
+
+private:
+	class Worker;
+
+	/** The parts of a run() call; shared with the helpers queued for it, which may only get to
+	run after the call has returned. */
+	struct Batch {
+		Batch(vector<Task>& tasks) : tasks(&tasks[0]), count(tasks.size()), next(0), done(0) { }
+
+		/** Run parts until there are none left.
+		@return Whether this finished the last part. */
+		bool help();
+
+		Task* tasks;
+		const size_t count;
+		std::atomic<size_t> next;
+		std::atomic<size_t> done;
+		Semaphore finished;
+	};
+
+	vector<unique_ptr<Worker>> workers;
+	/** Tasks waiting for a worker; an empty task stops a worker. Protected by cs. */
+	deque<Task> queue;
+	CriticalSection cs;
+	Semaphore work;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_SEARCH_EXECUTOR_H)
@@ -433,20 +433,44 @@ void SearchManager::respond(const AdcCommand& cmd, const OnlineUser& user) {
 	if(user.getUser() == ClientManager::getInstance()->getMe())
 		return;
 
-	auto results = ShareManager::getInstance()->search(cmd.getParameters(), user.getIdentity().isUdpActive() ? 10 : 5);
-	if(results.empty())
-		return;
-
-	string token, key;
+	string token, key, tth;
 	cmd.getParam("TO", 0, token);
 	cmd.getParam("KY", 0, key);
 
-	for(auto& i: results) {
-		AdcCommand res = i->toRES(AdcCommand::TYPE_UDP);
-		if(!token.empty())
-			res.addParam("TO", token);
-		ClientManager::getInstance()->sendUDP(res, user, key);
+	if(cmd.getParam("TR", 0, tth)) {
+		// a plain lookup; answer it right away.
+		TTHValue root(tth);
+		auto r = ShareManager::getInstance()->findTTH(root);
+		if(r) {
+			AdcCommand res = SearchResult(SearchResult::TYPE_FILE, r->size, r->file, root).toRES(AdcCommand::TYPE_UDP);
+			if(!token.empty())
+				res.addParam("TO", token);
+			ClientManager::getInstance()->sendUDP(res, user, key);
+		}
+		return;
 	}
+
+	// answered from a search thread; the user may be gone by then.
+	HintedUser hinted(user.getUser(), user.getClient().getHubUrl());
+	ShareManager::getInstance()->searchAsync(cmd.getParameters(), user.getIdentity().isUdpActive() ? 10 : 5,
+		[hinted, token, key](const SearchResultList& results)
+	{
+		if(results.empty())
+			return;
+
+		auto cm = ClientManager::getInstance();
+		auto lock = cm->lock();
+		auto ou = cm->findOnlineUserHint(hinted);
+		if(!ou)
+			return;
+
+		for(auto& i: results) {
+			AdcCommand res = i->toRES(AdcCommand::TYPE_UDP);
+			if(!token.empty())
+				res.addParam("TO", token);
+			cm->sendUDP(res, *ou, key);
+		}
+	});
 }
 
 void SearchManager::on(TimerManagerListener::Minute, uint64_t aTick) noexcept {
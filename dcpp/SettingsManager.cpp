@@ -91,6 +91,7 @@ const string SettingsManager::settingTags[] =
 	"MinUploadSpeed", "PMLastLogLines", "SearchHistory", "SetMinislotSize",
 	"SettingsSaveInterval", "Slots", "TabStyle", "TabWidth", "ToolbarSize", "AutoSearchInterval",
 	"MaxExtraSlots", "TestingStatus",
+	"ShareScanThreads", "ShareScanThreadsPerDevice", "HashThreadsPerDevice",
 	"SENTRY",
 	// Bools
 	"AddFinishedInstantly", "AdlsBreakOnFirst",
@@ -258,6 +259,9 @@ SettingsManager::SettingsManager() {
 	setDefault(LOG_SYSTEM, false);
 	setDefault(SEND_UNKNOWN_COMMANDS, true);
 	setDefault(MAX_HASH_SPEED, 0);
+	setDefault(SHARE_SCAN_THREADS, 4);
+	setDefault(SHARE_SCAN_THREADS_PER_DEVICE, 2);
+	setDefault(HASH_THREADS_PER_DEVICE, 1);
 	setDefault(GET_USER_COUNTRY, true);
 	setDefault(FAV_SHOW_JOINS, false);
 	setDefault(LOG_STATUS_MESSAGES, false);
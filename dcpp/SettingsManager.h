@@ -123,6 +123,7 @@ public:
 		MIN_UPLOAD_SPEED, PM_LAST_LOG_LINES, SEARCH_HISTORY, SET_MINISLOT_SIZE,
 		SETTINGS_SAVE_INTERVAL, SLOTS, TAB_STYLE, TAB_WIDTH, TOOLBAR_SIZE,
 		AUTO_SEARCH_INTERVAL, MAX_EXTRA_SLOTS, TESTING_STATUS,
+		SHARE_SCAN_THREADS, SHARE_SCAN_THREADS_PER_DEVICE, HASH_THREADS_PER_DEVICE,
 
 		INT_LAST };
 
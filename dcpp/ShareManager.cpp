@@ -19,23 +19,25 @@
 #include "ShareManager.h"
 
 #include "AdcHub.h"
-#include "BZUtils.h"
 #include "ClientManager.h"
 #include "CryptoManager.h"
 #include "Download.h"
 #include "File.h"
 #include "FilteredFile.h"
 #include "LogManager.h"
-#include "HashBloom.h"
+#include "MappedFile.h"
+#include "ParallelBZ.h"
 #include "HashManager.h"
 #include "QueueManager.h"
 #include "ScopedFunctor.h"
+#include "SemaphoreDCpp.h"
 #include "SearchResult.h"
 #include "SimpleXML.h"
 #include "StringTokenizer.h"
 #include "Transfer.h"
 #include "UserConnection.h"
 #include "version.h"
+#include "ZUtils.h"
 
 #ifndef _WIN32
 #include <dirent.h>
@@ -44,13 +46,20 @@
 #include <fnmatch.h>
 #endif
 
+#include <deque>
 #include <limits>
+#include <thread>
 
 // define this to 1 to measure the time taken by searches to complete.
 #ifndef DCPP_TIME_SEARCHES
 #define DCPP_TIME_SEARCHES 0
 #endif
 
+// define this to 1 to check the results of indexed searches against a full walk of the share tree.
+#ifndef DCPP_VERIFY_SEARCH_INDEX
+#define DCPP_VERIFY_SEARCH_INDEX 0
+#endif
+
 namespace dcpp {
 
 using std::numeric_limits;
@@ -58,20 +67,29 @@ using std::numeric_limits;
 std::atomic_flag ShareManager::refreshing = ATOMIC_FLAG_INIT;
 
 ShareManager::ShareManager() : hits(0), xmlListLen(0), bzXmlListLen(0),
-	xmlDirty(true), forceXmlRefresh(true), refreshDirs(false), update(false), listN(0),
-	lastXmlUpdate(0), lastFullUpdate(GET_TICK()), bloom(1<<20)
+	xmlDirty(true), forceXmlRefresh(true), refreshDirs(false), update(false), revalidate(false), listN(0),
+	compactTreeBytes(0), lastXmlUpdate(0), lastFullUpdate(GET_TICK()), snapshot(std::make_shared<Snapshot>(treeCs)),
+	fullRefresh(false), queuedRefresh(false), queuedRefreshDirs(false), queuedRefreshUpdate(false),
+	searchCacheHits(0), searchCacheMisses(0), droppedSearches(0), lastRefresh(),
+	searchExecutor(new SearchExecutor(std::min(std::max(std::thread::hardware_concurrency(), 2u), 4u))), generation(0), changed(false), lastChange(0),
+	partialListBytes(0), partialListHits(0), partialListMisses(0)
 {
 	SettingsManager::getInstance()->addListener(this);
 	TimerManager::getInstance()->addListener(this);
 	QueueManager::getInstance()->addListener(this);
 	HashManager::getInstance()->addListener(this);
+	monitor.addListener(this);
 }
 
 ShareManager::~ShareManager() {
+	searchExecutor.reset();
+
 	SettingsManager::getInstance()->removeListener(this);
 	TimerManager::getInstance()->removeListener(this);
 	QueueManager::getInstance()->removeListener(this);
 	HashManager::getInstance()->removeListener(this);
+	monitor.removeListener(this);
+	monitor.shutdown();
 
 	join();
 
@@ -82,26 +100,51 @@ ShareManager::~ShareManager() {
 }
 
 ShareManager::Directory::Directory(const string& aName, const ShareManager::Directory::Ptr& aParent) :
+	Directory(SharedName(aName), aParent)
+{
+}
+
+ShareManager::Directory::Directory(const SharedName& aName, const ShareManager::Directory::Ptr& aParent) :
 	size(0),
+	lastWrite(0),
+	parent(aParent.get()),
 	name(aName),
-	parent(aParent.get())
+	paths(nullptr)
 {
 }
 
 const string& ShareManager::Directory::getRealName() const noexcept {
-	return realName ? realName.get() : name;
+	return realName ? realName.get() : getName();
 }
 
-string ShareManager::Directory::getADCPath() const noexcept {
-	if(!getParent())
-		return '/' + name + '/';
-	return getParent()->getADCPath() + name + '/';
+const ShareManager::Directory::Paths& ShareManager::Directory::getPaths() const noexcept {
+	auto p = paths.load(std::memory_order_acquire);
+	if(p) {
+		return *p;
+	}
+
+	unique_ptr<Paths> built(new Paths);
+	if(!getParent()) {
+		built->adc = '/' + getName() + '/';
+		built->full = getName() + '\\';
+	} else {
+		auto& parentPaths = getParent()->getPaths();
+		built->adc = parentPaths.adc + getName() + '/';
+		built->full = parentPaths.full + getName() + '\\';
+	}
+
+	// another reader may have been building them at the same time; keep whichever came first.
+	if(paths.compare_exchange_strong(p, built.get(), std::memory_order_acq_rel)) {
+		p = built.release();
+	}
+	return *p;
 }
 
-string ShareManager::Directory::getFullName() const noexcept {
-	if(!getParent())
-		return getName() + '\\';
-	return getParent()->getFullName() + getName() + '\\';
+void ShareManager::Directory::dropPaths() noexcept {
+	delete paths.exchange(nullptr);
+	for(auto& i: directories) {
+		i.second->dropPaths();
+	}
 }
 
 string ShareManager::Directory::getRealPath(const std::string& path) const {
@@ -113,6 +156,7 @@ string ShareManager::Directory::getRealPath(const std::string& path) const {
 }
 
 string ShareManager::findRealRoot(const string& virtualRoot, const string& virtualPath) const {
+	Lock l(cs);
 	for(auto& i: shares) {
 		if(Util::stricmp(i.second, virtualRoot) == 0) {
 			std::string name = i.first + virtualPath;
@@ -126,6 +170,26 @@ string ShareManager::findRealRoot(const string& virtualRoot, const string& virtu
 	throw ShareException(UserConnection::FILE_NOT_AVAILABLE);
 }
 
+ShareManager::Directory::Ptr ShareManager::Directory::clone(const Ptr& aParent) const {
+	// the name is already interned; no need to fold it again.
+	Ptr ret(new Directory(name, aParent));
+	ret->size = size;
+	ret->lastWrite = lastWrite;
+	ret->realName = realName;
+
+	for(auto& i: files) {
+		File f(i);
+		f.setParent(ret.get());
+		ret->files.insert(ret->files.end(), move(f));
+	}
+
+	for(auto& i: directories) {
+		ret->directories.emplace(i.first, i.second->clone(ret));
+	}
+
+	return ret;
+}
+
 int64_t ShareManager::Directory::getSize() const noexcept {
 	int64_t tmp = size;
 	for(auto& i: directories)
@@ -133,16 +197,55 @@ int64_t ShareManager::Directory::getSize() const noexcept {
 	return tmp;
 }
 
+namespace {
+
+/** Bytes a string has allocated outside of itself (nothing when its text fits in the object). */
+size_t getHeapSize(const string& str) {
+	auto p = reinterpret_cast<const char*>(&str);
+	return str.data() >= p && str.data() < p + sizeof(str) ? 0 : str.capacity() + 1;
+}
+
+} // unnamed namespace
+
+size_t ShareManager::Directory::getMemoryUsage() const noexcept {
+	// container nodes are assumed to carry 2 (hash map) or 3 (set) pointers of bookkeeping on top
+	// of their value, plus the allocator's own header.
+	size_t ret = sizeof(Directory) + directories.bucket_count() * sizeof(void*);
+	if(realName) {
+		ret += getHeapSize(*realName);
+	}
+	if(auto p = paths.load()) {
+		ret += sizeof(Paths) + getHeapSize(p->adc) + getHeapSize(p->full);
+	}
+
+	for(auto& i: directories) {
+		ret += sizeof(i) + 3 * sizeof(void*) + getHeapSize(i.first) + i.second->getMemoryUsage();
+	}
+
+	for(auto& f: files) {
+		ret += sizeof(f) + 4 * sizeof(void*);
+		if(f.realPath) {
+			ret += getHeapSize(*f.realPath);
+		}
+	}
+
+	return ret;
+}
+
 string ShareManager::toVirtual(const TTHValue& tth) const {
-	if(bzXmlRoot && tth == bzXmlRoot) {
-		return Transfer::USER_LIST_NAME_BZ;
-	} else if(xmlRoot && tth == xmlRoot) {
-		return Transfer::USER_LIST_NAME;
+	{
+		Lock l(listCs);
+		if(bzXmlRoot && tth == bzXmlRoot) {
+			return Transfer::USER_LIST_NAME_BZ;
+		} else if(xmlRoot && tth == xmlRoot) {
+			return Transfer::USER_LIST_NAME;
+		}
 	}
 
-	Lock l(cs);
-	auto i = tthIndex.find(tth);
-	if(i != tthIndex.end()) {
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
+	auto i = s->tthIndex.find(tth);
+	if(i != s->tthIndex.end()) {
 		return i->second->getADCPath();
 	} else {
 		throw ShareException(UserConnection::FILE_NOT_AVAILABLE);
@@ -154,17 +257,18 @@ string ShareManager::toReal(const string& virtualFile) {
 }
 
 pair<string, int64_t> ShareManager::toRealWithSize(const string& virtualFile) {
-	Lock l(cs);
-
 	if(virtualFile == "MyList.DcLst") {
 		throw ShareException("NMDC-style lists no longer supported, please upgrade your client");
 	}
 	if(virtualFile == Transfer::USER_LIST_NAME_BZ || virtualFile == Transfer::USER_LIST_NAME) {
+		Lock l(listCs);
 		generateXmlList();
 		return make_pair(getBZXmlFile(), 0);
 	}
 
-	auto f = findFile(virtualFile);
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
+	auto& f = s->findFile(virtualFile);
 	return make_pair(f.getRealPath(), f.getSize());
 }
 
@@ -174,16 +278,17 @@ StringList ShareManager::getRealPaths(const string& virtualPath) {
 
 	StringList ret;
 
-	Lock l(cs);
-
 	if(*(virtualPath.end() - 1) == '/') {
 		// directory
-		Directory::Ptr d = splitVirtual(virtualPath).first;
+		SharedLock l(treeCs);
+		auto s = getSnapshot();
+		Directory::Ptr d = s->splitVirtual(virtualPath).first;
 
 		// imitate Directory::getRealPath
 		if(d->getParent()) {
 			ret.push_back(d->getParent()->getRealPath(d->getName()));
 		} else {
+			Lock l(cs);
 			for(auto& i: shares) {
 				if(Util::stricmp(i.second, d->getName()) == 0) {
 					// remove the trailing path sep
@@ -203,8 +308,9 @@ StringList ShareManager::getRealPaths(const string& virtualPath) {
 }
 
 optional<TTHValue> ShareManager::getTTHFromReal(const string& realPath) noexcept {
-	Lock l(cs);
-	auto f = getFile(realPath);
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
+	auto f = getFile(*s, realPath);
 	if (f) {
 		return f->tth;
 	}
@@ -212,14 +318,17 @@ optional<TTHValue> ShareManager::getTTHFromReal(const string& realPath) noexcept
 }
 
 optional<TTHValue> ShareManager::getTTH(const string& virtualFile) const {
-	Lock l(cs);
 	if(virtualFile == Transfer::USER_LIST_NAME_BZ) {
+		Lock l(listCs);
 		return bzXmlRoot;
 	} else if(virtualFile == Transfer::USER_LIST_NAME) {
+		Lock l(listCs);
 		return xmlRoot;
 	}
 
-	return findFile(virtualFile).tth;
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
+	return s->findFile(virtualFile).tth;
 }
 
 MemoryInputStream* ShareManager::getTree(const string& virtualFile) const {
@@ -243,6 +352,7 @@ MemoryInputStream* ShareManager::getTree(const string& virtualFile) const {
 
 AdcCommand ShareManager::getFileInfo(const string& aFile) {
 	if(aFile == Transfer::USER_LIST_NAME) {
+		Lock l(listCs);
 		generateXmlList();
 		if(!xmlRoot) {
 			throw ShareException(UserConnection::FILE_NOT_AVAILABLE);
@@ -256,6 +366,7 @@ AdcCommand ShareManager::getFileInfo(const string& aFile) {
 	}
 
 	if(aFile == Transfer::USER_LIST_NAME_BZ) {
+		Lock l(listCs);
 		generateXmlList();
 		if(!bzXmlRoot) {
 			throw ShareException(UserConnection::FILE_NOT_AVAILABLE);
@@ -272,9 +383,10 @@ AdcCommand ShareManager::getFileInfo(const string& aFile) {
 		throw ShareException(UserConnection::FILE_NOT_AVAILABLE);
 
 	TTHValue val(aFile.substr(4));
-	Lock l(cs);
-	auto i = tthIndex.find(val);
-	if(i == tthIndex.end()) {
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
+	auto i = s->tthIndex.find(val);
+	if(i == s->tthIndex.end()) {
 		throw ShareException(UserConnection::FILE_NOT_AVAILABLE);
 	}
 
@@ -286,7 +398,7 @@ AdcCommand ShareManager::getFileInfo(const string& aFile) {
 	return cmd;
 }
 
-pair<ShareManager::Directory::Ptr, string> ShareManager::splitVirtual(const string& virtualPath) const {
+pair<ShareManager::Directory::Ptr, string> ShareManager::Snapshot::splitVirtual(const string& virtualPath) const {
 	if(virtualPath.empty() || virtualPath[0] != '/') {
 		throw ShareException(UserConnection::FILE_NOT_AVAILABLE);
 	}
@@ -315,7 +427,7 @@ pair<ShareManager::Directory::Ptr, string> ShareManager::splitVirtual(const stri
 	return make_pair(d, virtualPath.substr(j));
 }
 
-const ShareManager::Directory::File& ShareManager::findFile(const string& virtualFile) const {
+const ShareManager::Directory::File& ShareManager::Snapshot::findFile(const string& virtualFile) const {
 	if(virtualFile.compare(0, 4, "TTH/") == 0) {
 		auto i = tthIndex.find(TTHValue(virtualFile.substr(4)));
 		if(i == tthIndex.end()) {
@@ -343,35 +455,110 @@ string ShareManager::validateVirtual(const string& aVirt) const noexcept {
 }
 
 bool ShareManager::hasVirtual(const string& virtualName) const noexcept {
-	Lock l(cs);
-	return directories.find(virtualName) != directories.end();
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
+	return s->directories.find(virtualName) != s->directories.end();
+}
+
+bool ShareManager::isTTHShared(const TTHValue& tth) const noexcept {
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
+	return s->tthIndex.find(tth) != s->tthIndex.end();
+}
+
+ShareManager::SnapshotPtr ShareManager::getSnapshot() const {
+	return std::atomic_load(&snapshot);
+}
+
+void ShareManager::publish(const SnapshotPtr& newSnapshot) {
+	SnapshotPtr old;
+	{
+		// only for the swap; no reader is left with the old snapshot once this is through.
+		WriteLock l(treeCs);
+		old = std::atomic_exchange(&snapshot, newSnapshot);
+	}
+	++generation;
+	clearPartialLists();
+	// the old snapshot goes away here, outside of the lock, unless a reader still holds it.
+}
+
+ShareManager::SnapshotPtr ShareManager::Snapshot::clone(const string& changedRoot) const {
+	SharedLock l(cs);
+
+	auto ret = std::make_shared<Snapshot>(cs);
+	// found as merge() finds the root to merge into.
+	auto changed = directories.find(changedRoot);
+	for(auto& i: directories) {
+		if(changed != directories.end() && i.second == changed->second) {
+			ret->directories.emplace(i.first, i.second->clone());
+		} else {
+			ret->directories.emplace(i.first, i.second);
+			ret->sharedRoots.insert(i.second.get());
+		}
+	}
+	return ret;
+}
+
+std::shared_ptr<const CompactTree> ShareManager::Snapshot::buildCompactTree() const {
+	auto tree = std::make_shared<CompactTree>();
+	for(auto& i: directories) {
+		addToCompactTree(*tree, *i.second);
+	}
+	tree->finish();
+	return tree;
+}
+
+void ShareManager::Snapshot::addToCompactTree(CompactTree& tree, const Directory& dir) {
+	tree.beginDirectory(dir.getName());
+
+	for(auto& f: dir.files) {
+		if(f.tth) {
+			tree.addFile(f.getName(), f.getSize(), *f.tth);
+		}
+	}
+
+	for(auto& i: dir.directories) {
+		addToCompactTree(tree, *i.second);
+	}
+
+	tree.endDirectory();
 }
 
 void ShareManager::load(SimpleXML& aXml) {
-	Lock l(cs);
+	Lock pl(publishCs);
+	// roots are only added here, empty.
+	auto newSnapshot = getSnapshot()->clone(Util::emptyString);
 
-	aXml.resetCurrentChild();
-	if(aXml.findChild("Share")) {
-		aXml.stepIn();
-		while(aXml.findChild("Directory")) {
-			string realPath = aXml.getChildData();
-			if(realPath.empty()) {
-				continue;
-			}
-			// make sure realPath ends with a PATH_SEPARATOR
-			if(realPath[realPath.size() - 1] != PATH_SEPARATOR) {
-				realPath += PATH_SEPARATOR;
-			}
+	{
+		Lock l(cs);
+
+		aXml.resetCurrentChild();
+		if(aXml.findChild("Share")) {
+			aXml.stepIn();
+			while(aXml.findChild("Directory")) {
+				string realPath = aXml.getChildData();
+				if(realPath.empty()) {
+					continue;
+				}
+				// make sure realPath ends with a PATH_SEPARATOR
+				if(realPath[realPath.size() - 1] != PATH_SEPARATOR) {
+					realPath += PATH_SEPARATOR;
+				}
 
-			const string& virtualName = aXml.getChildAttrib("Virtual");
-			string vName = validateVirtual(virtualName.empty() ? Util::getLastDir(realPath) : virtualName);
-			shares[move(realPath)] = vName;
-			if(directories.find(vName) == directories.end()) {
-				directories[vName] = Directory::create(vName);
+				const string& virtualName = aXml.getChildAttrib("Virtual");
+				string vName = validateVirtual(virtualName.empty() ? Util::getLastDir(realPath) : virtualName);
+				shares[move(realPath)] = vName;
+				if(newSnapshot->directories.find(vName) == newSnapshot->directories.end()) {
+					newSnapshot->directories[vName] = Directory::create(vName);
+				}
 			}
+			aXml.stepOut();
 		}
-		aXml.stepOut();
 	}
+
+	// not under cs: publish() takes partialListCs, which getPartialList holds while taking cs
+	newSnapshot->rebuildIndices();
+	publish(newSnapshot);
 }
 
 void ShareManager::save(SimpleXML& aXml) {
@@ -420,17 +607,23 @@ void ShareManager::addDirectory(const string& realPath, const string& virtualNam
 	string vName = validateVirtual(virtualName);
 	dp->setName(vName);
 
-	Lock l(cs);
+	Lock pl(publishCs);
+	// the tree is merged into the root of the same name, if there's one.
+	auto newSnapshot = getSnapshot()->clone(vName);
 
-	shares[realPath] = move(vName);
+	{
+		Lock l(cs);
+		shares[realPath] = vName;
+	}
 
-	merge(dp, realPath);
+	newSnapshot->merge(dp, realPath);
+	newSnapshot->rebuildIndices();
+	publish(newSnapshot);
 
-	rebuildIndices();
 	setDirty();
 }
 
-void ShareManager::merge(const Directory::Ptr& directory, const string& realPath) {
+void ShareManager::Snapshot::merge(const Directory::Ptr& directory, const string& realPath) {
 	auto i = directories.find(directory->getName());
 	if(i != directories.end()) {
 		dcdebug("Merging directory <%s> into %s\n", realPath.c_str(), directory->getName().c_str());
@@ -451,7 +644,7 @@ void ShareManager::Directory::merge(const Directory::Ptr& source, const string&
 		if(ti == directories.end()) {
 			// the directory doesn't exist; create it.
 			directories.emplace(subSource->getName(), subSource);
-			subSource->parent = this;
+			subSource->setParent(this);
 
 			auto f = findFile(subSource->getName());
 			if(f != files.end()) {
@@ -482,9 +675,9 @@ bool ShareManager::Directory::nameInUse(const string& name) const {
 }
 
 void ShareManager::Directory::File::validateName(const string& sourcePath) {
-	if(parent->nameInUse(name)) {
+	if(parent->nameInUse(getName())) {
 		uint32_t num = 0;
-		string base = name, ext, vname;
+		string base = getName(), ext, vname;
 		auto dot = base.rfind('.');
 		if(dot != string::npos) {
 			ext = base.substr(dot);
@@ -494,9 +687,9 @@ void ShareManager::Directory::File::validateName(const string& sourcePath) {
 			++num;
 			vname = base + " (" + Util::toString(num) + ")" + ext;
 		} while(parent->nameInUse(vname));
-		dcdebug("Renaming duplicate <%s> to <%s>\n", name.c_str(), vname.c_str());
-		realPath = sourcePath + move(name);
-		name = move(vname);
+		dcdebug("Renaming duplicate <%s> to <%s>\n", getName().c_str(), vname.c_str());
+		realPath = sourcePath + getName();
+		setName(vname);
 	} else {
 		realPath.reset();
 	}
@@ -507,31 +700,47 @@ void ShareManager::removeDirectory(const string& realPath) {
 		return;
 
 	HashManager::getInstance()->stopHashing(realPath);
+	monitor.unwatch(realPath);
 
-	Lock l(cs);
+	Lock pl(publishCs);
 
-	auto i = shares.find(realPath);
-	if(i == shares.end()) {
-		return;
-	}
+	string vName;
+	StringPairList readd;
+	{
+		Lock l(cs);
 
-	auto vName = i->second;
-	directories.erase(vName);
+		auto i = shares.find(realPath);
+		if(i == shares.end()) {
+			return;
+		}
+
+		vName = i->second;
+		shares.erase(i);
+
+		for(auto& j: shares) {
+			if(Util::stricmp(j.second, vName) == 0) {
+				readd.push_back(j);
+			}
+		}
+	}
 
-	shares.erase(i);
+	auto newSnapshot = getSnapshot()->clone(Util::emptyString);
+	newSnapshot->directories.erase(vName);
 
 	HashManager::HashPauser pauser;
 
 	// Readd all directories with the same vName
-	for(i = shares.begin(); i != shares.end(); ++i) {
-		if(Util::stricmp(i->second, vName) == 0 && checkHidden(i->first)) {
-			auto dp = buildTree(i->first);
-			dp->setName(i->second);
-			merge(dp, i->first);
+	for(auto& i: readd) {
+		if(checkHidden(i.first)) {
+			auto dp = buildTree(i.first);
+			dp->setName(i.second);
+			newSnapshot->merge(dp, i.first);
 		}
 	}
 
-	rebuildIndices();
+	newSnapshot->rebuildIndices();
+	publish(newSnapshot);
+
 	setDirty();
 }
 
@@ -541,13 +750,15 @@ void ShareManager::renameDirectory(const string& realPath, const string& virtual
 }
 
 int64_t ShareManager::getShareSize(const string& realPath) const noexcept {
+	SharedLock sl(treeCs);
+	auto s = getSnapshot();
 	Lock l(cs);
  	dcassert(realPath.size()>0);
 	auto i = shares.find(realPath);
 
 	if(i != shares.end()) {
-		auto j = directories.find(i->second);
-		if(j != directories.end()) {
+		auto j = s->directories.find(i->second);
+		if(j != s->directories.end()) {
 			// Check whether this is a merged share
 			int vNames = 0;
 			for(auto& s: shares) {
@@ -584,181 +795,687 @@ int64_t ShareManager::getShareSize(const string& realPath) const noexcept {
 }
 
 int64_t ShareManager::getShareSize() const noexcept {
-	Lock l(cs);
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
 	int64_t tmp = 0;
-	for(auto& i: tthIndex) {
+	for(auto& i: s->tthIndex) {
 		tmp += i.second->getSize();
 	}
 	return tmp;
 }
 
 size_t ShareManager::getSharedFiles() const noexcept {
-	Lock l(cs);
-	return tthIndex.size();
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
+	return s->tthIndex.size();
 }
 
-ShareManager::Directory::Ptr ShareManager::buildTree(const string& realPath, optional<const string&> dirName, const Directory::Ptr& parent) {
-	auto dir = Directory::create(dirName ? dirName.get() : Util::getLastDir(realPath), parent);
+ShareManager::MemoryUsage ShareManager::getMemoryUsage() const noexcept {
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
 
-	auto lastFileIter = dir->files.begin();
+	MemoryUsage ret = { s->directories.bucket_count() * sizeof(void*), compactTreeBytes };
+	for(auto& i: s->directories) {
+		ret.tree += sizeof(i) + 3 * sizeof(void*) + getHeapSize(i.first) + i.second->getMemoryUsage();
+	}
+	return ret;
+}
 
-#ifdef _WIN32
-	for(FileFindIter i(realPath + "*"), end; i != end; ++i) {
-#else
-	//the fileiter just searches directorys for now, not sure if more
-	//will be needed later
-	for(FileFindIter i(realPath), end; i != end; ++i) {
-#endif
-		auto name = i->getFileName();
+ShareManager::Stats ShareManager::getStats() const noexcept {
+	Stats ret = { };
+	ret.memory = getMemoryUsage();
 
-		if(name.empty()) {
-			LogManager::getInstance()->message(str(F_("Invalid file name found while hashing folder %1%") % Util::addBrackets(realPath)),
-														LogMessage::TYPE_WARNING, LogMessage::LOG_SHARE);
-			continue;
+	{
+		SharedLock l(treeCs);
+		auto s = getSnapshot();
+
+		std::function<void (const Directory&)> count = [&](const Directory& dir) {
+			++ret.directories;
+			ret.files += dir.files.size();
+			for(auto& i: dir.directories) {
+				count(*i.second);
+			}
+		};
+		for(auto& i: s->directories) {
+			count(*i.second);
 		}
 
-		if(name == "." || name == "..")
-			continue;
-		if(!SETTING(SHARE_HIDDEN) && i->isHidden())
-			continue;
-		if(!SETTING(FOLLOW_LINKS) && i->isLink())
- 			continue;
+		ret.hashedFiles = s->tthIndex.size();
+		ret.tthIndexBytes = s->tthIndex.bucket_count() * sizeof(void*) +
+			s->tthIndex.size() * (sizeof(decltype(s->tthIndex)::value_type) + 2 * sizeof(void*));
+		ret.searchIndexBytes = s->searchIndex.getMemoryUsage();
+		ret.bloomBytes = s->bloom.size() / 8;
+		ret.bloomFill = s->bloom.getFillRatio();
 
-		if(i->isDirectory()) {
-			auto newRealPath = realPath + name + PATH_SEPARATOR;
+		{
+			Lock bl(s->hashBloomCs);
+			ret.hashBlooms = s->hashBlooms.size();
+			for(auto& i: s->hashBlooms) {
+				ret.hashBloomBytes += i.second.get_m() / 8;
+			}
+		}
 
-			if(!checkInvalidPaths(newRealPath))
-				continue;
+		Lock rl(s->tthResultsCs);
+		ret.tthResults = s->tthResults.size();
+	}
 
-			// don't share unfinished downloads
-			if(newRealPath == SETTING(TEMP_DOWNLOAD_DIRECTORY)) { continue; }
+	ret.partialLists = getPartialListCacheStats();
 
-			auto virtualName = name;
-			if(dir->nameInUse(virtualName)) {
-				uint32_t num = 0;
-				do {
-					++num;
-					virtualName = name + " (" + Util::toString(num) + ")";
-				} while(dir->nameInUse(virtualName));
-			}
+	{
+		Lock l(searchCacheCs);
+		ret.searchCacheEntries = searchCache.size();
+	}
+	ret.searchCacheHits = searchCacheHits;
+	ret.searchCacheMisses = searchCacheMisses;
 
-			dir->directories[virtualName] = buildTree(newRealPath, virtualName, dir);
+	{
+		Lock l(cs);
+		ret.lastRefresh = lastRefresh;
+	}
 
-			if(virtualName != name) {
-				dir->directories[virtualName]->setRealName(move(name));
-			}
+	ret.searches = searchLatency.getSummary();
+	ret.droppedSearches = droppedSearches;
+	ret.tthSearches = tthSearchLatency.getSummary();
 
-		} else {
-			// Not a directory, assume it's a file...make sure we're not sharing the settings file...
-			if(name == "DCPlusPlus.xml" || name == "Favorites.xml") { continue; }
+	auto hs = HashManager::getInstance()->getStoreStats();
+	ret.hashTrees = hs.trees;
+	ret.hashDataBytes = hs.dataSize;
+	ret.hashDataFragmentation = hs.fragmentation;
+	ret.hashDataCompacting = hs.compacting;
+	return ret;
+}
 
-			auto size = i->getSize();
-			auto fileName = realPath + name;
-			
-			if(!checkInvalidFileName(name))
-				continue;
+namespace {
 
-			if(!checkInvalidFileSize(size))
-				continue;
+string formatLatency(const LatencyHistogram::Summary& s) {
+	return str(F_("%1% (median under %2% us, 99%% under %3% us)") % s.count % s.p50 % s.p99);
+}
 
-			// don't share the private key file
-			if(fileName == SETTING(TLS_PRIVATE_KEY_FILE)) { continue; }
+void addAttrib(SimpleXML& xml, const string& name, uint64_t value) {
+	xml.addChildAttrib(name, static_cast<int64_t>(value));
+}
 
-			Directory::File f(name, size, dir,
-				HashManager::getInstance()->getTTH(fileName, size, i->getLastWriteTime()));
-			f.validateName(realPath);
-			lastFileIter = dir->files.insert(lastFileIter, move(f));
+void addLatency(SimpleXML& xml, const string& tag, const LatencyHistogram::Summary& s) {
+	xml.addTag(tag);
+	addAttrib(xml, "Count", s.count);
+	addAttrib(xml, "P50", s.p50);
+	addAttrib(xml, "P99", s.p99);
+	xml.stepIn();
+	for(size_t i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+		if(s.buckets[i]) {
+			xml.addTag("Bucket");
+			addAttrib(xml, "Below", LatencyHistogram::getUpperBound(i));
+			addAttrib(xml, "Count", s.buckets[i]);
 		}
 	}
-
-	return dir;
+	xml.stepOut();
+}
+
+} // unnamed namespace
+
+string ShareManager::Stats::toString() const {
+	string ret;
+	auto line = [&ret](const string& s) { ret += s; ret += "\r\n"; };
+
+	line(str(F_("Shared: %1% directories, %2% files, %3% hashed") % directories % files % hashedFiles));
+	line(str(F_("Share tree: %1% (compact form: %2%)") % Util::formatBytes(memory.tree) % Util::formatBytes(memory.compact)));
+	line(str(F_("TTH index: %1%; search index: %2%") % Util::formatBytes(tthIndexBytes) % Util::formatBytes(searchIndexBytes)));
+	line(str(F_("Name bloom filter: %1%, %2%%% full") % Util::formatBytes(bloomBytes) % Util::toString(bloomFill * 100.)));
+	line(str(F_("TTH bloom filters: %1% (%2%)") % hashBlooms % Util::formatBytes(hashBloomBytes)));
+	line(str(F_("Partial lists: %1% cached (%2%), %3% hits, %4% misses") % partialLists.lists % Util::formatBytes(partialLists.bytes)
+		% partialLists.hits % partialLists.misses));
+	line(str(F_("Search cache: %1% entries, %2% hits, %3% misses; %4% TTH paths") % searchCacheEntries % searchCacheHits
+		% searchCacheMisses % tthResults));
+	line(str(F_("Last refresh: %1% ms (scan %2%, cache %3%, merge %4%, index %5%, publish %6%)") % lastRefresh.total
+		% lastRefresh.scan % lastRefresh.saveCache % lastRefresh.merge % lastRefresh.index % lastRefresh.publish));
+	line(str(F_("Hash data: %1% trees in %2%, %3%%% fragmented%4%") % hashTrees % Util::formatBytes(hashDataBytes)
+		% Util::toString(hashDataFragmentation * 100.) % (hashDataCompacting ? _(", compacting") : "")));
+	line(_("Searches: ") + formatLatency(searches));
+	line(str(F_("Searches dropped as too many were waiting: %1%") % droppedSearches));
+	ret += _("TTH searches: ") + formatLatency(tthSearches);
+	return ret;
 }
 
-bool ShareManager::checkHidden(const string& realPath) const {
-	FileFindIter ff = FileFindIter(realPath.substr(0, realPath.size() - 1));
+string ShareManager::Stats::toXml() const {
+	SimpleXML xml;
+	xml.addTag("ShareStats");
+	xml.stepIn();
+
+	xml.addTag("Tree");
+	addAttrib(xml, "Directories", directories);
+	addAttrib(xml, "Files", files);
+	addAttrib(xml, "HashedFiles", hashedFiles);
+	addAttrib(xml, "Bytes", memory.tree);
+	addAttrib(xml, "CompactBytes", memory.compact);
+
+	xml.addTag("TTHIndex");
+	addAttrib(xml, "Bytes", tthIndexBytes);
+	xml.addTag("SearchIndex");
+	addAttrib(xml, "Bytes", searchIndexBytes);
+	xml.addTag("Bloom");
+	addAttrib(xml, "Bytes", bloomBytes);
+	xml.addChildAttrib("Fill", Util::toString(bloomFill));
+	xml.addTag("HashBlooms");
+	addAttrib(xml, "Count", hashBlooms);
+	addAttrib(xml, "Bytes", hashBloomBytes);
+
+	xml.addTag("PartialLists");
+	addAttrib(xml, "Count", partialLists.lists);
+	addAttrib(xml, "Bytes", partialLists.bytes);
+	addAttrib(xml, "Hits", partialLists.hits);
+	addAttrib(xml, "Misses", partialLists.misses);
+	xml.addTag("SearchCache");
+	addAttrib(xml, "Count", searchCacheEntries);
+	addAttrib(xml, "Hits", searchCacheHits);
+	addAttrib(xml, "Misses", searchCacheMisses);
+	addAttrib(xml, "TTHPaths", tthResults);
+
+	xml.addTag("HashData");
+	addAttrib(xml, "Trees", hashTrees);
+	addAttrib(xml, "Bytes", hashDataBytes);
+	xml.addChildAttrib("Fragmentation", Util::toString(hashDataFragmentation));
+	xml.addChildAttrib("Compacting", hashDataCompacting);
+
+	xml.addTag("Refresh");
+	addAttrib(xml, "Scan", lastRefresh.scan);
+	addAttrib(xml, "SaveCache", lastRefresh.saveCache);
+	addAttrib(xml, "Merge", lastRefresh.merge);
+	addAttrib(xml, "Index", lastRefresh.index);
+	addAttrib(xml, "Publish", lastRefresh.publish);
+	addAttrib(xml, "Total", lastRefresh.total);
+
+	addLatency(xml, "Searches", searches);
+	xml.addTag("DroppedSearches");
+	addAttrib(xml, "Count", droppedSearches);
+	addLatency(xml, "TTHSearches", tthSearches);
+
+	xml.stepOut();
+	return SimpleXML::utf8Header + xml.toXML();
+}
+
+class ShareManager::Scanner {
+public:
+	Scanner(ShareManager& sm, size_t threads, size_t perDevice) : sm(sm), perDevice(perDevice), queues(threads) { }
+
+	vector<Directory::Ptr> scan(const StringList& realPaths, const vector<Directory::Ptr>& cached, const function<void (float)>& progressF) {
+		vector<Directory::Ptr> ret;
+
+		// sub-directories are attributed to the device of their root; mount points within a share
+		// are not looked for.
+		unordered_map<string, Device*> deviceIds;
+		roots.reserve(realPaths.size());
+		for(auto& path: realPaths) {
+			auto& device = deviceIds[File::getDeviceId(path)];
+			if(!device) {
+				devices.emplace_back(new Device());
+				device = devices.back().get();
+			}
 
-	if (ff != FileFindIter()) {
-		return (SETTING(SHARE_HIDDEN) || !ff->isHidden());
-	}
+			roots.emplace_back(new Root());
+			ret.push_back(Directory::create(Util::getLastDir(path)));
+			push(0, Task { PendingDir { ret.back(), path, cached.empty() ? nullptr : cached[ret.size() - 1] }, roots.back().get(), device });
+		}
 
-	return true;
-}
+		// the calling thread takes part in the scan and reports progress; the others only help out.
+		vector<unique_ptr<Worker>> workers;
+		for(size_t i = 1; i < queues.size(); ++i) {
+			workers.emplace_back(new Worker(*this, i));
+			try {
+				workers.back()->start();
+			} catch(const ThreadException& e) {
+				dcdebug("Share scanner thread failed to start: %s\n", e.getError().c_str());
+				workers.pop_back();
+				break;
+			}
+		}
 
-bool ShareManager::checkInvalidFileName(const string& name) const
-{
-	for(auto& f: cachedFilterSkiplistRegEx)
-	{
-		if(checkRegEx(f, name))
-		{
-			return false;
+		size_t reported = 0;
+		while(pending > 0) {
+			work(0);
+
+			if(progressF && reported != finishedRoots) {
+				reported = finishedRoots;
+				progressF(static_cast<float>(reported) / roots.size());
+			}
 		}
-	}
 
-	for(auto& f: cachedFilterSkiplistFileExtensions)
-	{
-		if(checkRegEx(f, name))
-		{
-			dcdebug("Filtering away the file '%s' with the pattern matching '%s'\n", name.c_str(), f.pattern.c_str());
+		if(progressF && reported != roots.size()) {
+			progressF(1);
+		}
 
-			return false;
+		for(auto& i: workers) {
+			i->join();
 		}
+
+		return ret;
 	}
 
-	return true;
-}
+private:
+	struct Device {
+		Device() : active(0) { }
+		std::atomic<size_t> active;
+	};
 
-bool ShareManager::checkInvalidPaths(const string& name) const
-{
-	for(auto& f: cachedFilterSkiplistPaths)
-	{
-		if(checkRegEx(f, name))
-		{
-			return false;
+	struct Root {
+		Root() : pending(0) { }
+		std::atomic<size_t> pending;
+	};
+
+	struct Task {
+		PendingDir dir;
+		Root* root;
+		Device* device;
+	};
+
+	struct Queue {
+		CriticalSection cs;
+		std::deque<Task> tasks;
+	};
+
+	class Worker : public Thread {
+	public:
+		Worker(Scanner& scanner, size_t index) : scanner(scanner), index(index) { }
+
+	private:
+		int run() {
+			setThreadPriority(Thread::LOW);
+			while(scanner.pending > 0) {
+				scanner.work(index);
+			}
+			return 0;
 		}
-	}
 
-	return true;
-}
+		Scanner& scanner;
+		size_t index;
+	};
 
-bool ShareManager::checkInvalidFileSize(uint64_t size) const
-{
-	uint64_t minimumSize = SETTING(SHARING_SKIPLIST_MINSIZE);
-	if(minimumSize != 0)
-	{
-		if( size < minimumSize )
-		{
-			return false;
+	void push(size_t index, Task&& task) {
+		++task.root->pending;
+		++pending;
+
+		auto& q = queues[index];
+		Lock l(q.cs);
+		q.tasks.push_back(move(task));
+	}
+
+	bool acquire(Device& device) {
+		auto n = device.active.load();
+		while(n < perDevice) {
+			if(device.active.compare_exchange_weak(n, n + 1)) {
+				return true;
+			}
 		}
+		return false;
 	}
 
-	uint64_t maximumSize = SETTING(SHARING_SKIPLIST_MAXSIZE);
-	if(maximumSize != 0)
-	{
-		if( size > maximumSize )
+	/** Take a task whose device has a free slot: the newest one from our own queue, or else the
+	oldest one from somebody else's, which is likely to be the root of a larger sub-tree. */
+	optional<Task> take(size_t index) {
 		{
-			return false;
+			auto& q = queues[index];
+			Lock l(q.cs);
+			for(auto i = q.tasks.rbegin(); i != q.tasks.rend(); ++i) {
+				if(acquire(*i->device)) {
+					Task task = move(*i);
+					q.tasks.erase(std::next(i).base());
+					return task;
+				}
+			}
 		}
-	}
 
-	return true;
-}
+		for(size_t n = 1; n < queues.size(); ++n) {
+			auto& q = queues[(index + n) % queues.size()];
+			Lock l(q.cs);
+			for(auto i = q.tasks.begin(); i != q.tasks.end(); ++i) {
+				if(acquire(*i->device)) {
+					Task task = move(*i);
+					q.tasks.erase(i);
+					return task;
+				}
+			}
+		}
 
-bool ShareManager::checkRegEx(const StringMatch& matcher, const string& match) const
-{
-	if(match.empty())
-	{
-		return false;
+		return none;
 	}
-	
-	return matcher.match(match);
-}
 
-void ShareManager::updateFilterCache()
-{
-	updateFilterCache(SETTING(SHARING_SKIPLIST_REGEX), cachedFilterSkiplistRegEx);
-	updateFilterCache(SETTING(SHARING_SKIPLIST_EXTENSIONS), "$", true, cachedFilterSkiplistFileExtensions);
-	updateFilterCache(SETTING(SHARING_SKIPLIST_PATHS), cachedFilterSkiplistPaths);
-}
+	void work(size_t index) {
+		auto task = take(index);
+		if(!task) {
+			// nothing we can run right now; new tasks, a device freeing up and the end of the scan
+			// all signal.
+			wake.wait();
+			return;
+		}
+
+		vector<PendingDir> subdirs;
+		sm.tryScanDirectory(task->dir, subdirs);
+		--task->device->active;
+
+		for(auto& i: subdirs) {
+			push(index, Task { move(i), task->root, task->device });
+		}
+
+		for(size_t i = 0, n = std::min(subdirs.size() + 1, queues.size()); i < n; ++i) {
+			wake.signal();
+		}
+
+		if(--task->root->pending == 0) {
+			++finishedRoots;
+		}
+
+		if(--pending == 0) {
+			for(size_t i = 0; i < queues.size(); ++i) {
+				wake.signal();
+			}
+		}
+	}
+
+	ShareManager& sm;
+	const size_t perDevice;
+
+	vector<Queue> queues;
+	vector<unique_ptr<Root>> roots;
+	vector<unique_ptr<Device>> devices;
+
+	std::atomic<size_t> pending { 0 };
+	std::atomic<size_t> finishedRoots { 0 };
+
+	Semaphore wake;
+};
+
+vector<ShareManager::Directory::Ptr> ShareManager::buildTrees(const StringList& realPaths, const vector<Directory::Ptr>& cached,
+	const function<void (float)>& progressF)
+{
+	auto threads = static_cast<size_t>(std::max(SETTING(SHARE_SCAN_THREADS), 1));
+	auto perDevice = static_cast<size_t>(std::max(SETTING(SHARE_SCAN_THREADS_PER_DEVICE), 1));
+
+	if(threads == 1) {
+		vector<Directory::Ptr> ret;
+		float progressCounter = 0;
+		for(auto& path: realPaths) {
+			ret.push_back(Directory::create(Util::getLastDir(path)));
+
+			vector<PendingDir> subdirs;
+			subdirs.push_back(PendingDir { ret.back(), path, cached.empty() ? nullptr : cached[ret.size() - 1] });
+			while(!subdirs.empty()) {
+				auto dir = move(subdirs.back());
+				subdirs.pop_back();
+				tryScanDirectory(dir, subdirs);
+			}
+
+			if(progressF) {
+				progressF(++progressCounter / realPaths.size());
+			}
+		}
+		return ret;
+	}
+
+	return Scanner(*this, threads, perDevice).scan(realPaths, cached, progressF);
+}
+
+ShareManager::Directory::Ptr ShareManager::buildTree(const string& realPath) {
+	return buildTrees(StringList(1, realPath)).front();
+}
+
+bool ShareManager::tryScanDirectory(const PendingDir& pending, vector<PendingDir>& subdirs) noexcept {
+	try {
+		scanDirectory(pending, subdirs);
+		return true;
+	} catch(const Exception& e) {
+		LogManager::getInstance()->message(str(F_("Error while scanning %1%: %2%") % Util::addBrackets(pending.realPath) % e.getError()),
+			LogMessage::TYPE_WARNING, LogMessage::LOG_SHARE);
+		return false;
+	}
+}
+
+void ShareManager::scanDirectory(const PendingDir& pending, vector<PendingDir>& subdirs) {
+	auto& dir = pending.dir;
+	auto& realPath = pending.realPath;
+	auto& cached = pending.cached;
+
+	// before listing, so that nothing that happens from now on goes unnoticed.
+	monitor.watch(realPath);
+
+	if(!dir->getLastWrite()) {
+		// share roots and sub-directories of reused directories; others got it from their parent.
+		FileFindIter ff(realPath.substr(0, realPath.size() - 1));
+		if(ff != FileFindIter()) {
+			dir->setLastWrite(ff->getLastWriteTime());
+		}
+	}
+
+#ifdef _WIN32
+	auto findPath = realPath + "*";
+#else
+	//the fileiter just searches directorys for now, not sure if more
+	//will be needed later
+	const auto& findPath = realPath;
+#endif
+
+	if(cached && cached->getLastWrite() && cached->getLastWrite() == dir->getLastWrite()) {
+		// nothing was added, removed or renamed in here since the cache was written; but writing
+		// to a file doesn't touch its directory, so the sizes and times of the files are still
+		// checked against a listing before the hashes of the cache are reused.
+		unordered_map<string, pair<int64_t, uint32_t>> entries;
+		for(FileFindIter i(findPath), end; i != end; ++i) {
+			// the settings may have changed since the cache was written; what they now leave out goes.
+			if(checkEntry(*i, realPath)) {
+				entries.emplace(i->getFileName(), make_pair(i->isDirectory() ? -1 : i->getSize(), i->getLastWriteTime()));
+			}
+		}
+
+		for(auto& i: cached->files) {
+			Directory::File f(i);
+			f.setParent(dir.get());
+
+			auto fileName = f.realPath ? f.realPath.get() : realPath + f.getName();
+			auto entry = entries.find(Util::getFileName(fileName));
+			if(entry == entries.end() || entry->second.first == -1) {
+				continue;
+			}
+
+			auto size = entry->second.first;
+			auto lastWrite = entry->second.second;
+			if(size != f.getSize() || lastWrite != f.getLastWrite()) {
+				f.setSize(size);
+				f.setLastWrite(lastWrite);
+				f.tth.reset();
+			}
+
+			if(!f.tth) {
+				f.tth = HashManager::getInstance()->getTTH(fileName, size, lastWrite);
+			}
+			dir->files.insert(dir->files.end(), move(f));
+		}
+
+		for(auto& i: cached->directories) {
+			auto subdir = Directory::create(i.first, dir);
+			auto& realName = i.second->getRealName();
+			if(realName != i.first) {
+				subdir->setRealName(realName);
+			}
+
+			auto entry = entries.find(realName);
+			if(entry == entries.end() || entry->second.first != -1) {
+				continue;
+			}
+			// saves finding the sub-directory again to learn its time.
+			subdir->setLastWrite(entry->second.second);
+
+			dir->directories[i.first] = subdir;
+			subdirs.push_back(PendingDir { move(subdir), realPath + realName + PATH_SEPARATOR, i.second });
+		}
+		return;
+	}
+
+	auto lastFileIter = dir->files.begin();
+
+	for(FileFindIter i(findPath), end; i != end; ++i) {
+		if(!checkEntry(*i, realPath))
+			continue;
+
+		auto name = i->getFileName();
+
+		if(i->isDirectory()) {
+			auto newRealPath = realPath + name + PATH_SEPARATOR;
+
+			auto virtualName = name;
+			if(dir->nameInUse(virtualName)) {
+				uint32_t num = 0;
+				do {
+					++num;
+					virtualName = name + " (" + Util::toString(num) + ")";
+				} while(dir->nameInUse(virtualName));
+			}
+
+			auto subdir = Directory::create(virtualName, dir);
+			subdir->setLastWrite(i->getLastWriteTime());
+
+			Directory::Ptr cachedSubdir;
+			if(cached) {
+				auto c = cached->directories.find(virtualName);
+				if(c != cached->directories.end() && c->second->getRealName() == name) {
+					cachedSubdir = c->second;
+				}
+			}
+
+			if(virtualName != name) {
+				subdir->setRealName(move(name));
+			}
+
+			dir->directories[virtualName] = subdir;
+			subdirs.push_back(PendingDir { move(subdir), move(newRealPath), move(cachedSubdir) });
+
+		} else {
+			auto size = i->getSize();
+			auto fileName = realPath + name;
+			auto lastWrite = i->getLastWriteTime();
+			Directory::File f(name, size, dir,
+				HashManager::getInstance()->getTTH(fileName, size, lastWrite));
+			f.setLastWrite(lastWrite);
+			f.validateName(realPath);
+			lastFileIter = dir->files.insert(lastFileIter, move(f));
+		}
+	}
+}
+
+bool ShareManager::checkEntry(FileFindIter::DirData& entry, const string& realPath) const {
+	auto name = entry.getFileName();
+
+	if(name.empty()) {
+		LogManager::getInstance()->message(str(F_("Invalid file name found while hashing folder %1%") % Util::addBrackets(realPath)),
+													LogMessage::TYPE_WARNING, LogMessage::LOG_SHARE);
+		return false;
+	}
+
+	if(name == "." || name == "..")
+		return false;
+	if(!SETTING(SHARE_HIDDEN) && entry.isHidden())
+		return false;
+	if(!SETTING(FOLLOW_LINKS) && entry.isLink())
+		return false;
+
+	if(entry.isDirectory()) {
+		auto newRealPath = realPath + name + PATH_SEPARATOR;
+
+		// don't share unfinished downloads
+		return checkInvalidPaths(newRealPath) && newRealPath != SETTING(TEMP_DOWNLOAD_DIRECTORY);
+	}
+
+	// Not a directory, assume it's a file...make sure we're not sharing the settings file...
+	if(name == "DCPlusPlus.xml" || name == "Favorites.xml")
+		return false;
+
+	// don't share the private key file
+	return checkInvalidFileName(name) && checkInvalidFileSize(entry.getSize()) &&
+		realPath + name != SETTING(TLS_PRIVATE_KEY_FILE);
+}
+
+bool ShareManager::checkHidden(const string& realPath) const {
+	FileFindIter ff = FileFindIter(realPath.substr(0, realPath.size() - 1));
+
+	if (ff != FileFindIter()) {
+		return (SETTING(SHARE_HIDDEN) || !ff->isHidden());
+	}
+
+	return true;
+}
+
+bool ShareManager::checkInvalidFileName(const string& name) const
+{
+	for(auto& f: cachedFilterSkiplistRegEx)
+	{
+		if(checkRegEx(f, name))
+		{
+			return false;
+		}
+	}
+
+	for(auto& f: cachedFilterSkiplistFileExtensions)
+	{
+		if(checkRegEx(f, name))
+		{
+			dcdebug("Filtering away the file '%s' with the pattern matching '%s'\n", name.c_str(), f.pattern.c_str());
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ShareManager::checkInvalidPaths(const string& name) const
+{
+	for(auto& f: cachedFilterSkiplistPaths)
+	{
+		if(checkRegEx(f, name))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ShareManager::checkInvalidFileSize(uint64_t size) const
+{
+	uint64_t minimumSize = SETTING(SHARING_SKIPLIST_MINSIZE);
+	if(minimumSize != 0)
+	{
+		if( size < minimumSize )
+		{
+			return false;
+		}
+	}
+
+	uint64_t maximumSize = SETTING(SHARING_SKIPLIST_MAXSIZE);
+	if(maximumSize != 0)
+	{
+		if( size > maximumSize )
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ShareManager::checkRegEx(const StringMatch& matcher, const string& match) const
+{
+	if(match.empty())
+	{
+		return false;
+	}
+	
+	return matcher.match(match);
+}
+
+void ShareManager::updateFilterCache()
+{
+	updateFilterCache(SETTING(SHARING_SKIPLIST_REGEX), cachedFilterSkiplistRegEx);
+	updateFilterCache(SETTING(SHARING_SKIPLIST_EXTENSIONS), "$", true, cachedFilterSkiplistFileExtensions);
+	updateFilterCache(SETTING(SHARING_SKIPLIST_PATHS), cachedFilterSkiplistPaths);
+}
 
 void ShareManager::updateFilterCache(const std::string& strSetting, std::list<StringMatch>& lst)
 {
@@ -791,9 +1508,19 @@ void ShareManager::updateFilterCache(const std::string& strSetting, const std::s
 	}
 }
 
-void ShareManager::updateIndices(Directory& dir) {
-	bloom.add(Text::toLower(dir.getName()));
+void ShareManager::Snapshot::addIndices(const Directory& dir) {
+	for(auto& i: dir.directories) {
+		addIndices(*i.second);
+	}
+
+	for(auto& f: dir.files) {
+		if(f.tth) {
+			tthIndex[*f.tth] = &f;
+		}
+	}
+}
 
+void ShareManager::Snapshot::updateIndices(Directory& dir) {
 	for(auto& i: dir.directories) {
 		updateIndices(*i.second);
 	}
@@ -805,16 +1532,100 @@ void ShareManager::updateIndices(Directory& dir) {
 	}
 }
 
-void ShareManager::rebuildIndices() {
+void ShareManager::Snapshot::removeIndices(const Directory& dir, bool recursive) {
+	for(auto& f: dir.files) {
+		if(f.tth) {
+			auto i = tthIndex.find(*f.tth);
+			if(i != tthIndex.end() && i->second == &f) {
+				tthIndex.erase(i);
+				hashBlooms.clear();
+				dropTTHResult(*f.tth);
+			}
+		}
+	}
+
+	if(recursive) {
+		for(auto& i: dir.directories) {
+			removeIndices(*i.second, true);
+		}
+	}
+}
+
+void ShareManager::Snapshot::dropTTHResult(const TTHValue& root) {
+	auto i = tthResultsIndex.find(root);
+	if(i != tthResultsIndex.end()) {
+		tthResults.erase(i->second);
+		tthResultsIndex.erase(i);
+	}
+}
+
+void ShareManager::Snapshot::rebuildIndices() {
 	tthIndex.clear();
-	bloom.clear();
+	tthResults.clear();
+	tthResultsIndex.clear();
 
+	// shared trees are read with the lock held, as hashing may change them in place meanwhile.
+	SharedLock l(cs, boost::defer_lock);
+	if(!sharedRoots.empty()) {
+		l.lock();
+	}
+
+	// shared trees first, as they are; files of the others that duplicate theirs are left out.
 	for(auto& i: directories) {
-		updateIndices(*i.second);
+		if(sharedRoots.count(i.second.get())) {
+			addIndices(*i.second);
+		}
 	}
+	for(auto& i: directories) {
+		if(!sharedRoots.count(i.second.get())) {
+			updateIndices(*i.second);
+		}
+	}
+
+	/* size the bloom filter after the share so that it keeps rejecting queries on large shares;
+	files still being hashed are counted, as they are added once hashed. */
+	size_t grams = 0;
+	for(auto& i: directories) {
+		grams += countGrams(*i.second);
+	}
+	bloom.resize(BloomFilter<5>::getTableSize(grams));
+	for(auto& i: directories) {
+		updateBloom(*i.second);
+	}
+	dcdebug("Bloom filter rebuilt: %u bits, %.2f%% filled\n", static_cast<unsigned>(bloom.size()), bloom.getFillRatio() * 100.);
+
+	searchIndex.build(directories);
+}
+
+void ShareManager::Snapshot::updateBloom(const Directory& dir) {
+	bloom.add(dir.getLowerName());
+
+	for(auto& i: dir.directories) {
+		updateBloom(*i.second);
+	}
+
+	for(auto& f: dir.files) {
+		if(f.tth) {
+			bloom.add(f.getLowerName());
+		}
+	}
+}
+
+size_t ShareManager::Snapshot::countGrams(const Directory& dir) {
+	auto ret = BloomFilter<5>::getGrams(dir.getLowerName());
+
+	for(auto& i: dir.directories) {
+		ret += countGrams(*i.second);
+	}
+
+	for(auto& f: dir.files) {
+		ret += BloomFilter<5>::getGrams(f.getLowerName());
+	}
+
+	return ret;
 }
 
-void ShareManager::updateIndices(Directory& dir, const decltype(std::declval<Directory>().files.begin())& i) {
+void ShareManager::Snapshot::updateIndices(Directory& dir, const decltype(std::declval<Directory>().files.begin())& i) {
 	const Directory::File& f = *i;
 
 	if(!f.tth) {
@@ -839,23 +1650,53 @@ void ShareManager::updateIndices(Directory& dir, const decltype(std::declval<Dir
 	}
 
 	tthIndex[*f.tth] = &f;
-	bloom.add(Text::toLower(f.getName()));
+	dropTTHResult(*f.tth);
+	for(auto& b: hashBlooms) {
+		b.second.add(*f.tth);
+	}
 }
 
 void ShareManager::refresh(bool dirs, bool aUpdate, bool block, function<void (float)> progressF) noexcept {
-	if(refreshing.test_and_set()) {
-		LogManager::getInstance()->message(_("File list refresh in progress, please wait for it to finish before trying to refresh again"),
-												LogMessage::TYPE_WARNING, LogMessage::LOG_SHARE);
-		return;
-	}
-
+	bool busy = false;
+	{
+		Lock l(cs);
+		if(!refreshing.test_and_set()) {
+			fullRefresh = true;
+		} else if(!fullRefresh) {
+			// only changes seen by the monitor are being applied; refresh right after them.
+			queueRefresh(dirs, aUpdate);
+			return;
+		} else {
+			busy = true;
+		}
+	}
+
+	if(busy) {
+		LogManager::getInstance()->message(_("File list refresh in progress, please wait for it to finish before trying to refresh again"),
+												LogMessage::TYPE_WARNING, LogMessage::LOG_SHARE);
+		return;
+	}
+
 	update = aUpdate;
 	refreshDirs = dirs;
 
+	startRefresh(block, progressF);
+}
+
+void ShareManager::queueRefresh(bool dirs, bool aUpdate) {
+	queuedRefresh = true;
+	queuedRefreshDirs = queuedRefreshDirs || dirs;
+	queuedRefreshUpdate = queuedRefreshUpdate || aUpdate;
+}
+
+void ShareManager::startRefresh(bool block, function<void (float)> progressF) {
 	join();
 
 	if(block) {
 		runRefresh(progressF);
+		while(endRefresh()) {
+			runRefresh();
+		}
 
 	} else {
 		try {
@@ -867,6 +1708,208 @@ void ShareManager::refresh(bool dirs, bool aUpdate, bool block, function<void (f
 	}
 }
 
+namespace {
+
+/* Layout of the share cache, in host byte order (the cache is not meant to be moved around):
+	header: magic, version, root count
+	root: real path, directory
+	directory: name, real name (if renamed), mtime, file count, files, sub-directory count, directories
+	file: name, real path (if renamed), size, mtime, TTH (if hashed)
+strings are prefixed with their 32-bit length; optional fields with a byte telling whether they are present. */
+const uint32_t CACHE_MAGIC = 0x43535044; // "DPSC"
+const uint32_t CACHE_VERSION = 1;
+
+template<typename T> void put(OutputStream& os, const T& v) { os.write(&v, sizeof(v)); }
+void put(OutputStream& os, const string& s) { put(os, static_cast<uint32_t>(s.size())); os.write(s); }
+void put(OutputStream& os, const optional<string>& s) { put(os, static_cast<uint8_t>(s ? 1 : 0)); if(s) { put(os, *s); } }
+
+class CacheReader {
+public:
+	CacheReader(const uint8_t* data, size_t size) : p(data), end(data + size) { }
+
+	template<typename T> T get() {
+		check(sizeof(T));
+		T ret;
+		memcpy(&ret, p, sizeof(T));
+		p += sizeof(T);
+		return ret;
+	}
+
+	string getString() {
+		auto n = get<uint32_t>();
+		check(n);
+		string ret(reinterpret_cast<const char*>(p), n);
+		p += n;
+		return ret;
+	}
+
+	TTHValue getTTH() {
+		check(TTHValue::BYTES);
+		TTHValue ret(p);
+		p += TTHValue::BYTES;
+		return ret;
+	}
+
+	bool getFlag() { return get<uint8_t>() != 0; }
+
+	bool atEnd() const { return p == end; }
+
+private:
+	void check(size_t n) const {
+		if(static_cast<size_t>(end - p) < n) {
+			throw ShareException(_("The share cache is corrupt"));
+		}
+	}
+
+	const uint8_t* p;
+	const uint8_t* end;
+};
+
+} // namespace
+
+unordered_map<string, ShareManager::Directory::Ptr> ShareManager::loadCache() const noexcept {
+	unordered_map<string, Directory::Ptr> ret;
+
+	function<Directory::Ptr (CacheReader&, const Directory::Ptr&)> readDir = [&readDir](CacheReader& r, const Directory::Ptr& parent) {
+		auto dir = Directory::create(r.getString(), parent);
+		if(r.getFlag()) {
+			dir->setRealName(r.getString());
+		}
+		dir->setLastWrite(r.get<uint32_t>());
+
+		for(auto n = r.get<uint32_t>(); n > 0; --n) {
+			Directory::File f;
+			f.setName(r.getString());
+			if(r.getFlag()) {
+				f.realPath = r.getString();
+			}
+			f.setSize(r.get<int64_t>());
+			f.setLastWrite(r.get<uint32_t>());
+			if(r.getFlag()) {
+				f.tth = r.getTTH();
+			}
+			f.setParent(dir.get());
+			dir->files.insert(dir->files.end(), move(f));
+		}
+
+		for(auto n = r.get<uint32_t>(); n > 0; --n) {
+			auto subdir = readDir(r, dir);
+			dir->directories[subdir->getName()] = subdir;
+		}
+
+		return dir;
+	};
+
+	try {
+		MappedFile f(getCacheFile(), MappedFile::SEQUENTIAL);
+		CacheReader r(f.getData(), f.getSize());
+
+		if(r.get<uint32_t>() != CACHE_MAGIC || r.get<uint32_t>() != CACHE_VERSION) {
+			return ret;
+		}
+
+		for(auto n = r.get<uint32_t>(); n > 0; --n) {
+			auto realPath = r.getString();
+			ret[realPath] = readDir(r, nullptr);
+		}
+
+		if(!r.atEnd()) {
+			throw ShareException(_("The share cache is corrupt"));
+		}
+	} catch(const FileException&) {
+		// no cache yet
+		ret.clear();
+	} catch(const ShareException& e) {
+		LogManager::getInstance()->message(str(F_("Error loading the share cache: %1%") % e.getError()),
+			LogMessage::TYPE_WARNING, LogMessage::LOG_SHARE);
+		ret.clear();
+	}
+
+	return ret;
+}
+
+void ShareManager::saveCache(const StringList& realPaths, const vector<Directory::Ptr>& trees) const noexcept {
+	function<void (OutputStream&, const Directory&)> writeDir = [&writeDir](OutputStream& os, const Directory& dir) {
+		put(os, dir.getName());
+		put(os, dir.getRealName() != dir.getName() ? optional<string>(dir.getRealName()) : none);
+		put(os, dir.getLastWrite());
+
+		put(os, static_cast<uint32_t>(dir.files.size()));
+		for(auto& f: dir.files) {
+			put(os, f.getName());
+			put(os, f.realPath);
+			put(os, f.getSize());
+			put(os, f.getLastWrite());
+			put(os, static_cast<uint8_t>(f.tth ? 1 : 0));
+			if(f.tth) {
+				os.write(f.tth->data, TTHValue::BYTES);
+			}
+		}
+
+		put(os, static_cast<uint32_t>(dir.directories.size()));
+		for(auto& i: dir.directories) {
+			writeDir(os, *i.second);
+		}
+	};
+
+	try {
+		auto tmpName = getCacheFile() + ".tmp";
+		{
+			File ff(tmpName, File::WRITE, File::CREATE | File::TRUNCATE);
+			BufferedOutputStream<false> f(&ff);
+
+			put(f, CACHE_MAGIC);
+			put(f, CACHE_VERSION);
+			put(f, static_cast<uint32_t>(trees.size()));
+			for(size_t i = 0; i < trees.size(); ++i) {
+				put(f, realPaths[i]);
+				writeDir(f, *trees[i]);
+			}
+
+			f.flush();
+		}
+
+		File::deleteFile(getCacheFile());
+		File::renameFile(tmpName, getCacheFile());
+	} catch(const FileException& e) {
+		LogManager::getInstance()->message(str(F_("Error saving the share cache: %1%") % e.getError()),
+			LogMessage::TYPE_ERROR, LogMessage::LOG_SHARE);
+	}
+}
+
+void ShareManager::startup(function<void (float)> progressF) noexcept {
+	auto cache = loadCache();
+	if(cache.empty()) {
+		refresh(true, false, true, progressF);
+		return;
+	}
+
+	{
+		Lock pl(publishCs);
+		auto newSnapshot = std::make_shared<Snapshot>(treeCs);
+
+		for(auto& i: getDirectories()) {
+			auto c = cache.find(i.second);
+			if(c != cache.end()) {
+				c->second->setName(i.first);
+				newSnapshot->merge(c->second, i.second);
+			} else if(newSnapshot->directories.find(i.first) == newSnapshot->directories.end()) {
+				newSnapshot->directories[i.first] = Directory::create(i.first);
+			}
+		}
+
+		newSnapshot->rebuildIndices();
+		publish(newSnapshot);
+	}
+
+	LogManager::getInstance()->message(str(F_("Loaded %1% shared files from the share cache") % getSharedFiles()),
+		LogMessage::TYPE_GENERAL, LogMessage::LOG_SHARE);
+
+	// hubs may be connected by the time this is done; tell them if the share has changed since.
+	revalidate = true;
+	refresh(true, true, false);
+}
+
 StringPairList ShareManager::getDirectories() const noexcept {
 	Lock l(cs);
 	StringPairList ret;
@@ -877,7 +1920,9 @@ StringPairList ShareManager::getDirectories() const noexcept {
 }
 
 int ShareManager::run() {
-	runRefresh();
+	do {
+		runRefresh();
+	} while(endRefresh());
 	return 0;
 }
 
@@ -894,34 +1939,73 @@ void ShareManager::runRefresh(function<void (float)> progressF) {
 
 		lastFullUpdate = GET_TICK();
 
-		vector<pair<Directory::Ptr, string>> newDirs;
-
-		float progressCounter = 0, dirCount = dirs.size();
-
 		// Make sure that the cache is updated.
 		updateFilterCache();
 
+		monitor.clearErrors();
+
+		StringList paths, names;
 		for(auto& i: dirs) {
 			if(checkHidden(i.second)) {
-				auto dp = buildTree(i.second);
-				dp->setName(i.first);
-				newDirs.emplace_back(dp, i.second);
+				paths.push_back(i.second);
+				names.push_back(i.first);
 			}
+		}
 
-			if(progressF) {
-				progressF(++progressCounter / dirCount);
+		vector<Directory::Ptr> cached;
+		if(revalidate) {
+			revalidate = false;
+
+			auto cache = loadCache();
+			for(auto& path: paths) {
+				auto c = cache.find(path);
+				cached.push_back(c != cache.end() ? c->second : nullptr);
 			}
 		}
 
+		RefreshTimes times = { };
+		auto start = GET_TICK(), tick = start;
+		auto phase = [&tick](uint64_t& time) { auto now = GET_TICK(); time = now - tick; tick = now; };
+
+		auto trees = buildTrees(paths, cached, progressF);
+		phase(times.scan);
+
+		// before merging, which modifies the trees.
+		saveCache(paths, trees);
+		phase(times.saveCache);
+
+		vector<pair<Directory::Ptr, string>> newDirs;
+		for(size_t i = 0; i < trees.size(); ++i) {
+			trees[i]->setName(names[i]);
+			newDirs.emplace_back(trees[i], paths[i]);
+		}
+
 		{
-			Lock l(cs);
-			directories.clear();
+			// build the indices on the side; searches and uploads go on with the current snapshot.
+			Lock pl(publishCs);
+			auto newSnapshot = std::make_shared<Snapshot>(treeCs);
 
 			for(auto& i: newDirs) {
-				merge(i.first, i.second);
+				newSnapshot->merge(i.first, i.second);
+			}
+			phase(times.merge);
+
+			newSnapshot->rebuildIndices();
+			phase(times.index);
+
+			publish(newSnapshot);
+			phase(times.publish);
+
+			times.total = tick - start;
+			{
+				Lock l(cs);
+				lastRefresh = times;
 			}
 
-			rebuildIndices();
+#ifdef _DEBUG
+			auto usage = getMemoryUsage();
+			dcdebug("Share tree: %u bytes, compact form: %u bytes\n", static_cast<unsigned>(usage.tree), static_cast<unsigned>(usage.compact));
+#endif
 		}
 		refreshDirs = false;
 
@@ -931,25 +2015,265 @@ void ShareManager::runRefresh(function<void (float)> progressF) {
 	if(update) {
 		ClientManager::getInstance()->infoUpdated();
 	}
+}
+
+bool ShareManager::endRefresh() {
+	for(;;) {
+		StringList changes;
+		{
+			Lock l(cs);
+			// refreshes asked for from now on wait for the changes below rather than being refused.
+			fullRefresh = false;
+			if(deferredChanges.empty()) {
+				if(queuedRefresh) {
+					fullRefresh = true;
+					queuedRefresh = false;
+					refreshDirs = queuedRefreshDirs;
+					update = queuedRefreshUpdate;
+					queuedRefreshDirs = queuedRefreshUpdate = false;
+					return true;
+				}
+				refreshing.clear();
+				return false;
+			}
+			changes.swap(deferredChanges);
+		}
+		updateDirectories(move(changes));
+	}
+}
+
+bool ShareManager::hasMergedShares() const noexcept {
+	Lock l(cs);
+	StringSet names;
+	for(auto& i: shares) {
+		if(!names.insert(Text::toLower(i.second)).second) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void ShareManager::updateDirectories(StringList realPaths) {
+	if(hasMergedShares()) {
+		// a directory may then hold the contents of several real ones; leave it to timed refreshes.
+		return;
+	}
+
+	// parents first, so that their new sub-directories are known when these come up.
+	sort(realPaths.begin(), realPaths.end());
+	realPaths.erase(unique(realPaths.begin(), realPaths.end()), realPaths.end());
+
+	/* as in a refresh, files queued for hashing wait until they are in the tree; otherwise a small
+	one could be done before the swap below, and its TTH would go to the old entry. */
+	HashManager::HashPauser pauser;
+
+	Lock pl(publishCs);
+	auto s = getSnapshot();
+
+	for(auto& realPath: realPaths) {
+		Directory::Ptr dir;
+		DirMap gone;
+		{
+			SharedLock l(treeCs);
+			dir = getDirectory(*s, realPath);
+			if(dir) {
+				gone = dir->directories;
+			}
+		}
+
+		if(!dir) {
+			// not shared, or its parent hasn't been updated yet; the parent's update will scan it.
+			continue;
+		}
+
+		// list the directory again; sub-directories that were known already are kept as they are
+		// (they have events of their own), new ones are scanned in full.
+		auto fresh = Directory::create(dir->getName());
+		vector<PendingDir> subdirs;
+		if(!tryScanDirectory(PendingDir { fresh, realPath, nullptr }, subdirs)) {
+			// keep what was there rather than half a listing.
+			continue;
+		}
+
+		for(auto& subdir: subdirs) {
+			auto& name = subdir.dir->getName();
+			auto i = gone.find(name);
+			if(i != gone.end() && i->second->getRealName() == subdir.dir->getRealName()) {
+				fresh->directories[name] = i->second;
+				gone.erase(i);
+				continue;
+			}
+
+			vector<PendingDir> pending { subdir };
+			while(!pending.empty()) {
+				auto p = move(pending.back());
+				pending.pop_back();
+				tryScanDirectory(p, pending);
+			}
+		}
+
+		WriteLock l(treeCs);
+		changed = true;
+		dropPartialLists(*dir);
+
+		s->removeIndices(*dir, false);
+		s->searchIndex.removeFiles(*dir);
+		for(auto& i: gone) {
+			s->removeIndices(*i.second, true);
+			s->searchIndex.removeTree(*i.second);
+		}
+
+		// the old contents go away along with fresh, once the lock is released.
+		dir->files.swap(fresh->files);
+		dir->directories.swap(fresh->directories);
+		dir->setLastWrite(fresh->getLastWrite());
+
+		dir->size = 0;
+		for(auto i = dir->files.begin(); i != dir->files.end();) {
+			const_cast<Directory::File&>(*i).setParent(dir.get());
+			s->updateIndices(*dir, i++);
+		}
+
+		for(auto& f: dir->files) {
+			if(f.tth) {
+				s->bloom.add(f.getLowerName());
+			}
+			s->searchIndex.addPending(f);
+		}
+
+		for(auto& i: dir->directories) {
+			if(i.second->getParent() == fresh.get()) {
+				i.second->setParent(dir.get());
+				s->updateIndices(*i.second);
+				s->updateBloom(*i.second);
+				s->searchIndex.addPending(*i.second);
+			}
+		}
+	}
+
+	bool rebuild;
+	{
+		SharedLock l(treeCs);
+		rebuild = s->searchIndex.needsRebuild();
+	}
+	if(rebuild) {
+		// files added in place are matched by a plain scan; index them along with the rest before
+		// searches get slow. Built on the side, as refreshes do.
+		auto newSnapshot = s->clone(Util::emptyString);
+		newSnapshot->rebuildIndices();
+		publish(newSnapshot);
+	}
+
+	setDirty();
+}
+
+void ShareManager::on(DirectoryMonitorListener::Changed, const StringList& realPaths) noexcept {
+	{
+		Lock l(cs);
+		if(refreshing.test_and_set()) {
+			// the refresh may or may not see these changes; apply them once it's done.
+			deferredChanges.insert(deferredChanges.end(), realPaths.begin(), realPaths.end());
+			return;
+		}
+	}
+
+	updateDirectories(realPaths);
+	if(endRefresh()) {
+		startRefresh(false);
+	}
+}
+
+void ShareManager::on(DirectoryMonitorListener::Overflow) noexcept {
+	LogManager::getInstance()->message(_("Too many changes to the shared directories at once; refreshing them all"),
+		LogMessage::TYPE_GENERAL, LogMessage::LOG_SHARE);
+
+	{
+		Lock l(cs);
+		if(refreshing.test_and_set()) {
+			// whatever is running may already be past the directories that changed.
+			queueRefresh(true, true);
+			return;
+		}
+		fullRefresh = true;
+	}
 
-	refreshing.clear();
+	update = true;
+	refreshDirs = true;
+	startRefresh(false);
 }
 
 void ShareManager::getBloom(ByteVector& v, size_t k, size_t m, size_t h) const {
 	dcdebug("Creating bloom filter, k=%u, m=%u, h=%u\n", k, m, h);
-	Lock l(cs);
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
+	Lock bl(s->hashBloomCs);
+
+	auto key = std::make_tuple(k, m, h);
+	auto i = s->hashBlooms.find(key);
+	if(i == s->hashBlooms.end()) {
+		// hubs of a client seldom ask for more than a couple of parameter sets.
+		if(s->hashBlooms.size() >= 4) {
+			s->hashBlooms.clear();
+		}
+
+		i = s->hashBlooms.emplace(key, HashBloom()).first;
+		i->second.reset(k, m, h);
+		for(auto& j: s->tthIndex) {
+			i->second.add(j.first);
+		}
+	}
+
+	i->second.copy_to(v);
+}
+
+#define LITERAL(n) n, sizeof(n)-1
+
+namespace {
+
+/** Write a directory of the compact tree along with all of its contents. */
+void toXml(const CompactTree& tree, uint32_t id, OutputStream& xmlFile, string& indent, string& tmp2) {
+	auto& dir = tree.getDirs()[id];
+
+	xmlFile.write(indent);
+	xmlFile.write(LITERAL("<Directory Name=\""));
+	xmlFile.write(SimpleXML::escape(tmp2.assign(tree.getName(dir.name)), true));
+	xmlFile.write(LITERAL("\">\r\n"));
 
-	HashBloom bloom;
-	bloom.reset(k, m, h);
-	for(auto& i: tthIndex) {
-		bloom.add(i.first);
+	indent += '\t';
+
+	for(auto i = tree.firstChild(id); i < dir.dirEnd; i = tree.next(i)) {
+		toXml(tree, i, xmlFile, indent, tmp2);
+	}
+
+	for(auto i = dir.fileBegin; i < dir.fileEnd; ++i) {
+		auto& f = tree.getFiles()[i];
+		xmlFile.write(indent);
+		xmlFile.write(LITERAL("<File Name=\""));
+		xmlFile.write(SimpleXML::escape(tmp2.assign(tree.getName(f.name)), true));
+		xmlFile.write(LITERAL("\" Size=\""));
+		xmlFile.write(Util::toString(f.size));
+		xmlFile.write(LITERAL("\" TTH=\""));
+		tmp2.clear();
+		xmlFile.write(f.tth.toBase32(tmp2));
+		xmlFile.write(LITERAL("\"/>\r\n"));
 	}
-	bloom.copy_to(v);
+
+	indent.erase(indent.length()-1);
+
+	xmlFile.write(indent);
+	xmlFile.write(LITERAL("</Directory>\r\n"));
 }
 
+} // unnamed namespace
+
 void ShareManager::generateXmlList() {
-	Lock l(cs);
+	Lock l(listCs);
 	if(forceXmlRefresh || (xmlDirty && (lastXmlUpdate + 15 * 60 * 1000 < GET_TICK() || lastXmlUpdate < lastFullUpdate))) {
+		// cleared before the tree is taken, so that changes made while the list is written mark it
+		// dirty again rather than being lost.
+		forceXmlRefresh.exchange(false);
+		xmlDirty.exchange(false);
+
 		listN++;
 
 		try {
@@ -958,17 +2282,27 @@ void ShareManager::generateXmlList() {
 
 			string newXmlName = Util::getPath(Util::PATH_USER_CONFIG) + "files" + Util::toString(listN) + ".xml.bz2";
 			{
+				// a copy of the share, so it needn't be locked while writing; freed once written.
+				std::shared_ptr<const CompactTree> tree;
+				{
+					SharedLock sl(treeCs);
+					auto s = getSnapshot();
+					tree = s->buildCompactTree();
+				}
+				compactTreeBytes = tree->getMemoryUsage();
+
 				File f(newXmlName, File::WRITE, File::TRUNCATE | File::CREATE);
 				// We don't care about the leaves...
 				CalcOutputStream<TTFilter<1024*1024*1024>, false> bzTree(&f);
-				FilteredOutputStream<BZFilter, false> bzipper(&bzTree);
+				auto threads = std::thread::hardware_concurrency();
+				ParallelBZOutputStream bzipper(&bzTree, threads > 1 ? threads : 0);
 				CountOutputStream<false> count(&bzipper);
 				CalcOutputStream<TTFilter<1024*1024*1024>, false> newXmlFile(&count);
 
 				newXmlFile.write(SimpleXML::utf8Header);
 				newXmlFile.write("<FileListing Version=\"1\" CID=\"" + ClientManager::getInstance()->getMe()->getCID().toBase32() + "\" Base=\"/\" Generator=\"" APPNAME " " VERSIONSTRING "\">\r\n");
-				for(auto& i: directories) {
-					i.second->toXml(newXmlFile, indent, tmp2, -1);
+				for(uint32_t i = 0; i < tree->getDirs().size(); i = tree->next(i)) {
+					toXml(*tree, i, newXmlFile, indent, tmp2);
 				}
 				newXmlFile.write("</FileListing>");
 				newXmlFile.flush();
@@ -999,35 +2333,75 @@ void ShareManager::generateXmlList() {
 			LogManager::getInstance()->message(str(F_("File list %1% generated") % Util::addBrackets(bzXmlFile)), LogMessage::TYPE_GENERAL, LogMessage::LOG_SHARE);
 		} catch(const Exception&) {
 			// No new file lists...
+			xmlDirty = true;
 		}
 
-		xmlDirty = false;
-		forceXmlRefresh = false;
 		lastXmlUpdate = GET_TICK();
 	}
 }
 
+namespace {
+
+/** Partial lists taking more memory than this are dropped, least recently used first. */
+const size_t partialListCacheSize = 16 * 1024 * 1024;
+
+/** Data compressed ahead of time, read as if it was being compressed on the fly: the consumed
+size reported by read is that of the uncompressed data, as with FilteredInputStream. */
+class CompressedInputStream : public InputStream {
+public:
+	/** @param aData Read in place, and kept alive for as long as the stream. */
+	CompressedInputStream(std::shared_ptr<const string>&& aData, size_t aOrigSize) : data(move(aData)), origSize(aOrigSize), done(0), reported(0) { }
+
+	size_t read(void* tgt, size_t& len) {
+		auto n = std::min(len, data->size() - done);
+		memcpy(tgt, data->data() + done, n);
+		done += n;
+		len = static_cast<size_t>(static_cast<uint64_t>(done) * origSize / data->size()) - reported;
+		reported += len;
+		return n;
+	}
+
+private:
+	std::shared_ptr<const string> data;
+	size_t origSize;
+	size_t done;
+	size_t reported;
+};
+
+} // unnamed namespace
+
 MemoryInputStream* ShareManager::generatePartialList(const string& dir, bool recurse) const {
+	auto list = getPartialList(dir, recurse, false);
+	return list ? new MemoryInputStream(list->xml) : nullptr;
+}
+
+InputStream* ShareManager::getCompressedPartialList(const string& dir, bool recurse, int64_t& size) const {
+	auto list = getPartialList(dir, recurse, true);
+	if(!list) {
+		return nullptr;
+	}
+	size = list->xml.size();
+	// shares the cached list rather than copying it; it stays valid even once dropped from the cache.
+	return new CompressedInputStream(std::shared_ptr<const string>(list, &list->compressed), list->xml.size());
+}
+
+ShareManager::PartialListCacheStats ShareManager::getPartialListCacheStats() const noexcept {
+	Lock l(partialListCs);
+	PartialListCacheStats ret = { partialListHits, partialListMisses, partialListBytes, partialLists.size() };
+	return ret;
+}
+
+std::shared_ptr<const ShareManager::PartialList> ShareManager::getPartialList(const string& dir, bool recurse, bool compressed) const {
 	if(dir[0] != '/' || dir[dir.size()-1] != '/')
-		return 0;
+		return nullptr;
 
-	string xml = SimpleXML::utf8Header;
-	string tmp;
-	xml += "<FileListing Version=\"1\" CID=\"" + ClientManager::getInstance()->getMe()->getCID().toBase32() + "\" Base=\"" + SimpleXML::escape(dir, tmp, true) + "\" Generator=\"" APPNAME " " VERSIONSTRING "\">\r\n";
-	StringRefOutputStream sos(xml);
-	string indent = "\t";
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
 
-	Lock l(cs);
-	if(dir == "/") {
-		for(auto& i: directories) {
-			tmp.clear();
-			i.second->toXml(sos, indent, tmp, recurse ? -1 : 0);
-		}
-	} else {
+	Directory::Ptr root;
+	if(dir != "/") {
 		string::size_type i = 1, j = 1;
 
-		Directory::Ptr root;
-
 		bool first = true;
 		while( (i = dir.find('/', j)) != string::npos) {
 			if(i == j) {
@@ -1037,287 +2411,1039 @@ MemoryInputStream* ShareManager::generatePartialList(const string& dir, bool rec
 
 			if(first) {
 				first = false;
-				auto it = directories.find(dir.substr(j, i-j));
-				if(it == directories.end())
-					return 0;
+				auto it = s->directories.find(dir.substr(j, i-j));
+				if(it == s->directories.end())
+					return nullptr;
 				root = it->second;
 
 			} else {
 				auto it2 = root->directories.find(dir.substr(j, i-j));
 				if(it2 == root->directories.end()) {
-					return 0;
+					return nullptr;
 				}
 				root = it2->second;
 			}
 			j = i + 1;
 		}
 
-		if(!root)
-			return 0;
+		if(!root)
+			return nullptr;
+	}
+
+	// the list names the directory as it was requested; only cache those requested by their
+	// actual path, which is what changes to the share are matched against.
+	auto key = Text::toLower(dir);
+	bool cache = !root || key == Text::toLower(root->getADCPath());
+	key.insert(key.begin(), recurse ? 'R' : 'N');
+
+	std::shared_ptr<const PartialList> cached;
+	if(cache) {
+		Lock cl(partialListCs);
+		auto i = partialListIndex.find(key);
+		if(i != partialListIndex.end()) {
+			partialLists.splice(partialLists.begin(), partialLists, i->second);
+			if(!compressed || !i->second->second->compressed.empty()) {
+				++partialListHits;
+				return i->second->second;
+			}
+			cached = i->second->second;
+		}
+		++partialListMisses;
+	}
+
+	auto list = std::make_shared<PartialList>();
+	if(cached) {
+		list->xml = cached->xml;
+
+	} else {
+		string& xml = list->xml;
+		xml = SimpleXML::utf8Header;
+		string tmp;
+		xml += "<FileListing Version=\"1\" CID=\"" + ClientManager::getInstance()->getMe()->getCID().toBase32() + "\" Base=\"" + SimpleXML::escape(dir, tmp, true) + "\" Generator=\"" APPNAME " " VERSIONSTRING "\">\r\n";
+		StringRefOutputStream sos(xml);
+		string indent = "\t";
+
+		if(!root) {
+			for(auto& i: s->directories) {
+				tmp.clear();
+				i.second->toXml(sos, indent, tmp, recurse ? -1 : 0);
+			}
+		} else {
+			for(auto& it2: root->directories) {
+				it2.second->toXml(sos, indent, tmp, recurse ? -1 : 0);
+			}
+			root->filesToXml(sos, indent, tmp);
+		}
+
+		xml += "</FileListing>";
+	}
+
+	if(compressed) {
+		StringOutputStream out;
+		FilteredOutputStream<ZFilter, false> zipper(&out);
+		zipper.write(list->xml);
+		zipper.flush();
+		list->compressed = out.getString();
+	}
+
+	auto size = key.size() + list->getSize();
+	if(cache && size <= partialListCacheSize) {
+		Lock cl(partialListCs);
+		// a refresh may have replaced the snapshot meanwhile, and cleared the cache.
+		if(getSnapshot() == s) {
+			auto i = partialListIndex.find(key);
+			if(i != partialListIndex.end()) {
+				partialListBytes -= i->first.size() + i->second->second->getSize();
+				partialLists.erase(i->second);
+				partialListIndex.erase(i);
+			}
+
+			partialLists.emplace_front(key, list);
+			partialListIndex[key] = partialLists.begin();
+			partialListBytes += size;
+
+			while(partialListBytes > partialListCacheSize) {
+				auto& last = partialLists.back();
+				partialListBytes -= last.first.size() + last.second->getSize();
+				partialListIndex.erase(last.first);
+				partialLists.pop_back();
+			}
+		}
+	}
+
+	return list;
+}
+
+void ShareManager::dropPartialLists(const Directory& dir) {
+	auto path = Text::toLower(dir.getADCPath());
+
+	Lock l(partialListCs);
+	for(auto i = partialLists.begin(); i != partialLists.end();) {
+		// lists of the directory, of its parents (they may include it) and of its sub-directories.
+		auto listPath = i->first.substr(1);
+		if(path.compare(0, listPath.size(), listPath) == 0 || listPath.compare(0, path.size(), path) == 0) {
+			partialListBytes -= i->first.size() + i->second->getSize();
+			partialListIndex.erase(i->first);
+			i = partialLists.erase(i);
+		} else {
+			++i;
+		}
+	}
+}
+
+void ShareManager::clearPartialLists() {
+	Lock l(partialListCs);
+	partialLists.clear();
+	partialListIndex.clear();
+	partialListBytes = 0;
+}
+
+/* params for partial file lists - when any of these params is not satisfied, an incomplete dir is
+returned rather than a full dir list. */
+const int8_t maxLevel = 2;
+const size_t maxItemsPerLevel[maxLevel] = { 16, 4 };
+
+void ShareManager::Directory::toXml(OutputStream& xmlFile, string& indent, string& tmp2, int8_t level) const {
+	xmlFile.write(indent);
+	xmlFile.write(LITERAL("<Directory Name=\""));
+	xmlFile.write(SimpleXML::escape(getName(), tmp2, true));
+
+	if(level < 0 || (level < maxLevel && directories.size() + files.size() <= maxItemsPerLevel[level])) {
+		xmlFile.write(LITERAL("\">\r\n"));
+
+		indent += '\t';
+		if(level >= 0)
+			++level;
+
+		for(auto& i: directories) {
+			i.second->toXml(xmlFile, indent, tmp2, level);
+		}
+		filesToXml(xmlFile, indent, tmp2);
+
+		if(level >= 0)
+			--level;
+		indent.erase(indent.length()-1);
+
+		xmlFile.write(indent);
+		xmlFile.write(LITERAL("</Directory>\r\n"));
+
+	} else {
+		if(directories.empty() && files.empty()) {
+			xmlFile.write(LITERAL("\" />\r\n"));
+		} else {
+			xmlFile.write(LITERAL("\" Incomplete=\"1\" />\r\n"));
+		}
+	}
+}
+
+void ShareManager::Directory::filesToXml(OutputStream& xmlFile, string& indent, string& tmp2) const {
+	for(auto& f: files) {
+		if(!f.tth) { continue; }
+		xmlFile.write(indent);
+		xmlFile.write(LITERAL("<File Name=\""));
+		xmlFile.write(SimpleXML::escape(f.getName(), tmp2, true));
+		xmlFile.write(LITERAL("\" Size=\""));
+		xmlFile.write(Util::toString(f.getSize()));
+		xmlFile.write(LITERAL("\" TTH=\""));
+		tmp2.clear();
+		xmlFile.write(f.tth->toBase32(tmp2));
+		xmlFile.write(LITERAL("\"/>\r\n"));
+	}
+}
+
+ShareManager::SearchQuery::SearchQuery() :
+	pending(0),
+	found(nullptr),
+	gt(0),
+	lt(numeric_limits<int64_t>::max()),
+	isDirectory(false)
+{
+}
+
+string ShareManager::SearchQuery::getKey() const {
+	if(root) {
+		return "TR" + root->toBase32();
+	}
+
+	// the order of terms and extensions doesn't matter.
+	auto add = [](string& key, const char* code, StringList&& items) {
+		sort(items.begin(), items.end());
+		items.erase(unique(items.begin(), items.end()), items.end());
+		for(auto& i: items) {
+			key += code;
+			key += i;
+			key += '\0';
+		}
+	};
+
+	string key;
+	StringList terms;
+	for(auto& i: include) { terms.push_back(i.getPattern()); }
+	for(auto& i: extraInclude) { terms.push_back(i.getPattern()); }
+	add(key, "AN", move(terms));
+	terms.clear();
+	for(auto& i: exclude) { terms.push_back(i.getPattern()); }
+	add(key, "NO", move(terms));
+	add(key, "EX", StringList(ext));
+	add(key, "RX", StringList(noExt));
+	key += "GE" + Util::toString(gt) + "LE" + Util::toString(lt);
+	if(isDirectory) {
+		key += "TY2";
+	}
+	return key;
+}
+
+namespace {
+	inline uint16_t toCode(char a, char b) { return (uint16_t)a | ((uint16_t)b)<<8; }
+}
+ShareManager::SearchQuery::SearchQuery(const StringList& adcParams) :
+	SearchQuery()
+{
+	for(auto& p: adcParams) {
+		if(p.size() <= 2)
+			continue;
+
+		auto cmd = toCode(p[0], p[1]);
+		if(toCode('T', 'R') == cmd) {
+			root = TTHValue(p.substr(2));
+			return;
+		} else if(toCode('A', 'N') == cmd) {
+			addInclude(p.substr(2));
+		} else if(toCode('N', 'O') == cmd) {
+			exclude.emplace_back(p.substr(2));
+		} else if(toCode('E', 'X') == cmd) {
+			ext.push_back(Text::toLower(p.substr(2)));
+		} else if(toCode('G', 'R') == cmd) {
+			auto exts = AdcHub::parseSearchExts(Util::toInt(p.substr(2)));
+			ext.insert(ext.begin(), exts.begin(), exts.end());
+		} else if(toCode('R', 'X') == cmd) {
+			noExt.push_back(Text::toLower(p.substr(2)));
+		} else if(toCode('G', 'E') == cmd) {
+			gt = Util::toInt64(p.substr(2));
+		} else if(toCode('L', 'E') == cmd) {
+			lt = Util::toInt64(p.substr(2));
+		} else if(toCode('E', 'Q') == cmd) {
+			lt = gt = Util::toInt64(p.substr(2));
+		} else if(toCode('T', 'Y') == cmd) {
+			isDirectory = p[2] == '2';
+		}
+	}
+
+	prepare();
+}
+
+ShareManager::SearchQuery::SearchQuery(const string& nmdcString, int searchType, int64_t size, int fileType) :
+	SearchQuery()
+{
+	if(fileType == SearchManager::TYPE_TTH && nmdcString.compare(0, 4, "TTH:") == 0) {
+		root = TTHValue(nmdcString.substr(4));
+
+	} else {
+		StringTokenizer<string> tok(Text::toLower(nmdcString), '$');
+		for(auto& term: tok.getTokens()) {
+			if(!term.empty()) {
+				addInclude(term);
+			}
+		}
+
+		if(searchType == SearchManager::SIZE_ATLEAST) {
+			gt = size;
+		} else if(searchType == SearchManager::SIZE_ATMOST) {
+			lt = size;
+		}
+
+		switch(fileType) {
+		case SearchManager::TYPE_AUDIO: ext = AdcHub::parseSearchExts(1 << 0); break;
+		case SearchManager::TYPE_COMPRESSED: ext = AdcHub::parseSearchExts(1 << 1); break;
+		case SearchManager::TYPE_DOCUMENT: ext = AdcHub::parseSearchExts(1 << 2); break;
+		case SearchManager::TYPE_EXECUTABLE: ext = AdcHub::parseSearchExts(1 << 3); break;
+		case SearchManager::TYPE_PICTURE: ext = AdcHub::parseSearchExts(1 << 4); break;
+		case SearchManager::TYPE_VIDEO: ext = AdcHub::parseSearchExts(1 << 5); break;
+		case SearchManager::TYPE_DIRECTORY: isDirectory = true; break;
+		}
+
+		prepare();
+	}
+}
+
+void ShareManager::SearchQuery::addResult(SearchResultList& results, SearchResult* result) const {
+	results.push_back(result);
+	if(found) {
+		++*found;
+	}
+}
+
+void ShareManager::SearchQuery::prepare() {
+	includeSearch = MultiStringSearch(include);
+	excludeSearch = MultiStringSearch(exclude);
+	pending = includeSearch.getAll();
+}
+
+void ShareManager::SearchQuery::addInclude(const string& term) {
+	if(include.size() < MultiStringSearch::MAX_PATTERNS) {
+		include.emplace_back(term);
+	} else {
+		extraInclude.emplace_back(term);
+	}
+}
+
+bool ShareManager::SearchQuery::matchesExtra(const SearchResult& result) const {
+	if(extraInclude.empty()) {
+		return true;
+	}
+
+	StringTokenizer<string> tok(Text::toLower(result.getFile()), '\\');
+	auto& names = tok.getTokens();
+	for(auto& term: extraInclude) {
+		if(none_of(names.begin(), names.end(), [&term](const string& name) { return term.matchLower(name); })) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ShareManager::SearchQuery::isExcluded(const string& lowerName) {
+	return excludeSearch.matchAnyLower(lowerName);
+}
+
+bool ShareManager::SearchQuery::hasExt(const string& lowerName) {
+	if(ext.empty())
+		return true;
+	if(!noExt.empty()) {
+		ext = StringList(ext.begin(), set_difference(ext.begin(), ext.end(), noExt.begin(), noExt.end(), ext.begin()));
+		noExt.clear();
+	}
+	auto dot = lowerName.rfind('.');
+	return dot != string::npos && std::any_of(ext.cbegin(), ext.cend(), [&](const string& e) {
+		return lowerName.compare(dot + 1, string::npos, e) == 0; });
+}
+
+/**
+ * Alright, the main point here is that when searching, a search string is most often found in
+ * the filename, not directory name, so we want to make that case faster. Terms matched in a
+ * directory name are dropped from query.pending for all descendants, but not for the parents...
+ */
+void ShareManager::Directory::search(SearchResultList& results, SearchQuery& query, size_t maxResults) const noexcept {
+	if(query.isDone(results, maxResults) || query.isExcluded(getLowerName()))
+		return;
+
+	// Find any matches in the directory name and removed matched terms from the query.
+	auto const old = query.pending;
+	ScopedFunctor(([old, &query] { query.pending = old; }));
+	query.pending &= ~query.includeSearch.find(getLowerName(), query.pending);
+
+	if(!query.pending && query.ext.empty() && query.gt == 0) {
+		// We satisfied all the search words! Add the directory...
+		/// @todo send the directory hash when we have one
+		query.addResult(results, new SearchResult(SearchResult::TYPE_DIRECTORY, getSize(), getFullName(), TTHValue(string(39, 'A'))));
+		ShareManager::getInstance()->addHits(1);
+	}
+
+	if(!query.isDirectory) {
+		for(auto& i: files) {
+			if(!i.tth) { continue; }
+
+			// check the size
+			if(!(i.getSize() >= query.gt)) {
+				continue;
+			} else if(!(i.getSize() <= query.lt)) {
+				continue;
+			}
+
+			if(query.isExcluded(i.getLowerName()))
+				continue;
+
+			// check if the name matches
+			if((query.includeSearch.find(i.getLowerName(), query.pending) & query.pending) != query.pending)
+				continue;
+
+			// check extensions
+			if(!query.hasExt(i.getLowerName()))
+				continue;
+
+			query.addResult(results, new SearchResult(SearchResult::TYPE_FILE, i.getSize(),
+				getFullName() + i.getName(), *i.tth));
+			ShareManager::getInstance()->addHits(1);
+
+			if(query.isDone(results, maxResults)) { return; }
+		}
+	}
+
+	for(auto& dir: directories) {
+		dir.second->search(results, query, maxResults);
+
+		if(query.isDone(results, maxResults)) { return; }
+	}
+}
+
+namespace {
+
+/** Number of queries whose results are kept. */
+const size_t searchCacheSize = 256;
+
+/** Least time between two increments of the generation for changes made in place, in ms. */
+const uint64_t generationDelay = 5 * 1000;
+
+}
+
+SearchResultList ShareManager::search(SearchQuery&& query, size_t maxResults) noexcept {
+	SearchResultList ret;
+	search(query, maxResults, [&ret](const SearchResultList& results) { ret = results; }, false);
+	return ret;
+}
+
+void ShareManager::search(SearchQuery& query, size_t maxResults, SearchCallback&& callback, bool follow) noexcept {
+	auto start = LatencyHistogram::Clock::now();
+	ScopedFunctor(([this, start] { searchLatency.add(start); }));
+
+	auto key = query.getKey() + '\n' + Util::toString(static_cast<long long>(maxResults));
+
+	std::shared_ptr<vector<SearchCallback>> waiting;
+	{
+		Lock l(searchCacheCs);
+		auto i = searchCacheIndex.find(key);
+		if(i != searchCacheIndex.end() && i->second->generation == generation) {
+			searchCache.splice(searchCache.begin(), searchCache, i->second);
+			auto& cached = *i->second;
+			if(!cached.waiting) {
+				++searchCacheHits;
+				auto results = cached.results;
+				l.unlock();
+				addHits(results.size());
+				callback(results);
+				return;
+			}
+			if(follow) {
+				// don't hold a search thread while the identical search runs.
+				++searchCacheHits;
+				cached.waiting->push_back(move(callback));
+				return;
+			}
+			// run this one too rather than wait for the identical one; its results aren't cached.
+
+		} else {
+			if(i != searchCacheIndex.end()) {
+				searchCache.erase(i->second);
+				searchCacheIndex.erase(i);
+			}
+
+			// the generation is read before searching so that changes made meanwhile invalidate the results.
+			waiting = std::make_shared<vector<SearchCallback>>();
+			searchCache.push_front(CachedSearch { key, generation, waiting, SearchResultList() });
+			searchCacheIndex[key] = searchCache.begin();
+
+			if(searchCache.size() > searchCacheSize) {
+				// an evicted search that is still running keeps its waiting list and still answers it.
+				searchCacheIndex.erase(searchCache.back().key);
+				searchCache.pop_back();
+			}
+		}
+	}
+
+	++searchCacheMisses;
+	SearchResultList results;
+	if(query.extraInclude.empty()) {
+		results = runSearch(query, maxResults);
+	} else {
+		// the terms that didn't fit in the query are checked afterwards; don't stop at maxResults
+		// before they have thinned the results out.
+		results = runSearch(query, numeric_limits<size_t>::max());
+		results.erase(remove_if(results.begin(), results.end(), [&query](const SearchResultPtr& r) { return !query.matchesExtra(*r); }), results.end());
+		if(results.size() > maxResults) {
+			results.resize(maxResults);
+		}
+	}
+
+	vector<SearchCallback> followers;
+	if(waiting) {
+		Lock l(searchCacheCs);
+		followers.swap(*waiting);
+		auto i = searchCacheIndex.find(key);
+		if(i != searchCacheIndex.end() && i->second->waiting == waiting) {
+			i->second->results = results;
+			i->second->waiting.reset();
+		}
+	}
+
+	callback(results);
+	for(auto& f: followers) {
+		addHits(results.size());
+		f(results);
+	}
+}
+
+SearchResultList ShareManager::runSearch(SearchQuery& query, size_t maxResults) noexcept {
+	SearchResultList results;
+
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
+
+	if(query.root) {
+		auto i = s->tthIndex.find(*query.root);
+		if(i != s->tthIndex.end()) {
+			results.push_back(new SearchResult(SearchResult::TYPE_FILE, i->second->getSize(),
+				i->second->getParent()->getFullName() + i->second->getName(), *i->second->tth));
+			addHits(1);
+		}
+		return results;
+	}
+
+	for(auto& i: query.include) {
+		if(!s->bloom.match(i.getPattern()))
+			return results;
+	}
+	for(auto& i: query.extraInclude) {
+		if(!s->bloom.match(i.getPattern()))
+			return results;
+	}
+
+	if(s->searchIndex.search(results, query, maxResults)) {
+		addHits(results.size());
+
+#if DCPP_VERIFY_SEARCH_INDEX
+		if(results.size() < maxResults) {
+			auto oldHits = getHits();
+			SearchResultList walked;
+			for(auto& dir: s->directories) {
+				dir.second->search(walked, query, maxResults);
+			}
+			setHits(oldHits);
+
+			StringList a, b;
+			for(auto& i: results) { a.push_back(i->getFile()); }
+			for(auto& i: walked) { b.push_back(i->getFile()); }
+			sort(a.begin(), a.end());
+			sort(b.begin(), b.end());
+			if(a != b) {
+				dcdebug("Indexed search returned %u results, tree walk returned %u\n", a.size(), b.size());
+				dcassert(0);
+			}
+		}
+#endif
+
+		return results;
+	}
+
+	if(s->directories.size() < 2 || searchExecutor->getThreads() == 0) {
+		for(auto& dir: s->directories) {
+			dir.second->search(results, query, maxResults);
+
+			if(results.size() >= maxResults) { return results; }
+		}
+		return results;
+	}
+
+	// walk the share roots in parallel; they all stop once they have found enough between them.
+	std::atomic<size_t> found(0);
+	vector<SearchResultList> parts(s->directories.size());
+	vector<SearchExecutor::Task> tasks;
+	for(auto& dir: s->directories) {
+		tasks.push_back([&query, &found, &part = parts[tasks.size()], dir = dir.second.get(), maxResults] {
+			SearchQuery q(query);
+			q.found = &found;
+			dir->search(part, q, maxResults);
+		});
+	}
+	searchExecutor->run(tasks);
+
+	for(auto& part: parts) {
+		auto n = std::min(part.size(), maxResults - results.size());
+		results.insert(results.end(), part.begin(), part.begin() + n);
+	}
+	return results;
+}
+
+namespace {
+
+/** Collect the distinct byte trigrams of a lower-cased string. */
+void getTrigrams(const string& s, vector<uint32_t>& grams) {
+	grams.clear();
+	if(s.size() < 3) {
+		return;
+	}
+	auto p = reinterpret_cast<const uint8_t*>(s.data());
+	for(size_t i = 0, n = s.size() - 2; i < n; ++i) {
+		grams.push_back(p[i] | (p[i + 1] << 8) | (p[i + 2] << 16));
+	}
+	sort(grams.begin(), grams.end());
+	grams.erase(unique(grams.begin(), grams.end()), grams.end());
+}
+
+template<typename RangesT>
+bool inRanges(const RangesT& ranges, uint32_t id) {
+	auto i = upper_bound(ranges.begin(), ranges.end(), id, [](uint32_t id, const typename RangesT::value_type& r) { return id < r.first; });
+	return i != ranges.begin() && id < (--i)->second;
+}
+
+template<typename RangesT>
+size_t countRanges(const RangesT& ranges) {
+	size_t n = 0;
+	for(auto& r: ranges) {
+		n += r.second - r.first;
+	}
+	return n;
+}
+
+/** Whether each of the wanted terms matches the name of the given directory or of one of its
+parents. */
+template<typename DirT>
+bool matchesPath(const MultiStringSearch& terms, MultiStringSearch::Mask wanted, const DirT* dir) {
+	for(; wanted && dir; dir = dir->getParent()) {
+		wanted &= ~terms.find(dir->getLowerName(), wanted);
+	}
+	return !wanted;
+}
+
+} // unnamed namespace
+
+size_t ShareManager::SearchIndex::getMemoryUsage() const noexcept {
+	auto postings = [](const Postings& p) { return p.capacity() * sizeof(uint32_t); };
+	auto postingMap = [&postings](const PostingMap& map) {
+		size_t ret = map.bucket_count() * sizeof(void*);
+		for(auto& i: map) {
+			ret += sizeof(i) + 2 * sizeof(void*) + postings(i.second);
+		}
+		return ret;
+	};
+
+	size_t ret = files.capacity() * sizeof(files[0]) + dirs.capacity() * sizeof(DirEntry) +
+		postingMap(fileGrams) + postingMap(dirGrams) + sizes.capacity() * sizeof(sizes[0]) +
+		pending.capacity() * sizeof(pending[0]) + pendingDirs.capacity() * sizeof(pendingDirs[0]) +
+		dirIds.bucket_count() * sizeof(void*) + dirIds.size() * (sizeof(*dirIds.begin()) + 2 * sizeof(void*)) +
+		extFiles.bucket_count() * sizeof(void*);
+	for(auto& i: extFiles) {
+		ret += sizeof(i) + 2 * sizeof(void*) + getHeapSize(i.first) + postings(i.second);
+	}
+	return ret;
+}
+
+void ShareManager::SearchIndex::clear() {
+	files.clear();
+	dirs.clear();
+	dirIds.clear();
+	fileGrams.clear();
+	dirGrams.clear();
+	extFiles.clear();
+	sizes.clear();
+	pending.clear();
+	pendingDirs.clear();
+}
+
+void ShareManager::SearchIndex::build(const DirMap& roots) {
+	clear();
+
+	Postings grams;
+	for(auto& i: roots) {
+		add(*i.second, grams);
+	}
+
+	sort(sizes.begin(), sizes.end());
+}
+
+void ShareManager::SearchIndex::add(const Directory& dir, Postings& grams) {
+	auto id = static_cast<uint32_t>(dirs.size());
+	dirs.push_back(DirEntry { &dir, static_cast<uint32_t>(files.size()), 0, 0 });
+	dirIds[&dir] = id;
+
+	getTrigrams(dir.getLowerName(), grams);
+	for(auto gram: grams) {
+		dirGrams[gram].push_back(id);
+	}
+
+	for(auto& f: dir.files) {
+		auto fileId = static_cast<uint32_t>(files.size());
+		files.push_back(&f);
+
+		auto& lower = f.getLowerName();
+		getTrigrams(lower, grams);
+		for(auto gram: grams) {
+			fileGrams[gram].push_back(fileId);
+		}
+
+		auto ext = Util::getFileExt(lower);
+		if(!ext.empty()) {
+			extFiles[ext.substr(1)].push_back(fileId);
+		}
+		sizes.emplace_back(f.getSize(), fileId);
+	}
+
+	for(auto& i: dir.directories) {
+		add(*i.second, grams);
+	}
+
+	dirs[id].fileEnd = static_cast<uint32_t>(files.size());
+	dirs[id].dirEnd = static_cast<uint32_t>(dirs.size());
+}
+
+void ShareManager::SearchIndex::addPending(const Directory& dir) {
+	pendingDirs.push_back(&dir);
+
+	for(auto& f: dir.files) {
+		pending.push_back(&f);
+	}
+
+	for(auto& i: dir.directories) {
+		addPending(*i.second);
+	}
+}
+
+bool ShareManager::SearchIndex::needsRebuild() const {
+	return pending.size() + pendingDirs.size() > std::max(files.size() / 8, static_cast<size_t>(4096));
+}
+
+optional<uint32_t> ShareManager::SearchIndex::findEntry(const Directory& dir) const {
+	auto i = dirIds.find(&dir);
+	if(i == dirIds.end()) {
+		return none;
+	}
+	return i->second;
+}
 
-		for(auto& it2: root->directories) {
-			it2.second->toXml(sos, indent, tmp, recurse ? -1 : 0);
+void ShareManager::SearchIndex::removePending(const Directory& dir, bool recursive) {
+	auto isUnder = [&dir, recursive](const Directory* d) -> bool {
+		if(!recursive) {
+			return d == &dir;
 		}
-		root->filesToXml(sos, indent, tmp);
-	}
+		for(; d; d = d->getParent()) {
+			if(d == &dir) {
+				return true;
+			}
+		}
+		return false;
+	};
 
-	xml += "</FileListing>";
-	return new MemoryInputStream(xml);
+	pending.erase(remove_if(pending.begin(), pending.end(), [&](const Directory::File* f) { return isUnder(f->getParent()); }), pending.end());
+	if(recursive) {
+		pendingDirs.erase(remove_if(pendingDirs.begin(), pendingDirs.end(), isUnder), pendingDirs.end());
+	}
 }
 
-/* params for partial file lists - when any of these params is not satisfied, an incomplete dir is
-returned rather than a full dir list. */
-const int8_t maxLevel = 2;
-const size_t maxItemsPerLevel[maxLevel] = { 16, 4 };
+void ShareManager::SearchIndex::removeFiles(const Directory& dir) {
+	removePending(dir, false);
 
-#define LITERAL(n) n, sizeof(n)-1
-void ShareManager::Directory::toXml(OutputStream& xmlFile, string& indent, string& tmp2, int8_t level) const {
-	xmlFile.write(indent);
-	xmlFile.write(LITERAL("<Directory Name=\""));
-	xmlFile.write(SimpleXML::escape(name, tmp2, true));
+	auto id = findEntry(dir);
+	if(!id) {
+		return;
+	}
 
-	if(level < 0 || (level < maxLevel && directories.size() + files.size() <= maxItemsPerLevel[level])) {
-		xmlFile.write(LITERAL("\">\r\n"));
+	// the directory's own files come first, followed by those of its sub-directories.
+	auto& d = dirs[*id];
+	auto end = *id + 1 < d.dirEnd ? dirs[*id + 1].fileBegin : d.fileEnd;
+	fill(files.begin() + d.fileBegin, files.begin() + end, nullptr);
+}
 
-		indent += '\t';
-		if(level >= 0)
-			++level;
+void ShareManager::SearchIndex::removeTree(const Directory& dir) {
+	removePending(dir, true);
 
-		for(auto& i: directories) {
-			i.second->toXml(xmlFile, indent, tmp2, level);
+	auto id = findEntry(dir);
+	if(!id) {
+		return;
+	}
+
+	auto& d = dirs[*id];
+	fill(files.begin() + d.fileBegin, files.begin() + d.fileEnd, nullptr);
+	for(auto i = *id, end = d.dirEnd; i < end; ++i) {
+		// the address may be taken by a new directory once this one is gone.
+		if(dirs[i].dir) {
+			dirIds.erase(dirs[i].dir);
 		}
-		filesToXml(xmlFile, indent, tmp2);
+		dirs[i].dir = nullptr;
+	}
+}
 
-		if(level >= 0)
-			--level;
-		indent.erase(indent.length()-1);
+void ShareManager::SearchIndex::lookup(const PostingMap& map, const string& pattern, Postings& ids) const {
+	ids.clear();
 
-		xmlFile.write(indent);
-		xmlFile.write(LITERAL("</Directory>\r\n"));
+	Postings grams;
+	getTrigrams(pattern, grams);
 
-	} else {
-		if(directories.empty() && files.empty()) {
-			xmlFile.write(LITERAL("\" />\r\n"));
-		} else {
-			xmlFile.write(LITERAL("\" Incomplete=\"1\" />\r\n"));
+	vector<const Postings*> lists;
+	for(auto gram: grams) {
+		auto i = map.find(gram);
+		if(i == map.end()) {
+			return;
 		}
+		lists.push_back(&i->second);
 	}
-}
 
-void ShareManager::Directory::filesToXml(OutputStream& xmlFile, string& indent, string& tmp2) const {
-	for(auto& f: files) {
-		if(!f.tth) { continue; }
-		xmlFile.write(indent);
-		xmlFile.write(LITERAL("<File Name=\""));
-		xmlFile.write(SimpleXML::escape(f.getName(), tmp2, true));
-		xmlFile.write(LITERAL("\" Size=\""));
-		xmlFile.write(Util::toString(f.getSize()));
-		xmlFile.write(LITERAL("\" TTH=\""));
-		tmp2.clear();
-		xmlFile.write(f.tth->toBase32(tmp2));
-		xmlFile.write(LITERAL("\"/>\r\n"));
+	// intersect the shortest lists first to keep the intermediate results small.
+	sort(lists.begin(), lists.end(), [](const Postings* a, const Postings* b) { return a->size() < b->size(); });
+
+	ids = *lists.front();
+	Postings tmp;
+	for(auto i = lists.begin() + 1; i != lists.end() && !ids.empty(); ++i) {
+		tmp.clear();
+		std::set_intersection(ids.begin(), ids.end(), (*i)->begin(), (*i)->end(), back_inserter(tmp));
+		ids.swap(tmp);
 	}
 }
 
-ShareManager::SearchQuery::SearchQuery() :
-	include(&includeInit),
-	gt(0),
-	lt(numeric_limits<int64_t>::max()),
-	isDirectory(false)
-{
-}
+void ShareManager::SearchIndex::getHits(const StringSearch& term, Hits& hits) const {
+	// trigrams don't carry positions; confirm each candidate against the actual name.
+	lookup(fileGrams, term.getPattern(), hits.files);
+	hits.files.erase(remove_if(hits.files.begin(), hits.files.end(),
+		[&](uint32_t id) { return !files[id] || !term.matchLower(files[id]->getLowerName()); }), hits.files.end());
 
-namespace {
-	inline uint16_t toCode(char a, char b) { return (uint16_t)a | ((uint16_t)b)<<8; }
-}
-ShareManager::SearchQuery::SearchQuery(const StringList& adcParams) :
-	SearchQuery()
-{
-	for(auto& p: adcParams) {
-		if(p.size() <= 2)
-			continue;
+	Postings dirIds;
+	lookup(dirGrams, term.getPattern(), dirIds);
 
-		auto cmd = toCode(p[0], p[1]);
-		if(toCode('T', 'R') == cmd) {
-			root = TTHValue(p.substr(2));
-			return;
-		} else if(toCode('A', 'N') == cmd) {
-			includeInit.emplace_back(p.substr(2));
-		} else if(toCode('N', 'O') == cmd) {
-			exclude.emplace_back(p.substr(2));
-		} else if(toCode('E', 'X') == cmd) {
-			ext.push_back(Text::toLower(p.substr(2)));
-		} else if(toCode('G', 'R') == cmd) {
-			auto exts = AdcHub::parseSearchExts(Util::toInt(p.substr(2)));
-			ext.insert(ext.begin(), exts.begin(), exts.end());
-		} else if(toCode('R', 'X') == cmd) {
-			noExt.push_back(Text::toLower(p.substr(2)));
-		} else if(toCode('G', 'E') == cmd) {
-			gt = Util::toInt64(p.substr(2));
-		} else if(toCode('L', 'E') == cmd) {
-			lt = Util::toInt64(p.substr(2));
-		} else if(toCode('E', 'Q') == cmd) {
-			lt = gt = Util::toInt64(p.substr(2));
-		} else if(toCode('T', 'Y') == cmd) {
-			isDirectory = p[2] == '2';
+	// ids are in tree order so ranges of sub-directories are nested within those of their parents.
+	for(auto id: dirIds) {
+		auto& d = dirs[id];
+		if(!d.dir || !term.matchLower(d.dir->getLowerName())) {
+			continue;
+		}
+		if(hits.dirRanges.empty() || id >= hits.dirRanges.back().second) {
+			hits.dirRanges.emplace_back(id, d.dirEnd);
+		}
+		if(d.fileBegin < d.fileEnd && (hits.fileRanges.empty() || d.fileBegin >= hits.fileRanges.back().second)) {
+			hits.fileRanges.emplace_back(d.fileBegin, d.fileEnd);
 		}
 	}
 }
 
-ShareManager::SearchQuery::SearchQuery(const string& nmdcString, int searchType, int64_t size, int fileType) :
-	SearchQuery()
-{
-	if(fileType == SearchManager::TYPE_TTH && nmdcString.compare(0, 4, "TTH:") == 0) {
-		root = TTHValue(nmdcString.substr(4));
+bool ShareManager::SearchIndex::filter(const SearchQuery& query, size_t limit, Postings& ids, bool& extChecked) const {
+	const auto none = numeric_limits<size_t>::max();
 
-	} else {
-		StringTokenizer<string> tok(Text::toLower(nmdcString), '$');
-		for(auto& term: tok.getTokens()) {
-			if(!term.empty()) {
-				includeInit.emplace_back(term);
+	size_t extCount = none;
+	vector<const Postings*> extLists;
+	if(!query.ext.empty()) {
+		extCount = 0;
+		for(auto& ext: query.ext) {
+			if(find(query.noExt.begin(), query.noExt.end(), ext) != query.noExt.end()) {
+				continue;
+			}
+			auto i = extFiles.find(ext);
+			if(i != extFiles.end()) {
+				extLists.push_back(&i->second);
+				extCount += i->second.size();
 			}
 		}
+	}
 
-		if(searchType == SearchManager::SIZE_ATLEAST) {
-			gt = size;
-		} else if(searchType == SearchManager::SIZE_ATMOST) {
-			lt = size;
-		}
-
-		switch(fileType) {
-		case SearchManager::TYPE_AUDIO: ext = AdcHub::parseSearchExts(1 << 0); break;
-		case SearchManager::TYPE_COMPRESSED: ext = AdcHub::parseSearchExts(1 << 1); break;
-		case SearchManager::TYPE_DOCUMENT: ext = AdcHub::parseSearchExts(1 << 2); break;
-		case SearchManager::TYPE_EXECUTABLE: ext = AdcHub::parseSearchExts(1 << 3); break;
-		case SearchManager::TYPE_PICTURE: ext = AdcHub::parseSearchExts(1 << 4); break;
-		case SearchManager::TYPE_VIDEO: ext = AdcHub::parseSearchExts(1 << 5); break;
-		case SearchManager::TYPE_DIRECTORY: isDirectory = true; break;
-		}
+	size_t sizeCount = none;
+	auto sizeBegin = sizes.end(), sizeEnd = sizes.end();
+	if(query.gt > 0 || query.lt < numeric_limits<int64_t>::max()) {
+		sizeBegin = lower_bound(sizes.begin(), sizes.end(), make_pair(query.gt, static_cast<uint32_t>(0)));
+		sizeEnd = upper_bound(sizeBegin, sizes.end(), make_pair(query.lt, numeric_limits<uint32_t>::max()));
+		sizeCount = sizeEnd - sizeBegin;
 	}
-}
 
-bool ShareManager::SearchQuery::isExcluded(const string& str) {
-	for(auto& i: exclude) {
-		if(i.match(str))
-			return true;
+	auto count = std::min(extCount, sizeCount);
+	if(count == none || count > limit) {
+		return false;
 	}
-	return false;
-}
 
-bool ShareManager::SearchQuery::hasExt(const string& name) {
-	if(ext.empty())
-		return true;
-	if(!noExt.empty()) {
-		ext = StringList(ext.begin(), set_difference(ext.begin(), ext.end(), noExt.begin(), noExt.end(), ext.begin()));
-		noExt.clear();
+	// go with the most selective filter; the other one is checked per file.
+	ids.clear();
+	ids.reserve(count);
+	if(extCount <= sizeCount) {
+		for(auto l: extLists) {
+			ids.insert(ids.end(), l->begin(), l->end());
+		}
+		extChecked = query.noExt.empty();
+	} else {
+		for(auto i = sizeBegin; i != sizeEnd; ++i) {
+			ids.push_back(i->second);
+		}
 	}
-	auto fileExt = Util::getFileExt(name);
-	return !fileExt.empty() && std::find(ext.cbegin(), ext.cend(), Text::toLower(fileExt.substr(1))) != ext.cend();
-}
 
-/**
- * Alright, the main point here is that when searching, a search string is most often found in
- * the filename, not directory name, so we want to make that case faster. Also, we want to
- * avoid changing StringLists unless we absolutely have to --> this should only be done if a string
- * has been matched in the directory name. This new stringlist should also be used in all descendants,
- * but not the parents...
- */
-void ShareManager::Directory::search(SearchResultList& results, SearchQuery& query, size_t maxResults) const noexcept {
-	if(query.isExcluded(name))
-		return;
+	sort(ids.begin(), ids.end());
+	ids.erase(unique(ids.begin(), ids.end()), ids.end());
+	return true;
+}
 
-	// Find any matches in the directory name and removed matched terms from the query.
-	unique_ptr<StringSearch::List> newTerms;
+bool ShareManager::SearchIndex::search(SearchResultList& results, SearchQuery& query, size_t maxResults) const {
+	const auto& terms = query.include;
 
-	for(auto& term: *query.include) {
-		if(term.match(name)) {
-			if(!newTerms) {
-				newTerms.reset(new StringSearch::List(*query.include));
-			}
-			newTerms->erase(remove(newTerms->begin(), newTerms->end(), term), newTerms->end());
+	vector<Hits> hits(terms.size());
+	vector<bool> indexed(terms.size());
+	bool usable = false;
+	// the terms too short to be looked up; they are matched against names in one pass.
+	MultiStringSearch::Mask unindexed = 0;
+	for(size_t i = 0; i < terms.size(); ++i) {
+		if(terms[i].getPattern().size() >= 3) {
+			getHits(terms[i], hits[i]);
+			indexed[i] = true;
+			usable = true;
+		} else {
+			unindexed |= MultiStringSearch::Mask(1) << i;
 		}
 	}
 
-	auto const old = query.include;
-	ScopedFunctor(([old, &query] { query.include = old; }));
-	if(newTerms) {
-		query.include = newTerms.get();
+	// without such filters, a query with no indexed term would match every directory.
+	if(!usable && query.ext.empty() && query.gt == 0) {
+		return false;
 	}
 
-	if(query.include->empty() && query.ext.empty() && query.gt == 0) {
-		// We satisfied all the search words! Add the directory...
-		/// @todo send the directory hash when we have one
-		results.push_back(new SearchResult(SearchResult::TYPE_DIRECTORY, getSize(), getFullName(), TTHValue(string(39, 'A'))));
-		ShareManager::getInstance()->addHits(1);
-	}
+	auto isExcluded = [&query](const Directory* d) -> bool {
+		for(; d; d = d->getParent()) {
+			if(query.isExcluded(d->getLowerName())) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	if(query.ext.empty() && query.gt == 0) {
+		// pick the term that matched the fewest directories to drive the enumeration.
+		size_t best = terms.size();
+		for(size_t i = 0; i < terms.size(); ++i) {
+			if(indexed[i] && (best == terms.size() || countRanges(hits[i].dirRanges) < countRanges(hits[best].dirRanges))) {
+				best = i;
+			}
+		}
 
-	if(!query.isDirectory) {
-		for(auto& i: files) {
-			if(!i.tth) { continue; }
+		for(auto& r: hits[best].dirRanges) {
+			for(auto id = r.first; id < r.second; ++id) {
+				auto dir = dirs[id].dir;
+				if(!dir) {
+					continue;
+				}
 
-			// check the size
-			if(!(i.getSize() >= query.gt)) {
-				continue;
-			} else if(!(i.getSize() <= query.lt)) {
-				continue;
+				size_t i = 0;
+				for(; i < terms.size() && (i == best || !indexed[i] || inRanges(hits[i].dirRanges, id)); ++i)
+					;	// Empty
+				if(i != terms.size() || !matchesPath(query.includeSearch, unindexed, dir) || isExcluded(dir)) {
+					continue;
+				}
+
+				/// @todo send the directory hash when we have one
+				results.push_back(new SearchResult(SearchResult::TYPE_DIRECTORY, dir->getSize(), dir->getFullName(), TTHValue(string(39, 'A'))));
+				if(results.size() >= maxResults) { return true; }
 			}
+		}
 
-			if(query.isExcluded(i.getName()))
+		for(auto dir: pendingDirs) {
+			if(!matchesPath(query.includeSearch, query.includeSearch.getAll(), dir) || isExcluded(dir)) {
 				continue;
+			}
 
-			// check if the name matches
-			auto j = query.include->begin();
-			for(; j != query.include->end() && j->match(i.getName()); ++j)
-				;	// Empty
-			if(j != query.include->end())
-				continue;
+			results.push_back(new SearchResult(SearchResult::TYPE_DIRECTORY, dir->getSize(), dir->getFullName(), TTHValue(string(39, 'A'))));
+			if(results.size() >= maxResults) { return true; }
+		}
+	}
 
-			// check extensions
-			if(!query.hasExt(i.getName()))
-				continue;
+	if(query.isDirectory) {
+		return true;
+	}
 
-			results.push_back(new SearchResult(SearchResult::TYPE_FILE, i.getSize(),
-				getFullName() + i.getName(), *i.tth));
-			ShareManager::getInstance()->addHits(1);
+	// whether each of the wanted terms matches the name of the file or that of a parent.
+	auto matchesFile = [&query](MultiStringSearch::Mask wanted, const Directory::File& f) -> bool {
+		wanted &= ~query.includeSearch.find(f.getLowerName(), wanted);
+		return matchesPath(query.includeSearch, wanted, f.getParent());
+	};
 
-			if(results.size() >= maxResults) { return; }
+	bool extChecked = false;
+	auto matches = [&](const Directory::File& f) -> bool {
+		if(!f.tth || f.getSize() < query.gt || f.getSize() > query.lt) {
+			return false;
+		}
+		if(query.isExcluded(f.getLowerName()) || isExcluded(f.getParent())) {
+			return false;
+		}
+		return extChecked || query.hasExt(f.getLowerName());
+	};
+
+	size_t best = terms.size();
+	auto bestCount = numeric_limits<size_t>::max();
+	for(size_t i = 0; i < terms.size(); ++i) {
+		auto count = hits[i].files.size() + countRanges(hits[i].fileRanges);
+		if(indexed[i] && count < bestCount) {
+			best = i;
+			bestCount = count;
 		}
 	}
 
-	for(auto& dir: directories) {
-		dir.second->search(results, query, maxResults);
+	Postings candidates;
+	if(filter(query, bestCount, candidates, extChecked)) {
+		// the extension or size filter narrows things down more than any term; check all terms.
+		best = terms.size();
 
-		if(results.size() >= maxResults) { return; }
+	} else {
+		dcassert(best != terms.size());
+		candidates = hits[best].files;
+		for(auto& r: hits[best].fileRanges) {
+			for(auto id = r.first; id < r.second; ++id) {
+				candidates.push_back(id);
+			}
+		}
+		sort(candidates.begin(), candidates.end());
+		candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
 	}
-}
-
-SearchResultList ShareManager::search(SearchQuery&& query, size_t maxResults) noexcept {
-	SearchResultList results;
 
-	Lock l(cs);
+	for(auto id: candidates) {
+		if(!files[id]) {
+			continue;
+		}
+		auto& f = *files[id];
 
-	if(query.root) {
-		auto i = tthIndex.find(*query.root);
-		if(i != tthIndex.end()) {
-			results.push_back(new SearchResult(SearchResult::TYPE_FILE, i->second->getSize(),
-				i->second->getParent()->getFullName() + i->second->getName(), *i->second->tth));
-			addHits(1);
+		size_t i = 0;
+		for(; i < terms.size(); ++i) {
+			if(i != best && indexed[i] && !binary_search(hits[i].files.begin(), hits[i].files.end(), id) && !inRanges(hits[i].fileRanges, id)) {
+				break;
+			}
+		}
+		if(i != terms.size() || !matchesFile(unindexed, f) || !matches(f)) {
+			continue;
 		}
-		return results;
-	}
 
-	for(auto& i: query.includeInit) {
-		if(!bloom.match(i.getPattern()))
-			return results;
+		results.push_back(new SearchResult(SearchResult::TYPE_FILE, f.getSize(), f.getFullName(), *f.tth));
+		if(results.size() >= maxResults) { return true; }
 	}
 
-	for(auto& dir: directories) {
-		dir.second->search(results, query, maxResults);
+	// pending files aren't in the extension index.
+	extChecked = false;
+	for(auto f: pending) {
+		if(!matchesFile(query.includeSearch.getAll(), *f) || !matches(*f)) {
+			continue;
+		}
 
-		if(results.size() >= maxResults) { return results; }
+		results.push_back(new SearchResult(SearchResult::TYPE_FILE, f->getSize(), f->getFullName(), *f->tth));
+		if(results.size() >= maxResults) { return true; }
 	}
 
-	return results;
+	return true;
 }
 
 SearchResultList ShareManager::search(const StringList& adcParams, size_t maxResults) noexcept {
@@ -1342,11 +3468,86 @@ SearchResultList ShareManager::search(const string& nmdcString, int searchType,
 	return search(SearchQuery(nmdcString, searchType, size, fileType), maxResults);
 }
 
-ShareManager::Directory::Ptr ShareManager::getDirectory(const string& realPath) noexcept {
+namespace {
+
+/** Most files whose path is kept for TTH searches. */
+const size_t tthResultsSize = 4096;
+
+}
+
+std::shared_ptr<const ShareManager::TTHResult> ShareManager::findTTH(const TTHValue& root) noexcept {
+	auto start = LatencyHistogram::Clock::now();
+	ScopedFunctor(([this, start] { tthSearchLatency.add(start); }));
+
+	SharedLock l(treeCs);
+	auto s = getSnapshot();
+
+	{
+		Lock rl(s->tthResultsCs);
+		auto i = s->tthResultsIndex.find(root);
+		if(i != s->tthResultsIndex.end()) {
+			s->tthResults.splice(s->tthResults.begin(), s->tthResults, i->second);
+			addHits(1);
+			return i->second->second;
+		}
+	}
+
+	auto i = s->tthIndex.find(root);
+	if(i == s->tthIndex.end()) {
+		return nullptr;
+	}
+	auto ret = std::make_shared<TTHResult>();
+	ret->size = i->second->getSize();
+	ret->file = i->second->getParent()->getFullName() + i->second->getName();
+	addHits(1);
+
+	// still under the snapshot lock, so that the in-place update of the index can't come in between.
+	Lock rl(s->tthResultsCs);
+	if(s->tthResultsIndex.find(root) == s->tthResultsIndex.end()) {
+		s->tthResults.emplace_front(root, ret);
+		s->tthResultsIndex[root] = s->tthResults.begin();
+		if(s->tthResults.size() > tthResultsSize) {
+			s->tthResultsIndex.erase(s->tthResults.back().first);
+			s->tthResults.pop_back();
+		}
+	}
+	return ret;
+}
+
+void ShareManager::searchAsync(const StringList& adcParams, size_t maxResults, SearchCallback&& callback) noexcept {
+	searchAsync(SearchQuery(adcParams), maxResults, move(callback));
+}
+
+void ShareManager::searchAsync(const string& nmdcString, int searchType, int64_t size, int fileType, size_t maxResults,
+	SearchCallback&& callback) noexcept
+{
+	searchAsync(SearchQuery(nmdcString, searchType, size, fileType), maxResults, move(callback));
+}
+
+void ShareManager::searchAsync(SearchQuery&& query, size_t maxResults, SearchCallback&& callback) noexcept {
+	auto task = [this, query, maxResults, callback]() mutable {
+#if DCPP_TIME_SEARCHES
+		auto start = GET_TICK();
+		ScopedFunctor(([start] {
+			LogManager::getInstance()->message("The search took " + Util::toString(GET_TICK() - start) + " ms");
+		}));
+#endif
+
+		search(query, maxResults, move(callback), true);
+	};
+
+	if(!searchExecutor->submit(move(task))) {
+		++droppedSearches;
+		dcdebug("Too many searches waiting, dropping one\n");
+	}
+}
+
+ShareManager::Directory::Ptr ShareManager::getDirectory(const Snapshot& s, const string& realPath) const noexcept {
+	Lock l(cs);
 	for(auto& mi: shares) {
 		if(Util::strnicmp(realPath, mi.first, mi.first.length()) == 0) {
-			auto di = directories.find(mi.second);
-			if(di == directories.end()) {
+			auto di = s.directories.find(mi.second);
+			if(di == s.directories.end()) {
 				return nullptr;
 			}
 			auto d = di->second;
@@ -1376,9 +3577,9 @@ ShareManager::Directory::Ptr ShareManager::getDirectory(const string& realPath)
 	return nullptr;
 }
 
-optional<const ShareManager::Directory::File&> ShareManager::getFile(const string& realPath, Directory::Ptr d) noexcept {
+optional<const ShareManager::Directory::File&> ShareManager::getFile(const Snapshot& s, const string& realPath, Directory::Ptr d) const noexcept {
 	if(!d) {
-		d = getDirectory(realPath);
+		d = getDirectory(s, realPath);
 		if(!d) {
 			return none;
 		}
@@ -1433,35 +3634,62 @@ void ShareManager::on(QueueManagerListener::FileMoved, const string& realPath) n
 			return;
 		}
 
-		Lock l(cs);
+		WriteLock l(treeCs);
+		auto s = getSnapshot();
 		// Check if the finished download dir is supposed to be shared
-		auto dir = getDirectory(realPath);
+		auto dir = getDirectory(*s, realPath);
 		if(dir) {
 			Directory::File f(Util::getFileName(realPath), size, dir,
 				HashManager::getInstance()->getTTH(realPath, size, 0));
 			f.validateName(Util::getFilePath(realPath));
-			dir->files.insert(move(f));
+			auto ins = dir->files.insert(move(f));
+			if(ins.second) {
+				s->searchIndex.addPending(*ins.first);
+				changed = true;
+				dropPartialLists(*dir);
+			}
 		}
 	}
 }
 
 void ShareManager::on(HashManagerListener::TTHDone, const string& realPath, const TTHValue& root) noexcept {
-	Lock l(cs);
-	auto f = getFile(realPath);
+	WriteLock l(treeCs);
+	auto s = getSnapshot();
+	auto f = getFile(*s, realPath);
 	if(f) {
-		if(f->tth && root != f->tth)
-			tthIndex.erase(*f->tth);
+		if(f->tth && root != f->tth) {
+			s->tthIndex.erase(*f->tth);
+			s->hashBlooms.clear();
+			s->dropTTHResult(*f->tth);
+		}
 		const_cast<Directory::File&>(*f).tth = root;
-		tthIndex[*f->tth] = &f.get();
+		s->tthIndex[*f->tth] = &f.get();
+		s->dropTTHResult(root);
+		for(auto& b: s->hashBlooms) {
+			b.second.add(root);
+		}
+		s->bloom.add(f->getLowerName());
+		changed = true;
+		dropPartialLists(*f->getParent());
 
 		setDirty();
 		forceXmlRefresh = true;
 	}
 }
 
+void ShareManager::on(TimerManagerListener::Second, uint64_t tick) noexcept {
+	// let the search caches serve a few seconds of changes at once, rather than go stale with every
+	// file hashed.
+	if(tick >= lastChange + generationDelay && changed.exchange(false)) {
+		++generation;
+		lastChange = tick;
+	}
+}
+
 void ShareManager::on(TimerManagerListener::Minute, uint64_t tick) noexcept {
 	if(SETTING(AUTO_REFRESH_TIME) > 0) {
-		if(lastFullUpdate + SETTING(AUTO_REFRESH_TIME) * 60 * 1000 <= tick) {
+		// no need to rescan what the monitor keeps up to date.
+		if(lastFullUpdate + SETTING(AUTO_REFRESH_TIME) * 60 * 1000 <= tick && (!monitor.isReliable() || hasMergedShares())) {
 			refresh(true, true);
 		}
 	}
@@ -26,22 +26,30 @@
 #include <set>
 #include <unordered_map>
 
+#include <boost/flyweight.hpp>
 #include <boost/optional.hpp>
 
 #include "TimerManager.h"
 #include "SearchManager.h"
 #include "SettingsManager.h"
 #include "HashManagerListener.h"
+#include "DirectoryMonitor.h"
 #include "QueueManagerListener.h"
 
 #include "Exception.h"
 #include "CriticalSection.h"
+#include "MultiStringSearch.h"
 #include "StringSearch.h"
 #include "Singleton.h"
 #include "BloomFilter.h"
+#include "CompactTree.h"
 #include "FastAlloc.h"
+#include "File.h"
+#include "HashBloom.h"
+#include "LatencyHistogram.h"
 #include "MerkleTree.h"
 #include "Pointer.h"
+#include "SearchExecutor.h"
 #include "StringMatch.h"
 
 namespace dcpp {
@@ -65,7 +73,7 @@ class MemoryInputStream;
 
 struct ShareLoader;
 class ShareManager : public Singleton<ShareManager>, private SettingsManagerListener, private Thread, private TimerManagerListener,
-	private HashManagerListener, private QueueManagerListener
+	private HashManagerListener, private QueueManagerListener, private DirectoryMonitorListener
 {
 public:
 	/**
@@ -85,14 +93,45 @@ public:
 	optional<TTHValue> getTTH(const string& virtualFile) const;
 
 	void refresh(bool dirs = false, bool aUpdate = true, bool block = false, function<void (float)> progressF = nullptr) noexcept;
+	/** Publish the share as it was when last scanned, from the share cache, and check it against
+	the disk in the background; fall back to a blocking refresh when there's no usable cache. */
+	void startup(function<void (float)> progressF) noexcept;
 	void setDirty() { xmlDirty = true; }
 
 	SearchResultList search(const StringList& adcParams, size_t maxResults) noexcept;
 	SearchResultList search(const string& nmdcString, int searchType, int64_t size, int fileType, size_t maxResults) noexcept;
 
+	struct TTHResult {
+		int64_t size;
+		string file; /// virtual path, as in SearchResult::getFile
+	};
+	/** Look a file up for a TTH search; skips the query parsing and the search cache of search(),
+	and keeps the paths of the files found recently.
+	@return null when no shared file has that TTH. */
+	std::shared_ptr<const TTHResult> findTTH(const TTHValue& root) noexcept;
+
+	typedef function<void (const SearchResultList&)> SearchCallback;
+	/** Run the search on a search thread, then call the callback there with the results. The
+	search is dropped, and the callback never called, when too many searches are waiting. */
+	void searchAsync(const StringList& adcParams, size_t maxResults, SearchCallback&& callback) noexcept;
+	void searchAsync(const string& nmdcString, int searchType, int64_t size, int fileType, size_t maxResults,
+		SearchCallback&& callback) noexcept;
+
 	StringPairList getDirectories() const noexcept;
 
 	MemoryInputStream* generatePartialList(const string& dir, bool recurse) const;
+	/** The partial list compressed with zlib, as sent by ZL1 transfers; reading it reports the
+	uncompressed size as consumed.
+	@param size Set to the uncompressed size of that same list. */
+	InputStream* getCompressedPartialList(const string& dir, bool recurse, int64_t& size) const;
+
+	struct PartialListCacheStats {
+		uint64_t hits;
+		uint64_t misses;
+		size_t bytes;
+		size_t lists;
+	};
+	PartialListCacheStats getPartialListCacheStats() const noexcept;
 	MemoryInputStream* getTree(const string& virtualFile) const;
 
 	AdcCommand getFileInfo(const string& aFile);
@@ -102,6 +141,64 @@ public:
 
 	size_t getSharedFiles() const noexcept;
 
+	struct MemoryUsage {
+		size_t tree; /// estimated bytes held by the share tree, not counting the interned names
+		size_t compact; /// bytes the compact form of the tree took when the file list was last written; 0 before
+	};
+	/** Compare the memory used by the share tree with that of its compact form. Only walks the
+	tree; the compact form isn't built for this. */
+	MemoryUsage getMemoryUsage() const noexcept;
+
+	/** Time taken by the phases of a full refresh, in milliseconds. */
+	struct RefreshTimes {
+		uint64_t scan; /// going through the disk, or the share cache, to build the trees
+		uint64_t saveCache;
+		uint64_t merge; /// joining the trees into a new snapshot
+		uint64_t index; /// building the TTH index, the bloom filter and the search index
+		uint64_t publish;
+		uint64_t total;
+	};
+
+	struct Stats {
+		size_t directories;
+		size_t files; /// including those not hashed yet
+		size_t hashedFiles; /// entries of the TTH index
+
+		/// estimated bytes
+		MemoryUsage memory;
+		size_t tthIndexBytes;
+		size_t searchIndexBytes;
+		size_t bloomBytes;
+		double bloomFill; /// proportion of the bits of the name bloom filter that are set
+		size_t hashBlooms; /// filters of the TTH index kept for hubs
+		size_t hashBloomBytes;
+
+		PartialListCacheStats partialLists;
+		size_t searchCacheEntries;
+		uint64_t searchCacheHits;
+		uint64_t searchCacheMisses;
+		size_t tthResults; /// paths kept for TTH searches
+
+		/// HashData.dat, as told by HashManager::getStoreStats
+		size_t hashTrees;
+		int64_t hashDataBytes;
+		double hashDataFragmentation;
+		bool hashDataCompacting;
+
+		RefreshTimes lastRefresh; /// all 0 until a full refresh is done
+		LatencyHistogram::Summary searches; /// search(), including answers from the cache
+		uint64_t droppedSearches; /// asynchronous searches dropped as too many were waiting
+		LatencyHistogram::Summary tthSearches; /// findTTH()
+
+		/** Human-readable form, one figure per line. */
+		string toString() const;
+		/** Machine-readable form. */
+		string toXml() const;
+	};
+	/** Gather counts, memory estimates and timings of the share and its caches. Walks the whole
+	tree; not meant to be called often. */
+	Stats getStats() const noexcept;
+
 	string getShareSizeString() const { return std::to_string(getShareSize()); }
 	string getShareSizeString(const string& aDir) const { return std::to_string(getShareSize(aDir)); }
 
@@ -121,27 +218,50 @@ public:
 		return getBZXmlFile();
 	}
 
-	bool isTTHShared(const TTHValue& tth){
-		Lock l(cs);
-		return tthIndex.find(tth) != tthIndex.end();
-	}
+	bool isTTHShared(const TTHValue& tth) const noexcept;
 
 	void updateFilterCache();
 
-	GETSET(uint32_t, hits, Hits);
+	uint32_t getHits() const { return hits; }
+	void setHits(uint32_t aHits) { hits = aHits; }
 	GETSET(string, bzXmlFile, BZXmlFile);
 
 private:
+	/** Counted by searches running in parallel */
+	std::atomic<uint32_t> hits;
+
 	struct SearchQuery;
 
+	/** A file or directory name along with its Text::toLower form (so searches don't have to fold
+	case again for every term). Both strings are interned in a process-wide pool: shares have lots
+	of identical names ("cover.jpg", "CD1"...) which are then only stored once. */
+	class SharedName {
+	public:
+		SharedName() { }
+		explicit SharedName(const string& aName) : name(aName), lower(Text::toLower(aName)) { }
+
+		const string& get() const { return name.get(); }
+		const string& getLower() const { return lower.get(); }
+
+	private:
+		typedef boost::flyweight<string> Pooled;
+
+		Pooled name;
+		Pooled lower;
+	};
+
 	class Directory : public FastAlloc<Directory>, public intrusive_ptr_base<Directory>, boost::noncopyable {
 	public:
 		typedef boost::intrusive_ptr<Directory> Ptr;
 
 		struct File {
-			File() : size(0), parent(0) { }
+			File() : size(0), lastWrite(0), parent(0) { }
 			File(const string& aName, int64_t aSize, const Directory::Ptr& aParent, const optional<TTHValue>& aRoot) :
-				name(aName), tth(aRoot), size(aSize), parent(aParent.get()) { }
+				name(aName), tth(aRoot), size(aSize), lastWrite(0), parent(aParent.get()) { }
+
+			const string& getName() const { return name.get(); }
+			const string& getLowerName() const { return name.getLower(); }
+			void setName(const string& aName) { name = SharedName(aName); }
 
 			bool operator==(const File& rhs) const {
 				return getParent() == rhs.getParent() && (Util::stricmp(getName(), rhs.getName()) == 0);
@@ -162,14 +282,18 @@ private:
 			@param sourcePath Real path (on the disk) of the directory this file came from. */
 			void validateName(const string& sourcePath);
 
-			string getADCPath() const { return parent->getADCPath() + name; }
-			string getFullName() const { return parent->getFullName() + name; }
-			string getRealPath() const { return realPath ? realPath.get() : parent->getRealPath(name); }
+			string getADCPath() const { return parent->getADCPath() + getName(); }
+			string getFullName() const { return parent->getFullName() + getName(); }
+			string getRealPath() const { return realPath ? realPath.get() : parent->getRealPath(getName()); }
+
+		private:
+			SharedName name;
 
-			GETSET(string, name, Name);
+		public:
 			optional<string> realPath; // only defined if this file had to be renamed to avoid duplication.
 			optional<TTHValue> tth;
 			GETSET(int64_t, size, Size);
+			GETSET(uint32_t, lastWrite, LastWrite);
 			GETSET(Directory*, parent, Parent);
 		};
 
@@ -182,8 +306,10 @@ private:
 		const string& getRealName() const noexcept;
 		template<typename SetT> void setRealName(SetT&& realName) noexcept { this->realName = std::forward<SetT>(realName); }
 
-		string getADCPath() const noexcept;
-		string getFullName() const noexcept;
+		/** Virtual path of this directory, in ADC form ("/root/dir/"); kept once built. */
+		const string& getADCPath() const noexcept { return getPaths().adc; }
+		/** Virtual path of this directory, in NMDC form ("root\dir\"); kept once built. */
+		const string& getFullName() const noexcept { return getPaths().full; }
 		string getRealPath(const std::string& path) const;
 
 		/** Check whether the given name would clash with this directory's sub-directories or
@@ -191,6 +317,8 @@ private:
 		bool nameInUse(const string& name) const;
 
 		int64_t getSize() const noexcept;
+		/** Estimate of the bytes allocated for this directory and everything under it. */
+		size_t getMemoryUsage() const noexcept;
 
 		void search(SearchResultList& results, SearchQuery& query, size_t maxResults) const noexcept;
 
@@ -202,16 +330,41 @@ private:
 
 		void merge(const Ptr& source, const string& realPath);
 
-		GETSET(string, name, Name);
-		GETSET(Directory*, parent, Parent);
+		/** Deep copy of this directory and its contents. */
+		Ptr clone(const Ptr& aParent = Ptr()) const;
+
+		const string& getName() const { return name.get(); }
+		const string& getLowerName() const { return name.getLower(); }
+		void setName(const string& aName) { name = SharedName(aName); dropPaths(); }
+
+		Directory* getParent() const { return parent; }
+		void setParent(Directory* aParent) { parent = aParent; dropPaths(); }
+
+		GETSET(uint32_t, lastWrite, LastWrite);
 
 	private:
 		friend void intrusive_ptr_release(intrusive_ptr_base<Directory>*);
 
-		Directory(const string& aName, const Ptr& aParent);
-		~Directory() { }
+		struct Paths {
+			string adc;
+			string full;
+		};
 
+		Directory(const string& aName, const Ptr& aParent);
+		Directory(const SharedName& aName, const Ptr& aParent);
+		~Directory() { delete paths.load(); }
+
+		/** Build the paths of this directory (and of its parents) if they aren't yet. Safe to call
+		from several readers at once. */
+		const Paths& getPaths() const noexcept;
+		/** Forget the paths of this directory and its sub-directories, once its name or position
+		in the tree changes. Requires exclusive access to the tree. */
+		void dropPaths() noexcept;
+
+		Directory* parent;
+		SharedName name;
 		optional<string> realName; // only defined if this directory had to be renamed to avoid duplication.
+		mutable std::atomic<Paths*> paths;
 	};
 
 	friend class Directory;
@@ -227,12 +380,40 @@ private:
 		SearchQuery(const StringList& adcParams);
 		SearchQuery(const string& nmdcString, int searchType, int64_t size, int fileType);
 
-		bool isExcluded(const string& str);
-		bool hasExt(const string& name);
-
-		StringSearch::List* include;
-		StringSearch::List includeInit;
+		/// @param lowerName Name already folded with Text::toLower.
+		bool isExcluded(const string& lowerName);
+		/// @param lowerName Name already folded with Text::toLower.
+		bool hasExt(const string& lowerName);
+
+		/** @return A string that is the same for queries that match the same results. */
+		string getKey() const;
+
+		void addResult(SearchResultList& results, SearchResult* result) const;
+		/** Whether enough results have been found, by this part of the search or by the parts run
+		in parallel with it. */
+		bool isDone(const SearchResultList& results, size_t maxResults) const {
+			return results.size() >= maxResults || (found && *found >= maxResults);
+		}
+
+		/** Build includeSearch and excludeSearch once the terms are known. */
+		void prepare();
+		/** Add an include term; those past MultiStringSearch::MAX_PATTERNS go to extraInclude. */
+		void addInclude(const string& term);
+		/** Whether the result matches each of extraInclude, by its name or that of a parent. */
+		bool matchesExtra(const SearchResult& result) const;
+
+		StringSearch::List include;
+		/** Include terms that don't fit in includeSearch; the results are checked against them
+		once found. */
+		StringSearch::List extraInclude;
 		StringSearch::List exclude;
+		/** All the include terms in one pass; bit i stands for include[i]. */
+		MultiStringSearch includeSearch;
+		MultiStringSearch excludeSearch;
+		/** Include terms not matched by the directories above the one being searched. */
+		MultiStringSearch::Mask pending;
+		/** Results found by all the parts of a search run in parallel; null otherwise. */
+		std::atomic<size_t>* found;
 		StringList ext;
 		StringList noExt;
 
@@ -244,44 +425,247 @@ private:
 		bool isDirectory;
 	};
 
+	typedef unordered_map<string, Directory::Ptr, noCaseStringHash, noCaseStringEq> DirMap;
+
+	/** Inverted index of the lower-cased names of shared files and directories, keyed by byte
+	trigrams. Ids are assigned in tree order so that the contents of a directory form contiguous
+	ranges of file and directory ids; a term matched by a directory name then applies to the whole
+	range, the same way Directory::search drops terms matched by parent directories.
+	Files are also indexed by extension and by size, for queries that restrict these. */
+	class SearchIndex {
+	public:
+		void clear();
+		void build(const DirMap& roots);
+
+		/** Register a file that was added to the tree after the last build; such files are matched
+		by a plain scan until the next rebuild. */
+		void addPending(const Directory::File& f) { pending.push_back(&f); }
+		/** Register a directory added after the last build, along with its contents. */
+		void addPending(const Directory& dir);
+		/** @return Whether so many files were added since the last build that scanning them
+		costs more than building the index again. */
+		bool needsRebuild() const;
+
+		/** Forget the files of a directory (not those of its sub-directories) before they are
+		replaced. */
+		void removeFiles(const Directory& dir);
+		/** Forget a directory along with everything under it before it is removed from the tree. */
+		void removeTree(const Directory& dir);
+
+		/** Estimate of the bytes held by the index. */
+		size_t getMemoryUsage() const noexcept;
+
+		/** @return false if the query has neither a term long enough to be looked up nor an
+		extension or minimum size filter; the caller should then walk the tree instead. */
+		bool search(SearchResultList& results, SearchQuery& query, size_t maxResults) const;
+
+	private:
+		typedef vector<uint32_t> Postings;
+		typedef unordered_map<uint32_t, Postings> PostingMap;
+		typedef vector<pair<uint32_t, uint32_t>> Ranges;
+
+		struct DirEntry {
+			const Directory* dir;
+			uint32_t fileBegin; /// first file id of this directory
+			uint32_t fileEnd; /// one past the last file id of this directory and its sub-directories
+			uint32_t dirEnd; /// one past the last id of this directory's sub-directories
+		};
+
+		/** Ids matched by a single include term. */
+		struct Hits {
+			Postings files; /// files whose own name matches
+			Ranges fileRanges; /// files under a directory whose name matches
+			Ranges dirRanges; /// directories whose own name or a parent's name matches
+		};
+
+		void add(const Directory& dir, Postings& grams);
+		void lookup(const PostingMap& map, const string& pattern, Postings& ids) const;
+		void getHits(const StringSearch& term, Hits& hits) const;
+		/** Collect the ids of the files that pass the extension and size filters of the query.
+		@param limit Give up if that would be more than this many files.
+		@param extChecked Set when the collected files are known to pass the extension filter.
+		@return false if the query has no such filter or it isn't selective enough. */
+		bool filter(const SearchQuery& query, size_t limit, Postings& ids, bool& extChecked) const;
+		optional<uint32_t> findEntry(const Directory& dir) const;
+		void removePending(const Directory& dir, bool recursive);
+
+		vector<const Directory::File*> files;
+		vector<DirEntry> dirs;
+		unordered_map<const Directory*, uint32_t> dirIds;
+		PostingMap fileGrams;
+		PostingMap dirGrams;
+
+		/** Lower-cased extension (without the dot) -> ids of the files that have it. */
+		unordered_map<string, Postings> extFiles;
+		/** (size, file id), sorted by size. */
+		vector<pair<int64_t, uint32_t>> sizes;
+
+		vector<const Directory::File*> pending;
+		vector<const Directory*> pendingDirs;
+	};
+
+	/** The share tree along with the indices built from it. Refreshes build a new snapshot and
+	publish it in place of the current one, so readers never wait on a refresh; changes to a few
+	roots build one that shares the trees of the other roots with the current one. The tree is only
+	modified in place for files added or hashed after the snapshot was published, while holding cs
+	exclusively. */
+	struct Snapshot {
+		explicit Snapshot(SharedCriticalSection& cs) : bloom(1<<20), cs(cs) { }
+
+		// List of root directory items
+		DirMap directories;
+
+		unordered_map<TTHValue, const Directory::File*> tthIndex;
+
+		BloomFilter<5> bloom;
+
+		/** Filters of tthIndex sent to hubs, by (k, m, h). TTHs added to the index are added to
+		them as well; removing any drops them. In-place updates hold cs exclusively; getBloom
+		fills them with cs held shared, and hashBloomCs. */
+		mutable map<std::tuple<size_t, size_t, size_t>, HashBloom> hashBlooms;
+		mutable CriticalSection hashBloomCs;
+
+		/** Files recently found by TTH, most recently used first. Entries go with the TTH index
+		entries they were made from; findTTH adds them with cs held shared, and tthResultsCs. */
+		mutable std::list<pair<TTHValue, std::shared_ptr<const TTHResult>>> tthResults;
+		mutable unordered_map<TTHValue, decltype(tthResults)::iterator> tthResultsIndex;
+		mutable CriticalSection tthResultsCs;
+		/** Forget the file found for that TTH; with cs held exclusively. */
+		void dropTTHResult(const TTHValue& root);
+
+		SearchIndex searchIndex;
+
+		/** ShareManager::treeCs, common to all snapshots since they share trees. */
+		SharedCriticalSection& cs;
+
+		/** Roots shared with the snapshot this one was cloned from; rebuildIndices only reads them. */
+		unordered_set<const Directory*> sharedRoots;
+
+		/** Compact form of the tree, holding the hashed files only; built anew on each call (with cs
+		held shared) and kept by the caller only for as long as it needs it. */
+		std::shared_ptr<const CompactTree> buildCompactTree() const;
+
+		/** Copy of the snapshot that shares the trees of its roots, but for the one named, which
+		is copied deep when there's one so that it can be changed; the indices are left for
+		rebuildIndices to fill. */
+		std::shared_ptr<Snapshot> clone(const string& changedRoot) const;
+
+		const Directory::File& findFile(const string& virtualFile) const;
+		pair<Directory::Ptr, string> splitVirtual(const string& virtualPath) const;
+
+		void merge(const Directory::Ptr& directory, const string& realPath);
+
+		void rebuildIndices();
+		void updateBloom(const Directory& dir);
+		/** N-grams of every name in the tree, hashed or not, for sizing the bloom filter. */
+		static size_t countGrams(const Directory& dir);
+
+		/** Add the hashed files of a shared tree to the TTH index, leaving the tree as it is. */
+		void addIndices(const Directory& dir);
+		void updateIndices(Directory& aDirectory);
+		void updateIndices(Directory& dir, const decltype(std::declval<Directory>().files.begin())& i);
+		/** Remove the files of the directory (and of its sub-directories if recursive) from the TTH
+		index. The bloom filter can't forget; it is cleaned up on the next refresh. */
+		void removeIndices(const Directory& dir, bool recursive);
+
+	private:
+		static void addToCompactTree(CompactTree& tree, const Directory& dir);
+	};
+
+	typedef std::shared_ptr<Snapshot> SnapshotPtr;
+
 	int64_t xmlListLen;
 	optional<TTHValue> xmlRoot;
 	int64_t bzXmlListLen;
 	optional<TTHValue> bzXmlRoot;
 	unique_ptr<File> bzXmlRef;
 
-	bool xmlDirty;
-	bool forceXmlRefresh; /// bypass the 15-minutes guard
+	/** Set under the snapshot lock by hashing and refreshes, read under listCs */
+	std::atomic<bool> xmlDirty;
+	std::atomic<bool> forceXmlRefresh; /// bypass the 15-minutes guard
 	bool refreshDirs;
 	bool update;
+	bool revalidate; /// reuse cached directories whose modification time hasn't changed
 
 	int listN;
+	/** Memory used by the compact tree the file list was last written from. */
+	std::atomic<size_t> compactTreeBytes;
 
 	static std::atomic_flag refreshing;
 
 	uint64_t lastXmlUpdate;
 	uint64_t lastFullUpdate;
 
+	/** Protects shares; only ever held briefly. */
 	mutable CriticalSection cs;
+	/** Serializes the building of new snapshots from the current one. */
+	CriticalSection publishCs;
+	/** Held shared by readers of the snapshot, from before they take it until they are done with
+	it, and exclusively by in-place updates and to swap snapshots. Readers thus never see a tree
+	changed in place through a newer snapshot that shares it while they still use an older one. */
+	mutable SharedCriticalSection treeCs;
+	/** Protects the generated file list. */
+	mutable CriticalSection listCs;
 
-	// List of root directory items
-	unordered_map<string, Directory::Ptr, noCaseStringHash, noCaseStringEq> directories;
+	SnapshotPtr snapshot;
 
 	/** Map real name to virtual name - multiple real names may be mapped to a single virtual one.
 	The map is sorted to make sure conflicts are always resolved in the same order when merging. */
 	map<string, string> shares;
 
-	unordered_map<TTHValue, const Directory::File*> tthIndex;
-
-	BloomFilter<5> bloom;
+	/** Watches the shared directories so that changes can be applied without a full refresh. */
+	DirectoryMonitor monitor;
+	/** Changes reported while a refresh was running; protected by cs. */
+	StringList deferredChanges;
+	/** Whether refreshing is held by a refresh rather than by a monitor update; protected by cs. */
+	bool fullRefresh;
+	/** A refresh asked for while refreshing was held, run once it is released; protected by cs. */
+	bool queuedRefresh;
+	bool queuedRefreshDirs;
+	bool queuedRefreshUpdate;
 
 	std::list<StringMatch> cachedFilterSkiplistRegEx;
 	std::list<StringMatch> cachedFilterSkiplistFileExtensions;
 	std::list<StringMatch> cachedFilterSkiplistPaths;
 
-	const Directory::File& findFile(const string& virtualFile) const;
+	/** The current snapshot; hold treeCs from before calling until done with it, unless
+	publishCs is held throughout. */
+	SnapshotPtr getSnapshot() const;
+	void publish(const SnapshotPtr& newSnapshot);
+
+	/** Lists the share roots on SHARE_SCAN_THREADS work-stealing threads, one task per directory,
+	with at most SHARE_SCAN_THREADS_PER_DEVICE listings running at once on any device.
+	@param cached Trees of the same roots read from the share cache, or empty.
+	@param progressF Called from the calling thread each time a root has been fully scanned. */
+	class Scanner;
+	vector<Directory::Ptr> buildTrees(const StringList& realPaths, const vector<Directory::Ptr>& cached = vector<Directory::Ptr>(),
+		const function<void (float)>& progressF = nullptr);
+	Directory::Ptr buildTree(const string& realPath);
+
+	/** A directory whose contents are yet to be scanned. */
+	struct PendingDir {
+		Directory::Ptr dir;
+		string realPath;
+		/** The same directory as found in the share cache, if any; its contents are reused when
+		the directory hasn't been modified since. */
+		Directory::Ptr cached;
+	};
 
-	Directory::Ptr buildTree(const string& realPath, optional<const string&> dirName = none, const Directory::Ptr& parent = nullptr);
+	/** Fill the directory with the contents of its real path; sub-directories are created empty
+	and added to subdirs for the caller to scan. Names are de-duplicated in listing order. */
+	void scanDirectory(const PendingDir& pending, vector<PendingDir>& subdirs);
+	/** scanDirectory, logging what it throws; the directory keeps what was found until then.
+	@return false when it threw. */
+	bool tryScanDirectory(const PendingDir& pending, vector<PendingDir>& subdirs) noexcept;
+
+	/** The share cache holds the trees of the share roots as last scanned, before merging, with
+	the modification times of their files and directories. */
+	static string getCacheFile() { return Util::getPath(Util::PATH_USER_CONFIG) + "ShareCache.dat"; }
+	/** @return Cached trees keyed by the real path of their root; empty when there's no cache. */
+	unordered_map<string, Directory::Ptr> loadCache() const noexcept;
+	void saveCache(const StringList& realPaths, const vector<Directory::Ptr>& trees) const noexcept;
+	/** Whether an entry listed in the directory at realPath passes the filters of the share. */
+	bool checkEntry(FileFindIter::DirData& entry, const string& realPath) const;
 	bool checkHidden(const string& realPath) const;
 	bool checkInvalidFileName(const string& realPath) const;
 	bool checkInvalidPaths(const string& realPath) const;
@@ -291,34 +675,109 @@ private:
 	void updateFilterCache(const std::string& strSetting, std::list<StringMatch>& lst);
 	void updateFilterCache(const std::string& strSetting, const std::string& strExtraPattern, bool escapeDot, std::list<StringMatch>& lst);
 
-	void rebuildIndices();
-
-	void updateIndices(Directory& aDirectory);
-	void updateIndices(Directory& dir, const decltype(std::declval<Directory>().files.begin())& i);
-
-	void merge(const Directory::Ptr& directory, const string& realPath);
-
 	void generateXmlList();
-	pair<Directory::Ptr, string> splitVirtual(const string& virtualPath) const;
 	string findRealRoot(const string& virtualRoot, const string& virtualLeaf) const;
 
 	SearchResultList search(SearchQuery&& query, size_t maxResults) noexcept;
+	/** Answer from the search cache when possible; otherwise run the search and call the callback
+	with its results.
+	@param follow Whether to queue the callback behind an identical search that is already
+	running instead of running this one too; it's then called on the thread of that search. */
+	void search(SearchQuery& query, size_t maxResults, SearchCallback&& callback, bool follow) noexcept;
+	void searchAsync(SearchQuery&& query, size_t maxResults, SearchCallback&& callback) noexcept;
+	SearchResultList runSearch(SearchQuery& query, size_t maxResults) noexcept;
+
+	struct CachedSearch {
+		string key;
+		uint32_t generation; /// generation of the share the results were computed from
+		/** Callbacks of the identical searches made while this one is running; null once it's done. */
+		std::shared_ptr<vector<SearchCallback>> waiting;
+		SearchResultList results;
+	};
+
+	/** Results of recent searches, most recently used first; protected by searchCacheCs. */
+	std::list<CachedSearch> searchCache;
+	unordered_map<string, std::list<CachedSearch>::iterator> searchCacheIndex;
+	mutable CriticalSection searchCacheCs;
+	std::atomic<uint64_t> searchCacheHits;
+	std::atomic<uint64_t> searchCacheMisses;
+	mutable LatencyHistogram searchLatency;
+	std::atomic<uint64_t> droppedSearches;
+
+	mutable LatencyHistogram tthSearchLatency;
+
+	/** Protected by cs. */
+	RefreshTimes lastRefresh;
+
+	/** Runs asynchronous searches, and the share roots of a tree walk in parallel. Reset first
+	thing on destruction so that no search outlives the manager. */
+	unique_ptr<SearchExecutor> searchExecutor;
+
+	/** Incremented when a snapshot is published, and every few seconds at most for the changes
+	made in place, which come by the file while hashing; cached search results of older
+	generations are stale. */
+	std::atomic<uint32_t> generation;
+	/** Whether the share was changed in place since generation was last incremented. */
+	std::atomic<bool> changed;
+	/** When generation was last incremented for changes made in place; only used by the timer. */
+	uint64_t lastChange;
+
+	struct PartialList {
+		string xml;
+		string compressed; /// zlib form of xml; empty until requested
+		size_t getSize() const { return xml.size() + compressed.size(); }
+	};
+
+	/** Generate a partial list or get it from the cache. Cached lists belong to the current
+	snapshot; they are all dropped when a new one is published, and those that include a directory
+	when it is changed in place. */
+	std::shared_ptr<const PartialList> getPartialList(const string& dir, bool recurse, bool compressed) const;
+	void dropPartialLists(const Directory& dir);
+	void clearPartialLists();
+
+	/** Partial lists keyed by recursion flag ('R' or 'N') and lower-cased path, most recently used
+	first; protected by partialListCs. */
+	mutable std::list<pair<string, std::shared_ptr<const PartialList>>> partialLists;
+	mutable unordered_map<string, decltype(partialLists.begin())> partialListIndex;
+	mutable size_t partialListBytes;
+	mutable uint64_t partialListHits;
+	mutable uint64_t partialListMisses;
+	mutable CriticalSection partialListCs;
 
 	/** Get the directory pointer corresponding to a given real path (on disk). Note that only
 	directories are considered here but not the file's base name. */
-	Directory::Ptr getDirectory(const string& realPath) noexcept;
+	Directory::Ptr getDirectory(const Snapshot& s, const string& realPath) const noexcept;
 	/** Get the file corresponding to a given real path (on disk). */
-	optional<const ShareManager::Directory::File&> getFile(const string& realPath, Directory::Ptr d = nullptr) noexcept;
+	optional<const ShareManager::Directory::File&> getFile(const Snapshot& s, const string& realPath, Directory::Ptr d = nullptr) const noexcept;
 
 	virtual int run();
+	/** Run the refresh set up in refreshDirs and update, with refreshing held. */
+	void startRefresh(bool block, function<void (float)> progressF = nullptr);
 	void runRefresh(function<void (float)> progressF = nullptr);
 
+	/** Scan the given directories again (not recursively, except for new sub-directories) and
+	update the current snapshot in place. */
+	void updateDirectories(StringList realPaths);
+	/** Remember a refresh to run once refreshing is released; called with cs held. */
+	void queueRefresh(bool dirs, bool aUpdate);
+	/** Apply the changes that came in during a refresh, then let other refreshes go.
+	@return true if a refresh was queued meanwhile; refreshing is then kept for it, and
+	refreshDirs and update set up. */
+	bool endRefresh();
+	/** @return Whether some virtual name is shared from several real directories; these are
+	merged together, which incremental updates can't deal with. */
+	bool hasMergedShares() const noexcept;
+
 	// QueueManagerListener
 	virtual void on(QueueManagerListener::FileMoved, const string& realPath) noexcept;
 
 	// HashManagerListener
 	virtual void on(HashManagerListener::TTHDone, const string& realPath, const TTHValue& root) noexcept;
 
+	// DirectoryMonitorListener
+	virtual void on(DirectoryMonitorListener::Changed, const StringList& realPaths) noexcept;
+	virtual void on(DirectoryMonitorListener::Overflow) noexcept;
+
 	// SettingsManagerListener
 	virtual void on(SettingsManagerListener::Save, SimpleXML& xml) noexcept {
 		save(xml);
@@ -328,6 +787,7 @@ private:
 	}
 
 	// TimerManagerListener
+	virtual void on(TimerManagerListener::Second, uint64_t tick) noexcept;
 	virtual void on(TimerManagerListener::Minute, uint64_t tick) noexcept;
 	void load(SimpleXML& aXml);
 	void save(SimpleXML& aXml);
@@ -25,12 +25,12 @@
 namespace dcpp {
 
 StringMatch::Method StringMatch::getMethod() const {
-	return (boost::get<StringSearch::List>(&search) ? PARTIAL : (boost::get<string>(&search) ? EXACT : (boost::get<boost::regex>(&search) ? REGEX : SDEX)));
+	return (boost::get<MultiStringSearch>(&search) ? PARTIAL : (boost::get<string>(&search) ? EXACT : (boost::get<boost::regex>(&search) ? REGEX : SDEX)));
 }
 
 void StringMatch::setMethod(Method method) {
 	switch(method) {
-	case PARTIAL: search = StringSearch::List(); break;
+	case PARTIAL: search = MultiStringSearch(); break;
 	case EXACT: search = string(); break;
 	case REGEX: search = boost::regex(); break;
 	case SDEX: search = SdEx(); break;
@@ -45,14 +45,15 @@ bool StringMatch::operator==(const StringMatch& rhs) const {
 struct Prepare : boost::static_visitor<bool> {
 	Prepare(const string& pattern) : pattern(pattern) { }
 
-	bool operator()(StringSearch::List& s) const {
-		s.clear();
+	bool operator()(MultiStringSearch& s) const {
+		StringList patterns;
 		StringTokenizer<string> st(pattern, ' ');
 		for(auto& i: st.getTokens()) {
 			if(!i.empty()) {
-				s.emplace_back(i);
+				patterns.push_back(i);
 			}
 		}
+		s = MultiStringSearch(patterns);
 		return true;
 	}
 
@@ -87,13 +88,8 @@ bool StringMatch::prepare() {
 struct Match : boost::static_visitor<bool> {
 	Match(const string& str) : str(str) { }
 
-	bool operator()(const StringSearch::List& s) const {
-		for(auto& i: s) {
-			if(!i.match(str)) {
-				return false;
-			}
-		}
-		return !s.empty();
+	bool operator()(const MultiStringSearch& s) const {
+		return !s.empty() && s.matchLower(Text::toLower(str));
 	}
 
 	bool operator()(const string& s) const {
@@ -19,7 +19,7 @@
 #define DCPLUSPLUS_DCPP_STRING_MATCH_H
 
 #include "forward.h"
-#include "StringSearch.h"
+#include "MultiStringSearch.h"
 #include "SdEx.h"
 
 #include <string>
@@ -53,7 +53,7 @@ struct StringMatch {
 	bool match(const string& str) const;
 
 private:
-	boost::variant<StringSearch::List, string, boost::regex, SdEx> search;
+	boost::variant<MultiStringSearch, string, boost::regex, SdEx> search;
 };
 
 } // namespace dcpp
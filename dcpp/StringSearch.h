@@ -29,7 +29,7 @@ namespace dcpp {
  * one pattern against many strings (currently Quick Search, a variant of
  * Boyer-Moore. Code based on "A very fast substring search algorithm" by
  * D. Sunday).
- * @todo Perhaps find an algo suitable for matching multiple substrings.
+ * MultiStringSearch matches several patterns at once.
  */
 class StringSearch {
 public:
@@ -59,22 +59,26 @@ public:
 
 	/** Match a text against the pattern */
 	bool match(const string& aText) const noexcept {
-
 		// Lower-case representation of UTF-8 string, since we no longer have that 1 char = 1 byte...
 		string lower;
 		Text::toLower(aText, lower);
+		return matchLower(lower);
+	}
 
+	/** Match a text that has already been folded with Text::toLower against the pattern; doesn't
+	allocate. */
+	bool matchLower(const string& aLower) const noexcept {
 		// uint8_t to avoid problems with signed char pointer arithmetic
-		uint8_t *tx = (uint8_t*)lower.c_str();
-		uint8_t *px = (uint8_t*)pattern.c_str();
+		const uint8_t *tx = (const uint8_t*)aLower.c_str();
+		const uint8_t *px = (const uint8_t*)pattern.c_str();
 
 		string::size_type plen = pattern.length();
 
-		if(aText.length() < plen) {
+		if(aLower.length() < plen) {
 			return false;
 		}
 
-		uint8_t *end = tx + aText.length() - plen + 1;
+		const uint8_t *end = tx + aLower.length() - plen + 1;
 		while(tx < end) {
 			size_t i = 0;
 			for(; px[i] && (px[i] == tx[i]); ++i)
@@ -45,6 +45,11 @@
 #define TIGER_ARCH64
 #endif
 
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define TIGER_AVX2
+#include <immintrin.h>
+#endif
+
 namespace dcpp {
 
 using std::min;
@@ -254,6 +259,230 @@ uint8_t* TigerHash::finalize() {
 	return getResult();
 }
 
+/* Multi-buffer compress function: LANES independent states advance through the same rounds
+ * together, as two interleaved halves so that one half's gathers run while the other waits. The
+ * words of the blocks and states are stored lane-minor (x[word][lane]), ready to be loaded
+ * into vectors. */
+
+namespace {
+
+typedef uint64_t Lanes[TigerHash::LANES];
+
+#ifdef TIGER_AVX2
+
+#define avx2_lookup(t,v,n) \
+	_mm256_i64gather_epi64(reinterpret_cast<const long long*>(t), \
+		_mm256_and_si256(_mm256_srli_epi64(v, (n)*8), bytes), 8)
+
+#define avx2_mul5(v) _mm256_add_epi64(_mm256_slli_epi64(v, 2), v)
+#define avx2_mul7(v) _mm256_sub_epi64(_mm256_slli_epi64(v, 3), v)
+#define avx2_mul9(v) _mm256_add_epi64(_mm256_slli_epi64(v, 3), v)
+
+#define avx2_round(a,b,c,x,mul) \
+	c = _mm256_xor_si256(c, x); \
+	a = _mm256_sub_epi64(a, _mm256_xor_si256( \
+		_mm256_xor_si256(avx2_lookup(t1,c,0), avx2_lookup(t2,c,2)), \
+		_mm256_xor_si256(avx2_lookup(t3,c,4), avx2_lookup(t4,c,6)))); \
+	b = _mm256_add_epi64(b, _mm256_xor_si256( \
+		_mm256_xor_si256(avx2_lookup(t4,c,1), avx2_lookup(t3,c,3)), \
+		_mm256_xor_si256(avx2_lookup(t2,c,5), avx2_lookup(t1,c,7)))); \
+	b = avx2_mul##mul(b);
+
+#define avx2_round2(a,b,c,n,mul) \
+	avx2_round(a##0,b##0,c##0,x##n[0],mul) \
+	avx2_round(a##1,b##1,c##1,x##n[1],mul)
+
+#define avx2_pass(a,b,c,mul) \
+	avx2_round2(a,b,c,0,mul) \
+	avx2_round2(b,c,a,1,mul) \
+	avx2_round2(c,a,b,2,mul) \
+	avx2_round2(a,b,c,3,mul) \
+	avx2_round2(b,c,a,4,mul) \
+	avx2_round2(c,a,b,5,mul) \
+	avx2_round2(a,b,c,6,mul) \
+	avx2_round2(b,c,a,7,mul)
+
+#define avx2_not(v) _mm256_xor_si256(v, ones)
+
+#define avx2_key_schedule(h) \
+	x0[h] = _mm256_sub_epi64(x0[h], _mm256_xor_si256(x7[h], _mm256_set1_epi64x(_ULL(0xA5A5A5A5A5A5A5A5)))); \
+	x1[h] = _mm256_xor_si256(x1[h], x0[h]); \
+	x2[h] = _mm256_add_epi64(x2[h], x1[h]); \
+	x3[h] = _mm256_sub_epi64(x3[h], _mm256_xor_si256(x2[h], _mm256_slli_epi64(avx2_not(x1[h]), 19))); \
+	x4[h] = _mm256_xor_si256(x4[h], x3[h]); \
+	x5[h] = _mm256_add_epi64(x5[h], x4[h]); \
+	x6[h] = _mm256_sub_epi64(x6[h], _mm256_xor_si256(x5[h], _mm256_srli_epi64(avx2_not(x4[h]), 23))); \
+	x7[h] = _mm256_xor_si256(x7[h], x6[h]); \
+	x0[h] = _mm256_add_epi64(x0[h], x7[h]); \
+	x1[h] = _mm256_sub_epi64(x1[h], _mm256_xor_si256(x0[h], _mm256_slli_epi64(avx2_not(x7[h]), 19))); \
+	x2[h] = _mm256_xor_si256(x2[h], x1[h]); \
+	x3[h] = _mm256_add_epi64(x3[h], x2[h]); \
+	x4[h] = _mm256_sub_epi64(x4[h], _mm256_xor_si256(x3[h], _mm256_srli_epi64(avx2_not(x2[h]), 23))); \
+	x5[h] = _mm256_xor_si256(x5[h], x4[h]); \
+	x6[h] = _mm256_add_epi64(x6[h], x5[h]); \
+	x7[h] = _mm256_sub_epi64(x7[h], _mm256_xor_si256(x6[h], _mm256_set1_epi64x(_ULL(0x0123456789ABCDEF))));
+
+#define avx2_load(p) _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))
+#define avx2_store(p,v) _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v)
+
+__attribute__((target("avx2")))
+void compressLanesAvx2(const uint64_t* table, Lanes* x, Lanes* state) {
+	const __m256i bytes = _mm256_set1_epi64x(0xFF);
+	const __m256i ones = _mm256_set1_epi64x(-1);
+
+	__m256i a0 = avx2_load(state[0]), b0 = avx2_load(state[1]), c0 = avx2_load(state[2]);
+	__m256i a1 = avx2_load(state[0] + 4), b1 = avx2_load(state[1] + 4), c1 = avx2_load(state[2] + 4);
+	__m256i x0[2], x1[2], x2[2], x3[2], x4[2], x5[2], x6[2], x7[2];
+	for(int h = 0; h < 2; ++h) {
+		x0[h] = avx2_load(x[0] + 4 * h); x1[h] = avx2_load(x[1] + 4 * h);
+		x2[h] = avx2_load(x[2] + 4 * h); x3[h] = avx2_load(x[3] + 4 * h);
+		x4[h] = avx2_load(x[4] + 4 * h); x5[h] = avx2_load(x[5] + 4 * h);
+		x6[h] = avx2_load(x[6] + 4 * h); x7[h] = avx2_load(x[7] + 4 * h);
+	}
+
+	avx2_pass(a,b,c,5)
+	avx2_key_schedule(0)
+	avx2_key_schedule(1)
+	avx2_pass(c,a,b,7)
+	avx2_key_schedule(0)
+	avx2_key_schedule(1)
+	avx2_pass(b,c,a,9)
+
+	// feedforward
+	avx2_store(state[0], _mm256_xor_si256(a0, avx2_load(state[0])));
+	avx2_store(state[1], _mm256_sub_epi64(b0, avx2_load(state[1])));
+	avx2_store(state[2], _mm256_add_epi64(c0, avx2_load(state[2])));
+	avx2_store(state[0] + 4, _mm256_xor_si256(a1, avx2_load(state[0] + 4)));
+	avx2_store(state[1] + 4, _mm256_sub_epi64(b1, avx2_load(state[1] + 4)));
+	avx2_store(state[2] + 4, _mm256_add_epi64(c1, avx2_load(state[2] + 4)));
+}
+
+#undef avx2_store
+#undef avx2_load
+#undef avx2_key_schedule
+#undef avx2_not
+#undef avx2_pass
+#undef avx2_round2
+#undef avx2_round
+#undef avx2_mul9
+#undef avx2_mul7
+#undef avx2_mul5
+#undef avx2_lookup
+
+#endif // TIGER_AVX2
+
+typedef void (*CompressLanesF)(const uint64_t* table, Lanes* x, Lanes* state);
+
+struct Engine {
+	Engine() : run(nullptr), name("scalar") {
+#ifdef TIGER_AVX2
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")) {
+			run = &compressLanesAvx2;
+			name = "avx2";
+		}
+#endif
+	}
+
+	/** null when the CPU has nothing faster than hashing one message after the other */
+	CompressLanesF run;
+	const char* name;
+};
+
+const Engine& getEngineImpl() {
+	static const Engine engine;
+	return engine;
+}
+
+} // unnamed namespace
+
+const char* TigerHash::getEngine() {
+	return getEngineImpl().name;
+}
+
+void TigerHash::hashMany(uint8_t prefix, const uint8_t* data, size_t len, size_t count, uint8_t* out) {
+	size_t i = 0;
+
+#ifndef TIGER_BIG_ENDIAN
+	auto compressAll = getEngineImpl().run;
+	const size_t batched = compressAll ? count - count % LANES : 0;
+
+	// each message is the prefix followed by len bytes, so block k starts at data byte 64k - 1.
+	const size_t total = len + 1;
+	const size_t fullBlocks = total / BLOCK_SIZE;
+	const size_t tail = total % BLOCK_SIZE;
+
+	for(; i < batched; i += LANES) {
+		Lanes state[3];
+		for(size_t l = 0; l < LANES; ++l) {
+			state[0][l] = _ULL(0x0123456789ABCDEF);
+			state[1][l] = _ULL(0xFEDCBA9876543210);
+			state[2][l] = _ULL(0xF096A5B4C3B2E187);
+		}
+
+		Lanes x[8];
+		uint64_t block[BLOCK_SIZE / 8];
+		auto load = [&](size_t l) {
+			for(size_t w = 0; w < 8; ++w)
+				x[w][l] = block[w];
+		};
+
+		for(size_t k = 0; k < fullBlocks; ++k) {
+			for(size_t l = 0; l < LANES; ++l) {
+				auto msg = data + (i + l) * len;
+				if(k == 0) {
+					reinterpret_cast<uint8_t*>(block)[0] = prefix;
+					memcpy(reinterpret_cast<uint8_t*>(block) + 1, msg, BLOCK_SIZE - 1);
+				} else {
+					memcpy(block, msg + k * BLOCK_SIZE - 1, BLOCK_SIZE);
+				}
+				load(l);
+			}
+			compressAll(table, x, state);
+		}
+
+		// padding, as in finalize: 0x01, zeros, and the bit length in the last 8 bytes
+		bool extra = tail + 1 > BLOCK_SIZE - sizeof(uint64_t);
+		for(size_t l = 0; l < LANES; ++l) {
+			auto bytes = reinterpret_cast<uint8_t*>(block);
+			if(fullBlocks == 0) {
+				bytes[0] = prefix;
+				memcpy(bytes + 1, data + (i + l) * len, len);
+			} else {
+				memcpy(bytes, data + (i + l) * len + fullBlocks * BLOCK_SIZE - 1, tail);
+			}
+			bytes[tail] = 0x01;
+			memset(bytes + tail + 1, 0, BLOCK_SIZE - tail - 1);
+			if(!extra)
+				block[7] = static_cast<uint64_t>(total) << 3;
+			load(l);
+		}
+		compressAll(table, x, state);
+
+		if(extra) {
+			memset(block, 0, BLOCK_SIZE);
+			block[7] = static_cast<uint64_t>(total) << 3;
+			for(size_t l = 0; l < LANES; ++l)
+				load(l);
+			compressAll(table, x, state);
+		}
+
+		for(size_t l = 0; l < LANES; ++l) {
+			uint64_t res[3] = { state[0][l], state[1][l], state[2][l] };
+			memcpy(out + (i + l) * BYTES, res, BYTES);
+		}
+	}
+#endif
+
+	// whatever doesn't fill all the lanes (and everything on big-endian machines)
+	for(; i < count; ++i) {
+		TigerHash h;
+		h.update(&prefix, 1);
+		h.update(data + i * len, len);
+		memcpy(out + i * BYTES, h.finalize(), BYTES);
+	}
+}
+
 uint64_t TigerHash::table[4*256] = {
 	_ULL(0x02AAB17CF7E90C5E)   /*    0 */,    _ULL(0xAC424B03E243A8EC)   /*    1 */,
 		_ULL(0x72CD5BE30DD5FCD3)   /*    2 */,    _ULL(0x6D019B93F6F97F3A)   /*    3 */,
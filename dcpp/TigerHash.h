@@ -42,6 +42,9 @@ public:
 	static const size_t BITS = 192;
 	static const size_t BYTES = BITS / 8;
 
+	/** Number of messages hashMany runs through the compress function side by side. */
+	static const size_t LANES = 8;
+
 	TigerHash() : pos(0) {
 		res[0]=_ULL(0x0123456789ABCDEF);
 		res[1]=_ULL(0xFEDCBA9876543210);
@@ -57,6 +60,18 @@ public:
 	uint8_t* finalize();
 
 	uint8_t* getResult() { return (uint8_t*) res; }
+
+	/**
+	 * Hash count messages of the same length in one go; message i is the prefix byte followed
+	 * by the len bytes at data + i * len, and its hash is written to out + i * BYTES. This gives
+	 * the same result as one TigerHash per message, but runs LANES of them in lockstep (with
+	 * AVX2 when the CPU has it) so the S-box lookups of one message overlap those of the others.
+	 */
+	static void hashMany(uint8_t prefix, const uint8_t* data, size_t len, size_t count, uint8_t* out);
+
+	/** Name of the multi-buffer engine hashMany picked for this CPU. */
+	static const char* getEngine();
+
 private:
 	enum { BLOCK_SIZE = 512/8 };
 	/** 512 bit blocks for the compress function */
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2001-2023 Jacek Sieka, arnetheduck on gmail point com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_TOKEN_BUCKET_H
+#define DCPLUSPLUS_DCPP_TOKEN_BUCKET_H
+
+#include <algorithm>
+#include <cstdint>
+
+namespace dcpp {
+
+/** Rate limiter that allows bursts: tokens accumulate at a steady rate up to a cap, and each
+event takes one. Not thread-safe. */
+class TokenBucket {
+public:
+	/** @param aRate Tokens added per second.
+	@param aBurst Most tokens that can accumulate; the bucket starts full. */
+	TokenBucket(uint32_t aRate, uint32_t aBurst) : rate(aRate), burst(aBurst * 1000), tokens(burst), last(0) { }
+
+	/** @param aTick Current time in milliseconds (GET_TICK).
+	@return Whether a token was available; it is then used up. */
+	bool take(uint64_t aTick) {
+		if(aTick > last) {
+			tokens = std::min(tokens + (aTick - last) * rate, burst);
+			last = aTick;
+		}
+		if(tokens < 1000) {
+			return false;
+		}
+		tokens -= 1000;
+		return true;
+	}
+
+private:
+	// tokens are counted in thousandths so that short intervals add up.
+	uint64_t rate;
+	uint64_t burst;
+	uint64_t tokens;
+	uint64_t last;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_TOKEN_BUCKET_H)
@@ -54,7 +54,9 @@ UploadManager::~UploadManager() {
 	}
 }
 
-bool UploadManager::prepareFile(UserConnection& aSource, const string& aType, const string& aFile, int64_t aStartPos, int64_t aBytes, bool listRecursive) {
+bool UploadManager::prepareFile(UserConnection& aSource, const string& aType, const string& aFile, int64_t aStartPos, int64_t aBytes,
+	bool listRecursive, bool compress)
+{
 	dcdebug("Preparing %s %s " I64_FMT " " I64_FMT " %d\n", aType.c_str(), aFile.c_str(), aStartPos, aBytes, listRecursive);
 
 	if(aFile.empty() || aStartPos < 0 || aBytes < -1 || aBytes == 0) {
@@ -134,6 +136,7 @@ bool UploadManager::prepareFile(UserConnection& aSource, const string& aType, co
 	InputStream* is = 0;
 	int64_t start = 0;
 	int64_t size = 0;
+	bool compressed = false;
 
 	try {
 		switch(type) {
@@ -188,15 +191,23 @@ bool UploadManager::prepareFile(UserConnection& aSource, const string& aType, co
 		case Transfer::TYPE_PARTIAL_LIST:
 			{
 				// Partial file list
-				MemoryInputStream* mis = ShareManager::getInstance()->generatePartialList(aFile, listRecursive);
-				if(!mis) {
+				start = 0;
+				if(compress) {
+					// the size sent has to be that of the list the compressed data comes from.
+					is = ShareManager::getInstance()->getCompressedPartialList(aFile, listRecursive, size);
+					compressed = true;
+				} else {
+					MemoryInputStream* mis = ShareManager::getInstance()->generatePartialList(aFile, listRecursive);
+					if(mis) {
+						size = mis->getSize();
+					}
+					is = mis;
+				}
+
+				if(!is) {
 					aSource.fileNotAvail();
 					return false;
 				}
-
-				start = 0;
-				size = mis->getSize();
-				is = mis;
 				break;
 			}
 		case Transfer::TYPE_LAST: break;
@@ -218,6 +229,9 @@ bool UploadManager::prepareFile(UserConnection& aSource, const string& aType, co
 	u->setSegment(Segment(start, size));
 
 	u->setType(type);
+	if(compressed) {
+		u->setFlag(Upload::FLAG_ZUPLOAD);
+	}
 
 	uploads.push_back(u);
 
@@ -347,7 +361,7 @@ void UploadManager::on(AdcCommand::GET, UserConnection* aSource, const AdcComman
 	int64_t aStartPos = Util::toInt64(c.getParam(2));
 	int64_t aBytes = Util::toInt64(c.getParam(3));
 
-	if(prepareFile(*aSource, type, fname, aStartPos, aBytes, c.hasFlag("RE", 4))) {
+	if(prepareFile(*aSource, type, fname, aStartPos, aBytes, c.hasFlag("RE", 4), c.hasFlag("ZL", 4))) {
 		Upload* u = aSource->getUpload();
 		dcassert(u != NULL);
 
@@ -357,8 +371,11 @@ void UploadManager::on(AdcCommand::GET, UserConnection* aSource, const AdcComman
 			.addParam(Util::toString(u->getSize()));
 
 		if(c.hasFlag("ZL", 4)) {
-			u->setStream(new FilteredInputStream<ZFilter, true>(u->getStream()));
-			u->setFlag(Upload::FLAG_ZUPLOAD);
+			// partial lists come compressed already.
+			if(!u->isSet(Upload::FLAG_ZUPLOAD)) {
+				u->setStream(new FilteredInputStream<ZFilter, true>(u->getStream()));
+				u->setFlag(Upload::FLAG_ZUPLOAD);
+			}
 			cmd.addParam("ZL1");
 		}
 
@@ -149,7 +149,10 @@ private:
 	virtual void on(AdcCommand::GET, UserConnection*, const AdcCommand&) noexcept;
 	virtual void on(AdcCommand::GFI, UserConnection*, const AdcCommand&) noexcept;
 
-	bool prepareFile(UserConnection& aSource, const string& aType, const string& aFile, int64_t aResume, int64_t aBytes, bool listRecursive = false);
+	/** @param compress Whether the upload is to be compressed with zlib; partial lists are then
+	taken compressed from the cache, the others are compressed by the caller. */
+	bool prepareFile(UserConnection& aSource, const string& aType, const string& aFile, int64_t aResume, int64_t aBytes,
+		bool listRecursive = false, bool compress = false);
 };
 
 } // namespace dcpp
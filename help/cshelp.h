@@ -205,224 +205,227 @@
 #define IDH_SETTINGS_EXPERT_AUTO_SEARCH_INTERVAL 11199
 #define IDH_SETTINGS_EXPERT_AUTO_SEARCH_LIMIT 11200
 #define IDH_SETTINGS_EXPERT_BUFFERSIZE 11201
-#define IDH_SETTINGS_EXPERT_MAX_COMMAND_LENGTH 11202
-#define IDH_SETTINGS_EXPERT_MAX_FILELIST_SIZE 11203
-#define IDH_SETTINGS_EXPERT_MAX_HASH_SPEED 11204
-#define IDH_SETTINGS_EXPERT_MAX_PM_WINDOWS 11205
-#define IDH_SETTINGS_EXPERT_MINISLOT_SIZE 11206
-#define IDH_SETTINGS_EXPERT_PRIVATE_ID 11207
-#define IDH_SETTINGS_EXPERT_SETTINGS_SAVE_INTERVAL 11208
-#define IDH_SETTINGS_EXPERT_SOCKET_IN_BUFFER 11209
-#define IDH_SETTINGS_EXPERT_SOCKET_OUT_BUFFER 11210
-#define IDH_SETTINGS_EXPERT_WHITELIST_OPEN_URIS 11211
-#define IDH_SETTINGS_FAVORITE_DIRS_ADD 11212
-#define IDH_SETTINGS_FAVORITE_DIRS_FAVORITE_DIRECTORIES 11213
-#define IDH_SETTINGS_FAVORITE_DIRS_REMOVE 11214
-#define IDH_SETTINGS_FAVORITE_DIRS_RENAME 11215
-#define IDH_SETTINGS_GENERAL_AUTO_AWAY 11216
-#define IDH_SETTINGS_GENERAL_AWAY_COMP_LOCK 11217
-#define IDH_SETTINGS_GENERAL_AWAY_IDLE 11218
-#define IDH_SETTINGS_GENERAL_AWAY_MODE 11219
-#define IDH_SETTINGS_GENERAL_AWAY_TIMESTAMP 11220
-#define IDH_SETTINGS_GENERAL_CONNECTION 11221
-#define IDH_SETTINGS_GENERAL_DEFAULT_AWAY_MESSAGE 11222
-#define IDH_SETTINGS_GENERAL_DESCRIPTION 11223
-#define IDH_SETTINGS_GENERAL_EMAIL 11224
-#define IDH_SETTINGS_GENERAL_NICK 11225
-#define IDH_SETTINGS_GENERAL_PERSONAL_INFORMATION 11226
-#define IDH_SETTINGS_HISTORY_CHAT_HUBS 11227
-#define IDH_SETTINGS_HISTORY_CHAT_PM 11228
-#define IDH_SETTINGS_HISTORY_RECENT_FLS 11229
-#define IDH_SETTINGS_HISTORY_RECENT_HUBS 11230
-#define IDH_SETTINGS_HISTORY_RECENT_PMS 11231
-#define IDH_SETTINGS_HISTORY_SEARCH_HISTORY 11232
-#define IDH_SETTINGS_LOG_DIRECTORY 11233
-#define IDH_SETTINGS_LOG_DOWNLOADS 11234
-#define IDH_SETTINGS_LOG_FILELIST_TRANSFERS 11235
-#define IDH_SETTINGS_LOG_FINISHED_DOWNLOADS 11236
-#define IDH_SETTINGS_LOG_MAIN_CHAT 11237
-#define IDH_SETTINGS_LOG_PRIVATE_CHAT 11238
-#define IDH_SETTINGS_LOG_STATUS_MESSAGES 11239
-#define IDH_SETTINGS_LOG_SYSTEM 11240
-#define IDH_SETTINGS_LOG_UPLOADS 11241
-#define IDH_SETTINGS_MAX_EXTRA_UPLOAD_SLOTS 11242
-#define IDH_SETTINGS_NOTIFICATIONS_BALLOON 11243
-#define IDH_SETTINGS_NOTIFICATIONS_BALLOON_BG 11244
-#define IDH_SETTINGS_NOTIFICATIONS_BALLOON_EXAMPLE 11245
-#define IDH_SETTINGS_NOTIFICATIONS_FINISHED_DL 11246
-#define IDH_SETTINGS_NOTIFICATIONS_FINISHED_FL 11247
-#define IDH_SETTINGS_NOTIFICATIONS_MAIN_CHAT 11248
-#define IDH_SETTINGS_NOTIFICATIONS_PM 11249
-#define IDH_SETTINGS_NOTIFICATIONS_PM_WINDOW 11250
-#define IDH_SETTINGS_NOTIFICATIONS_SOUND 11251
-#define IDH_SETTINGS_NOTIFICATIONS_SOUND_FILE 11252
-#define IDH_SETTINGS_PLUGINS_ADD 11253
-#define IDH_SETTINGS_PLUGINS_CONFIGURE 11254
-#define IDH_SETTINGS_PLUGINS_DISABLE 11255
-#define IDH_SETTINGS_PLUGINS_ENABLE 11256
-#define IDH_SETTINGS_PLUGINS_INFO 11257
-#define IDH_SETTINGS_PLUGINS_LIST 11258
-#define IDH_SETTINGS_PLUGINS_MOVE_DOWN 11259
-#define IDH_SETTINGS_PLUGINS_MOVE_UP 11260
-#define IDH_SETTINGS_PLUGINS_REMOVE 11261
-#define IDH_SETTINGS_PROXY_DIRECT_OUT 11262
-#define IDH_SETTINGS_PROXY_SOCKS5 11263
-#define IDH_SETTINGS_PROXY_SOCKS_PASSWORD 11264
-#define IDH_SETTINGS_PROXY_SOCKS_PORT 11265
-#define IDH_SETTINGS_PROXY_SOCKS_RESOLVE 11266
-#define IDH_SETTINGS_PROXY_SOCKS_SERVER 11267
-#define IDH_SETTINGS_PROXY_SOCKS_USER 11268
-#define IDH_SETTINGS_QUEUE_AUTODROP 11269
-#define IDH_SETTINGS_QUEUE_AUTODROP_ALL 11270
-#define IDH_SETTINGS_QUEUE_AUTODROP_DISCONNECT 11271
-#define IDH_SETTINGS_QUEUE_AUTODROP_ELAPSED 11272
-#define IDH_SETTINGS_QUEUE_AUTODROP_FILELISTS 11273
-#define IDH_SETTINGS_QUEUE_AUTODROP_FILESIZE 11274
-#define IDH_SETTINGS_QUEUE_AUTODROP_INACTIVITY 11275
-#define IDH_SETTINGS_QUEUE_AUTODROP_INTERVAL 11276
-#define IDH_SETTINGS_QUEUE_AUTODROP_MINSOURCES 11277
-#define IDH_SETTINGS_QUEUE_AUTODROP_SPEED 11278
-#define IDH_SETTINGS_QUEUE_AUTOPRIO 11279
-#define IDH_SETTINGS_QUEUE_AUTO_SEARCH 11280
-#define IDH_SETTINGS_QUEUE_AUTO_SEARCH_AUTO_MATCH 11281
-#define IDH_SETTINGS_QUEUE_DONT_DL_ALREADY_QUEUED 11282
-#define IDH_SETTINGS_QUEUE_DONT_DL_ALREADY_SHARED 11283
-#define IDH_SETTINGS_QUEUE_KEEP_FINISHED_FILES 11284
-#define IDH_SETTINGS_QUEUE_PRIO_HIGH 11285
-#define IDH_SETTINGS_QUEUE_PRIO_HIGHEST 11286
-#define IDH_SETTINGS_QUEUE_PRIO_LOW 11287
-#define IDH_SETTINGS_QUEUE_PRIO_LOWEST 11288
-#define IDH_SETTINGS_QUEUE_PRIO_NORMAL 11289
-#define IDH_SETTINGS_QUEUE_SKIP_ZERO_BYTE 11290
-#define IDH_SETTINGS_SEARCHTYPES_ADD 11291
-#define IDH_SETTINGS_SEARCHTYPES_DEFAULTS 11292
-#define IDH_SETTINGS_SEARCHTYPES_LIST 11293
-#define IDH_SETTINGS_SEARCHTYPES_MODIFY 11294
-#define IDH_SETTINGS_SEARCHTYPES_REMOVE 11295
-#define IDH_SETTINGS_SEARCHTYPES_RENAME 11296
-#define IDH_SETTINGS_STYLES_BG 11297
-#define IDH_SETTINGS_STYLES_CONF_USER_MATCHING 11298
-#define IDH_SETTINGS_STYLES_DOWNLOADS 11299
-#define IDH_SETTINGS_STYLES_FONT 11300
-#define IDH_SETTINGS_STYLES_GLOBAL 11301
-#define IDH_SETTINGS_STYLES_LINKS 11302
-#define IDH_SETTINGS_STYLES_LOGS 11303
-#define IDH_SETTINGS_STYLES_PREVIEW 11304
-#define IDH_SETTINGS_STYLES_SHOW_GEN_MATCHERS 11305
-#define IDH_SETTINGS_STYLES_TEXT 11306
-#define IDH_SETTINGS_STYLES_UPLOADS 11307
-#define IDH_SETTINGS_STYLES_USER_MATCH 11308
-#define IDH_SETTINGS_TABS_BOLD_FINISHED_DOWNLOADS 11309
-#define IDH_SETTINGS_TABS_BOLD_FINISHED_UPLOADS 11310
-#define IDH_SETTINGS_TABS_BOLD_FL 11311
-#define IDH_SETTINGS_TABS_BOLD_HUB 11312
-#define IDH_SETTINGS_TABS_BOLD_PM 11313
-#define IDH_SETTINGS_TABS_BOLD_QUEUE 11314
-#define IDH_SETTINGS_TABS_BOLD_SEARCH 11315
-#define IDH_SETTINGS_TABS_BOLD_SYSTEM_LOG 11316
-#define IDH_SETTINGS_TABS_DRAW 11317
-#define IDH_SETTINGS_TABS_STYLE 11318
-#define IDH_SETTINGS_TAB_PREVIEW 11319
-#define IDH_SETTINGS_TAB_WIDTH 11320
-#define IDH_SETTINGS_TREE 11321
-#define IDH_SETTINGS_UC_ADD 11322
-#define IDH_SETTINGS_UC_CHANGE 11323
-#define IDH_SETTINGS_UC_LIST 11324
-#define IDH_SETTINGS_UC_MOVE_DOWN 11325
-#define IDH_SETTINGS_UC_MOVE_UP 11326
-#define IDH_SETTINGS_UC_REMOVE 11327
-#define IDH_SETTINGS_UPLOAD_ADD 11328
-#define IDH_SETTINGS_UPLOAD_DIRECTORIES 11329
-#define IDH_SETTINGS_UPLOAD_MIN_UPLOAD_SPEED 11330
-#define IDH_SETTINGS_UPLOAD_REMOVE 11331
-#define IDH_SETTINGS_UPLOAD_RENAME 11332
-#define IDH_SETTINGS_UPLOAD_SHAREHIDDEN 11333
-#define IDH_SETTINGS_UPLOAD_SKIPLIST_EXTENSIONS 11334
-#define IDH_SETTINGS_UPLOAD_SKIPLIST_MAXSIZE 11335
-#define IDH_SETTINGS_UPLOAD_SKIPLIST_MINSIZE 11336
-#define IDH_SETTINGS_UPLOAD_SKIPLIST_PATHS 11337
-#define IDH_SETTINGS_UPLOAD_SKIPLIST_REGEX 11338
-#define IDH_SETTINGS_UPLOAD_SLOTS 11339
-#define IDH_SETTINGS_USER_MATCH_ADD 11340
-#define IDH_SETTINGS_USER_MATCH_EDIT 11341
-#define IDH_SETTINGS_USER_MATCH_LIST 11342
-#define IDH_SETTINGS_USER_MATCH_MOVE_DOWN 11343
-#define IDH_SETTINGS_USER_MATCH_MOVE_UP 11344
-#define IDH_SETTINGS_USER_MATCH_REMOVE 11345
-#define IDH_SETTINGS_USER_MATCH_STYLES 11346
-#define IDH_SETTINGS_WINDOWS_CONFIRM_ADLS_REMOVAL 11347
-#define IDH_SETTINGS_WINDOWS_CONFIRM_EXIT 11348
-#define IDH_SETTINGS_WINDOWS_CONFIRM_HUB_CLOSING 11349
-#define IDH_SETTINGS_WINDOWS_CONFIRM_HUB_REMOVAL 11350
-#define IDH_SETTINGS_WINDOWS_CONFIRM_ITEM_REMOVAL 11351
-#define IDH_SETTINGS_WINDOWS_CONFIRM_USER_REMOVAL 11352
-#define IDH_SETTINGS_WINDOWS_IGNORE_BOT_PMS 11353
-#define IDH_SETTINGS_WINDOWS_IGNORE_HUB_PMS 11354
-#define IDH_SETTINGS_WINDOWS_JOIN_OPEN_NEW_WINDOW 11355
-#define IDH_SETTINGS_WINDOWS_POPUNDER_FILELIST 11356
-#define IDH_SETTINGS_WINDOWS_POPUNDER_PM 11357
-#define IDH_SETTINGS_WINDOWS_POPUP_BOT_PMS 11358
-#define IDH_SETTINGS_WINDOWS_POPUP_HUB_PMS 11359
-#define IDH_SETTINGS_WINDOWS_POPUP_PMS 11360
-#define IDH_SETTINGS_WINDOWS_PROMPT_PASSWORD 11361
-#define IDH_SETTINGS_WINDOWS_TOGGLE_ACTIVE_WINDOW 11362
-#define IDH_STRING_LIST_ADD 11363
-#define IDH_STRING_LIST_EDIT 11364
-#define IDH_STRING_LIST_EDIT_BOX 11365
-#define IDH_STRING_LIST_LIST 11366
-#define IDH_STRING_LIST_MOVE_DOWN 11367
-#define IDH_STRING_LIST_MOVE_UP 11368
-#define IDH_STRING_LIST_REMOVE 11369
-#define IDH_TEXT_FONT 11370
-#define IDH_TOOLBAR_ADL_SEARCH 11371
-#define IDH_TOOLBAR_DOWNLOADS_DIR 11372
-#define IDH_TOOLBAR_FAVORITE_HUBS 11373
-#define IDH_TOOLBAR_FILE_LIST 11374
-#define IDH_TOOLBAR_FINISHED_DL 11375
-#define IDH_TOOLBAR_FINISHED_UL 11376
-#define IDH_TOOLBAR_NET_STATS 11377
-#define IDH_TOOLBAR_NOTEPAD 11378
-#define IDH_TOOLBAR_OWN_FILE_LIST 11379
-#define IDH_TOOLBAR_PLUGINS 11380
-#define IDH_TOOLBAR_PUBLIC_HUBS 11381
-#define IDH_TOOLBAR_QUEUE 11382
-#define IDH_TOOLBAR_RECENT 11383
-#define IDH_TOOLBAR_RECONNECT 11384
-#define IDH_TOOLBAR_REFRESH 11385
-#define IDH_TOOLBAR_SEARCH 11386
-#define IDH_TOOLBAR_SETTINGS 11387
-#define IDH_TOOLBAR_USERS 11388
-#define IDH_TOOLBAR_WHATS_THIS 11389
-#define IDH_USERS_DETAILS 11390
-#define IDH_USERS_FILTER 11391
-#define IDH_USERS_FILTER_FAVORITE 11392
-#define IDH_USERS_FILTER_ONLINE 11393
-#define IDH_USERS_FILTER_QUEUE 11394
-#define IDH_USERS_FILTER_WAITING 11395
-#define IDH_USER_COMMAND_CHAT 11396
-#define IDH_USER_COMMAND_COMMAND 11397
-#define IDH_USER_COMMAND_CONTEXT 11398
-#define IDH_USER_COMMAND_FILELIST_MENU 11399
-#define IDH_USER_COMMAND_HUB 11400
-#define IDH_USER_COMMAND_HUB_MENU 11401
-#define IDH_USER_COMMAND_NAME 11402
-#define IDH_USER_COMMAND_NICK 11403
-#define IDH_USER_COMMAND_ONCE 11404
-#define IDH_USER_COMMAND_PM 11405
-#define IDH_USER_COMMAND_RAW 11406
-#define IDH_USER_COMMAND_SEARCH_MENU 11407
-#define IDH_USER_COMMAND_SEPARATOR 11408
-#define IDH_USER_COMMAND_USER_MENU 11409
-#define IDH_USER_MATCH_ADD_RULE 11410
-#define IDH_USER_MATCH_BOTS 11411
-#define IDH_USER_MATCH_FAVS 11412
-#define IDH_USER_MATCH_FORCE_CHAT 11413
-#define IDH_USER_MATCH_IGNORE_CHAT 11414
-#define IDH_USER_MATCH_NAME 11415
-#define IDH_USER_MATCH_OPS 11416
-#define IDH_USER_MATCH_RULE_FIELD 11417
-#define IDH_USER_MATCH_RULE_METHOD 11418
-#define IDH_USER_MATCH_RULE_PATTERN 11419
-#define IDH_USER_MATCH_RULE_REMOVE 11420
+#define IDH_SETTINGS_EXPERT_HASH_THREADS_PER_DEVICE 11202
+#define IDH_SETTINGS_EXPERT_MAX_COMMAND_LENGTH 11203
+#define IDH_SETTINGS_EXPERT_MAX_FILELIST_SIZE 11204
+#define IDH_SETTINGS_EXPERT_MAX_HASH_SPEED 11205
+#define IDH_SETTINGS_EXPERT_MAX_PM_WINDOWS 11206
+#define IDH_SETTINGS_EXPERT_MINISLOT_SIZE 11207
+#define IDH_SETTINGS_EXPERT_PRIVATE_ID 11208
+#define IDH_SETTINGS_EXPERT_SETTINGS_SAVE_INTERVAL 11209
+#define IDH_SETTINGS_EXPERT_SHARE_SCAN_THREADS 11210
+#define IDH_SETTINGS_EXPERT_SHARE_SCAN_THREADS_PER_DEVICE 11211
+#define IDH_SETTINGS_EXPERT_SOCKET_IN_BUFFER 11212
+#define IDH_SETTINGS_EXPERT_SOCKET_OUT_BUFFER 11213
+#define IDH_SETTINGS_EXPERT_WHITELIST_OPEN_URIS 11214
+#define IDH_SETTINGS_FAVORITE_DIRS_ADD 11215
+#define IDH_SETTINGS_FAVORITE_DIRS_FAVORITE_DIRECTORIES 11216
+#define IDH_SETTINGS_FAVORITE_DIRS_REMOVE 11217
+#define IDH_SETTINGS_FAVORITE_DIRS_RENAME 11218
+#define IDH_SETTINGS_GENERAL_AUTO_AWAY 11219
+#define IDH_SETTINGS_GENERAL_AWAY_COMP_LOCK 11220
+#define IDH_SETTINGS_GENERAL_AWAY_IDLE 11221
+#define IDH_SETTINGS_GENERAL_AWAY_MODE 11222
+#define IDH_SETTINGS_GENERAL_AWAY_TIMESTAMP 11223
+#define IDH_SETTINGS_GENERAL_CONNECTION 11224
+#define IDH_SETTINGS_GENERAL_DEFAULT_AWAY_MESSAGE 11225
+#define IDH_SETTINGS_GENERAL_DESCRIPTION 11226
+#define IDH_SETTINGS_GENERAL_EMAIL 11227
+#define IDH_SETTINGS_GENERAL_NICK 11228
+#define IDH_SETTINGS_GENERAL_PERSONAL_INFORMATION 11229
+#define IDH_SETTINGS_HISTORY_CHAT_HUBS 11230
+#define IDH_SETTINGS_HISTORY_CHAT_PM 11231
+#define IDH_SETTINGS_HISTORY_RECENT_FLS 11232
+#define IDH_SETTINGS_HISTORY_RECENT_HUBS 11233
+#define IDH_SETTINGS_HISTORY_RECENT_PMS 11234
+#define IDH_SETTINGS_HISTORY_SEARCH_HISTORY 11235
+#define IDH_SETTINGS_LOG_DIRECTORY 11236
+#define IDH_SETTINGS_LOG_DOWNLOADS 11237
+#define IDH_SETTINGS_LOG_FILELIST_TRANSFERS 11238
+#define IDH_SETTINGS_LOG_FINISHED_DOWNLOADS 11239
+#define IDH_SETTINGS_LOG_MAIN_CHAT 11240
+#define IDH_SETTINGS_LOG_PRIVATE_CHAT 11241
+#define IDH_SETTINGS_LOG_STATUS_MESSAGES 11242
+#define IDH_SETTINGS_LOG_SYSTEM 11243
+#define IDH_SETTINGS_LOG_UPLOADS 11244
+#define IDH_SETTINGS_MAX_EXTRA_UPLOAD_SLOTS 11245
+#define IDH_SETTINGS_NOTIFICATIONS_BALLOON 11246
+#define IDH_SETTINGS_NOTIFICATIONS_BALLOON_BG 11247
+#define IDH_SETTINGS_NOTIFICATIONS_BALLOON_EXAMPLE 11248
+#define IDH_SETTINGS_NOTIFICATIONS_FINISHED_DL 11249
+#define IDH_SETTINGS_NOTIFICATIONS_FINISHED_FL 11250
+#define IDH_SETTINGS_NOTIFICATIONS_MAIN_CHAT 11251
+#define IDH_SETTINGS_NOTIFICATIONS_PM 11252
+#define IDH_SETTINGS_NOTIFICATIONS_PM_WINDOW 11253
+#define IDH_SETTINGS_NOTIFICATIONS_SOUND 11254
+#define IDH_SETTINGS_NOTIFICATIONS_SOUND_FILE 11255
+#define IDH_SETTINGS_PLUGINS_ADD 11256
+#define IDH_SETTINGS_PLUGINS_CONFIGURE 11257
+#define IDH_SETTINGS_PLUGINS_DISABLE 11258
+#define IDH_SETTINGS_PLUGINS_ENABLE 11259
+#define IDH_SETTINGS_PLUGINS_INFO 11260
+#define IDH_SETTINGS_PLUGINS_LIST 11261
+#define IDH_SETTINGS_PLUGINS_MOVE_DOWN 11262
+#define IDH_SETTINGS_PLUGINS_MOVE_UP 11263
+#define IDH_SETTINGS_PLUGINS_REMOVE 11264
+#define IDH_SETTINGS_PROXY_DIRECT_OUT 11265
+#define IDH_SETTINGS_PROXY_SOCKS5 11266
+#define IDH_SETTINGS_PROXY_SOCKS_PASSWORD 11267
+#define IDH_SETTINGS_PROXY_SOCKS_PORT 11268
+#define IDH_SETTINGS_PROXY_SOCKS_RESOLVE 11269
+#define IDH_SETTINGS_PROXY_SOCKS_SERVER 11270
+#define IDH_SETTINGS_PROXY_SOCKS_USER 11271
+#define IDH_SETTINGS_QUEUE_AUTODROP 11272
+#define IDH_SETTINGS_QUEUE_AUTODROP_ALL 11273
+#define IDH_SETTINGS_QUEUE_AUTODROP_DISCONNECT 11274
+#define IDH_SETTINGS_QUEUE_AUTODROP_ELAPSED 11275
+#define IDH_SETTINGS_QUEUE_AUTODROP_FILELISTS 11276
+#define IDH_SETTINGS_QUEUE_AUTODROP_FILESIZE 11277
+#define IDH_SETTINGS_QUEUE_AUTODROP_INACTIVITY 11278
+#define IDH_SETTINGS_QUEUE_AUTODROP_INTERVAL 11279
+#define IDH_SETTINGS_QUEUE_AUTODROP_MINSOURCES 11280
+#define IDH_SETTINGS_QUEUE_AUTODROP_SPEED 11281
+#define IDH_SETTINGS_QUEUE_AUTOPRIO 11282
+#define IDH_SETTINGS_QUEUE_AUTO_SEARCH 11283
+#define IDH_SETTINGS_QUEUE_AUTO_SEARCH_AUTO_MATCH 11284
+#define IDH_SETTINGS_QUEUE_DONT_DL_ALREADY_QUEUED 11285
+#define IDH_SETTINGS_QUEUE_DONT_DL_ALREADY_SHARED 11286
+#define IDH_SETTINGS_QUEUE_KEEP_FINISHED_FILES 11287
+#define IDH_SETTINGS_QUEUE_PRIO_HIGH 11288
+#define IDH_SETTINGS_QUEUE_PRIO_HIGHEST 11289
+#define IDH_SETTINGS_QUEUE_PRIO_LOW 11290
+#define IDH_SETTINGS_QUEUE_PRIO_LOWEST 11291
+#define IDH_SETTINGS_QUEUE_PRIO_NORMAL 11292
+#define IDH_SETTINGS_QUEUE_SKIP_ZERO_BYTE 11293
+#define IDH_SETTINGS_SEARCHTYPES_ADD 11294
+#define IDH_SETTINGS_SEARCHTYPES_DEFAULTS 11295
+#define IDH_SETTINGS_SEARCHTYPES_LIST 11296
+#define IDH_SETTINGS_SEARCHTYPES_MODIFY 11297
+#define IDH_SETTINGS_SEARCHTYPES_REMOVE 11298
+#define IDH_SETTINGS_SEARCHTYPES_RENAME 11299
+#define IDH_SETTINGS_STYLES_BG 11300
+#define IDH_SETTINGS_STYLES_CONF_USER_MATCHING 11301
+#define IDH_SETTINGS_STYLES_DOWNLOADS 11302
+#define IDH_SETTINGS_STYLES_FONT 11303
+#define IDH_SETTINGS_STYLES_GLOBAL 11304
+#define IDH_SETTINGS_STYLES_LINKS 11305
+#define IDH_SETTINGS_STYLES_LOGS 11306
+#define IDH_SETTINGS_STYLES_PREVIEW 11307
+#define IDH_SETTINGS_STYLES_SHOW_GEN_MATCHERS 11308
+#define IDH_SETTINGS_STYLES_TEXT 11309
+#define IDH_SETTINGS_STYLES_UPLOADS 11310
+#define IDH_SETTINGS_STYLES_USER_MATCH 11311
+#define IDH_SETTINGS_TABS_BOLD_FINISHED_DOWNLOADS 11312
+#define IDH_SETTINGS_TABS_BOLD_FINISHED_UPLOADS 11313
+#define IDH_SETTINGS_TABS_BOLD_FL 11314
+#define IDH_SETTINGS_TABS_BOLD_HUB 11315
+#define IDH_SETTINGS_TABS_BOLD_PM 11316
+#define IDH_SETTINGS_TABS_BOLD_QUEUE 11317
+#define IDH_SETTINGS_TABS_BOLD_SEARCH 11318
+#define IDH_SETTINGS_TABS_BOLD_SYSTEM_LOG 11319
+#define IDH_SETTINGS_TABS_DRAW 11320
+#define IDH_SETTINGS_TABS_STYLE 11321
+#define IDH_SETTINGS_TAB_PREVIEW 11322
+#define IDH_SETTINGS_TAB_WIDTH 11323
+#define IDH_SETTINGS_TREE 11324
+#define IDH_SETTINGS_UC_ADD 11325
+#define IDH_SETTINGS_UC_CHANGE 11326
+#define IDH_SETTINGS_UC_LIST 11327
+#define IDH_SETTINGS_UC_MOVE_DOWN 11328
+#define IDH_SETTINGS_UC_MOVE_UP 11329
+#define IDH_SETTINGS_UC_REMOVE 11330
+#define IDH_SETTINGS_UPLOAD_ADD 11331
+#define IDH_SETTINGS_UPLOAD_DIRECTORIES 11332
+#define IDH_SETTINGS_UPLOAD_MIN_UPLOAD_SPEED 11333
+#define IDH_SETTINGS_UPLOAD_REMOVE 11334
+#define IDH_SETTINGS_UPLOAD_RENAME 11335
+#define IDH_SETTINGS_UPLOAD_SHAREHIDDEN 11336
+#define IDH_SETTINGS_UPLOAD_SKIPLIST_EXTENSIONS 11337
+#define IDH_SETTINGS_UPLOAD_SKIPLIST_MAXSIZE 11338
+#define IDH_SETTINGS_UPLOAD_SKIPLIST_MINSIZE 11339
+#define IDH_SETTINGS_UPLOAD_SKIPLIST_PATHS 11340
+#define IDH_SETTINGS_UPLOAD_SKIPLIST_REGEX 11341
+#define IDH_SETTINGS_UPLOAD_SLOTS 11342
+#define IDH_SETTINGS_USER_MATCH_ADD 11343
+#define IDH_SETTINGS_USER_MATCH_EDIT 11344
+#define IDH_SETTINGS_USER_MATCH_LIST 11345
+#define IDH_SETTINGS_USER_MATCH_MOVE_DOWN 11346
+#define IDH_SETTINGS_USER_MATCH_MOVE_UP 11347
+#define IDH_SETTINGS_USER_MATCH_REMOVE 11348
+#define IDH_SETTINGS_USER_MATCH_STYLES 11349
+#define IDH_SETTINGS_WINDOWS_CONFIRM_ADLS_REMOVAL 11350
+#define IDH_SETTINGS_WINDOWS_CONFIRM_EXIT 11351
+#define IDH_SETTINGS_WINDOWS_CONFIRM_HUB_CLOSING 11352
+#define IDH_SETTINGS_WINDOWS_CONFIRM_HUB_REMOVAL 11353
+#define IDH_SETTINGS_WINDOWS_CONFIRM_ITEM_REMOVAL 11354
+#define IDH_SETTINGS_WINDOWS_CONFIRM_USER_REMOVAL 11355
+#define IDH_SETTINGS_WINDOWS_IGNORE_BOT_PMS 11356
+#define IDH_SETTINGS_WINDOWS_IGNORE_HUB_PMS 11357
+#define IDH_SETTINGS_WINDOWS_JOIN_OPEN_NEW_WINDOW 11358
+#define IDH_SETTINGS_WINDOWS_POPUNDER_FILELIST 11359
+#define IDH_SETTINGS_WINDOWS_POPUNDER_PM 11360
+#define IDH_SETTINGS_WINDOWS_POPUP_BOT_PMS 11361
+#define IDH_SETTINGS_WINDOWS_POPUP_HUB_PMS 11362
+#define IDH_SETTINGS_WINDOWS_POPUP_PMS 11363
+#define IDH_SETTINGS_WINDOWS_PROMPT_PASSWORD 11364
+#define IDH_SETTINGS_WINDOWS_TOGGLE_ACTIVE_WINDOW 11365
+#define IDH_STRING_LIST_ADD 11366
+#define IDH_STRING_LIST_EDIT 11367
+#define IDH_STRING_LIST_EDIT_BOX 11368
+#define IDH_STRING_LIST_LIST 11369
+#define IDH_STRING_LIST_MOVE_DOWN 11370
+#define IDH_STRING_LIST_MOVE_UP 11371
+#define IDH_STRING_LIST_REMOVE 11372
+#define IDH_TEXT_FONT 11373
+#define IDH_TOOLBAR_ADL_SEARCH 11374
+#define IDH_TOOLBAR_DOWNLOADS_DIR 11375
+#define IDH_TOOLBAR_FAVORITE_HUBS 11376
+#define IDH_TOOLBAR_FILE_LIST 11377
+#define IDH_TOOLBAR_FINISHED_DL 11378
+#define IDH_TOOLBAR_FINISHED_UL 11379
+#define IDH_TOOLBAR_NET_STATS 11380
+#define IDH_TOOLBAR_NOTEPAD 11381
+#define IDH_TOOLBAR_OWN_FILE_LIST 11382
+#define IDH_TOOLBAR_PLUGINS 11383
+#define IDH_TOOLBAR_PUBLIC_HUBS 11384
+#define IDH_TOOLBAR_QUEUE 11385
+#define IDH_TOOLBAR_RECENT 11386
+#define IDH_TOOLBAR_RECONNECT 11387
+#define IDH_TOOLBAR_REFRESH 11388
+#define IDH_TOOLBAR_SEARCH 11389
+#define IDH_TOOLBAR_SETTINGS 11390
+#define IDH_TOOLBAR_USERS 11391
+#define IDH_TOOLBAR_WHATS_THIS 11392
+#define IDH_USERS_DETAILS 11393
+#define IDH_USERS_FILTER 11394
+#define IDH_USERS_FILTER_FAVORITE 11395
+#define IDH_USERS_FILTER_ONLINE 11396
+#define IDH_USERS_FILTER_QUEUE 11397
+#define IDH_USERS_FILTER_WAITING 11398
+#define IDH_USER_COMMAND_CHAT 11399
+#define IDH_USER_COMMAND_COMMAND 11400
+#define IDH_USER_COMMAND_CONTEXT 11401
+#define IDH_USER_COMMAND_FILELIST_MENU 11402
+#define IDH_USER_COMMAND_HUB 11403
+#define IDH_USER_COMMAND_HUB_MENU 11404
+#define IDH_USER_COMMAND_NAME 11405
+#define IDH_USER_COMMAND_NICK 11406
+#define IDH_USER_COMMAND_ONCE 11407
+#define IDH_USER_COMMAND_PM 11408
+#define IDH_USER_COMMAND_RAW 11409
+#define IDH_USER_COMMAND_SEARCH_MENU 11410
+#define IDH_USER_COMMAND_SEPARATOR 11411
+#define IDH_USER_COMMAND_USER_MENU 11412
+#define IDH_USER_MATCH_ADD_RULE 11413
+#define IDH_USER_MATCH_BOTS 11414
+#define IDH_USER_MATCH_FAVS 11415
+#define IDH_USER_MATCH_FORCE_CHAT 11416
+#define IDH_USER_MATCH_IGNORE_CHAT 11417
+#define IDH_USER_MATCH_NAME 11418
+#define IDH_USER_MATCH_OPS 11419
+#define IDH_USER_MATCH_RULE_FIELD 11420
+#define IDH_USER_MATCH_RULE_METHOD 11421
+#define IDH_USER_MATCH_RULE_PATTERN 11422
+#define IDH_USER_MATCH_RULE_REMOVE 11423
 
 #endif
@@ -1,5 +1,10 @@
 #include "testbase.h"
 
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include <dcpp/BloomFilter.h>
 #include <dcpp/HashBloom.h>
 #include <dcpp/HashValue.h>
 #include <dcpp/TigerHash.h>
@@ -122,3 +127,249 @@ TEST(testbloom, test_9)
 	ASSERT_EQ("AAAAAAACAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAABAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
 		HashValue<Hasher>(&v[0]).toBase32());
 }
+
+namespace {
+
+string randomName(std::mt19937& gen, size_t len, char first = 'a') {
+	std::uniform_int_distribution<int> dist(first, first + 25);
+	string ret(len, ' ');
+	for(auto& c: ret) {
+		c = static_cast<char>(dist(gen));
+	}
+	return ret;
+}
+
+}
+
+TEST(testbloom, test_ngram_no_false_negatives)
+{
+	std::mt19937 gen(1);
+	StringList names;
+	size_t grams = 0;
+	for(size_t i = 0; i < 10000; ++i) {
+		names.push_back(randomName(gen, 32));
+		grams += BloomFilter<5>::getGrams(names.back());
+	}
+
+	BloomFilter<5> bloom(BloomFilter<5>::getTableSize(grams));
+	for(auto& name: names) {
+		bloom.add(name);
+	}
+
+	for(auto& name: names) {
+		ASSERT_TRUE(bloom.match(name));
+		ASSERT_TRUE(bloom.match(name.substr(7, 11)));
+	}
+
+	// shorter than an n-gram; can't be rejected.
+	ASSERT_TRUE(bloom.match("abc"));
+}
+
+TEST(testbloom, test_ngram_table_size)
+{
+	ASSERT_EQ(BloomFilter<5>::getGrams("abcd"), 0u);
+	ASSERT_EQ(BloomFilter<5>::getGrams("abcde"), 1u);
+	ASSERT_EQ(BloomFilter<5>::getGrams("some file.mp3"), 9u);
+
+	// the table grows with the share, within bounds.
+	ASSERT_EQ(BloomFilter<5>::getTableSize(0), BloomFilter<5>::getTableSize(1000));
+	ASSERT_LT(BloomFilter<5>::getTableSize(1000), BloomFilter<5>::getTableSize(1000000));
+	ASSERT_EQ(BloomFilter<5>::getTableSize(1000000) * 2, BloomFilter<5>::getTableSize(2000000));
+	ASSERT_EQ(BloomFilter<5>::getTableSize(1000000000), BloomFilter<5>::getTableSize(2000000000));
+}
+
+namespace {
+
+/** Names the way shares have them: words from a limited vocabulary, numbers, extensions. */
+StringList shareNames(std::mt19937& gen, size_t n) {
+	StringList words;
+	std::uniform_int_distribution<size_t> wordLen(2, 9);
+	for(size_t i = 0; i < 5000; ++i) {
+		words.push_back(randomName(gen, wordLen(gen)));
+	}
+
+	const char* exts[] = { ".mp3", ".flac", ".mkv", ".avi", ".jpg", ".txt", ".pdf", ".zip" };
+
+	std::uniform_int_distribution<size_t> word(0, words.size() - 1), count(1, 6), number(1, 99), ext(0, 8);
+	StringList ret;
+	for(size_t i = 0; i < n; ++i) {
+		auto name = std::to_string(number(gen)) + " -";
+		for(size_t j = 0, c = count(gen); j < c; ++j) {
+			name += ' ' + words[word(gen)];
+		}
+		// directories have no extension.
+		auto e = ext(gen);
+		if(e < 8) {
+			name += exts[e];
+		}
+		ret.push_back(move(name));
+	}
+	return ret;
+}
+
+}
+
+TEST(testbloom, test_ngram_false_positive_rate)
+{
+	std::mt19937 gen(2);
+	auto names = shareNames(gen, 100000);
+
+	size_t grams = 0;
+	for(auto& name: names) {
+		grams += BloomFilter<5>::getGrams(name);
+	}
+
+	BloomFilter<5> bloom(BloomFilter<5>::getTableSize(grams));
+	for(auto& name: names) {
+		bloom.add(name);
+	}
+
+	// each 5-gram sets at most 4 bits.
+	auto fill = bloom.getFillRatio();
+	ASSERT_GT(fill, 0.);
+	ASSERT_LT(fill, 0.4);
+
+	// single 5-grams from another alphabet, that were never added.
+	const size_t tries = 100000;
+	size_t positives = 0;
+	for(size_t i = 0; i < tries; ++i) {
+		if(bloom.match(randomName(gen, 5, 'A'))) {
+			++positives;
+		}
+	}
+
+	ASSERT_LT(static_cast<double>(positives) / tries, 0.03);
+
+	bloom.clear();
+	ASSERT_EQ(0., bloom.getFillRatio());
+	ASSERT_FALSE(bloom.match(randomName(gen, 5)));
+}
+
+// a benchmark; run with --gtest_also_run_disabled_tests.
+TEST(testbloom, DISABLED_test_ngram_throughput)
+{
+	std::mt19937 gen(3);
+	StringList names;
+	for(size_t i = 0; i < 100000; ++i) {
+		names.push_back(randomName(gen, 64));
+	}
+
+	BloomFilter<5> bloom(BloomFilter<5>::getTableSize(names.size()));
+
+	auto start = std::chrono::steady_clock::now();
+	for(auto& name: names) {
+		bloom.add(name);
+	}
+	auto added = std::chrono::steady_clock::now();
+	size_t matched = 0;
+	for(auto& name: names) {
+		matched += bloom.match(name);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	ASSERT_EQ(names.size(), matched);
+
+	// 60 5-grams per name.
+	auto grams = static_cast<double>(names.size() * 60);
+	auto addTime = std::chrono::duration<double>(added - start).count();
+	auto matchTime = std::chrono::duration<double>(end - added).count();
+	std::cout << "n-gram bloom: " << grams / std::max(addTime, 1e-9) / 1e6 << " M adds/s, "
+		<< grams / std::max(matchTime, 1e-9) / 1e6 << " M matches/s" << std::endl;
+	ASSERT_LT(addTime + matchTime, 10.);
+}
+
+namespace {
+
+/** The bit by bit filter HashBloom used to be, as a reference. */
+ByteVector referenceBloom(const vector<TTHValue>& tths, size_t k, size_t m, size_t h) {
+	std::vector<bool> bits(m);
+	for(auto& tth: tths) {
+		for(size_t n = 0; n < k; ++n) {
+			uint64_t x = 0;
+			for(size_t i = 0; i < h; ++i) {
+				size_t bit = n * h + i;
+				if(tth.data[bit / 8] & (1 << (bit % 8))) {
+					x |= (1ULL << i);
+				}
+			}
+			bits[x % m] = true;
+		}
+	}
+
+	ByteVector v(m / 8);
+	for(size_t i = 0; i < m; ++i) {
+		v[i / 8] |= bits[i] << (i % 8);
+	}
+	return v;
+}
+
+vector<TTHValue> randomTTHs(size_t n) {
+	std::mt19937 gen(4);
+	vector<TTHValue> ret(n);
+	for(auto& tth: ret) {
+		for(auto& b: tth.data) {
+			b = static_cast<uint8_t>(gen());
+		}
+	}
+	return ret;
+}
+
+}
+
+TEST(testbloom, test_reference)
+{
+	auto tths = randomTTHs(1000);
+	for(auto h: { 8, 13, 24, 31, 63, 64 }) {
+		auto k = TTHValue::BITS / h;
+		auto m = HashBloom::get_m(tths.size(), k);
+
+		HashBloom bloom;
+		bloom.reset(k, m, h);
+		for(auto& tth: tths) {
+			bloom.add(tth);
+		}
+
+		ByteVector v;
+		bloom.copy_to(v);
+		ASSERT_EQ(referenceBloom(tths, k, m, h), v) << "h = " << h;
+
+		for(auto& tth: tths) {
+			ASSERT_TRUE(bloom.match(tth));
+		}
+	}
+}
+
+// a benchmark over a million TTHs; test_reference checks the same filters on fewer. Run with
+// --gtest_also_run_disabled_tests.
+TEST(testbloom, DISABLED_test_benchmark)
+{
+	auto tths = randomTTHs(1000000);
+	auto k = HashBloom::get_k(tths.size(), 24);
+	auto m = HashBloom::get_m(tths.size(), k);
+
+	// what answering a hub used to cost, what building the filter now costs, and what it costs
+	// once the filter is cached.
+	auto start = std::chrono::steady_clock::now();
+	auto reference = referenceBloom(tths, k, m, 24);
+	auto referenced = std::chrono::steady_clock::now();
+
+	HashBloom bloom;
+	bloom.reset(k, m, 24);
+	for(auto& tth: tths) {
+		bloom.add(tth);
+	}
+	ByteVector v;
+	bloom.copy_to(v);
+	auto built = std::chrono::steady_clock::now();
+
+	ByteVector cached;
+	bloom.copy_to(cached);
+	auto end = std::chrono::steady_clock::now();
+
+	ASSERT_EQ(reference, v);
+	ASSERT_EQ(v, cached);
+
+	auto ms = [](std::chrono::steady_clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+	std::cout << "hash bloom of " << tths.size() << " TTHs (k = " << k << ", m = " << m << "): bit by bit " << ms(referenced - start)
+		<< " ms, word-packed " << ms(built - referenced) << " ms, cached " << ms(end - built) << " ms" << std::endl;
+}
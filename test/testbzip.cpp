@@ -0,0 +1,57 @@
+#include "testbase.h"
+
+#include <bzlib.h>
+
+#include <dcpp/ParallelBZ.h>
+#include <dcpp/Streams.h>
+
+using namespace dcpp;
+
+namespace {
+
+string makeInput(size_t size) {
+	// lines shaped like a file list, with runs of tabs that bzip2 run-length encodes.
+	string ret;
+	for(size_t i = 0; ret.size() < size; ++i) {
+		ret += string(i % 7, '\t') + "<File Name=\"file " + std::to_string(i * 2654435761U) + ".ext\" Size=\"" + std::to_string(i) + "\"/>\r\n";
+	}
+	ret.resize(size);
+	return ret;
+}
+
+string compress(const string& input, size_t threads) {
+	StringOutputStream out;
+	{
+		ParallelBZOutputStream bz(&out, threads);
+		// odd write sizes to cross chunk boundaries anywhere.
+		for(size_t i = 0; i < input.size(); i += 4099) {
+			bz.write(input.data() + i, std::min(input.size() - i, static_cast<size_t>(4099)));
+		}
+		bz.flush();
+	}
+	return out.getString();
+}
+
+/** Decompress a single bzip2 stream; data after its end is an error. */
+string decompress(const string& input, size_t size) {
+	string ret(size + 1, '\0');
+	auto len = static_cast<unsigned int>(ret.size());
+	if(BZ2_bzBuffToBuffDecompress(&ret[0], &len, const_cast<char*>(input.data()), static_cast<unsigned int>(input.size()), 0, 0) != BZ_OK) {
+		return "error";
+	}
+	ret.resize(len);
+	return ret;
+}
+
+} // unnamed namespace
+
+TEST(testbzip, test_parallel)
+{
+	for(auto size: { static_cast<size_t>(0), static_cast<size_t>(1000), static_cast<size_t>(3 * 1000 * 1000 + 17) }) {
+		auto input = makeInput(size);
+		for(auto threads: { 0, 1, 4 }) {
+			auto output = compress(input, threads);
+			ASSERT_EQ(input, decompress(output, size)) << size << " bytes, " << threads << " threads";
+		}
+	}
+}
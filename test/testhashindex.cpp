@@ -0,0 +1,121 @@
+#include "testbase.h"
+
+#include <dcpp/File.h>
+#include <dcpp/HashIndex.h>
+#include <dcpp/TigerHash.h>
+
+using namespace dcpp;
+
+namespace {
+
+const string path = "test/data/out/HashIndex.bin";
+
+TTHValue root(int i) {
+	TigerHash h;
+	h.update(&i, sizeof(i));
+	return TTHValue(h.finalize());
+}
+
+string dir(int i) {
+	return "/share/dir " + std::to_string(i % 100) + "/";
+}
+
+string name(int i) {
+	return "file " + std::to_string(i) + ".ext";
+}
+
+}
+
+TEST(testhashindex, test_lookup)
+{
+	const int n = 5000;
+
+	{
+		HashIndex::Writer w;
+		for(int i = 0; i < n; ++i) {
+			w.addTree(root(i), i * 1024, i * 24, 64 * 1024);
+			w.addFile(dir(i), name(i), root(i), i + 1);
+		}
+		File::ensureDirectory(path);
+		w.write(path);
+	}
+
+	HashIndex index(path);
+	ASSERT_EQ(index.getTreeCount(), static_cast<uint32_t>(n));
+	ASSERT_EQ(index.getFileCount(), static_cast<uint32_t>(n));
+
+	for(int i = 0; i < n; ++i) {
+		auto tr = index.findTree(root(i));
+		ASSERT_TRUE(tr);
+		ASSERT_EQ(tr->size, i * 1024);
+		ASSERT_EQ(tr->index, i * 24);
+		ASSERT_EQ(tr->blockSize, 64 * 1024);
+
+		auto f = index.findFile(dir(i), name(i));
+		ASSERT_NE(f, HashIndex::NOT_FOUND);
+		const auto& fr = index.getFile(f);
+		ASSERT_EQ(index.getDir(fr), dir(i));
+		ASSERT_EQ(index.getName(fr), name(i));
+		ASSERT_EQ(TTHValue(fr.root), root(i));
+		ASSERT_EQ(fr.timeStamp, static_cast<uint32_t>(i + 1));
+	}
+
+	ASSERT_FALSE(index.findTree(root(n)));
+	ASSERT_EQ(index.findFile(dir(0), name(n)), HashIndex::NOT_FOUND);
+	ASSERT_EQ(index.findFile(dir(1), name(0)), HashIndex::NOT_FOUND);
+	// the directory is a separate string; a path split elsewhere is a different file
+	ASSERT_EQ(index.findFile("/share/", "dir 0/" + name(0)), HashIndex::NOT_FOUND);
+}
+
+TEST(testhashindex, test_empty)
+{
+	HashIndex::Writer().write(path);
+
+	HashIndex index(path);
+	ASSERT_EQ(index.getTreeCount(), 0u);
+	ASSERT_EQ(index.getFileCount(), 0u);
+	ASSERT_FALSE(index.findTree(root(0)));
+	ASSERT_EQ(index.findFile(dir(0), name(0)), HashIndex::NOT_FOUND);
+}
+
+TEST(testhashindex, test_corrupt)
+{
+	{
+		HashIndex::Writer w;
+		w.addTree(root(0), 1024, -1, 1024);
+		w.addFile(dir(0), name(0), root(0), 1);
+		w.write(path);
+	}
+
+	string data;
+	{
+		File f(path, File::READ, File::OPEN);
+		data = f.read();
+	}
+
+	auto check = [&data](const string& broken) {
+		File(path, File::WRITE, File::CREATE | File::TRUNCATE).write(broken);
+		ASSERT_THROW(HashIndex index(path), HashException);
+	};
+
+	check(data.substr(0, data.size() - 1));
+	check(data + '\0');
+	check(string());
+
+	auto badMagic = data;
+	badMagic[0] ^= 1;
+	check(badMagic);
+
+	// the name offset of the only file record, pointed past the string table
+	auto badString = data;
+	badString[32 + 48 + 24 + 8] = 0x7f;
+	check(badString);
+
+	// every tree slot taken, by the one record over and over; lookups would probe forever
+	auto fullSlots = data;
+	for(size_t i = 0; i < 16; ++i) {
+		uint32_t slot = 1;
+		memcpy(&fullSlots[32 + 48 + 48 + i * sizeof(slot)], &slot, sizeof(slot));
+	}
+	check(fullSlots);
+}
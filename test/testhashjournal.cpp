@@ -0,0 +1,176 @@
+#include "testbase.h"
+
+#include <dcpp/File.h>
+#include <dcpp/HashJournal.h>
+#include <dcpp/TigerHash.h>
+
+using namespace dcpp;
+
+namespace {
+
+const string path = "test/data/out/HashIndex.journal";
+
+TTHValue root(int i) {
+	TigerHash h;
+	h.update(&i, sizeof(i));
+	return TTHValue(h.finalize());
+}
+
+struct Replayed {
+	vector<int64_t> trees;
+	StringList files;
+	vector<TTHValue> drops;
+
+	size_t replay(HashJournal& j) {
+		return j.replay(
+			[this](const TTHValue& r, int64_t size, int64_t index, int64_t blockSize) {
+				EXPECT_EQ(r, root(static_cast<int>(size)));
+				EXPECT_EQ(index, size * 24);
+				EXPECT_EQ(blockSize, 1024);
+				trees.push_back(size);
+			},
+			[this](const string& fileName, const TTHValue& r, uint32_t timeStamp) {
+				EXPECT_EQ(r, root(static_cast<int>(timeStamp)));
+				files.push_back(fileName);
+			},
+			[this](const TTHValue& r) {
+				drops.push_back(r);
+			});
+	}
+};
+
+}
+
+TEST(testhashjournal, test_replay)
+{
+	File::ensureDirectory(path);
+	File::deleteFile(path);
+
+	{
+		HashJournal j(path);
+		for(int i = 0; i < 10; ++i) {
+			j.addTree(root(i), i, i * 24, 1024);
+			j.addFile("/share/file " + std::to_string(i), root(i), i);
+		}
+		j.dropTree(root(3));
+		ASSERT_EQ(j.getPending(), 21u);
+		j.sync();
+		ASSERT_EQ(j.getPending(), 0u);
+
+		// never synced, as if the client had crashed
+		j.addTree(root(10), 10, 240, 1024);
+	}
+
+	{
+		HashJournal j(path);
+		Replayed r;
+		ASSERT_EQ(r.replay(j), 21u);
+		ASSERT_EQ(r.trees.size(), 10u);
+		ASSERT_EQ(r.files.size(), 10u);
+		ASSERT_EQ(r.files[3], "/share/file 3");
+		ASSERT_EQ(r.drops.size(), 1u);
+		ASSERT_EQ(r.drops[0], root(3));
+
+		// new records follow the old ones
+		j.addFile("/share/file 10", root(10), 10);
+		j.sync();
+	}
+
+	{
+		HashJournal j(path);
+		Replayed r;
+		ASSERT_EQ(r.replay(j), 22u);
+		ASSERT_EQ(r.files.back(), "/share/file 10");
+
+		j.clear();
+	}
+
+	HashJournal j(path);
+	Replayed r;
+	ASSERT_EQ(r.replay(j), 0u);
+	ASSERT_EQ(j.getSize(), 0);
+}
+
+TEST(testhashjournal, test_torn)
+{
+	File::ensureDirectory(path);
+	File::deleteFile(path);
+
+	{
+		HashJournal j(path);
+		for(int i = 0; i < 3; ++i) {
+			j.addFile("/share/file " + std::to_string(i), root(i), i);
+		}
+		j.sync();
+	}
+
+	string data;
+	{
+		File f(path, File::READ, File::OPEN);
+		data = f.read();
+	}
+
+	// cut the last record short, then garble the second one: replay stops before them
+	File(path, File::WRITE, File::CREATE | File::TRUNCATE).write(data.substr(0, data.size() - 5));
+	{
+		HashJournal j(path);
+		Replayed r;
+		ASSERT_EQ(r.replay(j), 2u);
+	}
+
+	data[data.size() / 2] ^= 1;
+	File(path, File::WRITE, File::CREATE | File::TRUNCATE).write(data);
+	{
+		HashJournal j(path);
+		Replayed r;
+		ASSERT_EQ(r.replay(j), 1u);
+		ASSERT_EQ(r.files[0], "/share/file 0");
+
+		// the damaged tail is gone, so appending is safe again
+		j.addFile("/share/file 5", root(5), 5);
+		j.sync();
+	}
+
+	HashJournal j(path);
+	Replayed r;
+	ASSERT_EQ(r.replay(j), 2u);
+	ASSERT_EQ(r.files[1], "/share/file 5");
+}
+
+TEST(testhashjournal, test_mark)
+{
+	File::ensureDirectory(path);
+	File::deleteFile(path);
+
+	{
+		HashJournal j(path);
+		for(int i = 0; i < 3; ++i) {
+			j.addFile("/share/file " + std::to_string(i), root(i), i);
+		}
+		auto mark = j.getMark();
+		j.addFile("/share/file 3", root(3), 3);
+
+		// only what came before the mark is written
+		j.write(mark);
+		j.flush();
+		ASSERT_EQ(j.getPending(), 1u);
+
+		// already written
+		j.write(mark);
+		ASSERT_EQ(j.getPending(), 1u);
+	}
+
+	{
+		HashJournal j(path);
+		Replayed r;
+		ASSERT_EQ(r.replay(j), 3u);
+
+		// a mark taken before the journal was cleared has nothing left to write
+		j.addFile("/share/file 4", root(4), 4);
+		auto mark = j.getMark();
+		j.clear();
+		j.write(mark);
+		ASSERT_EQ(j.getPending(), 0u);
+		ASSERT_EQ(j.getSize(), 0);
+	}
+}
@@ -0,0 +1,69 @@
+#include "testbase.h"
+
+#include <dcpp/DCPlusPlus.h>
+#include <dcpp/File.h>
+#include <dcpp/HashManager.h>
+#include <dcpp/SettingsManager.h>
+#include <dcpp/ShareManager.h>
+#include <dcpp/Thread.h>
+#include <dcpp/TimerManager.h>
+#include <dcpp/Util.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace dcpp;
+
+// the directory monitor is only implemented with inotify.
+#ifndef _WIN32
+
+namespace {
+
+void clean(const string& path) {
+	File::ensureDirectory(path);
+	for(auto& f: File::findFiles(path, "*")) {
+		File::deleteFile(f);
+	}
+}
+
+}
+
+TEST(testsharemonitor, test_new_file)
+{
+	char cwd[4096];
+	ASSERT_TRUE(getcwd(cwd, sizeof(cwd)));
+	const string base = string(cwd) + "/test/data/out/sharemonitor/";
+	const string config = base + "config/", share = base + "share/";
+	clean(config);
+	clean(share);
+
+	Util::PathsMap paths;
+	paths[Util::PATH_USER_CONFIG] = config;
+	paths[Util::PATH_USER_LOCAL] = config;
+	Util::initialize(paths);
+
+	dcpp::startup();
+	SettingsManager::getInstance()->load();
+	HashManager::getInstance()->startup([](float) { });
+	ShareManager::getInstance()->startup([](float) { });
+	TimerManager::getInstance()->start();
+
+	ShareManager::getInstance()->addDirectory(share, "share");
+
+	// small enough to be hashed while the update that found it is still scanning.
+	const string file = share + "new file.txt";
+	File(file, File::WRITE, File::CREATE | File::TRUNCATE).write(string("new file"));
+
+	optional<TTHValue> tth;
+	for(int i = 0; i < 300 && !tth; ++i) {
+		Thread::sleep(100);
+		tth = ShareManager::getInstance()->getTTHFromReal(file);
+	}
+
+	dcpp::shutdown();
+
+	ASSERT_TRUE(tth);
+}
+
+#endif
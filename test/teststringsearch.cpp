@@ -0,0 +1,78 @@
+#include "testbase.h"
+
+#include <random>
+
+#include <dcpp/MultiStringSearch.h>
+#include <dcpp/StringSearch.h>
+
+using namespace dcpp;
+
+TEST(teststringsearch, test_multi)
+{
+	StringList patterns = { "he", "she", "his", "hers", "" };
+	MultiStringSearch search(patterns);
+
+	ASSERT_EQ(search.getAll(), 0x1fu);
+	ASSERT_EQ(search.find("ushers", search.getAll()), 0x1bu);
+	ASSERT_EQ(search.find("this", search.getAll()), 0x14u);
+	ASSERT_EQ(search.find("", search.getAll()), 0x10u);
+	ASSERT_TRUE(search.matchLower("ushershis"));
+	ASSERT_FALSE(search.matchLower("ushers"));
+	ASSERT_TRUE(search.match("USHERSHIS"));
+	ASSERT_TRUE(search.matchAnyLower("abc"));
+
+	MultiStringSearch none((StringList()));
+	ASSERT_TRUE(none.matchLower("abc"));
+	ASSERT_FALSE(none.matchAnyLower("abc"));
+}
+
+TEST(teststringsearch, test_overflow)
+{
+	StringList patterns;
+	for(int i = 0; i < 70; ++i) {
+		patterns.push_back(string(1, 'a' + i % 26) + string(1, 'a' + i / 26));
+	}
+	MultiStringSearch search(patterns);
+	ASSERT_EQ(search.getAll(), ~MultiStringSearch::Mask(0));
+
+	string text;
+	for(auto& i: patterns) {
+		text += i + ' ';
+	}
+	ASSERT_TRUE(search.matchLower(text));
+	ASSERT_FALSE(search.matchLower(text.substr(0, text.size() - 3)));
+	ASSERT_TRUE(search.matchAnyLower("rc"));
+}
+
+TEST(teststringsearch, test_reference)
+{
+	// compare against single-pattern searches on a small alphabet, where patterns overlap a lot.
+	std::mt19937 gen(42);
+	auto randomString = [&gen](size_t maxLen) {
+		string ret(std::uniform_int_distribution<size_t>(0, maxLen)(gen), 'a');
+		for(auto& c: ret) { c = 'a' + std::uniform_int_distribution<int>(0, 3)(gen); }
+		return ret;
+	};
+
+	for(int round = 0; round < 200; ++round) {
+		StringSearch::List list;
+		auto count = std::uniform_int_distribution<int>(1, 8)(gen);
+		for(int i = 0; i < count; ++i) {
+			list.emplace_back(randomString(4));
+		}
+		MultiStringSearch search(list);
+
+		for(int i = 0; i < 50; ++i) {
+			auto text = randomString(20);
+			MultiStringSearch::Mask expected = 0;
+			for(size_t j = 0; j < list.size(); ++j) {
+				if(list[j].matchLower(text)) {
+					expected |= MultiStringSearch::Mask(1) << j;
+				}
+			}
+			ASSERT_EQ(search.find(text, search.getAll()), expected);
+			ASSERT_EQ(search.matchLower(text), expected == search.getAll());
+			ASSERT_EQ(search.matchAnyLower(text), expected != 0);
+		}
+	}
+}
@@ -0,0 +1,182 @@
+#include "testbase.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include <dcpp/MerkleTree.h>
+#include <dcpp/ParallelTigerTree.h>
+#include <dcpp/TigerHash.h>
+
+using namespace dcpp;
+
+namespace {
+
+ByteVector randomData(size_t len, unsigned seed) {
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<int> dist(0, 255);
+	ByteVector data(len);
+	for(auto& c: data) {
+		c = static_cast<uint8_t>(dist(gen));
+	}
+	return data;
+}
+
+ByteVector hashOneByOne(uint8_t prefix, const uint8_t* data, size_t len, size_t count) {
+	ByteVector out(count * TigerHash::BYTES);
+	for(size_t i = 0; i < count; ++i) {
+		TigerHash h;
+		h.update(&prefix, 1);
+		h.update(data + i * len, len);
+		memcpy(&out[i * TigerHash::BYTES], h.finalize(), TigerHash::BYTES);
+	}
+	return out;
+}
+
+/** The same tree, fed one leaf at a time so it never takes the batched path */
+TigerTree leafByLeaf(const ByteVector& data, int64_t blockSize) {
+	TigerTree tt(blockSize);
+	size_t i = 0;
+	do {
+		auto n = std::min(data.size() - i, TigerTree::BASE_BLOCK_SIZE);
+		tt.update(data.data() + i, n);
+		i += n;
+	} while(i < data.size());
+	tt.finalize();
+	return tt;
+}
+
+}
+
+TEST(testtiger, test_known)
+{
+	// THEX test vectors
+	TigerTree empty;
+	empty.finalize();
+	ASSERT_EQ("LWPNACQDBZRYXW3VHJVCJ64QBZNGHOHHHZWCLNQ", empty.getRoot().toBase32());
+
+	ByteVector as(1025, 'A');
+	TigerTree tt;
+	tt.update(as.data(), as.size());
+	tt.finalize();
+	ASSERT_EQ("PZMRYHGY6LTBEH63ZWAHDORHSYTLO4LEFUIKHWY", tt.getRoot().toBase32());
+}
+
+TEST(testtiger, test_many)
+{
+	// around every place where the padding changes shape
+	for(size_t len: { 0, 1, 54, 55, 56, 62, 63, 64, 65, 118, 119, 127, 128, 1000, 1023, 1024, 1025 }) {
+		for(size_t count = 0; count <= 2 * TigerHash::LANES + 1; ++count) {
+			auto data = randomData(len * count, static_cast<unsigned>(len * 31 + count));
+			for(uint8_t prefix: { 0, 1 }) {
+				ByteVector out(count * TigerHash::BYTES);
+				TigerHash::hashMany(prefix, data.data(), len, count, out.data());
+				ASSERT_EQ(hashOneByOne(prefix, data.data(), len, count), out) << "len = " << len << ", count = " << count;
+			}
+		}
+	}
+}
+
+TEST(testtiger, test_tree)
+{
+	for(size_t len: { 1024 * 3, 1024 * 64 + 1, 1024 * 1000 + 17 }) {
+		auto data = randomData(len, static_cast<unsigned>(len));
+		for(int64_t blockSize: { 1024, 4096, 65536 }) {
+			TigerTree tt(blockSize);
+			tt.update(data.data(), data.size());
+			tt.finalize();
+
+			auto expected = leafByLeaf(data, blockSize);
+			ASSERT_EQ(expected.getRoot(), tt.getRoot()) << "len = " << len << ", block size = " << blockSize;
+			ASSERT_EQ(expected.getLeaves(), tt.getLeaves());
+		}
+	}
+}
+
+TEST(testtiger, test_parallel)
+{
+	std::mt19937 gen(11);
+	for(size_t len: { 0, 1000, 64 * 1024, 64 * 1024 * 5 + 1024, 1024 * 1024 * 3 + 4095 }) {
+		auto data = randomData(len, static_cast<unsigned>(len) + 1);
+		for(int64_t blockSize: { 1024, 64 * 1024, 1024 * 1024 * 4 }) {
+			TigerTree serial(blockSize);
+			serial.update(data.data(), data.size());
+			serial.finalize();
+
+			for(size_t threads: { 0, 1, 3 }) {
+				ParallelTigerTree::Pool pool(threads, Thread::NORMAL);
+				TigerTree tt(blockSize);
+				{
+					ParallelTigerTree ptt(tt, threads ? &pool : nullptr);
+					// in pieces that don't line up with anything, as FileReader may hand them out
+					std::uniform_int_distribution<size_t> piece(1, 200 * 1024);
+					for(size_t i = 0; i < data.size();) {
+						auto n = std::min(piece(gen), data.size() - i);
+						ptt.update(data.data() + i, n);
+						i += n;
+					}
+					ptt.flush();
+				}
+				tt.finalize();
+
+				ASSERT_EQ(serial.getRoot(), tt.getRoot()) << "len = " << len << ", block size = " << blockSize << ", threads = " << threads;
+				ASSERT_EQ(serial.getLeaves(), tt.getLeaves());
+				ASSERT_EQ(serial.getFileSize(), tt.getFileSize());
+			}
+		}
+	}
+}
+
+TEST(testtiger, test_shared_pool)
+{
+	// trees hashed at the same time on one pool don't mix their chunks up.
+	ParallelTigerTree::Pool pool(3, Thread::NORMAL);
+	auto a = randomData(1024 * 1024 * 5, 21), b = randomData(1024 * 1024 * 3, 22);
+
+	TigerTree serialA(64 * 1024), serialB(64 * 1024);
+	serialA.update(a.data(), a.size());
+	serialA.finalize();
+	serialB.update(b.data(), b.size());
+	serialB.finalize();
+
+	TigerTree ta(64 * 1024), tb(64 * 1024);
+	{
+		ParallelTigerTree pa(ta, &pool), pb(tb, &pool);
+		for(size_t i = 0; i < a.size(); i += 100 * 1024) {
+			pa.update(a.data() + i, std::min(static_cast<size_t>(100 * 1024), a.size() - i));
+			if(i < b.size()) {
+				pb.update(b.data() + i, std::min(static_cast<size_t>(100 * 1024), b.size() - i));
+			}
+		}
+		pa.flush();
+		pb.flush();
+	}
+	ta.finalize();
+	tb.finalize();
+
+	ASSERT_EQ(serialA.getRoot(), ta.getRoot());
+	ASSERT_EQ(serialB.getRoot(), tb.getRoot());
+}
+
+// a benchmark; test_many checks the same against hashing one by one. Run with
+// --gtest_also_run_disabled_tests.
+TEST(testtiger, DISABLED_test_throughput)
+{
+	const size_t leaves = 64 * 1024;
+	auto data = randomData(leaves * TigerTree::BASE_BLOCK_SIZE, 7);
+
+	auto start = std::chrono::steady_clock::now();
+	auto expected = hashOneByOne(0, data.data(), TigerTree::BASE_BLOCK_SIZE, leaves);
+	auto single = std::chrono::steady_clock::now();
+	ByteVector out(leaves * TigerHash::BYTES);
+	TigerHash::hashMany(0, data.data(), TigerTree::BASE_BLOCK_SIZE, leaves, out.data());
+	auto end = std::chrono::steady_clock::now();
+
+	ASSERT_EQ(expected, out);
+
+	auto mbs = [&](std::chrono::steady_clock::duration d) {
+		return data.size() / std::max(std::chrono::duration<double>(d).count(), 1e-9) / (1024 * 1024);
+	};
+	std::cout << "tiger leaves: one by one " << mbs(single - start) << " MiB/s, " << TigerHash::getEngine()
+		<< " x" << TigerHash::LANES << " " << mbs(end - single) << " MiB/s" << std::endl;
+}
@@ -33,7 +33,7 @@ using dwt::GridInfo;
 using dwt::Label;
 
 ExpertsPage::ExpertsPage(dwt::Widget* parent) :
-PropPage(parent, 7, 2),
+PropPage(parent, 8, 2),
 modifyWhitelistButton(nullptr)
 {
 	grid->column(0).mode = GridInfo::FILL;
@@ -47,6 +47,9 @@ modifyWhitelistButton(nullptr)
 	addItem(T_("Max filelist size"), SettingsManager::MAX_FILELIST_SIZE, true, T_("MiB"));
 	addItem(T_("PID"), SettingsManager::PRIVATE_ID, false);
 	addItem(T_("Auto refresh time"), SettingsManager::AUTO_REFRESH_TIME, true, T_("minutes"));
+	addItem(T_("Share scan threads"), SettingsManager::SHARE_SCAN_THREADS, true);
+	addItem(T_("Share scan threads per disk"), SettingsManager::SHARE_SCAN_THREADS_PER_DEVICE, true);
+	addItem(T_("Hash threads per disk"), SettingsManager::HASH_THREADS_PER_DEVICE, true);
 	addItem(T_("Settings save interval"), SettingsManager::SETTINGS_SAVE_INTERVAL, true, T_("minutes"));
 	addItem(T_("Socket read buffer"), SettingsManager::SOCKET_IN_BUFFER, true, T_("B"));
 	addItem(T_("Socket write buffer"), SettingsManager::SOCKET_OUT_BUFFER, true, T_("B"));
@@ -72,6 +75,13 @@ void ExpertsPage::write() {
 	else if(SETTING(AUTO_SEARCH_LIMIT) < 1)
 		settings->set(SettingsManager::AUTO_SEARCH_LIMIT, 1);
 
+	if(SETTING(SHARE_SCAN_THREADS) < 1)
+		settings->set(SettingsManager::SHARE_SCAN_THREADS, 1);
+	if(SETTING(SHARE_SCAN_THREADS_PER_DEVICE) < 1)
+		settings->set(SettingsManager::SHARE_SCAN_THREADS_PER_DEVICE, 1);
+	if(SETTING(HASH_THREADS_PER_DEVICE) < 1)
+		settings->set(SettingsManager::HASH_THREADS_PER_DEVICE, 1);
+
 	if(SETTING(AUTO_SEARCH_INTERVAL) < 120)
 		settings->set(SettingsManager::AUTO_SEARCH_INTERVAL, 120);
 }
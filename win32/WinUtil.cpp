@@ -572,7 +572,8 @@ static const map<tstring, tstring> cmdMap = {
 	{_T("/d <search string>"),						  T_("Launches your default web browser to the DuckDuckGo search engine with the specified search.")},
 	{_T("/g <search string>"),						  T_("Launches your default web browser to the Google search engine with the specified search.")},
 	{_T("/imdb <imdb query>"),						  T_("Launches your default web browser to the Internet Movie Database (imdb) with the specified query.")},
-	{_T("/rebuild"),								  T_("Rebuilds the HashIndex.xml and HashData.dat files, removing entries to files that are no longer shared, or old hashes for files that have since changed. This runs in the main DC++ thread, so the interface will freeze until the rebuild is finished.")},
+	{_T("/rebuild"),								  T_("Rebuilds the HashIndex.bin and HashData.dat files, removing entries to files that are no longer shared, or old hashes for files that have since changed. This runs in the main DC++ thread, so the interface will freeze until the rebuild is finished.")},
+	{_T("/exporthashes"),							  T_("Saves the hash index to HashIndex.export.xml in the settings directory, in the XML format used by older versions.")},
 	{_T("/log <status, system, downloads, uploads>"), T_("If no parameter is specified, it launches the log for the hub or private chat with the associated application in Windows. If one of the parameters is specified it opens that log file. The status log is available only in the hub frame.")},
 	{_T("/help"),									  T_("Displays available commands. (The ones listed on this page.) Optionally, you can specify \"brief\" to have a brief listing.")},
 	{_T("/u <url>"),								  T_("Launches your default web browser with the given URL.")},
@@ -588,7 +589,8 @@ static const map<tstring, tstring> cmdMap = {
 	{_T("/uptime, /ut"),							  T_("Display current client and system uptime")},
 	{_T("/osinfo, /os"),							  T_("Display current OS info")},
 	{_T("/cinfo, /ci"),								  T_("Display current Client info")},
-	{_T("/libs"),									  T_("Display current lib versions used by BDC++")}
+	{_T("/libs"),									  T_("Display current lib versions used by BDC++")},
+	{_T("/sharestats [xml]"),						  T_("Displays statistics about the share: sizes, memory use of its indices and caches, refresh timings and search latencies. With \"xml\", saves them to ShareStats.xml in the settings directory instead.")}
 };
 
 tstring WinUtil::getDescriptiveCommands() {
@@ -603,8 +605,8 @@ tstring WinUtil::getDescriptiveCommands() {
 
 tstring
 	WinUtil::commands =
-		_T("/refresh, /me <msg>, /slots #, /dslots #, /search <string>, /clear [lines to keep], /dc++, /away <msg>, /back, /d <searchstring>, /g <searchstring>, /imdb <imdbquery>, /rebuild, /log [type], /help [brief], /u <url>, /f <string>, /download [#], /upload [#], /close, /a[bout][:]c[onfig]")
-	    _T(" [/sysinfo | /si], [/netstat | /ni], [/diskinfo | /di], [/diskfree | /df], [/uptime | /ut], [/osinfo | /os], [/cinfo | /ci], /libs");
+		_T("/refresh, /me <msg>, /slots #, /dslots #, /search <string>, /clear [lines to keep], /dc++, /away <msg>, /back, /d <searchstring>, /g <searchstring>, /imdb <imdbquery>, /rebuild, /exporthashes, /log [type], /help [brief], /u <url>, /f <string>, /download [#], /upload [#], /close, /a[bout][:]c[onfig]")
+	    _T(" [/sysinfo | /si], [/netstat | /ni], [/diskinfo | /di], [/diskfree | /df], [/uptime | /ut], [/osinfo | /os], [/cinfo | /ci], /libs, /sharestats [xml]");
 
 bool WinUtil::checkCommand(tstring& cmd, tstring& param, tstring& message, tstring& status, bool& thirdPerson) {
 	string::size_type i = cmd.find(' ');
@@ -636,6 +638,19 @@ bool WinUtil::checkCommand(tstring& cmd, tstring& param, tstring& message, tstri
 		} catch (const ShareException& e) {
 			status = Text::toT(e.getError());
 		}
+	} else if(Util::stricmp(cmd.c_str(), _T("sharestats")) == 0) {
+		auto stats = ShareManager::getInstance()->getStats();
+		if(Util::stricmp(param.c_str(), _T("xml")) == 0) {
+			auto path = Util::getPath(Util::PATH_USER_CONFIG) + "ShareStats.xml";
+			try {
+				File(path, File::WRITE, File::CREATE | File::TRUNCATE).write(stats.toXml());
+				status = str(TF_("Share statistics saved to %1%") % Text::toT(path));
+			} catch(const FileException& e) {
+				status = Text::toT(e.getError());
+			}
+		} else {
+			status = Text::toT(stats.toString());
+		}
 	} else if(Util::stricmp(cmd.c_str(), _T("slots")) == 0) {
 		int j = Util::toInt(Text::fromT(param));
 		if(j > 0) {
@@ -699,6 +714,15 @@ bool WinUtil::checkCommand(tstring& cmd, tstring& param, tstring& message, tstri
 		}
 	} else if(Util::stricmp(cmd.c_str(), _T("rebuild")) == 0) {
 		HashManager::getInstance()->rebuild();
+	} else if(Util::stricmp(cmd.c_str(), _T("exporthashes")) == 0) {
+		// not HashIndex.xml, which would be converted back whenever the binary index is missing.
+		auto path = Util::getPath(Util::PATH_USER_CONFIG) + "HashIndex.export.xml";
+		try {
+			HashManager::getInstance()->exportIndex(path);
+			status = str(TF_("Hash index saved to %1%") % Text::toT(path));
+		} catch(const FileException& e) {
+			status = Text::toT(e.getError());
+		}
 	} else if(Util::stricmp(cmd.c_str(), _T("upload")) == 0) {
 		auto value = Util::toInt(Text::fromT(param));
 		if(value >= 0) {